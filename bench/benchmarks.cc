@@ -0,0 +1,158 @@
+/**
+ * @file benchmarks.cc
+ * @brief Google Benchmark suite for the request path, run against the
+ * in-process loopback server so results don't depend on the network
+ * @author Daniel Schauenberg <d@unwiredcouch.com>
+ *
+ * Run with e.g.
+ *
+ *   ./bench-program --benchmark_filter=Get --benchmark_repetitions=5
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <string>
+
+#include "restclient-cpp/connection.h"
+#include "restclient-cpp/restclient.h"
+#include "loopback_server.h"
+
+namespace {
+
+RestClient::Testing::LoopbackServer& http1Server() {
+  static RestClient::Testing::LoopbackServer server;
+  static bool started = server.Start();
+  (void)started;
+  return server;
+}
+
+RestClient::Testing::LoopbackServer& http2Server() {
+  static RestClient::Testing::LoopbackServer server;
+  static bool started = (server.SetHttp2Path("/bytes/1024"), server.Start());
+  (void)started;
+  return server;
+}
+
+bool checkResponse(benchmark::State& state,  // NOLINT(runtime/references)
+                   const RestClient::Response& res) {
+  if (res.code == 200) {
+    return true;
+  }
+  state.SkipWithError(("request failed: " + std::to_string(res.code) + " " +
+                       res.body).c_str());
+  return false;
+}
+
+}  // namespace
+
+// smallest possible request over a reused connection with the default
+// instrumentation (flight recorder, eager info capture)
+static void BM_ConnectionGet(benchmark::State& state) {
+  RestClient::Connection conn(http1Server().Url());
+  for (auto _ : state) {
+    if (!checkResponse(state, conn.get("/bytes/0"))) {
+      break;
+    }
+  }
+}
+BENCHMARK(BM_ConnectionGet);
+
+// same request with all optional bookkeeping switched off
+static void BM_ConnectionGetBare(benchmark::State& state) {
+  RestClient::Connection conn(http1Server().Url());
+  conn.SetFlightRecorder(NULL);
+  conn.SetInfoCapture(RestClient::Connection::InfoCapture::Disabled);
+  for (auto _ : state) {
+    if (!checkResponse(state, conn.get("/bytes/0"))) {
+      break;
+    }
+  }
+}
+BENCHMARK(BM_ConnectionGetBare);
+
+// the simple API sets up a new handle and TCP connection for every request
+static void BM_SimpleGet(benchmark::State& state) {
+  const std::string url = http1Server().Url() + "/bytes/0";
+  for (auto _ : state) {
+    if (!checkResponse(state, RestClient::get(url))) {
+      break;
+    }
+  }
+}
+BENCHMARK(BM_SimpleGet);
+
+// response header parsing, argument is the number of extra headers
+static void BM_HeaderHeavyGet(benchmark::State& state) {
+  RestClient::Connection conn(http1Server().Url());
+  const std::string path = "/headers/" + std::to_string(state.range(0));
+  for (auto _ : state) {
+    if (!checkResponse(state, conn.get(path))) {
+      break;
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_HeaderHeavyGet)->Arg(0)->Arg(16)->Arg(64)->Arg(256);
+
+// body accumulation in write_callback, argument is the body size
+static void BM_LargeBodyGet(benchmark::State& state) {
+  RestClient::Connection conn(http1Server().Url());
+  const std::string path = "/bytes/" + std::to_string(state.range(0));
+  for (auto _ : state) {
+    if (!checkResponse(state, conn.get(path))) {
+      break;
+    }
+  }
+  state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_LargeBodyGet)->RangeMultiplier(16)->Range(1 << 10, 16 << 20);
+
+// uploads through read_callback, argument is the body size
+static void BM_Upload(benchmark::State& state) {
+  RestClient::Connection conn(http1Server().Url());
+  const std::string data(static_cast<size_t>(state.range(0)), 'x');
+  for (auto _ : state) {
+    if (!checkResponse(state, conn.put("/", data))) {
+      break;
+    }
+  }
+  state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_Upload)->RangeMultiplier(16)->Range(1 << 10, 16 << 20);
+
+// one connection per thread, shows contention in shared state such as the
+// flight recorder and curl's global locks
+static void BM_ConnectionGetThreaded(benchmark::State& state) {
+  RestClient::Connection conn(http1Server().Url());
+  for (auto _ : state) {
+    if (!checkResponse(state, conn.get("/bytes/0"))) {
+      break;
+    }
+  }
+}
+BENCHMARK(BM_ConnectionGetThreaded)->ThreadRange(1, 16)->UseRealTime();
+
+// h2c, upgraded on the first request and reused after that
+static void BM_Http2Get(benchmark::State& state) {
+  RestClient::Connection conn(http2Server().Url());
+  conn.SetHttpVersion(CURL_HTTP_VERSION_2_0);
+  for (auto _ : state) {
+    if (!checkResponse(state, conn.get("/bytes/1024"))) {
+      break;
+    }
+  }
+}
+BENCHMARK(BM_Http2Get);
+
+int main(int argc, char** argv) {
+  RestClient::init();
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+    return 1;
+  }
+  benchmark::RunSpecifiedBenchmarks();
+  http1Server().Stop();
+  http2Server().Stop();
+  RestClient::disable();
+  return 0;
+}
@@ -0,0 +1,157 @@
+/**
+ * @file arena.h
+ * @brief bump allocator and responses allocated from it
+ * @author Daniel Schauenberg <d@unwiredcouch.com>
+ * @version
+ * @date 2026-10-19
+ */
+
+#ifndef INCLUDE_RESTCLIENT_CPP_ARENA_H_
+#define INCLUDE_RESTCLIENT_CPP_ARENA_H_
+
+#include <cstddef>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief namespace for all RestClient definitions
+ */
+namespace RestClient {
+
+/**
+  * @brief monotonic bump allocator.
+  *
+  * Allocations take memory from the end of the current block; nothing is
+  * freed on its own. Reset() frees everything at once and keeps the blocks
+  * for the next round, so a per-request arena stops touching the heap
+  * after the first few requests, and threads with arenas of their own
+  * don't contend on malloc. An arena can start with a buffer of the
+  * caller's, e.g. on the stack, and only falls back to heap blocks when
+  * that runs out. Not thread-safe.
+  */
+class Arena {
+ public:
+    // blocks are allocated with at least blockSize bytes
+    explicit Arena(size_t blockSize = 4096);
+    // use buffer (not owned) as first block
+    Arena(void* buffer, size_t size, size_t blockSize = 4096);
+    ~Arena();
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    void* Allocate(size_t size, size_t alignment = alignof(std::max_align_t));
+
+    // free all allocations, keeping the blocks
+    void Reset();
+
+    // free all allocations and the heap blocks
+    void Release();
+
+    // bytes handed out since the last Reset()
+    size_t Used() const;
+
+    // bytes in all blocks
+    size_t Capacity() const;
+
+ private:
+    struct Block {
+      char* data;
+      size_t size;
+      bool owned;
+    };
+
+    std::vector<Block> blocks;
+    // block allocations come from and the offset into it
+    size_t current;
+    size_t offset;
+    size_t used;
+    size_t blockSize;
+};
+
+/**
+  * @brief standard allocator handing out memory from an Arena.
+  * Deallocation does nothing, the memory comes back with Arena::Reset()
+  */
+template <typename T>
+class ArenaAllocator {
+ public:
+    typedef T value_type;
+
+    explicit ArenaAllocator(Arena* arena) : arena(arena) {
+    }
+
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other)  // NOLINT(runtime/explicit)
+      : arena(other.GetArena()) {
+    }
+
+    T* allocate(size_t n) {
+      return static_cast<T*>(this->arena->Allocate(n * sizeof(T),
+                                                    alignof(T)));
+    }
+
+    void deallocate(T* /* p */, size_t /* n */) {
+    }
+
+    Arena* GetArena() const {
+      return this->arena;
+    }
+
+ private:
+    Arena* arena;
+};
+
+template <typename T, typename U>
+bool operator==(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) {
+  return a.GetArena() == b.GetArena();
+}
+
+template <typename T, typename U>
+bool operator!=(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) {
+  return a.GetArena() != b.GetArena();
+}
+
+/**
+  * @brief Response with body and headers allocated by Allocator.
+  *
+  * Unlike Response, headers only holds header fields (no status line) and
+  * there is no default constructor for allocators that need state, such as
+  * ArenaAllocator.
+  */
+template <typename Allocator>
+struct BasicResponse {
+  typedef typename std::allocator_traits<Allocator>::template
+    rebind_alloc<char> CharAllocator;
+  typedef std::basic_string<char, std::char_traits<char>, CharAllocator>
+    String;
+  typedef std::map<String, String, std::less<String>,
+                   typename std::allocator_traits<Allocator>::template
+                     rebind_alloc<std::pair<const String, String> > >
+    Headers;
+
+  explicit BasicResponse(const Allocator& allocator)
+    : code(0), body(CharAllocator(allocator)),
+      headers(std::less<String>(), allocator),
+      digest(CharAllocator(allocator)) {
+  }
+
+  int code;
+  String body;
+  Headers headers;
+  // digest of the body in hex, see Connection::SetDigest()
+  String digest;
+};
+
+/**
+  * @brief Response allocated from an Arena, see Connection::get()
+  */
+typedef BasicResponse<ArenaAllocator<char> > ArenaResponse;
+
+};  // namespace RestClient
+
+#endif  // INCLUDE_RESTCLIENT_CPP_ARENA_H_
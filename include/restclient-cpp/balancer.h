@@ -0,0 +1,180 @@
+/**
+ * @file balancer.h
+ * @brief client side load balancing over replicated endpoints
+ * @author Daniel Schauenberg <d@unwiredcouch.com>
+ * @version
+ * @date 2026-10-19
+ */
+
+#ifndef INCLUDE_RESTCLIENT_CPP_BALANCER_H_
+#define INCLUDE_RESTCLIENT_CPP_BALANCER_H_
+
+#include <chrono>  // NOLINT(build/c++11)
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "restclient-cpp/restclient.h"
+#include "restclient-cpp/connection.h"
+
+/**
+ * @brief namespace for all RestClient definitions
+ */
+namespace RestClient {
+
+/**
+  * @brief sends requests to one of several replicated base URLs.
+  *
+  * Every endpoint has a Connection of its own, so each keeps its own warm
+  * keep-alive connections; configure them with ForEachEndpoint(). Requests
+  * go to the endpoint with the lowest peak-EWMA latency: an exponentially
+  * weighted moving average that jumps up to a slower observation right
+  * away and decays back over the decay time, also while the endpoint is
+  * not used, so slow replicas get probed again now and then.
+  *
+  * An endpoint that fails (transport error or 5xx) a number of times in a
+  * row is ejected for a cooldown period. When the cooldown ends it gets
+  * requests again, but a single failure ejects it once more. If all
+  * endpoints are ejected, the one whose cooldown ends first is used.
+  *
+  * Like Connection, a BalancedConnection is meant to be used by one thread.
+  */
+class BalancedConnection {
+ public:
+    /**
+      *  @brief how an endpoint is picked for a request
+      *
+      *  PeakEwma picks the endpoint with the lowest latency. It reacts
+      *  fastest, but all clients that see the same latencies pick the same
+      *  endpoint. PowerOfTwoChoices (the default) compares two random
+      *  endpoints and picks the faster one, which spreads load over the
+      *  fast endpoints and still avoids slow ones.
+      */
+    enum class Strategy {
+      PeakEwma,
+      PowerOfTwoChoices
+    };
+
+    /**
+      *  @struct EndpointStats
+      *  @brief state of an endpoint as seen by the balancer
+      *  @var EndpointStats::baseUrl
+      *  Member 'baseUrl' contains the base URL of the endpoint
+      *  @var EndpointStats::latency
+      *  Member 'latency' contains the current peak-EWMA latency in
+      *  microseconds, 0 before the first request
+      *  @var EndpointStats::requests
+      *  Member 'requests' contains the number of requests sent to the
+      *  endpoint
+      *  @var EndpointStats::failures
+      *  Member 'failures' contains the number of failed requests
+      *  @var EndpointStats::consecutiveFailures
+      *  Member 'consecutiveFailures' contains the number of failures since
+      *  the last successful request
+      *  @var EndpointStats::ejections
+      *  Member 'ejections' contains how often the endpoint was ejected
+      *  @var EndpointStats::ejected
+      *  Member 'ejected' is true while the endpoint is in its cooldown
+      */
+    typedef struct {
+      std::string baseUrl;
+      double latency;
+      uint64_t requests;
+      uint64_t failures;
+      int consecutiveFailures;
+      uint64_t ejections;
+      bool ejected;
+    } EndpointStats;
+
+    // baseUrls must not be empty, throws std::invalid_argument otherwise
+    explicit BalancedConnection(const std::vector<std::string>& baseUrls);
+    ~BalancedConnection();
+
+    BalancedConnection(const BalancedConnection&) = delete;
+    BalancedConnection& operator=(const BalancedConnection&) = delete;
+
+    // set how endpoints are picked
+    void SetStrategy(Strategy strategy);
+
+    // set how fast latency observations decay, default 10 seconds
+    void SetDecayTime(int milliseconds);
+
+    // eject endpoints for cooldownMilliseconds after failures failed
+    // requests in a row. Default 5 failures and 30 seconds, 0 failures
+    // disables ejection
+    void SetOutlierEjection(int failures, int cooldownMilliseconds);
+
+    // request sent by Warmup() and KeepWarm(), and how long an endpoint may
+    // be idle before KeepWarm() sends it
+    void SetWarmup(const std::string& uri, int idleMilliseconds);
+
+    // call fn with the Connection of every endpoint, to set timeouts,
+    // headers, TCP keepalive and the like
+    void ForEachEndpoint(const std::function<void(Connection*)>& fn);
+
+    size_t Endpoints() const;
+    Connection* GetEndpoint(size_t index);
+    EndpointStats GetEndpointStats(size_t index);
+
+    // index of the endpoint that served the last request
+    size_t LastEndpoint() const;
+
+    // send the warmup request to every endpoint that isn't ejected.
+    // Returns the number of endpoints that answered
+    size_t Warmup();
+
+    // send the warmup request to endpoints idle for longer than the warmup
+    // idle time, so their connections don't time out. Call it from an idle
+    // loop or timer; returns the number of requests sent
+    size_t KeepWarm();
+
+    // Basic HTTP verb methods
+    RestClient::Response get(const std::string& uri);
+    RestClient::Response post(const std::string& uri,
+                              const std::string& data);
+    RestClient::Response put(const std::string& uri,
+                             const std::string& data);
+    RestClient::Response patch(const std::string& uri,
+                               const std::string& data);
+    RestClient::Response del(const std::string& uri);
+    RestClient::Response head(const std::string& uri);
+    RestClient::Response options(const std::string& uri);
+
+ private:
+    typedef std::chrono::steady_clock::time_point TimePoint;
+    struct Endpoint {
+      std::unique_ptr<Connection> connection;
+      // peak-EWMA in microseconds as of stamp
+      double latency;
+      TimePoint stamp;
+      TimePoint lastUsed;
+      TimePoint ejectedUntil;
+      uint64_t requests;
+      uint64_t failures;
+      int consecutiveFailures;
+      uint64_t ejections;
+    };
+
+    size_t pick();
+    double cost(const Endpoint& endpoint, TimePoint now) const;
+    void observe(size_t index, const Response& response,
+                 TimePoint started);
+    void fail(Endpoint* endpoint, TimePoint now);
+
+    std::vector<Endpoint> endpoints;
+    Strategy strategy;
+    double decayTime;
+    int ejectionFailures;
+    int ejectionCooldown;
+    std::string warmupUri;
+    int warmupIdle;
+    size_t lastEndpoint;
+    std::minstd_rand rng;
+};
+
+};  // namespace RestClient
+
+#endif  // INCLUDE_RESTCLIENT_CPP_BALANCER_H_
@@ -0,0 +1,64 @@
+/**
+ * @file cancellation.h
+ * @brief cooperative cancellation of running requests
+ * @author Daniel Schauenberg <d@unwiredcouch.com>
+ * @version
+ * @date 2026-10-19
+ */
+
+#ifndef INCLUDE_RESTCLIENT_CPP_CANCELLATION_H_
+#define INCLUDE_RESTCLIENT_CPP_CANCELLATION_H_
+
+#include <curl/curl.h>
+
+#include <atomic>
+#include <mutex>  // NOLINT(build/c++11)
+#include <vector>
+
+#include "restclient-cpp/restclient.h"
+
+/**
+ * @brief namespace for all RestClient definitions
+ */
+namespace RestClient {
+
+/**
+  * @brief flag that aborts the requests of the connections it is set on
+  * (see Connection::SetCancellationToken).
+  *
+  * Cancel() may be called from any thread, e.g. when the client that waits
+  * for the result disconnects or a sibling request of a fan-out failed. A
+  * running transfer returns a Response with code kCancelled right away:
+  * with libcurl 7.68 or newer, connections with a token wait on a multi
+  * handle that Cancel() wakes up. Older libcurl versions only notice it in
+  * the progress callback, which runs about once a second while the
+  * transfer is idle.
+  * Requests that start after Cancel() are not sent at all. A token stays
+  * cancelled until Reset().
+  */
+class CancellationToken {
+ public:
+    CancellationToken();
+
+    CancellationToken(const CancellationToken&) = delete;
+    CancellationToken& operator=(const CancellationToken&) = delete;
+
+    void Cancel();
+    bool IsCancelled() const;
+    void Reset();
+
+ private:
+    friend class Connection;
+    std::atomic<bool> cancelled;
+#if LIBCURL_VERSION_NUM >= 0x074400
+    // multi handles of the transfers waiting on the token
+    std::mutex waitersMutex;
+    std::vector<CURLM*> waiters;
+    void attach(CURLM* multi);
+    void detach(CURLM* multi);
+#endif
+};
+
+};  // namespace RestClient
+
+#endif  // INCLUDE_RESTCLIENT_CPP_CANCELLATION_H_
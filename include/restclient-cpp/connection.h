@@ -12,10 +12,26 @@
 #include <curl/curl.h>
 #include <string>
 #include <map>
+#include <vector>
+#include <atomic>
 #include <cstdlib>
 #include <cstdint>
+#include <chrono>  // NOLINT(build/c++11)
+#include <memory>
+#include <mutex>  // NOLINT(build/c++11)
+#include <thread>  // NOLINT(build/c++11)
 
 #include "restclient-cpp/restclient.h"
+#include "restclient-cpp/arena.h"
+#include "restclient-cpp/cancellation.h"
+#include "restclient-cpp/deadline.h"
+#include "restclient-cpp/digest.h"
+#include "restclient-cpp/flightrecorder.h"
+#include "restclient-cpp/headers.h"
+#include "restclient-cpp/metrics.h"
+#include "restclient-cpp/singleflight.h"
+#include "restclient-cpp/stream.h"
+#include "restclient-cpp/traffic.h"
 #include "restclient-cpp/version.h"
 
 /**
@@ -29,6 +45,9 @@ namespace RestClient {
 typedef size_t (*WriteCallback)(void *data, size_t size,
                   size_t nmemb, void *userdata);
 
+class Interceptor;
+class WebSocket;
+
 /**
   * @brief Connection object for advanced usage
   */
@@ -69,6 +88,9 @@ class Connection {
       *  @var RequestInfo::curlError
       *  Member 'curlError' contains the cURL error as a string, if any. See
       *  CURLOPT_ERRORBUFFER
+      *  @var RequestInfo::uploadDigest
+      *  Member 'uploadDigest' contains the digest of the request body in
+      *  hex, see SetDigest()
       */
     typedef struct {
         double totalTime;
@@ -85,7 +107,121 @@ class Connection {
         uint64_t redirectCount;
         int curlCode;
         std::string curlError;
+        std::string uploadDigest;
       } RequestInfo;
+    /**
+      *  @struct ExtendedRequestInfo
+      *  @brief holds extended diagnostics information about a request. All
+      *  times are in microseconds from the start of the request.
+      *  @var ExtendedRequestInfo::totalTime
+      *  Member 'totalTime' contains the total time. See CURLINFO_TOTAL_TIME_T
+      *  @var ExtendedRequestInfo::queueTime
+      *  Member 'queueTime' contains the time the transfer was held in a
+      *  waiting queue before it started. See CURLINFO_QUEUE_TIME_T (0 with
+      *  libcurl older than 8.6.0)
+      *  @var ExtendedRequestInfo::nameLookupTime
+      *  Member 'nameLookupTime' contains the time until name resolving
+      *  completed. See CURLINFO_NAMELOOKUP_TIME_T
+      *  @var ExtendedRequestInfo::connectTime
+      *  Member 'connectTime' contains the time until the connection to the
+      *  remote host or proxy completed. See CURLINFO_CONNECT_TIME_T
+      *  @var ExtendedRequestInfo::appConnectTime
+      *  Member 'appConnectTime' contains the time until the SSL/SSH
+      *  handshake completed. See CURLINFO_APPCONNECT_TIME_T
+      *  @var ExtendedRequestInfo::preTransferTime
+      *  Member 'preTransferTime' contains the time until just before the
+      *  transfer begins. See CURLINFO_PRETRANSFER_TIME_T
+      *  @var ExtendedRequestInfo::startTransferTime
+      *  Member 'startTransferTime' contains the time until the first byte
+      *  was received. See CURLINFO_STARTTRANSFER_TIME_T
+      *  @var ExtendedRequestInfo::redirectTime
+      *  Member 'redirectTime' contains the time taken for all redirect steps
+      *  before the final transfer. See CURLINFO_REDIRECT_TIME_T
+      *  @var ExtendedRequestInfo::redirectCount
+      *  Member 'redirectCount' contains the number of redirects followed.
+      *  See CURLINFO_REDIRECT_COUNT
+      *  @var ExtendedRequestInfo::newConnections
+      *  Member 'newConnections' contains the number of new connections that
+      *  had to be made. See CURLINFO_NUM_CONNECTS
+      *  @var ExtendedRequestInfo::connectionReused
+      *  Member 'connectionReused' is true if the request went over an
+      *  already established connection
+      *  @var ExtendedRequestInfo::uploadedBytes
+      *  Member 'uploadedBytes' contains the number of body bytes uploaded.
+      *  See CURLINFO_SIZE_UPLOAD_T
+      *  @var ExtendedRequestInfo::downloadedBytes
+      *  Member 'downloadedBytes' contains the number of body bytes
+      *  downloaded. See CURLINFO_SIZE_DOWNLOAD_T
+      *  @var ExtendedRequestInfo::requestHeaderBytes
+      *  Member 'requestHeaderBytes' contains the size of the sent request
+      *  headers. See CURLINFO_REQUEST_SIZE
+      *  @var ExtendedRequestInfo::responseHeaderBytes
+      *  Member 'responseHeaderBytes' contains the size of all received
+      *  headers. See CURLINFO_HEADER_SIZE
+      *  @var ExtendedRequestInfo::remoteIp
+      *  Member 'remoteIp' contains the IP address of the last connection.
+      *  See CURLINFO_PRIMARY_IP
+      *  @var ExtendedRequestInfo::remotePort
+      *  Member 'remotePort' contains the port of the last connection. See
+      *  CURLINFO_PRIMARY_PORT
+      *  @var ExtendedRequestInfo::httpVersion
+      *  Member 'httpVersion' contains the negotiated HTTP version as
+      *  CURL_HTTP_VERSION_* value, 0 if unknown. See CURLINFO_HTTP_VERSION
+      *  @var ExtendedRequestInfo::curlCode
+      *  Member 'curlCode' contains the cURL code (cast to int)
+      */
+    typedef struct {
+      int64_t totalTime;
+      int64_t queueTime;
+      int64_t nameLookupTime;
+      int64_t connectTime;
+      int64_t appConnectTime;
+      int64_t preTransferTime;
+      int64_t startTransferTime;
+      int64_t redirectTime;
+      int64_t redirectCount;
+      int64_t newConnections;
+      bool connectionReused;
+      int64_t uploadedBytes;
+      int64_t downloadedBytes;
+      int64_t requestHeaderBytes;
+      int64_t responseHeaderBytes;
+      std::string remoteIp;
+      int remotePort;
+      int httpVersion;
+      int curlCode;
+    } ExtendedRequestInfo;
+    /**
+      *  @brief when to read diagnostics information of a request from curl
+      *
+      *  Eager reads everything right after each request (the default).
+      *  Lazy keeps the curl handle untouched until the next request and
+      *  only reads the information when GetInfo() or GetRequestInfo() are
+      *  called. Disabled never reads it, timings in lastRequest and
+      *  GetRequestInfo() stay 0. Metrics and the flight recorder read the
+      *  few timings they need on their own, interceptors get lastRequest
+      *  filled in regardless of the mode.
+      */
+    enum class InfoCapture {
+      Eager,
+      Lazy,
+      Disabled
+    };
+    /**
+      *  @brief which response headers are stored
+      *
+      *  All stores every header in Response::headers and
+      *  GetResponseHeaders() (the default). AllowList stores only the
+      *  names passed to SetHeaderCapture() in Response::headers, while
+      *  GetResponseHeaders() still has all of them. None stores no headers
+      *  at all, except in GetResponseHeaders() while SetVerifyDigestHeaders()
+      *  or subscribe() need them.
+      */
+    enum class HeaderCapture {
+      All,
+      AllowList,
+      None
+    };
     /**
       *  @struct Info
       *  @brief holds some diagnostics information
@@ -95,7 +231,14 @@ class Connection {
       *  @var Info::headers
       *  Member 'headers' contains the HeaderFields map
       *  @var Info::timeout
-      *  Member 'timeout' contains the configured timeout
+      *  Member 'timeout' contains the configured timeout in seconds, rounded
+      *  up
+      *  @var Info::timeoutMilliseconds
+      *  Member 'timeoutMilliseconds' contains the configured timeout in
+      *  milliseconds
+      *  @var Info::connectTimeout
+      *  Member 'connectTimeout' contains the configured connect timeout in
+      *  milliseconds
       *  @var Info::followRedirects
       *  Member 'followRedirects' contains whether or not to follow redirects
       *  @var Info::maxRedirects
@@ -124,11 +267,15 @@ class Connection {
       *  Member 'uriProxy' contains the HTTP proxy address
       *  @var Info::lastRequest
       *  Member 'lastRequest' contains metrics about the last request
+      *  @var Info::infoCapture
+      *  Member 'infoCapture' contains the configured InfoCapture mode
       */
     typedef struct {
       std::string baseUrl;
       RestClient::HeaderFields headers;
       int timeout;
+      int timeoutMilliseconds;
+      int connectTimeout;
       bool followRedirects;
       int maxRedirects;
       bool noSignal;
@@ -147,6 +294,7 @@ class Connection {
       std::string uriProxy;
       std::string unixSocketPath;
       RequestInfo lastRequest;
+      InfoCapture infoCapture;
     } Info;
 
 
@@ -164,6 +312,21 @@ class Connection {
     // set connection timeout to seconds
     void SetTimeout(int seconds);
 
+    // set connection timeout to milliseconds (CURLOPT_TIMEOUT_MS)
+    void SetTimeoutMilliseconds(int milliseconds);
+
+    // set the timeout for connecting, including name resolution and the
+    // TLS handshake, to milliseconds. 0 keeps libcurl's default
+    void SetConnectTimeout(int milliseconds);
+
+    // abort transfers that stay below bytesPerSecond for seconds
+    // (CURLOPT_LOW_SPEED_LIMIT, CURLOPT_LOW_SPEED_TIME)
+    void SetLowSpeedLimit(int bytesPerSecond, int seconds);
+
+    // deadline for all following requests, in addition to the one of the
+    // current Deadline::Scope. Deadline() removes it
+    void SetDeadline(const RestClient::Deadline& deadline);
+
     // set file progress callback
     void SetFileProgressCallback(curl_progress_callback progressFn);
 
@@ -197,9 +360,62 @@ class Connection {
     // set CURLOPT_SSL_VERIFYPEER. Default is true.
     void SetVerifyPeer(bool verifyPeer);
 
+    // set CURLOPT_HTTP_VERSION to one of the CURL_HTTP_VERSION_* values.
+    // Default is CURL_HTTP_VERSION_NONE (libcurl's choice)
+    void SetHttpVersion(int httpVersion);
+
     // set CURLOPT_KEYPASSWD.
     void SetKeyPassword(const std::string& keyPassword);
 
+    // set CURLOPT_HAPPY_EYEBALLS_TIMEOUT_MS, 0 keeps libcurl's default
+    void SetHappyEyeballsTimeout(int milliseconds);
+
+    // resolve host names once and pin them (CURLOPT_RESOLVE), refreshing
+    // after ttlSeconds. 0 disables pinning, the default
+    void SetDnsPinning(int ttlSeconds);
+
+    // pin host:port to fixed comma separated addresses
+    void PinHost(const std::string& host, int port,
+                 const std::string& addresses);
+
+    // resolve, connect and complete TLS for the base URL ahead of time
+    bool Preconnect();
+
+    // send a HEAD to warmupUri, leaving a connection for the next request
+    bool Preconnect(const std::string& warmupUri);
+
+    // Preconnect() to several hosts, returns how many succeeded
+    size_t Warmup(const std::vector<std::string>& urls);
+
+    // send TCP keepalive probes after idleSeconds without traffic, every
+    // intervalSeconds (CURLOPT_TCP_KEEPALIVE). Off by default
+    void SetTcpKeepAlive(bool enable, int idleSeconds = 60,
+                         int intervalSeconds = 60);
+
+    // set CURLOPT_TCP_NODELAY. Default is true
+    void SetTcpNoDelay(bool noDelay);
+
+    // don't reuse connections that were idle for longer than seconds,
+    // 0 keeps libcurl's default
+    void SetMaxIdleTime(int seconds);
+
+    // don't reuse connections older than seconds, 0 (the default) means no
+    // limit
+    void SetMaxConnectionAge(int seconds);
+
+    // close connections after they served this many requests, e.g. to
+    // spread load behind L4 balancers. 0 (the default) means no limit
+    void SetMaxRequestsPerConnection(int requests);
+
+    // check idle connections every intervalMilliseconds on a background
+    // thread and close the ones past the limits above or closed by the
+    // peer, so requests don't find out. Call between requests
+    void StartRecycler(int intervalMilliseconds = 1000);
+    void StopRecycler();
+
+    // number of connections closed because of the limits above
+    uint64_t GetRecycledConnections();
+
     // set CURLOPT_PROXY
     void SetProxy(const std::string& uriProxy);
 
@@ -209,10 +425,67 @@ class Connection {
     // set CURLOPT_WRITEFUNCTION
     void SetWriteFunction(WriteCallback write_callback);
 
+    // coalesce identical concurrent GET requests through the given group
+    // (NULL disables coalescing, the default)
+    void SetSingleFlight(RestClient::SingleFlight* group);
+
+    // record request metrics in the given registry (NULL disables metrics,
+    // the default)
+    void SetMetrics(RestClient::Metrics::Registry* registry);
+
+    // record finished requests in the given flight recorder (defaults to
+    // FlightRecorder::Default(), NULL disables recording)
+    void SetFlightRecorder(RestClient::FlightRecorder* recorder);
+
+    // capture the shape of outgoing requests with the given recorder, see
+    // traffic.h (NULL disables capturing, the default)
+    void SetTrafficRecorder(RestClient::TrafficRecorder* recorder);
+
+    // abort requests when the token is cancelled, see cancellation.h (NULL
+    // disables cancellation, the default)
+    void SetCancellationToken(RestClient::CancellationToken* token);
+
+    // compute a digest of every response body while it is received, into
+    // the digest of the response, and of every request body while it is
+    // sent, into RequestInfo::uploadDigest (DigestAlgorithm::None disables
+    // it, the default)
+    void SetDigest(RestClient::DigestAlgorithm algorithm);
+
+    // fail 2xx responses whose body doesn't have this digest (hex) with
+    // kDigestMismatch. Empty disables the check, the default
+    void SetExpectedDigest(const std::string& hex);
+
+    // fail 2xx responses whose body doesn't match the Digest,
+    // Content-Digest, Repr-Digest or Content-MD5 header they came with
+    // with kDigestMismatch (off by default)
+    void SetVerifyDigestHeaders(bool verify);
+
+    // add an interceptor to the end of the chain, see interceptor.h
+    void AddInterceptor(RestClient::Interceptor* interceptor);
+
+    // remove all interceptors
+    void ClearInterceptors();
+
     std::string GetUserAgent();
 
     RestClient::Connection::Info GetInfo();
 
+    // set when diagnostics information of a request is read from curl
+    void SetInfoCapture(InfoCapture mode);
+
+    // get extended diagnostics information about the last request
+    RestClient::Connection::ExtendedRequestInfo GetRequestInfo();
+
+    // set which response headers are stored. Names in allowList are
+    // matched case-insensitively
+    void SetHeaderCapture(HeaderCapture mode,
+                          const std::vector<std::string>& allowList =
+                            std::vector<std::string>());
+
+    // all header fields of the last response, including repeated ones,
+    // with case-insensitive lookup. Valid until the next request
+    const RestClient::HeaderBlock& GetResponseHeaders() const;
+
     // set headers
     void SetHeaders(RestClient::HeaderFields headers);
 
@@ -236,9 +509,71 @@ class Connection {
     RestClient::Response head(const std::string& uri);
     RestClient::Response options(const std::string& uri);
 
-    // GET with custom response structure
+    // verbs with custom response structure. A response reused for a
+    // series of requests keeps the capacity of its body and header
+    // strings, which makes the steady state free of allocations in
+    // restclient-cpp
     RestClient::Response*
     get(const std::string& uri, RestClient::Response* response);
+    RestClient::Response* post(const std::string& uri,
+                               const std::string& data,
+                               RestClient::Response* response);
+    RestClient::Response* put(const std::string& uri,
+                              const std::string& data,
+                              RestClient::Response* response);
+    RestClient::Response* patch(const std::string& uri,
+                                const std::string& data,
+                                RestClient::Response* response);
+    RestClient::Response* del(const std::string& uri,
+                              RestClient::Response* response);
+    RestClient::Response* head(const std::string& uri,
+                               RestClient::Response* response);
+    RestClient::Response* options(const std::string& uri,
+                                  RestClient::Response* response);
+
+    // verbs writing the body into the buffer of a BufferResponse, bodies
+    // that don't fit fail with kBodyTooLarge
+    RestClient::BufferResponse*
+    get(const std::string& uri, RestClient::BufferResponse* response);
+    RestClient::BufferResponse* post(const std::string& uri,
+                                     const std::string& data,
+                                     RestClient::BufferResponse* response);
+    RestClient::BufferResponse* put(const std::string& uri,
+                                    const std::string& data,
+                                    RestClient::BufferResponse* response);
+    RestClient::BufferResponse* patch(const std::string& uri,
+                                      const std::string& data,
+                                      RestClient::BufferResponse* response);
+    RestClient::BufferResponse* del(const std::string& uri,
+                                    RestClient::BufferResponse* response);
+    RestClient::BufferResponse* head(const std::string& uri,
+                                     RestClient::BufferResponse* response);
+    RestClient::BufferResponse* options(const std::string& uri,
+                                        RestClient::BufferResponse* response);
+
+    // GET into a response allocated from an arena, see arena.h
+    RestClient::ArenaResponse*
+    get(const std::string& uri, RestClient::ArenaResponse* response);
+
+    // GET and POST handing the body to response->consumer while it is
+    // transferred, see stream.h. Bypass a SingleFlight group.
+    RestClient::StreamResponse*
+    get(const std::string& uri, RestClient::StreamResponse* response);
+    RestClient::StreamResponse* post(const std::string& uri,
+                                     const std::string& data,
+                                     RestClient::StreamResponse* response);
+    // GET a Server-Sent Events stream, reconnecting with Last-Event-ID
+    // when it ends or breaks. maxReconnects < 0 reconnects until the
+    // stream fails, is stopped or cancelled. A response that isn't
+    // text/event-stream ends it.
+    RestClient::StreamResponse* subscribe(const std::string& uri,
+                                          RestClient::SseConsumer* consumer,
+                                          RestClient::StreamResponse* response,
+                                          int maxReconnects = -1);
+
+    // GET returning a reference counted response, which is shared with all
+    // other callers of a coalesced request instead of being copied
+    RestClient::SharedResponse getShared(const std::string& uri);
 
  private:
     CURL* getCurlHandle();
@@ -246,6 +581,11 @@ class Connection {
     std::string baseUrl;
     RestClient::HeaderFields headerFields;
     int timeout;
+    int timeoutMilliseconds;
+    int connectTimeout;
+    int lowSpeedLimit;
+    int lowSpeedTime;
+    RestClient::Deadline deadline;
     bool followRedirects;
     int maxRedirects;
     bool noSignal;
@@ -263,13 +603,137 @@ class Connection {
     std::string keyPath;
     std::string keyPassword;
     bool verifyPeer;
+    int httpVersion;
+    int happyEyeballsTimeout;
+    struct DnsPin {
+      std::string addresses;
+      std::chrono::steady_clock::time_point resolvedAt;
+      // set with PinHost, never refreshed
+      bool fixed;
+      // not handed to curl yet
+      bool changed;
+      DnsPin() : fixed(false), changed(false) {}
+    };
+    // keyed by "host:port"
+    std::map<std::string, DnsPin> dnsPins;
+    int dnsPinTtl;
+    bool tcpKeepAlive;
+    int tcpKeepIdle;
+    int tcpKeepInterval;
+    bool tcpNoDelay;
+    int maxIdleTime;
+    int maxConnectionAge;
+    int maxRequestsPerConnection;
+    struct SocketState {
+      std::chrono::steady_clock::time_point opened;
+      std::chrono::steady_clock::time_point lastUsed;
+      int requests;
+      // shut down, waiting for curl to notice and close it
+      bool retired;
+    };
+    // guards sockets, transferActive and recycled, shared with the
+    // recycler thread
+    std::mutex socketsMutex;
+    std::map<curl_socket_t, SocketState> sockets;
+    bool transferActive;
+    uint64_t recycled;
+    std::thread recycler;
+    std::atomic<bool> recyclerRunning;
+    bool tracksSockets() const;
+    void beginTransfer();
+    void endTransfer();
+    void retireExpired(bool checkPeer);
+    void retire(curl_socket_t socket, SocketState* state);
+    void recycleLoop(int intervalMilliseconds);
+    static int openedSocket(void* clientp, curl_socket_t socket,
+                            curlsocktype purpose);
+    static int closeSocket(void* clientp, curl_socket_t socket);
     std::string uriProxy;
     std::string unixSocketPath;
     char curlErrorBuf[CURL_ERROR_SIZE] = {0};
     RestClient::WriteCallback writeCallback;
-    RestClient::Response*
-    performCurlRequest(const std::string& uri, RestClient::Response* resp);
-    RestClient::Response performCurlRequest(const std::string& uri);
+    RestClient::SingleFlight* singleFlight;
+    RestClient::Metrics::Registry* metrics;
+    std::vector<RestClient::Interceptor*> interceptors;
+    RestClient::FlightRecorder* flightRecorder;
+    // what metrics and the flight recorder need from the curl handle
+    struct TransferTimes {
+      int64_t totalTime;
+      int64_t nameLookupTime;
+      int64_t connectTime;
+      int64_t appConnectTime;
+      int64_t startTransferTime;
+      int64_t uploadedBytes;
+      int64_t downloadedBytes;
+    };
+    void readTransferTimes(bool captured, TransferTimes* times);
+    void recordFlight(const std::string& url, const char* method,
+                      int statusCode, const TransferTimes& times);
+    RestClient::TrafficRecorder* trafficRecorder;
+    // body size of the request being prepared, for the traffic recorder
+    uint64_t requestBodySize;
+    RestClient::CancellationToken* cancellationToken;
+    // runs the transfers of connections with a cancellation token, so
+    // Cancel() can wake them up. Created on first use.
+    CURLM* multiHandle;
+    CURLcode performTransfer();
+    RestClient::DigestAlgorithm digestAlgorithm;
+    std::string expectedDigest;
+    bool verifyDigestHeaders;
+    RestClient::Digest bodyDigest;
+    // digest of the body of the request being prepared, algorithm None if
+    // it has none
+    RestClient::Digest uploadDigest;
+    static int transferProgress(void* clientp, curl_off_t dltotal,
+                                curl_off_t dlnow, curl_off_t ultotal,
+                                curl_off_t ulnow);
+    InfoCapture infoCapture;
+    HeaderCapture headerCapture;
+    std::vector<std::string> headerAllowList;
+    RestClient::HeaderBlock responseHeaders;
+    // fill responseHeaders even with HeaderCapture::None
+    bool keepHeaderBlock;
+    // scratch space of performCurlRequest, kept for its capacity
+    std::string requestUrl;
+    std::string userAgent;
+    std::string headerName;
+    std::vector<RestClient::HeaderFields::iterator> storedHeaders;
+    ExtendedRequestInfo lastRequestInfo;
+    // lastRequestInfo has not been read from the handle yet
+    bool infoPending;
+    // the handle still holds the state of the last transfer
+    bool resetPending;
+    void prepareHandle();
+    curl_slist* setConnectOptions(const std::string& url);
+    curl_slist* resolveDnsPins(const std::string& url);
+    bool connectOnly(const std::string& url);
+    // connect to url for curl_easy_send() and curl_easy_recv(), the
+    // connection stays with the handle until the next request
+    CURLcode openConnection(const std::string& url);
+#if LIBCURL_VERSION_NUM >= 0x080b00
+    // connect to a ws:// or wss:// url for curl_ws_send() and
+    // curl_ws_recv(), with the handshake done by libcurl
+    CURLcode openWebSocket(const std::string& url,
+                           RestClient::Response* response);
+#endif
+    friend class RestClient::WebSocket;
+    const ExtendedRequestInfo& captureRequestInfo();
+    void recordMetrics(const std::string& url, const char* method,
+                       int statusCode, const TransferTimes& times);
+    std::string singleFlightKey(const std::string& method,
+                                const std::string& uri);
+    bool coalesces() const;
+    // R is Response, BufferResponse, ArenaResponse or StreamResponse
+    template <typename R>
+    R* performCurlRequest(const std::string& uri, R* resp,
+                          const char* method);
+    // set up the handle for method, data is the body for POST, PUT and
+    // PATCH
+    template <typename R>
+    R* performMethod(const char* method, const std::string& uri,
+                     const std::string* data, R* resp);
+    RestClient::Response performCurlRequest(const std::string& uri,
+                                            const char* method);
 };
 };  // namespace RestClient
 
@@ -0,0 +1,89 @@
+/**
+ * @file deadline.h
+ * @brief absolute deadlines that are passed down through nested calls
+ * @author Daniel Schauenberg <d@unwiredcouch.com>
+ * @version
+ * @date 2026-10-19
+ */
+
+#ifndef INCLUDE_RESTCLIENT_CPP_DEADLINE_H_
+#define INCLUDE_RESTCLIENT_CPP_DEADLINE_H_
+
+#include <chrono>  // NOLINT(build/c++11)
+#include <cstdint>
+
+/**
+ * @brief namespace for all RestClient definitions
+ */
+namespace RestClient {
+
+/**
+  * @brief a point in time by which an operation has to be done.
+  *
+  * A deadline is absolute, so it can be handed down to nested calls which
+  * then only get the budget that is left of their parent operation:
+  *
+  *   RestClient::Deadline::Scope scope(RestClient::Deadline::After(200));
+  *   conn.get("/a");  // gets at most 200ms
+  *   conn.get("/b");  // gets what /a left over
+  *
+  * A Scope makes a deadline the current one of its thread until it goes
+  * out of scope. Scopes nest and an inner scope can only make the deadline
+  * earlier. Connection caps the timeout of every request at the current
+  * deadline, and requests that start after it don't get sent at all.
+  */
+class Deadline {
+ public:
+    typedef std::chrono::steady_clock Clock;
+
+    // no deadline
+    Deadline();
+    explicit Deadline(Clock::time_point at);
+
+    // deadline milliseconds from now
+    static Deadline After(int64_t milliseconds);
+
+    // the deadline of the innermost Scope of this thread, unset if there is
+    // none
+    static Deadline Current();
+
+    bool IsSet() const;
+    bool Expired() const;
+    Clock::time_point When() const;
+
+    // milliseconds left, 0 once expired and INT64_MAX if not set
+    int64_t RemainingMilliseconds() const;
+
+    // the earlier of this deadline and other
+    Deadline Min(const Deadline& other) const;
+
+    // the earlier of this deadline and milliseconds from now, to give a
+    // part of the operation only a share of the budget
+    Deadline Within(int64_t milliseconds) const;
+
+    /**
+      * @brief makes a deadline the current one of the thread for its
+      * lifetime, see Deadline::Current()
+      */
+    class Scope {
+     public:
+        explicit Scope(const Deadline& deadline);
+        ~Scope();
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+     private:
+        // a Deadline member would need the complete type
+        bool previousSet;
+        Clock::time_point previousAt;
+    };
+
+ private:
+    bool set;
+    Clock::time_point at;
+};
+
+};  // namespace RestClient
+
+#endif  // INCLUDE_RESTCLIENT_CPP_DEADLINE_H_
@@ -0,0 +1,85 @@
+/**
+ * @file digest.h
+ * @brief checksums of bodies, computed while they are transferred
+ * @author Daniel Schauenberg <d@unwiredcouch.com>
+ * @version
+ * @date 2026-10-19
+ */
+
+#ifndef INCLUDE_RESTCLIENT_CPP_DIGEST_H_
+#define INCLUDE_RESTCLIENT_CPP_DIGEST_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "restclient-cpp/restclient.h"
+
+/**
+ * @brief namespace for all RestClient definitions
+ */
+namespace RestClient {
+
+/**
+  * @brief checksum algorithms for Connection::SetDigest(). MD5 is only
+  * there to check Content-MD5 headers.
+  */
+enum class DigestAlgorithm {
+  None,
+  CRC32C,
+  SHA256,
+  MD5
+};
+
+/**
+  * @brief incremental checksum of a byte stream.
+  *
+  * CRC32C uses the CRC32 instructions of SSE 4.2 or ARMv8 and SHA-256 the
+  * x86 SHA extensions when the CPU has them, see Accelerated() and
+  * SetPortable().
+  */
+class Digest {
+ public:
+    explicit Digest(DigestAlgorithm algorithm = DigestAlgorithm::None);
+
+    DigestAlgorithm Algorithm() const;
+    // start over, with another algorithm
+    void Reset(DigestAlgorithm algorithm);
+    // start over
+    void Reset();
+    void Update(const void* data, size_t length);
+    // digest of everything so far: 4 bytes big-endian for CRC32C, 32 for
+    // SHA-256, 16 for MD5, empty for None. Update() can go on after it.
+    std::string Bytes() const;
+    // Bytes() in lower case hex
+    std::string Hex() const;
+
+    // whether the algorithm runs on instructions made for it on this CPU
+    static bool Accelerated(DigestAlgorithm algorithm);
+    // use the portable implementations even where the CPU has
+    // instructions for the algorithm, for all digests of the process
+    static void SetPortable(bool portable);
+
+ private:
+    DigestAlgorithm algorithm;
+    uint32_t state[8];
+    uint64_t length;
+    unsigned char buffer[64];
+    size_t buffered;
+};
+
+/**
+  * @brief the digest a response header carries for an algorithm, as
+  * bytes like Digest::Bytes(). Understands Digest (RFC 3230), Content-Digest
+  * and Repr-Digest (RFC 9530) and Content-MD5 (RFC 1864), with base64 or hex
+  * values.
+  *
+  * @return empty if the header has no digest for the algorithm
+  */
+std::string DigestFromHeader(DigestAlgorithm algorithm,
+                             const std::string& name,
+                             const std::string& value);
+
+};  // namespace RestClient
+
+#endif  // INCLUDE_RESTCLIENT_CPP_DIGEST_H_
@@ -0,0 +1,135 @@
+/**
+ * @file download.h
+ * @brief parallel downloads of byte ranges, resumable
+ * @author Daniel Schauenberg <d@unwiredcouch.com>
+ * @version
+ * @date 2026-10-19
+ */
+
+#ifndef INCLUDE_RESTCLIENT_CPP_DOWNLOAD_H_
+#define INCLUDE_RESTCLIENT_CPP_DOWNLOAD_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>  // NOLINT(build/c++11)
+#include <string>
+#include <vector>
+
+#include "restclient-cpp/restclient.h"
+#include "restclient-cpp/connection.h"
+
+/**
+ * @brief namespace for all RestClient definitions
+ */
+namespace RestClient {
+
+/**
+  * @brief downloads a large resource in segments over several connections
+  * at once.
+  *
+  * Download() sends a HEAD first. If the server accepts byte ranges and
+  * reports the length, the resource is split into segments that are
+  * fetched with Range requests in parallel, each written straight to its
+  * offset in the output file or buffer. A failed segment is retried on its
+  * own from where it broke off. Only when it fails too often does the
+  * download give up. Without range support the resource is fetched with a
+  * single GET.
+  *
+  * Progress goes to a sidecar state file next to the output file, so a
+  * download that failed or was interrupted can be resumed by calling
+  * Download() again: segments already on disk aren't fetched again, as
+  * long as the server reports the same length and ETag (or Last-Modified,
+  * if the ETag is missing or weak). Every Range request carries that
+  * validator in If-Range, so a resource that changed in between fails the
+  * download instead of mixing versions.
+  *
+  * Every connection is a Connection of its own; configure them with
+  * ForEachConnection(). Like Connection, a SegmentedDownload is meant to be
+  * used by one thread, only BytesDone() can be read from others.
+  */
+class SegmentedDownload {
+ public:
+    explicit SegmentedDownload(const std::string& baseUrl,
+                               size_t connections = 4);
+    ~SegmentedDownload();
+
+    SegmentedDownload(const SegmentedDownload&) = delete;
+    SegmentedDownload& operator=(const SegmentedDownload&) = delete;
+
+    // call fn with every Connection, to set timeouts, TLS, proxy, auth,
+    // headers and the like
+    void ForEachConnection(const std::function<void(Connection*)>& fn);
+    // bytes per Range request, default 8MiB
+    void SetSegmentSize(uint64_t bytes);
+    // attempts per segment before the download fails, default 3
+    void SetMaxAttempts(int attempts);
+    // state file for resuming, default path + ".state" when downloading to
+    // a file and none when downloading to a buffer. An empty path turns it
+    // off
+    void SetStateFile(const std::string& path);
+
+    // download uri into the file at path. Code 200 once the resource is
+    // complete, otherwise the status or error of the failed request (or of
+    // the HEAD), the headers are those of the HEAD
+    RestClient::Response Download(const std::string& uri,
+                                  const std::string& path);
+    // download uri into a buffer, e.g. a mapped file. kBodyTooLarge if the
+    // resource doesn't fit
+    RestClient::Response Download(const std::string& uri, char* buffer,
+                                  size_t capacity);
+
+    // length of the resource, 0 until the HEAD reported it
+    uint64_t Length() const;
+    // bytes of the resource that are in place, for progress reports
+    uint64_t BytesDone() const;
+    // bytes that were in place from an earlier Download()
+    uint64_t BytesResumed() const;
+    // failed segment requests that were retried
+    uint64_t Retries() const;
+
+ private:
+    struct Segment {
+      uint64_t offset;
+      uint64_t length;
+      // bytes of the segment in place
+      uint64_t done;
+      int attempts;
+      bool busy;
+    };
+
+    RestClient::Response run(const std::string& uri, const std::string& path,
+                             char* buffer, size_t capacity);
+    bool loadState(const std::string& url, const std::string& validator);
+    void saveState(const std::string& url, const std::string& validator);
+    void work(size_t index, const std::string& uri,
+              const std::string& validator, const std::string& path,
+              char* buffer, size_t capacity, const std::string& url);
+    bool nextSegment(size_t* index);
+
+    std::string baseUrl;
+    std::vector<std::unique_ptr<Connection> > connections;
+    uint64_t segmentSize;
+    int maxAttempts;
+    bool stateFileSet;
+    std::string stateFile;
+    std::string statePath;
+    uint64_t length;
+    // whether the server takes Range requests
+    bool ranged;
+    std::atomic<uint64_t> bytesDone;
+    uint64_t bytesResumed;
+    uint64_t retries;
+    // guards the segments, the result and the state file while the
+    // workers run
+    std::mutex mutex;
+    std::vector<Segment> segments;
+    bool failed;
+    RestClient::Response result;
+};
+
+};  // namespace RestClient
+
+#endif  // INCLUDE_RESTCLIENT_CPP_DOWNLOAD_H_
@@ -0,0 +1,134 @@
+/**
+ * @file flightrecorder.h
+ * @brief fixed size in-memory log of recently finished requests
+ * @author Daniel Schauenberg <d@unwiredcouch.com>
+ * @version
+ * @date 2026-10-19
+ */
+
+#ifndef INCLUDE_RESTCLIENT_CPP_FLIGHTRECORDER_H_
+#define INCLUDE_RESTCLIENT_CPP_FLIGHTRECORDER_H_
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * @brief namespace for all RestClient definitions
+ */
+namespace RestClient {
+
+/** @struct FlightRecord
+  *  @brief compact record of a single finished request. Times are in
+  *  microseconds relative to the start of the request.
+  *  @var FlightRecord::sequence
+  *  Member 'sequence' contains the position of the record in the recorder
+  *  @var FlightRecord::timestamp
+  *  Member 'timestamp' contains the completion time in microseconds since
+  *  the Unix epoch
+  *  @var FlightRecord::totalTime
+  *  Member 'totalTime' contains the total time of the request
+  *  @var FlightRecord::nameLookupTime
+  *  Member 'nameLookupTime' contains the time until name resolving completed
+  *  @var FlightRecord::connectTime
+  *  Member 'connectTime' contains the time until the connection was
+  *  established
+  *  @var FlightRecord::startTransferTime
+  *  Member 'startTransferTime' contains the time until the first byte was
+  *  received
+  *  @var FlightRecord::requestBytes
+  *  Member 'requestBytes' contains the number of body bytes uploaded
+  *  @var FlightRecord::responseBytes
+  *  Member 'responseBytes' contains the number of body bytes downloaded
+  *  @var FlightRecord::statusCode
+  *  Member 'statusCode' contains the HTTP status code, 0 if there was none
+  *  @var FlightRecord::curlCode
+  *  Member 'curlCode' contains the cURL code of the transfer
+  *  @var FlightRecord::method
+  *  Member 'method' contains the HTTP method
+  *  @var FlightRecord::url
+  *  Member 'url' contains the URL template (see FlightRecorder::UrlTemplate),
+  *  truncated to fit
+  */
+typedef struct {
+  uint64_t sequence;
+  int64_t timestamp;
+  int64_t totalTime;
+  int64_t nameLookupTime;
+  int64_t connectTime;
+  int64_t startTransferTime;
+  uint64_t requestBytes;
+  uint64_t responseBytes;
+  int32_t statusCode;
+  int32_t curlCode;
+  char method[8];
+  char url[112];
+} FlightRecord;
+
+/**
+  * @brief lock-free ring buffer keeping the last N finished requests of all
+  * connections it is set on (see Connection::SetFlightRecorder).
+  *
+  * Writers claim a slot with a single atomic increment and publish the
+  * record with a per slot sequence number, so recording costs a few dozen
+  * nanoseconds and never blocks or allocates. Readers skip records that are
+  * being overwritten while they are read. Dumping is allocation free and
+  * async-signal-safe, so it can be triggered from a signal handler.
+  */
+class FlightRecorder {
+ public:
+    static const size_t kDefaultCapacity = 4096;
+
+    // capacity gets rounded up to the next power of two
+    explicit FlightRecorder(size_t capacity = kDefaultCapacity);
+    ~FlightRecorder();
+
+    FlightRecorder(const FlightRecorder&) = delete;
+    FlightRecorder& operator=(const FlightRecorder&) = delete;
+
+    // add a record, overwriting the oldest one when the buffer is full.
+    // record.sequence is assigned by the recorder
+    void Record(const FlightRecord& record);
+
+    // copy all complete records, oldest first
+    std::vector<FlightRecord> Dump() const;
+
+    // write all complete records as text lines to a file descriptor
+    void DumpTo(int fd) const;
+
+    // number of records ever recorded
+    uint64_t Recorded() const;
+
+    size_t Capacity() const;
+
+    // process wide recorder used by connections by default
+    static FlightRecorder& Default();
+
+    // dump the default recorder to fd whenever signum is received
+    static bool InstallSignalHandler(int signum, int fd);
+
+    // write the URL template of url into out: query and fragment are
+    // dropped and path segments that look like ids (all digits, or 8 and
+    // more hex digits and dashes) are replaced by ":id"
+    static void UrlTemplate(const char* url, char* out, size_t size);
+
+ private:
+    struct Slot {
+      std::atomic<uint64_t> sequence;
+      FlightRecord record;
+    };
+
+    bool read(uint64_t ticket, FlightRecord* out) const;
+
+    const size_t capacity;
+    const size_t mask;
+    std::unique_ptr<Slot[]> slots;
+    std::atomic<uint64_t> head;
+};
+
+};  // namespace RestClient
+
+#endif  // INCLUDE_RESTCLIENT_CPP_FLIGHTRECORDER_H_
@@ -0,0 +1,86 @@
+/**
+ * @file headers.h
+ * @brief compact storage for the header fields of a response
+ * @author Daniel Schauenberg <d@unwiredcouch.com>
+ * @version
+ * @date 2026-10-19
+ */
+
+#ifndef INCLUDE_RESTCLIENT_CPP_HEADERS_H_
+#define INCLUDE_RESTCLIENT_CPP_HEADERS_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * @brief namespace for all RestClient definitions
+ */
+namespace RestClient {
+
+/**
+  * @brief the header fields of a response, stored as one block of raw
+  * header lines plus a flat index of where names and values start.
+  *
+  * Unlike HeaderFields, names are looked up case-insensitively and repeated
+  * fields such as Set-Cookie are all kept, in the order they were received.
+  * Adding a field copies the line into the block, so once the block and
+  * index grew to the size of typical responses, Clear() and refilling them
+  * doesn't allocate. Lookups scan the index, which for the few dozen fields
+  * of a response is faster than a map.
+  */
+class HeaderBlock {
+ public:
+    HeaderBlock();
+
+    // add a header line as passed to CURLOPT_HEADERFUNCTION. A status line
+    // starts a new response (e.g. after a redirect) and clears the block,
+    // blank lines and lines without a colon are skipped
+    void AddLine(const char* line, size_t length);
+
+    // remove all fields, keeping the allocated memory
+    void Clear();
+
+    // number of fields
+    size_t Size() const;
+    bool Empty() const;
+
+    // name and value of the field at index, in the order received
+    std::string Name(size_t index) const;
+    std::string Value(size_t index) const;
+    // name and value of the field at index without copying, valid until
+    // the block changes
+    const char* NameData(size_t index, size_t* length) const;
+    const char* ValueData(size_t index, size_t* length) const;
+
+    // index of the first field called name at or after start, Size() if
+    // there is none
+    size_t Find(const std::string& name, size_t start = 0) const;
+
+    bool Has(const std::string& name) const;
+
+    // value of the first field called name, empty if there is none
+    std::string Get(const std::string& name) const;
+
+    // values of all fields called name
+    std::vector<std::string> GetAll(const std::string& name) const;
+
+    // the header lines the fields were read from
+    const std::string& Raw() const;
+
+ private:
+    struct Field {
+      uint32_t name;
+      uint32_t nameLength;
+      uint32_t value;
+      uint32_t valueLength;
+    };
+
+    std::string raw;
+    std::vector<Field> fields;
+};
+
+};  // namespace RestClient
+
+#endif  // INCLUDE_RESTCLIENT_CPP_HEADERS_H_
@@ -0,0 +1,76 @@
+/**
+ * @file interceptor.h
+ * @brief request lifecycle hooks for restclient-cpp connections
+ * @author Daniel Schauenberg <d@unwiredcouch.com>
+ * @version
+ * @date 2026-10-19
+ */
+
+#ifndef INCLUDE_RESTCLIENT_CPP_INTERCEPTOR_H_
+#define INCLUDE_RESTCLIENT_CPP_INTERCEPTOR_H_
+
+#include <string>
+#include <map>
+
+#include "restclient-cpp/restclient.h"
+#include "restclient-cpp/connection.h"
+
+/**
+ * @brief namespace for all RestClient definitions
+ */
+namespace RestClient {
+
+/** @struct RequestContext
+  *  @brief This structure represents a single request while it passes
+  *  through the interceptor chain. The same object is handed to all hooks of
+  *  all interceptors for that request.
+  *  @var RequestContext::method
+  *  Member 'method' contains the HTTP method
+  *  @var RequestContext::url
+  *  Member 'url' contains the full URL of the request
+  *  @var RequestContext::headers
+  *  Member 'headers' contains additional headers to send with this request
+  *  only. They take precedence over the headers set on the connection
+  *  @var RequestContext::tags
+  *  Member 'tags' contains arbitrary key/value pairs interceptors can use to
+  *  tag the request or to pass state (e.g. span ids) between their hooks
+  */
+typedef struct {
+  const char* method;
+  std::string url;
+  HeaderFields headers;
+  std::map<std::string, std::string> tags;
+} RequestContext;
+
+/**
+  * @brief base class for request interceptors. Register instances with
+  * Connection::AddInterceptor; hooks are called in registration order. All
+  * hooks have empty default implementations, so an interceptor only
+  * overrides the ones it needs. Hooks run on the thread performing the
+  * request and must not throw.
+  */
+class Interceptor {
+ public:
+    virtual ~Interceptor() {}
+
+    // called before the request is sent, may add headers to ctx->headers
+    virtual void BeforeSend(RequestContext* /* ctx */) {}
+
+    // called when the first byte of the response arrived
+    virtual void OnFirstByte(RequestContext* /* ctx */) {}
+
+    // called after a response was received, whatever its status code
+    virtual void OnComplete(RequestContext* /* ctx */,
+                            const RestClient::Response& /* response */,
+                            const Connection::RequestInfo& /* info */) {}
+
+    // called when the transfer failed, info.curlCode and info.curlError
+    // describe the failure
+    virtual void OnError(RequestContext* /* ctx */,
+                         const RestClient::Response& /* response */,
+                         const Connection::RequestInfo& /* info */) {}
+};
+
+};  // namespace RestClient
+
+#endif  // INCLUDE_RESTCLIENT_CPP_INTERCEPTOR_H_
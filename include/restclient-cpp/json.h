@@ -0,0 +1,204 @@
+/**
+ * @file json.h
+ * @brief incremental JSON parsing of response bodies
+ * @author Daniel Schauenberg <d@unwiredcouch.com>
+ * @version
+ * @date 2026-10-19
+ */
+
+#ifndef INCLUDE_RESTCLIENT_CPP_JSON_H_
+#define INCLUDE_RESTCLIENT_CPP_JSON_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "restclient-cpp/stream.h"
+
+/**
+ * @brief namespace for all RestClient definitions
+ */
+namespace RestClient {
+
+/**
+  * @brief receives the events of a JsonParser, in document order. Every
+  * method returns false to stop parsing, by default they ignore the event.
+  *
+  * Strings and keys are unescaped UTF-8 and only valid during the call.
+  */
+class JsonHandler {
+ public:
+    virtual ~JsonHandler() {}
+
+    virtual bool Null() { return true; }
+    virtual bool Bool(bool /* value */) { return true; }
+    // text is the number as it was written, for integers a double can't
+    // hold exactly
+    virtual bool Number(double /* value */, const char* /* text */,
+                        size_t /* length */) { return true; }
+    virtual bool String(const char* /* value */, size_t /* length */) {
+      return true;
+    }
+    virtual bool StartObject() { return true; }
+    virtual bool Key(const char* /* name */, size_t /* length */) {
+      return true;
+    }
+    virtual bool EndObject() { return true; }
+    virtual bool StartArray() { return true; }
+    virtual bool EndArray() { return true; }
+};
+
+/**
+  * @brief push parser for a single JSON document (RFC 8259) that takes the
+  * document in pieces split anywhere and reports it to a JsonHandler as it
+  * goes.
+  *
+  * As a StreamConsumer it parses a response body while it is transferred
+  * (see Connection::get() with a StreamResponse), so a large document
+  * never has to be held in memory. The only memory it keeps is the
+  * nesting of the open containers and the string or number being read,
+  * both keep their capacity over Reset().
+  */
+class JsonParser : public StreamConsumer {
+ public:
+    explicit JsonParser(JsonHandler* handler, size_t maxDepth = 512);
+
+    JsonParser(const JsonParser&) = delete;
+    JsonParser& operator=(const JsonParser&) = delete;
+
+    // parse the next piece of the document, false on an error
+    bool Consume(const char* data, size_t length);
+    // the document ended, false if it was incomplete or invalid
+    bool Finish();
+    // start over with a new document
+    void Reset();
+
+    // whether the document was complete once Finish() returned
+    bool Done() const;
+    bool Failed() const;
+    // what went wrong, empty without an error
+    const std::string& Error() const;
+    // bytes of the document consumed so far, on an error the offset of the
+    // byte that caused it
+    uint64_t Offset() const;
+
+ private:
+    enum class State {
+      Value, ValueOrEnd, KeyOrEnd, Key, Colon, CommaOrEnd, Done, String,
+      Number, Literal, Failed
+    };
+
+    bool startValue(char c, uint64_t position);
+    bool endContainer(char c, uint64_t position);
+    void valueDone();
+    void beginString(bool isKey);
+    const char* string(const char* p, const char* end);
+    bool escape(char c, uint64_t position);
+    bool endNumber(uint64_t position);
+    void appendCodePoint(uint32_t codePoint);
+    void flushSurrogate();
+    bool fail(const char* message, uint64_t position);
+    bool stopped(uint64_t position);
+    uint64_t at(const char* p) const;
+
+    JsonHandler* const handler;
+    const size_t maxDepth;
+    State state;
+    // '{' and '[' of the open containers
+    std::vector<char> stack;
+    // string or number being read
+    std::string token;
+    bool tokenIsKey;
+    // 0 outside of an escape, 1 after the backslash, 2 to 5 for the hex
+    // digits of \uXXXX
+    int escapeState;
+    uint32_t codeUnit;
+    uint32_t highSurrogate;
+    const char* literal;
+    size_t literalPosition;
+    uint64_t offset;
+    std::string error;
+    // the piece being parsed and its offset in the document
+    const char* chunk;
+    uint64_t chunkOffset;
+};
+
+/**
+  * @brief a JSON value built by a JsonDomBuilder. Object members keep the
+  * order of the document, repeated keys are kept as well.
+  */
+class JsonValue {
+ public:
+    enum class Type { Null, Bool, Number, String, Array, Object };
+
+    JsonValue();
+
+    Type type;
+    bool boolean;
+    double number;
+    // the text of a String, or of a Number as it was written
+    std::string string;
+    std::vector<JsonValue> elements;
+    std::vector<std::pair<std::string, JsonValue> > members;
+
+    // first member with that key, NULL if there is none or this is no
+    // object
+    const JsonValue* Find(const std::string& key) const;
+    // number of elements or members
+    size_t Size() const;
+    void Clear();
+};
+
+/**
+  * @brief JsonHandler that builds JsonValues while the document is parsed.
+  *
+  * With an element callback the elements of the arrays at arrayDepth (0
+  * for a document that is an array, 1 for arrays that are members of the
+  * outermost container and so on) are handed to the callback as soon as
+  * each of them is complete and dropped afterwards, so arrays of any
+  * length are processed one element at a time. The rest of the document
+  * is built as usual.
+  */
+class JsonDomBuilder : public JsonHandler {
+ public:
+    // return false to stop parsing
+    typedef std::function<bool(const JsonValue&)> ElementCallback;
+
+    explicit JsonDomBuilder(JsonValue* root);
+    JsonDomBuilder(JsonValue* root, size_t arrayDepth,
+                   const ElementCallback& callback);
+
+    JsonDomBuilder(const JsonDomBuilder&) = delete;
+    JsonDomBuilder& operator=(const JsonDomBuilder&) = delete;
+
+    bool Null();
+    bool Bool(bool value);
+    bool Number(double value, const char* text, size_t length);
+    bool String(const char* value, size_t length);
+    bool StartObject();
+    bool Key(const char* name, size_t length);
+    bool EndObject();
+    bool StartArray();
+    bool EndArray();
+
+    // clear the root for a new document
+    void Reset();
+
+ private:
+    JsonValue* add(JsonValue::Type type);
+    bool elementDone();
+
+    JsonValue* const root;
+    const size_t arrayDepth;
+    const ElementCallback callback;
+    // open containers, innermost last
+    std::vector<JsonValue*> stack;
+    std::string key;
+};
+
+};  // namespace RestClient
+
+#endif  // INCLUDE_RESTCLIENT_CPP_JSON_H_
@@ -0,0 +1,161 @@
+/**
+ * @file memory.h
+ * @brief allocators for the memory libcurl uses internally
+ * @author Daniel Schauenberg <d@unwiredcouch.com>
+ * @version
+ * @date 2026-10-19
+ */
+
+#ifndef INCLUDE_RESTCLIENT_CPP_MEMORY_H_
+#define INCLUDE_RESTCLIENT_CPP_MEMORY_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>  // NOLINT(build/c++11)
+#include <thread>  // NOLINT(build/c++11)
+#include <vector>
+
+/**
+ * @brief namespace for all RestClient definitions
+ */
+namespace RestClient {
+
+/**
+  * @brief allocator for libcurl's own memory, see RestClient::init().
+  *
+  * Implementations have to be thread-safe: libcurl allocates from every
+  * thread that runs a transfer and from its resolver threads, and memory
+  * may be freed on another thread than the one that allocated it.
+  */
+class MemoryAllocator {
+ public:
+    virtual ~MemoryAllocator();
+
+    // like malloc(), realloc() and free()
+    virtual void* Allocate(size_t size) = 0;
+    virtual void* Reallocate(void* p, size_t size) = 0;
+    virtual void Free(void* p) = 0;
+};
+
+/**
+  * @brief allocator caching freed blocks in power of two size classes.
+  *
+  * libcurl allocates and frees the same few sizes for every transfer
+  * (buffers, header lists, URL parts). The pool keeps up to
+  * maxCachedBlocks freed blocks per class from 16 bytes to 64KiB and hands
+  * them out again, so a steady stream of requests stops going to malloc.
+  * Larger allocations go to malloc directly. Blocks are rounded up to
+  * their class, which can waste up to half of a block.
+  */
+class PoolAllocator : public MemoryAllocator {
+ public:
+    static const size_t kMinBlockSize = 16;
+    static const size_t kClasses = 13;
+
+    explicit PoolAllocator(size_t maxCachedBlocks = 64);
+    ~PoolAllocator();
+
+    PoolAllocator(const PoolAllocator&) = delete;
+    PoolAllocator& operator=(const PoolAllocator&) = delete;
+
+    void* Allocate(size_t size);
+    void* Reallocate(void* p, size_t size);
+    void Free(void* p);
+
+    // allocations served from the cache and from malloc
+    uint64_t Hits() const;
+    uint64_t Misses() const;
+    // blocks currently cached over all classes
+    size_t Cached() const;
+
+    // give all cached blocks back to malloc
+    void Trim();
+
+ private:
+    struct SizeClass {
+      mutable std::mutex mutex;
+      std::vector<void*> blocks;
+    };
+
+    const size_t maxCachedBlocks;
+    SizeClass classes[kClasses];
+    std::atomic<uint64_t> hits;
+    std::atomic<uint64_t> misses;
+};
+
+/**
+  *  @struct MemoryStats
+  *  @brief allocations seen by an AccountingAllocator
+  *  @var MemoryStats::allocations
+  *  Member 'allocations' contains the number of allocations
+  *  @var MemoryStats::reallocations
+  *  Member 'reallocations' contains the number of reallocations
+  *  @var MemoryStats::frees
+  *  Member 'frees' contains the number of frees
+  *  @var MemoryStats::bytesAllocated
+  *  Member 'bytesAllocated' contains the bytes requested by allocations and
+  *  reallocations
+  *  @var MemoryStats::bytesFreed
+  *  Member 'bytesFreed' contains the bytes given back by frees and
+  *  reallocations
+  */
+typedef struct {
+  uint64_t allocations;
+  uint64_t reallocations;
+  uint64_t frees;
+  uint64_t bytesAllocated;
+  uint64_t bytesFreed;
+} MemoryStats;
+
+/**
+  * @brief allocator that counts allocations per thread and passes them on
+  * to another allocator (malloc if there is none).
+  *
+  * Memory freed on another thread than the one that allocated it counts as
+  * freed on the freeing thread, so only the sum over all threads has
+  * matching allocated and freed bytes. Each allocation carries a small
+  * header with its size.
+  */
+class AccountingAllocator : public MemoryAllocator {
+ public:
+    explicit AccountingAllocator(MemoryAllocator* upstream = NULL);
+    ~AccountingAllocator();
+
+    AccountingAllocator(const AccountingAllocator&) = delete;
+    AccountingAllocator& operator=(const AccountingAllocator&) = delete;
+
+    void* Allocate(size_t size);
+    void* Reallocate(void* p, size_t size);
+    void Free(void* p);
+
+    // stats of the calling thread
+    MemoryStats ThreadStats();
+    // stats of a thread, all zero if it never allocated
+    MemoryStats ThreadStats(std::thread::id thread);
+    // sum over all threads
+    MemoryStats Totals();
+
+ private:
+    struct Counters {
+      std::atomic<uint64_t> allocations;
+      std::atomic<uint64_t> reallocations;
+      std::atomic<uint64_t> frees;
+      std::atomic<uint64_t> bytesAllocated;
+      std::atomic<uint64_t> bytesFreed;
+    };
+
+    Counters* localCounters();
+    static MemoryStats read(const Counters& counters);
+
+    MemoryAllocator* const upstream;
+    const uint64_t id;
+    std::mutex mutex;
+    std::map<std::thread::id, std::unique_ptr<Counters> > threads;
+};
+
+};  // namespace RestClient
+
+#endif  // INCLUDE_RESTCLIENT_CPP_MEMORY_H_
@@ -0,0 +1,243 @@
+/**
+ * @file metrics.h
+ * @brief latency histograms and counters for restclient-cpp requests
+ * @author Daniel Schauenberg <d@unwiredcouch.com>
+ * @version
+ * @date 2026-10-19
+ */
+
+#ifndef INCLUDE_RESTCLIENT_CPP_METRICS_H_
+#define INCLUDE_RESTCLIENT_CPP_METRICS_H_
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>  // NOLINT(build/c++11)
+#include <string>
+#include <thread>  // NOLINT(build/c++11)
+#include <utility>
+#include <vector>
+
+/**
+ * @brief namespace for all RestClient definitions
+ */
+namespace RestClient {
+
+/**
+  * @brief namespace for request metrics
+  */
+namespace Metrics {
+
+/**
+  * @brief snapshot of a Histogram, safe to keep and merge after the
+  * histogram itself moved on
+  */
+class HistogramSnapshot {
+ public:
+    HistogramSnapshot();
+
+    // add all observations of another snapshot to this one
+    void Merge(const HistogramSnapshot& other);
+
+    // approximate value at quantile q (0.0 - 1.0), accurate to the
+    // resolution of the histogram buckets
+    uint64_t Percentile(double q) const;
+
+    // number of observations <= value, rounded down to bucket boundaries
+    uint64_t CountAtOrBelow(uint64_t value) const;
+
+    std::vector<uint64_t> counts;
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+};
+
+/**
+  * @brief log-linear ("HDR style") histogram of unsigned values. Every power
+  * of two is split into 8 linear sub buckets, which keeps the relative error
+  * of any recorded value below 12.5% over the whole range.
+  *
+  * A histogram has exactly one writing thread (see Registry) and any number
+  * of concurrent readers. Record() therefore uses relaxed loads and stores
+  * instead of atomic read-modify-write operations.
+  */
+class Histogram {
+ public:
+    static const unsigned int kSubBucketBits = 3;
+    static const unsigned int kSubBuckets = 1u << kSubBucketBits;
+    // values are clamped to 2^40 - 1 (~12 days in microseconds, 1 TiB)
+    static const unsigned int kMaxValueBits = 40;
+    static const unsigned int kBucketCount =
+      (kMaxValueBits - kSubBucketBits + 1) * kSubBuckets;
+
+    Histogram();
+
+    Histogram(const Histogram&) = delete;
+    Histogram& operator=(const Histogram&) = delete;
+
+    // record a value, must only be called from the owning thread
+    void Record(uint64_t value);
+
+    // copy the current state, may be called from any thread
+    HistogramSnapshot Snapshot() const;
+
+    static unsigned int BucketIndex(uint64_t value);
+    // largest value that falls into the bucket at index
+    static uint64_t BucketUpperBound(unsigned int index);
+
+ private:
+    std::atomic<uint64_t> counts[kBucketCount];
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> sum;
+    std::atomic<uint64_t> max;
+};
+
+/**
+  *  @struct Sample
+  *  @brief measurements of a single finished request. All times are in
+  *  microseconds and relative to the start of the request
+  *  @var Sample::totalTime
+  *  Member 'totalTime' contains the total time. See CURLINFO_TOTAL_TIME_T
+  *  @var Sample::nameLookupTime
+  *  Member 'nameLookupTime' contains the time until name resolving completed.
+  *  See CURLINFO_NAMELOOKUP_TIME_T
+  *  @var Sample::connectTime
+  *  Member 'connectTime' contains the time until the connection was
+  *  established. See CURLINFO_CONNECT_TIME_T
+  *  @var Sample::appConnectTime
+  *  Member 'appConnectTime' contains the time until the TLS handshake
+  *  completed, 0 for plain connections. See CURLINFO_APPCONNECT_TIME_T
+  *  @var Sample::startTransferTime
+  *  Member 'startTransferTime' contains the time until the first byte was
+  *  received. See CURLINFO_STARTTRANSFER_TIME_T
+  *  @var Sample::requestBytes
+  *  Member 'requestBytes' contains the number of body bytes uploaded
+  *  @var Sample::responseBytes
+  *  Member 'responseBytes' contains the number of body bytes downloaded
+  *  @var Sample::statusCode
+  *  Member 'statusCode' contains the HTTP status code, 0 if there was none
+  *  @var Sample::curlCode
+  *  Member 'curlCode' contains the cURL code of the transfer
+  */
+typedef struct {
+  int64_t totalTime;
+  int64_t nameLookupTime;
+  int64_t connectTime;
+  int64_t appConnectTime;
+  int64_t startTransferTime;
+  uint64_t requestBytes;
+  uint64_t responseBytes;
+  int statusCode;
+  int curlCode;
+} Sample;
+
+/**
+  * @brief all metrics recorded for one host and method combination.
+  * Phase histograms hold durations of the single phases, not the cumulative
+  * times reported by libcurl: connect is the TCP connect after DNS, tls the
+  * handshake after the TCP connect (only recorded for TLS connections) and
+  * ttfb the time from start until the first response byte. Phases that did
+  * not happen for a request (DNS and connect on a reused connection, TLS on
+  * plain connections, first byte on failed transfers) are not recorded.
+  */
+class Series {
+ public:
+    static const int kMaxStatusCode = 600;
+    static const int kMaxCurlCode = 128;
+
+    Series();
+
+    Series(const Series&) = delete;
+    Series& operator=(const Series&) = delete;
+
+    void Record(const Sample& sample);
+
+    Histogram totalTime;
+    Histogram nameLookupTime;
+    Histogram connectTime;
+    Histogram tlsTime;
+    Histogram firstByteTime;
+    Histogram requestSize;
+    Histogram responseSize;
+    std::atomic<uint64_t> statusCodes[kMaxStatusCode];
+    std::atomic<uint64_t> curlErrors[kMaxCurlCode];
+};
+
+/**
+  *  @struct SeriesSnapshot
+  *  @brief point in time copy of a Series, merged over all threads
+  */
+typedef struct {
+  std::string host;
+  std::string method;
+  HistogramSnapshot totalTime;
+  HistogramSnapshot nameLookupTime;
+  HistogramSnapshot connectTime;
+  HistogramSnapshot tlsTime;
+  HistogramSnapshot firstByteTime;
+  HistogramSnapshot requestSize;
+  HistogramSnapshot responseSize;
+  std::map<int, uint64_t> statusCodes;
+  std::map<int, uint64_t> curlErrors;
+} SeriesSnapshot;
+
+typedef std::vector<SeriesSnapshot> Snapshot;
+
+/**
+  * @brief collects metrics of all connections that have it set (see
+  * Connection::SetMetrics).
+  *
+  * Every recording thread gets its own shard of series, so recording a
+  * request never takes a lock once the (host, method) series exists for
+  * the calling thread. Snapshot() can be called at any time from any thread,
+  * e.g. from a monitoring endpoint, and merges the shards of all threads.
+  */
+class Registry {
+ public:
+    Registry();
+    ~Registry();
+
+    Registry(const Registry&) = delete;
+    Registry& operator=(const Registry&) = delete;
+
+    // record a finished request for host and method
+    void Record(const std::string& host, const std::string& method,
+                const Sample& sample);
+
+    // merge the series of all threads
+    RestClient::Metrics::Snapshot Snapshot();
+
+    // render the current state in the Prometheus text exposition format
+    std::string PrometheusText();
+
+    // process wide registry
+    static Registry& Default();
+
+ private:
+    typedef std::map<std::pair<std::string, std::string>,
+                     std::unique_ptr<Series> > SeriesMap;
+    struct Shard {
+      std::mutex mutex;
+      SeriesMap series;
+    };
+
+    Shard* localShard();
+    Series* localSeries(const std::string& host, const std::string& method);
+
+    const uint64_t id;
+    std::mutex mutex;
+    std::map<std::thread::id, std::unique_ptr<Shard> > shards;
+};
+
+// render a snapshot in the Prometheus text exposition format
+std::string PrometheusText(const RestClient::Metrics::Snapshot& snapshot);
+
+// extract the host (and port) part of a URL
+std::string HostFromUrl(const std::string& url);
+
+};  // namespace Metrics
+
+};  // namespace RestClient
+
+#endif  // INCLUDE_RESTCLIENT_CPP_METRICS_H_
@@ -33,15 +33,69 @@ typedef std::map<std::string, std::string> HeaderFields;
   *  Member 'body' contains the HTTP response body, or curl_easy_strerror output
   *  @var Response::headers
   *  Member 'headers' contains the HTTP response headers
+  *  @var Response::digest
+  *  Member 'digest' contains the digest of the body in hex, computed while
+  *  it was received, see Connection::SetDigest()
   */
 typedef struct {
   int code;
   std::string body;
   HeaderFields headers;
+  std::string digest;
 } Response;
 
+/**
+  * @brief codes restclient-cpp itself puts into Response::code (and the
+  * code of the other response types). They are negative, so they can't be
+  * mistaken for an HTTP status or a cURL error code; -1 stands for a cURL
+  * error code above 99.
+  *
+  * kCancelled: the request was cancelled with a CancellationToken
+  * kBodyTooLarge: the body didn't fit into the buffer of a BufferResponse
+  * kStreamAborted: the consumer of a StreamResponse stopped the transfer or
+  * rejected the end of the body
+  * kDigestMismatch: the body didn't match the expected digest or the one
+  * the server sent
+  */
+const int kCancelled = -2;
+const int kBodyTooLarge = -3;
+const int kStreamAborted = -4;
+const int kDigestMismatch = -5;
+
+/** @struct BufferResponse
+  *  @brief HTTP response with the body written into a buffer of the caller
+  *  @var BufferResponse::code
+  *  Member 'code' contains the HTTP response code, cURL error code or
+  *  kBodyTooLarge
+  *  @var BufferResponse::body
+  *  Member 'body' points to the buffer the body is written to (not owned),
+  *  or the curl_easy_strerror output as far as it fits
+  *  @var BufferResponse::capacity
+  *  Member 'capacity' contains the size of the buffer
+  *  @var BufferResponse::size
+  *  Member 'size' contains the number of bytes written to the buffer
+  *  @var BufferResponse::headers
+  *  Member 'headers' contains the HTTP response headers
+  *  @var BufferResponse::digest
+  *  Member 'digest' contains the digest of the body in hex, see
+  *  Connection::SetDigest()
+  */
+typedef struct {
+  int code;
+  char* body;
+  size_t capacity;
+  size_t size;
+  HeaderFields headers;
+  std::string digest;
+} BufferResponse;
+
+class MemoryAllocator;
+
 // init and disable functions
 int init();
+// init with libcurl's memory going to allocator (see memory.h), which has
+// to stay alive until after disable()
+int init(MemoryAllocator* allocator);
 void disable();
 
 /**
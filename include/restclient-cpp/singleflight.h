@@ -0,0 +1,66 @@
+/**
+ * @file singleflight.h
+ * @brief request coalescing for identical concurrent requests
+ * @author Daniel Schauenberg <d@unwiredcouch.com>
+ * @version
+ * @date 2026-10-19
+ */
+
+#ifndef INCLUDE_RESTCLIENT_CPP_SINGLEFLIGHT_H_
+#define INCLUDE_RESTCLIENT_CPP_SINGLEFLIGHT_H_
+
+#include <functional>
+#include <future>  // NOLINT(build/c++11)
+#include <map>
+#include <memory>
+#include <mutex>  // NOLINT(build/c++11)
+#include <string>
+
+#include "restclient-cpp/restclient.h"
+
+/**
+ * @brief namespace for all RestClient definitions
+ */
+namespace RestClient {
+
+/**
+  * @brief reference counted response handed out to all callers that took
+  * part in a coalesced request
+  */
+typedef std::shared_ptr<const Response> SharedResponse;
+
+/**
+  * @brief groups identical concurrent requests so that only one of them
+  * performs the transfer while all others wait for and share its result.
+  *
+  * A SingleFlight object is meant to be shared between the Connection
+  * objects of multiple threads (see Connection::SetSingleFlight). Requests
+  * are identified by a key built from the method, the full URL and the
+  * request headers. A key is only in flight while its transfer runs, so
+  * nothing gets cached once the result has been handed out.
+  */
+class SingleFlight {
+ public:
+    SingleFlight();
+    ~SingleFlight();
+
+    SingleFlight(const SingleFlight&) = delete;
+    SingleFlight& operator=(const SingleFlight&) = delete;
+
+    // run fn for key unless an identical call is already in flight, in
+    // which case wait for and return its result instead
+    SharedResponse Do(const std::string& key,
+                      const std::function<Response()>& fn,
+                      bool* shared = NULL);
+
+    // number of distinct keys currently in flight
+    size_t InFlight();
+
+ private:
+    std::mutex mutex;
+    std::map<std::string, std::shared_future<SharedResponse> > calls;
+};
+
+};  // namespace RestClient
+
+#endif  // INCLUDE_RESTCLIENT_CPP_SINGLEFLIGHT_H_
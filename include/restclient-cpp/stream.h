@@ -0,0 +1,203 @@
+/**
+ * @file stream.h
+ * @brief response bodies handed to a consumer while they arrive
+ * @author Daniel Schauenberg <d@unwiredcouch.com>
+ * @version
+ * @date 2026-10-19
+ */
+
+#ifndef INCLUDE_RESTCLIENT_CPP_STREAM_H_
+#define INCLUDE_RESTCLIENT_CPP_STREAM_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+#include "restclient-cpp/restclient.h"
+
+/**
+ * @brief namespace for all RestClient definitions
+ */
+namespace RestClient {
+
+/**
+  * @brief receives a response body piece by piece from the write path,
+  * e.g. a JsonParser (see json.h). Consume() is called with the pieces as
+  * libcurl delivers them, which can split the body anywhere.
+  */
+class StreamConsumer {
+ public:
+    virtual ~StreamConsumer() {}
+
+    // a piece of the body, false stops the transfer
+    virtual bool Consume(const char* data, size_t length) = 0;
+    // the body is complete, false if it ended where it shouldn't have
+    virtual bool Finish() = 0;
+};
+
+/** @struct StreamResponse
+  *  @brief HTTP response with the body handed to a StreamConsumer instead
+  *  of being stored. Only bodies of 2xx responses go to the consumer.
+  *  @var StreamResponse::code
+  *  Member 'code' contains the HTTP response code, cURL error code or
+  *  kStreamAborted. While the transfer runs it holds the status of the
+  *  last status line received.
+  *  @var StreamResponse::body
+  *  Member 'body' contains the body of a response that wasn't 2xx, or
+  *  curl_easy_strerror output
+  *  @var StreamResponse::headers
+  *  Member 'headers' contains the HTTP response headers
+  *  @var StreamResponse::consumer
+  *  Member 'consumer' points to the consumer of the body (not owned)
+  *  @var StreamResponse::digest
+  *  Member 'digest' contains the digest of the body in hex, see
+  *  Connection::SetDigest()
+  */
+typedef struct {
+  int code;
+  std::string body;
+  HeaderFields headers;
+  StreamConsumer* consumer;
+  std::string digest;
+} StreamResponse;
+
+/**
+  * @brief StreamConsumer that splits the body into lines and hands them to
+  * Line() without their terminator.
+  *
+  * Lines within one piece of the body are handed over where they are, only
+  * lines that span pieces are collected in a buffer that keeps its capacity.
+  * A line longer than maxLineLength stops the stream, so a consumer of an
+  * endless stream runs in bounded memory.
+  */
+class LineConsumer : public StreamConsumer {
+ public:
+    // lines end with "\n" or "\r\n", and with a lone "\r" as well if
+    // carriageReturnEndsLine is set
+    LineConsumer(size_t maxLineLength, bool carriageReturnEndsLine);
+
+    LineConsumer(const LineConsumer&) = delete;
+    LineConsumer& operator=(const LineConsumer&) = delete;
+
+    bool Consume(const char* data, size_t length);
+
+    // forget an unfinished line and the error
+    virtual void Reset();
+    // why the stream was stopped, empty if it wasn't
+    const std::string& Error() const;
+
+ protected:
+    // a complete line, false stops the stream
+    virtual bool Line(const char* data, size_t length) = 0;
+    // stop the stream with an error
+    bool fail(const char* message);
+    // an unfinished line at the end of the stream
+    const std::string& pending() const;
+
+ private:
+    bool append(const char* data, size_t length);
+
+    const size_t maxLineLength;
+    const bool carriageReturnEndsLine;
+    std::string buffer;
+    // the last piece ended with "\r", a "\n" starting the next is part of
+    // that terminator
+    bool afterCarriageReturn;
+    std::string error;
+};
+
+/**
+  * @brief consumer of newline delimited records such as NDJSON or JSON
+  * Lines, handing every non-empty record to a callback. The record is only
+  * valid during the call, e.g. to feed a JsonParser.
+  */
+class NdjsonConsumer : public LineConsumer {
+ public:
+    // return false to stop the stream
+    typedef std::function<bool(const char* record, size_t length)>
+      RecordCallback;
+
+    explicit NdjsonConsumer(const RecordCallback& callback,
+                            size_t maxRecordSize = 1 << 20);
+
+    // the last record doesn't need a newline
+    bool Finish();
+    // records handed to the callback
+    uint64_t Records() const;
+
+ protected:
+    bool Line(const char* data, size_t length);
+
+ private:
+    const RecordCallback callback;
+    uint64_t records;
+};
+
+/** @struct ServerSentEvent
+  *  @brief event of a text/event-stream
+  *  @var ServerSentEvent::event
+  *  Member 'event' contains the event type, "message" if the stream didn't
+  *  name one
+  *  @var ServerSentEvent::data
+  *  Member 'data' contains the data lines of the event joined with "\n"
+  *  @var ServerSentEvent::id
+  *  Member 'id' contains the last event id seen when the event was
+  *  dispatched
+  */
+typedef struct {
+  std::string event;
+  std::string data;
+  std::string id;
+} ServerSentEvent;
+
+/**
+  * @brief consumer of a Server-Sent Events stream (text/event-stream, see
+  * the WHATWG HTML standard), handing every event to a callback.
+  *
+  * The event is reused for the next one, so it is only valid during the
+  * call. The last event id and the reconnection time the stream sent
+  * survive Reset(), for Connection::subscribe() to pick up the stream where
+  * it broke off.
+  */
+class SseConsumer : public LineConsumer {
+ public:
+    // return false to stop the stream
+    typedef std::function<bool(const ServerSentEvent& event)> EventCallback;
+
+    explicit SseConsumer(const EventCallback& callback,
+                         size_t maxEventSize = 1 << 20);
+
+    // an unfinished event at the end of the stream is dropped
+    bool Finish();
+    // start a new connection: drops an unfinished event
+    void Reset();
+
+    // id of the last event, sent as Last-Event-ID when reconnecting
+    const std::string& LastEventId() const;
+    void SetLastEventId(const std::string& id);
+    // milliseconds to wait before reconnecting, 3000 unless the stream
+    // sent a retry field
+    int Retry() const;
+    void SetRetry(int milliseconds);
+    // events handed to the callback
+    uint64_t Events() const;
+
+ protected:
+    bool Line(const char* data, size_t length);
+
+ private:
+    bool dispatch();
+
+    const EventCallback callback;
+    const size_t maxEventSize;
+    ServerSentEvent event;
+    std::string lastEventId;
+    int retry;
+    uint64_t events;
+    bool firstLine;
+};
+
+};  // namespace RestClient
+
+#endif  // INCLUDE_RESTCLIENT_CPP_STREAM_H_
@@ -0,0 +1,117 @@
+/**
+ * @file traffic.h
+ * @brief capture of outgoing request shapes to a compact binary file, for
+ * replaying realistic traffic in benchmarks
+ * @author Daniel Schauenberg <d@unwiredcouch.com>
+ * @version
+ * @date 2026-10-19
+ */
+
+#ifndef INCLUDE_RESTCLIENT_CPP_TRAFFIC_H_
+#define INCLUDE_RESTCLIENT_CPP_TRAFFIC_H_
+
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <mutex>  // NOLINT(build/c++11)
+#include <string>
+#include <vector>
+
+#include "restclient-cpp/restclient.h"
+
+/**
+ * @brief namespace for all RestClient definitions
+ */
+namespace RestClient {
+
+/** @struct TrafficRecord
+  *  @brief shape of a single captured request. Bodies are not captured,
+  *  only their size.
+  *  @var TrafficRecord::offset
+  *  Member 'offset' contains the time the request was sent in microseconds
+  *  since the capture was opened
+  *  @var TrafficRecord::method
+  *  Member 'method' contains the HTTP method
+  *  @var TrafficRecord::url
+  *  Member 'url' contains the full URL of the request
+  *  @var TrafficRecord::headers
+  *  Member 'headers' contains the headers set on the connection and by
+  *  interceptors
+  *  @var TrafficRecord::bodySize
+  *  Member 'bodySize' contains the size of the request body in bytes
+  */
+typedef struct {
+  int64_t offset;
+  std::string method;
+  std::string url;
+  HeaderFields headers;
+  uint64_t bodySize;
+} TrafficRecord;
+
+/**
+  * @brief writes the requests of all connections it is set on (see
+  * Connection::SetTrafficRecorder) to a capture file.
+  *
+  * Records are small: times are stored as varint deltas and every string
+  * (method, URL, header names and values) is written once and referenced by
+  * index after that, so a repeated header set costs a few bytes per
+  * request. Recording takes a mutex and writes to a buffered file, it is
+  * meant for capture sessions rather than to stay enabled in production.
+  *
+  * Values of the Authorization, Proxy-Authorization and Cookie headers are
+  * replaced with kRedacted and user name and password are left out of URLs
+  * unless SetRecordSecrets(true) was called, so a capture can be shared
+  * without leaking credentials.
+  */
+class TrafficRecorder {
+ public:
+    TrafficRecorder();
+    ~TrafficRecorder();
+
+    TrafficRecorder(const TrafficRecorder&) = delete;
+    TrafficRecorder& operator=(const TrafficRecorder&) = delete;
+
+    // create or truncate the capture file and start the clock for record
+    // offsets. Returns false if the file can't be written
+    bool Open(const std::string& path);
+
+    // flush and close the capture file, records are dropped after this
+    void Close();
+
+    bool IsOpen() const;
+
+    // store credential header values and URLs as sent (false by default)
+    void SetRecordSecrets(bool record);
+
+    // stored in place of the value of a credential header
+    static const char kRedacted[];
+
+    // append a request sent now
+    void Record(const char* method, const std::string& url,
+                const HeaderFields& headers, uint64_t bodySize);
+
+    // number of records written since Open()
+    uint64_t Recorded() const;
+
+    // read all records of a capture file. Returns false if the file can't
+    // be read or is not a capture; records read up to a truncated or
+    // corrupt record are kept
+    static bool Load(const std::string& path,
+                     std::vector<TrafficRecord>* records);
+
+ private:
+    void writeString(const std::string& value);
+
+    mutable std::mutex mutex;
+    FILE* file;
+    int64_t start;
+    int64_t lastOffset;
+    uint64_t recorded;
+    bool recordSecrets;
+    std::map<std::string, uint64_t> strings;
+    std::string buffer;
+};
+
+};  // namespace RestClient
+
+#endif  // INCLUDE_RESTCLIENT_CPP_TRAFFIC_H_
@@ -0,0 +1,170 @@
+/**
+ * @file websocket.h
+ * @brief WebSocket client on top of a Connection
+ * @author Daniel Schauenberg <d@unwiredcouch.com>
+ * @version
+ * @date 2026-10-19
+ */
+
+#ifndef INCLUDE_RESTCLIENT_CPP_WEBSOCKET_H_
+#define INCLUDE_RESTCLIENT_CPP_WEBSOCKET_H_
+
+#include <curl/curl.h>
+
+#include <chrono>  // NOLINT(build/c++11)
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <string>
+
+#include "restclient-cpp/restclient.h"
+#include "restclient-cpp/connection.h"
+
+/**
+ * @brief namespace for all RestClient definitions
+ */
+namespace RestClient {
+
+/**
+  * @brief kind of a message received from a WebSocket
+  */
+enum class WebSocketMessageType { Text, Binary, Close };
+
+/** @struct WebSocketMessage
+  *  @brief message received from a WebSocket, reassembled from its
+  *  fragments
+  *  @var WebSocketMessage::type
+  *  Member 'type' contains whether it is a text, binary or close message
+  *  @var WebSocketMessage::data
+  *  Member 'data' contains the payload, UTF-8 for text messages and the
+  *  reason for close messages
+  *  @var WebSocketMessage::closeCode
+  *  Member 'closeCode' contains the status code of a close message, 1005
+  *  if the peer didn't send one
+  */
+typedef struct {
+  WebSocketMessageType type;
+  std::string data;
+  int closeCode;
+} WebSocketMessage;
+
+/**
+  * @brief WebSocket client (RFC 6455) on a connection of a Connection.
+  *
+  * Open() connects like a request of the Connection would, so its base
+  * URL, TLS, proxy and timeout settings apply, and sends the upgrade
+  * request with the Connection's headers, basic auth and user agent. The
+  * WebSocket then owns the Connection's curl handle until it is closed or
+  * destroyed: the next request of the Connection drops the WebSocket
+  * connection.
+  *
+  * With a libcurl of 8.11 or newer that was built with WebSocket support,
+  * libcurl does the handshake and the frames go through curl_ws_send() and
+  * curl_ws_recv(). Other builds lack that API, there the frames are read
+  * and written with curl_easy_recv() and curl_easy_send(). Receive() takes
+  * a timeout of 0 to never block, so Socket() can be watched by an event
+  * loop which calls Receive() whenever it is readable. Pings of the peer
+  * are answered, pongs are counted and the keepalive pings when the
+  * connection has been idle. Not thread safe, like the Connection.
+  */
+class WebSocket {
+ public:
+    enum class Status {
+      // a message was received
+      Message,
+      // no complete message arrived in time
+      WouldBlock,
+      // the connection was closed, by the peer or by Close()
+      Closed,
+      // the connection broke, see Error()
+      Error
+    };
+
+    explicit WebSocket(RestClient::Connection* connection,
+                       size_t maxMessageSize = 16 << 20);
+    ~WebSocket();
+
+    WebSocket(const WebSocket&) = delete;
+    WebSocket& operator=(const WebSocket&) = delete;
+
+    // upgrade a GET of uri, code 101 if the WebSocket is open
+    RestClient::Response Open(const std::string& uri);
+    bool IsOpen() const;
+
+    CURLcode SendText(const std::string& text);
+    CURLcode SendBinary(const void* data, size_t length);
+    CURLcode Ping(const std::string& payload = std::string());
+    // start the closing handshake, Receive() returns Closed once the peer
+    // answered it
+    CURLcode Close(int code = 1000, const std::string& reason = std::string());
+
+    // wait up to timeoutMilliseconds for a complete message, 0 returns
+    // right away and a negative timeout waits until one arrives. Message
+    // is only written on Status::Message and Status::Closed
+    Status Receive(RestClient::WebSocketMessage* message,
+                   int timeoutMilliseconds);
+
+    // ping after intervalMilliseconds without anything received and give
+    // up on the connection if nothing arrives within another interval, 0
+    // (the default) turns keepalive off
+    void SetKeepalive(int intervalMilliseconds);
+    // socket to watch for readability, CURL_SOCKET_BAD if not open
+    curl_socket_t Socket() const;
+    // pongs received
+    uint64_t Pongs() const;
+    // why the connection broke, empty if it didn't
+    const std::string& Error() const;
+    // whether Open() used libcurl's WebSocket support, so the frames go
+    // through curl_ws_send() and curl_ws_recv()
+    bool LibcurlFrames() const;
+
+ private:
+    bool handshake(const std::string& uri, RestClient::Response* response);
+    CURLcode send(const void* data, size_t length, int opcode);
+    CURLcode sendAll(const char* data, size_t length);
+    CURLcode receiveMore();
+    CURLcode receiveSome(RestClient::WebSocketMessage* message,
+                         Status* status, bool* done);
+#if LIBCURL_VERSION_NUM >= 0x080b00
+    CURLcode sendFrame(const void* data, size_t length, int opcode);
+    CURLcode receiveFrame(RestClient::WebSocketMessage* message,
+                          Status* status, bool* done);
+#endif
+    bool parse(RestClient::WebSocketMessage* message, Status* status);
+    bool controlFrame(RestClient::WebSocketMessage* message, Status* status);
+    Status fail(const std::string& message);
+    bool wait(bool writable, int timeoutMilliseconds);
+    bool keepalive();
+
+    RestClient::Connection* const connection;
+    const size_t maxMessageSize;
+    // masks and the handshake key must not be predictable
+    std::random_device random;
+    // the frames go through libcurl's curl_ws_* API
+    bool curlFrames;
+    bool open;
+    // Close() was called, the peer's close frame ends the connection
+    bool closing;
+    // received bytes not parsed yet, and a frame being sent
+    std::string input;
+    std::string output;
+    // the frame being received
+    bool inFrame;
+    int frameOpcode;
+    bool frameFinal;
+    uint64_t frameRemaining;
+    std::string control;
+    // type and data of the message being reassembled
+    bool partial;
+    WebSocketMessageType partialType;
+    std::string partialData;
+    int keepaliveInterval;
+    bool pingSent;
+    std::chrono::steady_clock::time_point lastReceived;
+    uint64_t pongs;
+    std::string error;
+};
+
+};  // namespace RestClient
+
+#endif  // INCLUDE_RESTCLIENT_CPP_WEBSOCKET_H_
@@ -0,0 +1,114 @@
+/**
+ * @file arena.cc
+ * @brief implementation of the bump allocator
+ * @author Daniel Schauenberg <d@unwiredcouch.com>
+ */
+
+#include "restclient-cpp/arena.h"
+
+#include <cstdint>
+#include <new>
+#include <vector>
+
+namespace {
+
+size_t alignUp(size_t value, size_t alignment) {
+  return (value + alignment - 1) & ~(alignment - 1);
+}
+
+}  // namespace
+
+RestClient::Arena::Arena(size_t blockSize)
+  : current(0), offset(0), used(0), blockSize(blockSize) {
+}
+
+RestClient::Arena::Arena(void* buffer, size_t size, size_t blockSize)
+  : current(0), offset(0), used(0), blockSize(blockSize) {
+  Block block;
+  block.data = static_cast<char*>(buffer);
+  block.size = size;
+  block.owned = false;
+  this->blocks.push_back(block);
+}
+
+RestClient::Arena::~Arena() {
+  this->Release();
+}
+
+/**
+ * @brief allocate memory from the arena
+ *
+ * @param size - number of bytes
+ * @param alignment - power of two the address has to be a multiple of
+ *
+ * @return pointer to the memory, valid until Reset() or Release()
+ */
+void*
+RestClient::Arena::Allocate(size_t size, size_t alignment) {
+  // first fit in the current or one of the following (reset) blocks
+  for (; this->current < this->blocks.size(); this->current++) {
+    Block& block = this->blocks[this->current];
+    uintptr_t base = reinterpret_cast<uintptr_t>(block.data);
+    size_t start = alignUp(base + this->offset, alignment) - base;
+    if (start + size <= block.size) {
+      this->offset = start + size;
+      this->used += size;
+      return block.data + start;
+    }
+    this->offset = 0;
+  }
+  Block block;
+  block.size = size + alignment > this->blockSize ?
+               size + alignment : this->blockSize;
+  block.data = static_cast<char*>(::operator new(block.size));
+  block.owned = true;
+  this->blocks.push_back(block);
+  this->current = this->blocks.size() - 1;
+  uintptr_t base = reinterpret_cast<uintptr_t>(block.data);
+  size_t start = alignUp(base, alignment) - base;
+  this->offset = start + size;
+  this->used += size;
+  return block.data + start;
+}
+
+/**
+ * @brief make all memory available again. Objects allocated from the
+ * arena must not be used after this
+ */
+void
+RestClient::Arena::Reset() {
+  this->current = 0;
+  this->offset = 0;
+  this->used = 0;
+}
+
+/**
+ * @brief like Reset(), and also give the heap blocks back
+ */
+void
+RestClient::Arena::Release() {
+  std::vector<Block> kept;
+  for (size_t i = 0; i < this->blocks.size(); i++) {
+    if (this->blocks[i].owned) {
+      ::operator delete(this->blocks[i].data);
+    } else {
+      kept.push_back(this->blocks[i]);
+    }
+  }
+  this->blocks.swap(kept);
+  this->Reset();
+}
+
+size_t
+RestClient::Arena::Used() const {
+  return this->used;
+}
+
+size_t
+RestClient::Arena::Capacity() const {
+  size_t capacity = 0;
+  for (size_t i = 0; i < this->blocks.size(); i++) {
+    capacity += this->blocks[i].size;
+  }
+  return capacity;
+}
@@ -0,0 +1,487 @@
+/**
+ * @file balancer.cc
+ * @brief implementation of client side load balancing
+ * @author Daniel Schauenberg <d@unwiredcouch.com>
+ */
+
+#include "restclient-cpp/balancer.h"
+
+#include <chrono>  // NOLINT(build/c++11)
+#include <cmath>
+#include <functional>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "restclient-cpp/cancellation.h"
+#include "restclient-cpp/connection.h"
+
+/**
+ * @brief constructor for the BalancedConnection object
+ *
+ * @param baseUrls - base URLs of the replicas, requests are sent to one of
+ * them. Throws std::invalid_argument if there are none.
+ */
+RestClient::BalancedConnection::BalancedConnection(
+    const std::vector<std::string>& baseUrls)
+  : strategy(Strategy::PowerOfTwoChoices), decayTime(10000000.0),
+    ejectionFailures(5), ejectionCooldown(30000), warmupUri("/"),
+    warmupIdle(30000), lastEndpoint(0),
+    rng(std::random_device()()) {
+  if (baseUrls.empty()) {
+    throw std::invalid_argument("BalancedConnection needs a base URL");
+  }
+  TimePoint now = std::chrono::steady_clock::now();
+  this->endpoints.resize(baseUrls.size());
+  for (size_t i = 0; i < baseUrls.size(); i++) {
+    Endpoint& endpoint = this->endpoints[i];
+    endpoint.connection.reset(new Connection(baseUrls[i]));
+    endpoint.latency = 0;
+    endpoint.stamp = now;
+    endpoint.lastUsed = now;
+    endpoint.ejectedUntil = now;
+    endpoint.requests = 0;
+    endpoint.failures = 0;
+    endpoint.consecutiveFailures = 0;
+    endpoint.ejections = 0;
+  }
+}
+
+RestClient::BalancedConnection::~BalancedConnection() {
+}
+
+/**
+ * @brief set how an endpoint is picked for a request
+ *
+ * @param strategy - PeakEwma or PowerOfTwoChoices
+ *
+ */
+void
+RestClient::BalancedConnection::SetStrategy(Strategy strategy) {
+  this->strategy = strategy;
+}
+
+/**
+ * @brief set the time constant of the latency average. Shorter times react
+ * faster to changes, longer ones smooth out noise.
+ *
+ * @param milliseconds - time after which an observation weighs 1/e
+ *
+ */
+void
+RestClient::BalancedConnection::SetDecayTime(int milliseconds) {
+  this->decayTime = milliseconds * 1000.0;
+}
+
+/**
+ * @brief set when endpoints are ejected
+ *
+ * @param failures - number of failed requests in a row, 0 disables ejection
+ * @param cooldownMilliseconds - how long an ejected endpoint gets no
+ * requests
+ *
+ */
+void
+RestClient::BalancedConnection::SetOutlierEjection(int failures,
+                                                   int cooldownMilliseconds) {
+  this->ejectionFailures = failures;
+  this->ejectionCooldown = cooldownMilliseconds;
+}
+
+/**
+ * @brief set the request used to keep endpoints warm. It is sent as HEAD,
+ * see Connection::Preconnect()
+ *
+ * @param uri - URI relative to the base URLs
+ * @param idleMilliseconds - idle time after which KeepWarm() sends it
+ *
+ */
+void
+RestClient::BalancedConnection::SetWarmup(const std::string& uri,
+                                          int idleMilliseconds) {
+  this->warmupUri = uri;
+  this->warmupIdle = idleMilliseconds;
+}
+
+/**
+ * @brief call a function with the Connection of every endpoint
+ *
+ * @param fn - function to call
+ *
+ */
+void
+RestClient::BalancedConnection::ForEachEndpoint(
+    const std::function<void(Connection*)>& fn) {
+  for (size_t i = 0; i < this->endpoints.size(); i++) {
+    fn(this->endpoints[i].connection.get());
+  }
+}
+
+/**
+ * @brief get the number of endpoints
+ *
+ * @return number of endpoints
+ */
+size_t
+RestClient::BalancedConnection::Endpoints() const {
+  return this->endpoints.size();
+}
+
+/**
+ * @brief get the Connection of an endpoint
+ *
+ * @param index - index of the endpoint, in the order of the base URLs
+ *
+ * @return connection, owned by the BalancedConnection
+ */
+RestClient::Connection*
+RestClient::BalancedConnection::GetEndpoint(size_t index) {
+  return this->endpoints[index].connection.get();
+}
+
+/**
+ * @brief get the balancer's view of an endpoint
+ *
+ * @param index - index of the endpoint, in the order of the base URLs
+ *
+ * @return EndpointStats
+ */
+RestClient::BalancedConnection::EndpointStats
+RestClient::BalancedConnection::GetEndpointStats(size_t index) {
+  TimePoint now = std::chrono::steady_clock::now();
+  const Endpoint& endpoint = this->endpoints[index];
+  EndpointStats ret;
+  ret.baseUrl = endpoint.connection->GetInfo().baseUrl;
+  ret.latency = this->cost(endpoint, now);
+  ret.requests = endpoint.requests;
+  ret.failures = endpoint.failures;
+  ret.consecutiveFailures = endpoint.consecutiveFailures;
+  ret.ejections = endpoint.ejections;
+  ret.ejected = endpoint.ejectedUntil > now;
+  return ret;
+}
+
+/**
+ * @brief get the endpoint the last request was sent to
+ *
+ * @return index of the endpoint
+ */
+size_t
+RestClient::BalancedConnection::LastEndpoint() const {
+  return this->lastEndpoint;
+}
+
+/**
+ * @brief send the warmup request to all endpoints that aren't ejected
+ *
+ * @return number of endpoints that answered
+ */
+size_t
+RestClient::BalancedConnection::Warmup() {
+  TimePoint now = std::chrono::steady_clock::now();
+  size_t warm = 0;
+  for (size_t i = 0; i < this->endpoints.size(); i++) {
+    Endpoint& endpoint = this->endpoints[i];
+    if (endpoint.ejectedUntil > now) {
+      continue;
+    }
+    endpoint.lastUsed = now;
+    if (endpoint.connection->Preconnect(this->warmupUri)) {
+      warm++;
+    } else {
+      this->fail(&endpoint, std::chrono::steady_clock::now());
+    }
+  }
+  return warm;
+}
+
+/**
+ * @brief send the warmup request to endpoints that were idle for longer
+ * than the warmup idle time and aren't ejected
+ *
+ * @return number of warmup requests sent
+ */
+size_t
+RestClient::BalancedConnection::KeepWarm() {
+  TimePoint now = std::chrono::steady_clock::now();
+  size_t sent = 0;
+  for (size_t i = 0; i < this->endpoints.size(); i++) {
+    Endpoint& endpoint = this->endpoints[i];
+    if (endpoint.ejectedUntil > now || now - endpoint.lastUsed <
+        std::chrono::milliseconds(this->warmupIdle)) {
+      continue;
+    }
+    endpoint.lastUsed = now;
+    sent++;
+    if (!endpoint.connection->Preconnect(this->warmupUri)) {
+      this->fail(&endpoint, std::chrono::steady_clock::now());
+    }
+  }
+  return sent;
+}
+
+/**
+ * @brief HTTP GET method
+ *
+ * @param url to query
+ *
+ * @return response struct
+ */
+RestClient::Response
+RestClient::BalancedConnection::get(const std::string& url) {
+  size_t i = this->pick();
+  TimePoint started = std::chrono::steady_clock::now();
+  RestClient::Response ret = this->endpoints[i].connection->get(url);
+  this->observe(i, ret, started);
+  return ret;
+}
+
+/**
+ * @brief HTTP POST method
+ *
+ * @param url to query
+ * @param data HTTP POST body
+ *
+ * @return response struct
+ */
+RestClient::Response
+RestClient::BalancedConnection::post(const std::string& url,
+                                     const std::string& data) {
+  size_t i = this->pick();
+  TimePoint started = std::chrono::steady_clock::now();
+  RestClient::Response ret = this->endpoints[i].connection->post(url, data);
+  this->observe(i, ret, started);
+  return ret;
+}
+
+/**
+ * @brief HTTP PUT method
+ *
+ * @param url to query
+ * @param data HTTP PUT body
+ *
+ * @return response struct
+ */
+RestClient::Response
+RestClient::BalancedConnection::put(const std::string& url,
+                                    const std::string& data) {
+  size_t i = this->pick();
+  TimePoint started = std::chrono::steady_clock::now();
+  RestClient::Response ret = this->endpoints[i].connection->put(url, data);
+  this->observe(i, ret, started);
+  return ret;
+}
+
+/**
+ * @brief HTTP PATCH method
+ *
+ * @param url to query
+ * @param data HTTP PATCH body
+ *
+ * @return response struct
+ */
+RestClient::Response
+RestClient::BalancedConnection::patch(const std::string& url,
+                                      const std::string& data) {
+  size_t i = this->pick();
+  TimePoint started = std::chrono::steady_clock::now();
+  RestClient::Response ret = this->endpoints[i].connection->patch(url, data);
+  this->observe(i, ret, started);
+  return ret;
+}
+
+/**
+ * @brief HTTP DELETE method
+ *
+ * @param url to query
+ *
+ * @return response struct
+ */
+RestClient::Response
+RestClient::BalancedConnection::del(const std::string& url) {
+  size_t i = this->pick();
+  TimePoint started = std::chrono::steady_clock::now();
+  RestClient::Response ret = this->endpoints[i].connection->del(url);
+  this->observe(i, ret, started);
+  return ret;
+}
+
+/**
+ * @brief HTTP HEAD method
+ *
+ * @param url to query
+ *
+ * @return response struct
+ */
+RestClient::Response
+RestClient::BalancedConnection::head(const std::string& url) {
+  size_t i = this->pick();
+  TimePoint started = std::chrono::steady_clock::now();
+  RestClient::Response ret = this->endpoints[i].connection->head(url);
+  this->observe(i, ret, started);
+  return ret;
+}
+
+/**
+ * @brief HTTP OPTIONS method
+ *
+ * @param url to query
+ *
+ * @return response struct
+ */
+RestClient::Response
+RestClient::BalancedConnection::options(const std::string& url) {
+  size_t i = this->pick();
+  TimePoint started = std::chrono::steady_clock::now();
+  RestClient::Response ret = this->endpoints[i].connection->options(url);
+  this->observe(i, ret, started);
+  return ret;
+}
+
+/**
+ * @brief pick the endpoint for the next request
+ *
+ * @return index of the endpoint
+ */
+size_t
+RestClient::BalancedConnection::pick() {
+  TimePoint now = std::chrono::steady_clock::now();
+  // candidates are the endpoints that aren't ejected, or the one coming
+  // back first if all are
+  size_t candidates[2];
+  size_t found = 0;
+  size_t healthy = 0;
+  size_t soonest = 0;
+  for (size_t i = 0; i < this->endpoints.size(); i++) {
+    if (this->endpoints[i].ejectedUntil <= now) {
+      healthy++;
+    } else if (this->endpoints[i].ejectedUntil <
+               this->endpoints[soonest].ejectedUntil) {
+      soonest = i;
+    }
+  }
+  if (healthy == 0) {
+    return soonest;
+  }
+
+  if (this->strategy == Strategy::PowerOfTwoChoices && healthy > 2) {
+    // two distinct random healthy endpoints
+    size_t first = this->rng() % healthy;
+    size_t second = this->rng() % (healthy - 1);
+    if (second >= first) {
+      second++;
+    }
+    size_t n = 0;
+    for (size_t i = 0; i < this->endpoints.size() && found < 2; i++) {
+      if (this->endpoints[i].ejectedUntil > now) {
+        continue;
+      }
+      if (n == first || n == second) {
+        candidates[found++] = i;
+      }
+      n++;
+    }
+    return this->cost(this->endpoints[candidates[1]], now) <
+           this->cost(this->endpoints[candidates[0]], now) ?
+           candidates[1] : candidates[0];
+  }
+
+  // lowest cost overall, ties go to a random endpoint so unobserved ones
+  // share the first requests
+  size_t best = 0;
+  double bestCost = 0;
+  size_t ties = 0;
+  for (size_t i = 0; i < this->endpoints.size(); i++) {
+    if (this->endpoints[i].ejectedUntil > now) {
+      continue;
+    }
+    double c = this->cost(this->endpoints[i], now);
+    if (ties == 0 || c < bestCost) {
+      best = i;
+      bestCost = c;
+      ties = 1;
+    } else if (c == bestCost && this->rng() % ++ties == 0) {
+      best = i;
+    }
+  }
+  return best;
+}
+
+/**
+ * @brief current peak-EWMA latency of an endpoint, decayed for the time
+ * since the last observation
+ */
+double
+RestClient::BalancedConnection::cost(const Endpoint& endpoint,
+                                     TimePoint now) const {
+  double elapsed = std::chrono::duration<double, std::micro>(
+      now - endpoint.stamp).count();
+  return endpoint.latency * std::exp(-elapsed / this->decayTime);
+}
+
+/**
+ * @brief update an endpoint with the result of a request
+ *
+ * @param index - endpoint the request was sent to
+ * @param response - its response
+ * @param started - when the request was started
+ *
+ */
+void
+RestClient::BalancedConnection::observe(size_t index,
+                                        const Response& response,
+                                        TimePoint started) {
+  TimePoint now = std::chrono::steady_clock::now();
+  Endpoint& endpoint = this->endpoints[index];
+  this->lastEndpoint = index;
+  endpoint.requests++;
+  endpoint.lastUsed = now;
+  if (response.code == RestClient::kCancelled) {
+    // says nothing about the endpoint
+    return;
+  }
+
+  double latency = static_cast<double>(
+      endpoint.connection->GetRequestInfo().totalTime);
+  if (latency <= 0) {
+    // info capture is disabled
+    latency = std::chrono::duration<double, std::micro>(
+        now - started).count();
+  }
+  double elapsed = std::chrono::duration<double, std::micro>(
+      now - endpoint.stamp).count();
+  double decay = std::exp(-elapsed / this->decayTime);
+  if (latency > endpoint.latency * decay) {
+    endpoint.latency = latency;
+  } else {
+    endpoint.latency = endpoint.latency * decay + latency * (1 - decay);
+  }
+  endpoint.stamp = now;
+
+  // transport errors are reported as curl codes below 100
+  if (response.code < 100 || response.code >= 500) {
+    this->fail(&endpoint, now);
+  } else {
+    endpoint.consecutiveFailures = 0;
+  }
+}
+
+/**
+ * @brief count a failure and eject the endpoint if it failed too often in
+ * a row
+ */
+void
+RestClient::BalancedConnection::fail(Endpoint* endpoint, TimePoint now) {
+  endpoint->failures++;
+  endpoint->consecutiveFailures++;
+  if (this->ejectionFailures > 0 &&
+      endpoint->consecutiveFailures >= this->ejectionFailures) {
+    endpoint->ejectedUntil = now +
+      std::chrono::milliseconds(this->ejectionCooldown);
+    endpoint->ejections++;
+    // back on probation: the next failure ejects it again
+    endpoint->consecutiveFailures = this->ejectionFailures - 1;
+  }
+}
@@ -0,0 +1,62 @@
+/**
+ * @file cancellation.cc
+ * @brief implementation of cancellation tokens
+ * @author Daniel Schauenberg <d@unwiredcouch.com>
+ */
+
+#include "restclient-cpp/cancellation.h"
+
+#include <algorithm>
+
+RestClient::CancellationToken::CancellationToken() : cancelled(false) {
+}
+
+/**
+ * @brief cancel all requests using the token, safe to call from any thread
+ */
+void
+RestClient::CancellationToken::Cancel() {
+  this->cancelled.store(true, std::memory_order_release);
+#if LIBCURL_VERSION_NUM >= 0x074400
+  std::lock_guard<std::mutex> lock(this->waitersMutex);
+  for (std::vector<CURLM*>::const_iterator it = this->waiters.begin();
+       it != this->waiters.end(); ++it) {
+    curl_multi_wakeup(*it);
+  }
+#endif
+}
+
+bool
+RestClient::CancellationToken::IsCancelled() const {
+  return this->cancelled.load(std::memory_order_acquire);
+}
+
+/**
+ * @brief make the token usable for new requests again
+ */
+void
+RestClient::CancellationToken::Reset() {
+  this->cancelled.store(false, std::memory_order_release);
+}
+
+#if LIBCURL_VERSION_NUM >= 0x074400
+/**
+ * @brief register the multi handle of a transfer, so Cancel() wakes it up.
+ * The transfer checks IsCancelled() after attaching.
+ */
+void
+RestClient::CancellationToken::attach(CURLM* multi) {
+  std::lock_guard<std::mutex> lock(this->waitersMutex);
+  this->waiters.push_back(multi);
+}
+
+void
+RestClient::CancellationToken::detach(CURLM* multi) {
+  std::lock_guard<std::mutex> lock(this->waitersMutex);
+  std::vector<CURLM*>::iterator it =
+    std::find(this->waiters.begin(), this->waiters.end(), multi);
+  if (it != this->waiters.end()) {
+    this->waiters.erase(it);
+  }
+}
+#endif
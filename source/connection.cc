@@ -8,17 +8,711 @@
 
 #include <curl/curl.h>
 
+#if defined(_WIN32)
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
 #include <algorithm>
+#include <cctype>
+#include <chrono>  // NOLINT(build/c++11)
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
 #include <iostream>
+#include <limits>
 #include <map>
+#include <memory>
 #include <stdexcept>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include "restclient-cpp/restclient.h"
+#include "restclient-cpp/flightrecorder.h"
 #include "restclient-cpp/helpers.h"
+#include "restclient-cpp/interceptor.h"
+#include "restclient-cpp/metrics.h"
+#include "restclient-cpp/singleflight.h"
 #include "restclient-cpp/version.h"
+#include "probes.h"
+
+#if defined(RESTCLIENT_USDT)
+RESTCLIENT_DEFINE_PROBE_SEMAPHORE(request__start);
+RESTCLIENT_DEFINE_PROBE_SEMAPHORE(headers__received);
+RESTCLIENT_DEFINE_PROBE_SEMAPHORE(first__byte);
+RESTCLIENT_DEFINE_PROBE_SEMAPHORE(request__done);
+RESTCLIENT_DEFINE_PROBE_SEMAPHORE(transfer__bytes);
+#endif
+
+namespace {
+
+/**
+ * @brief state for the header callback: where headers go and which ones.
+ * nameBuffer and stored belong to the connection and keep their capacity
+ * between requests. stored is NULL if the response came without headers,
+ * then there is nothing stale to drop.
+ */
+template <typename R>
+struct HeaderData {
+  R* response;
+  RestClient::HeaderBlock* block;
+  RestClient::Connection::HeaderCapture capture;
+  // fill the block even with HeaderCapture::None
+  bool fillBlock;
+  const std::vector<std::string>* allowList;
+  std::string* nameBuffer;
+  std::vector<RestClient::HeaderFields::iterator>* stored;
+};
+
+/**
+ * @brief reset a response before a request. Headers stay, so that
+ * entries that come again reuse their map nodes and strings, see
+ * finishHeaders()
+ */
+void beginResponse(RestClient::Response* r) {
+  r->code = 0;
+  r->body.clear();
+  r->digest.clear();
+}
+
+void beginResponse(RestClient::BufferResponse* r) {
+  r->code = 0;
+  r->size = 0;
+  r->digest.clear();
+}
+
+void beginResponse(RestClient::StreamResponse* r) {
+  r->code = 0;
+  r->body.clear();
+  r->digest.clear();
+}
+
+void beginResponse(RestClient::ArenaResponse* r) {
+  // freeing arena memory does nothing, there is nothing to reuse
+  r->code = 0;
+  r->body.clear();
+  r->headers.clear();
+  r->digest.clear();
+}
+
+/**
+ * @brief copy a header field into the headers of a response
+ */
+template <typename R>
+void storeHeader(HeaderData<R>* d, const char* name, size_t nameLength,
+                 const char* value, size_t valueLength) {
+  RestClient::HeaderFields& headers = d->response->headers;
+  d->nameBuffer->assign(name, nameLength);
+  RestClient::HeaderFields::iterator it = headers.find(*d->nameBuffer);
+  if (it == headers.end()) {
+    it = headers.insert(std::make_pair(*d->nameBuffer, std::string())).first;
+  }
+  it->second.assign(value, valueLength);
+  if (d->stored) {
+    d->stored->push_back(it);
+  }
+}
+
+void storeHeader(HeaderData<RestClient::ArenaResponse>* d, const char* name,
+                 size_t nameLength, const char* value, size_t valueLength) {
+  RestClient::ArenaResponse* r = d->response;
+  // operator[] would need a default constructible allocator
+  RestClient::ArenaResponse::String key(name, nameLength,
+                                        r->body.get_allocator());
+  RestClient::ArenaResponse::Headers::iterator it = r->headers.find(key);
+  if (it == r->headers.end()) {
+    r->headers.insert(std::make_pair(
+        key, RestClient::ArenaResponse::String(value, valueLength,
+                                               r->body.get_allocator())));
+  } else {
+    it->second.assign(value, valueLength);
+  }
+}
+
+/**
+ * @brief store a header line with HeaderCapture::All. Responses with
+ * HeaderFields keep the behaviour of Helpers::header_callback, which also
+ * stores status lines (as "present"), arena responses only take the fields
+ * the header block parsed.
+ */
+template <typename R>
+void storeAllHeaders(HeaderData<R>* d, const char* line, size_t length,
+                     size_t fields) {
+  if (d->block->Size() > fields) {
+    size_t added = d->block->Size() - 1;
+    size_t nameLength, valueLength;
+    const char* name = d->block->NameData(added, &nameLength);
+    const char* value = d->block->ValueData(added, &valueLength);
+    storeHeader(d, name, nameLength, value, valueLength);
+    return;
+  }
+  if (std::memchr(line, ':', length)) {
+    return;
+  }
+  const char* end = line + length;
+  while (line < end && std::isspace(static_cast<unsigned char>(*line))) {
+    line++;
+  }
+  while (end > line && std::isspace(static_cast<unsigned char>(end[-1]))) {
+    end--;
+  }
+  if (line == end) {
+    // blank line, marks the end of the header block
+    return;
+  }
+  storeHeader(d, line, end - line, "present", 7);
+}
+
+void storeAllHeaders(HeaderData<RestClient::ArenaResponse>* d,
+                     const char* /* line */, size_t /* length */,
+                     size_t fields) {
+  if (d->block->Size() > fields) {
+    size_t added = d->block->Size() - 1;
+    size_t nameLength, valueLength;
+    const char* name = d->block->NameData(added, &nameLength);
+    const char* value = d->block->ValueData(added, &valueLength);
+    storeHeader(d, name, nameLength, value, valueLength);
+  }
+}
+
+bool storedBefore(RestClient::HeaderFields::iterator a,
+                  RestClient::HeaderFields::iterator b) {
+  return &*a < &*b;
+}
+
+/**
+ * @brief drop the headers a previous response left that this one didn't
+ * store again
+ */
+template <typename R>
+void finishHeaders(HeaderData<R>* d) {
+  if (!d->stored) {
+    return;
+  }
+  RestClient::HeaderFields& headers = d->response->headers;
+  std::vector<RestClient::HeaderFields::iterator>& stored = *d->stored;
+  std::sort(stored.begin(), stored.end(), storedBefore);
+  for (RestClient::HeaderFields::iterator it = headers.begin();
+      it != headers.end();) {
+    if (std::binary_search(stored.begin(), stored.end(), it,
+                           storedBefore)) {
+      ++it;
+    } else {
+      headers.erase(it++);
+    }
+  }
+  stored.clear();
+}
+
+void finishHeaders(HeaderData<RestClient::ArenaResponse>* /* d */) {
+}
+
+/**
+ * @brief set the body of a failed request
+ */
+void setErrorBody(RestClient::Response* r, const char* message) {
+  r->body = message;
+}
+
+void setErrorBody(RestClient::ArenaResponse* r, const char* message) {
+  r->body = message;
+}
+
+void setErrorBody(RestClient::StreamResponse* r, const char* message) {
+  r->body = message;
+}
+
+void setErrorBody(RestClient::BufferResponse* r, const char* message) {
+  size_t length = std::strlen(message);
+  r->size = length < r->capacity ? length : r->capacity;
+  std::memcpy(r->body, message, r->size);
+}
+
+/**
+ * @brief code for a request that failed with CURLE_WRITE_ERROR. The
+ * buffer write callback only fails when the body doesn't fit, the stream
+ * write callback when the consumer stopped.
+ */
+int writeErrorCode(const RestClient::Response* /* r */) {
+  return CURLE_WRITE_ERROR;
+}
+
+int writeErrorCode(const RestClient::ArenaResponse* /* r */) {
+  return CURLE_WRITE_ERROR;
+}
+
+int writeErrorCode(const RestClient::BufferResponse* /* r */) {
+  return RestClient::kBodyTooLarge;
+}
+
+int writeErrorCode(const RestClient::StreamResponse* /* r */) {
+  return RestClient::kStreamAborted;
+}
+
+/**
+ * @brief tell the consumer of a stream response that the body is
+ * complete. Other responses have nothing to finish.
+ *
+ * @return false if the consumer rejected the end of the body
+ */
+template <typename R>
+bool finishBody(R* /* r */) {
+  return true;
+}
+
+bool finishBody(RestClient::StreamResponse* r) {
+  if (r->code < 200 || r->code > 299 || !r->consumer) {
+    return true;
+  }
+  return r->consumer->Finish();
+}
+
+/**
+ * @brief note the status of a status line in the response while the
+ * transfer runs. The stream write callback needs it to tell a body from an
+ * error page.
+ */
+template <typename R>
+void noteStatusLine(R* /* r */, const char* /* line */,
+                    size_t /* length */) {
+}
+
+void noteStatusLine(RestClient::StreamResponse* r, const char* line,
+                    size_t length) {
+  if (length < 9 || std::strncmp(line, "HTTP/", 5) != 0) {
+    return;
+  }
+  const char* space = static_cast<const char*>(
+      std::memchr(line, ' ', length));
+  if (space) {
+    r->code = std::atoi(space + 1);
+  }
+}
+
+/**
+ * @brief write callback for arena responses
+ */
+size_t arenaWriteCallback(void *data, size_t size, size_t nmemb,
+                          void *userdata) {
+  RestClient::ArenaResponse* r =
+    reinterpret_cast<RestClient::ArenaResponse*>(userdata);
+  if (r->body.empty()) {
+    RESTCLIENT_PROBE2(first__byte, r, size*nmemb);
+  }
+  r->body.append(reinterpret_cast<char*>(data), size*nmemb);
+  return size * nmemb;
+}
+
+/**
+ * @brief write callback for buffer responses. Copies what fits and fails
+ * the transfer if the body is larger than the buffer.
+ */
+size_t bufferWriteCallback(void *data, size_t size, size_t nmemb,
+                           void *userdata) {
+  RestClient::BufferResponse* r =
+    reinterpret_cast<RestClient::BufferResponse*>(userdata);
+  const size_t length = size * nmemb;
+  if (r->size == 0) {
+    RESTCLIENT_PROBE2(first__byte, r, length);
+  }
+  size_t room = r->capacity - r->size;
+  size_t copied = length < room ? length : room;
+  std::memcpy(r->body + r->size, data, copied);
+  r->size += copied;
+  return copied < length ? 0 : length;
+}
+
+/**
+ * @brief write callback for stream responses. Bodies of 2xx responses go
+ * to the consumer, others are kept in the body.
+ */
+size_t streamWriteCallback(void *data, size_t size, size_t nmemb,
+                           void *userdata) {
+  RestClient::StreamResponse* r =
+    reinterpret_cast<RestClient::StreamResponse*>(userdata);
+  const size_t length = size * nmemb;
+  if (r->code < 200 || r->code > 299 || !r->consumer) {
+    r->body.append(reinterpret_cast<char*>(data), length);
+    return length;
+  }
+  return r->consumer->Consume(reinterpret_cast<char*>(data), length) ?
+         length : 0;
+}
+
+/**
+ * @brief write callback of a response with the data it is called with,
+ * and the digest to add what it took to
+ */
+typedef struct {
+  RestClient::WriteCallback callback;
+  void* data;
+  RestClient::Digest* digest;
+} DigestedWrite;
+
+size_t digestWriteCallback(void *data, size_t size, size_t nmemb,
+                           void *userdata) {
+  DigestedWrite* w = reinterpret_cast<DigestedWrite*>(userdata);
+  size_t taken = w->callback(data, size, nmemb, w->data);
+  w->digest->Update(data, taken);
+  return taken;
+}
+
+typedef struct {
+  RestClient::Helpers::UploadObject* upload;
+  RestClient::Digest* digest;
+} DigestedRead;
+
+size_t digestReadCallback(void *data, size_t size, size_t nmemb,
+                          void *userdata) {
+  DigestedRead* r = reinterpret_cast<DigestedRead*>(userdata);
+  size_t copied = RestClient::Helpers::read_callback(data, size, nmemb,
+                                                     r->upload);
+  r->digest->Update(data, copied);
+  return copied;
+}
+
+std::string toHex(const std::string& bytes) {
+  static const char digits[] = "0123456789abcdef";
+  std::string hex;
+  for (size_t i = 0; i < bytes.size(); i++) {
+    unsigned char c = static_cast<unsigned char>(bytes[i]);
+    hex.push_back(digits[c >> 4]);
+    hex.push_back(digits[c & 0xf]);
+  }
+  return hex;
+}
+
+/**
+ * @brief compare the digest of a body with the expected one and with the
+ * digest headers of the response, if headers isn't NULL
+ *
+ * @return the error for the response body, empty if nothing differs
+ */
+std::string digestMismatch(const RestClient::Digest& digest,
+                           const std::string& hex,
+                           const std::string& expected,
+                           const RestClient::HeaderBlock* headers) {
+  std::string want;
+  if (!expected.empty()) {
+    want = expected;
+    std::transform(want.begin(), want.end(), want.begin(), ::tolower);
+    if (want == hex) {
+      want.clear();
+    }
+  }
+  for (size_t i = 0; want.empty() && headers && i < headers->Size(); i++) {
+    std::string bytes = RestClient::DigestFromHeader(
+        digest.Algorithm(), headers->Name(i), headers->Value(i));
+    if (!bytes.empty() && bytes != digest.Bytes()) {
+      want = toHex(bytes) + " (" + headers->Name(i) + ")";
+    }
+  }
+  if (want.empty()) {
+    return want;
+  }
+  return "Digest mismatch: expected " + want + ", got " + hex;
+}
+
+/**
+ * @brief write callback for a response type. Responses use the one set
+ * with SetWriteFunction(), which expects a Response.
+ */
+RestClient::WriteCallback writeCallbackFor(
+    RestClient::Response* /* r */, RestClient::WriteCallback configured) {
+  return configured;
+}
+
+RestClient::WriteCallback writeCallbackFor(
+    RestClient::ArenaResponse* /* r */,
+    RestClient::WriteCallback /* configured */) {
+  return arenaWriteCallback;
+}
+
+RestClient::WriteCallback writeCallbackFor(
+    RestClient::BufferResponse* /* r */,
+    RestClient::WriteCallback /* configured */) {
+  return bufferWriteCallback;
+}
+
+RestClient::WriteCallback writeCallbackFor(
+    RestClient::StreamResponse* /* r */,
+    RestClient::WriteCallback /* configured */) {
+  return streamWriteCallback;
+}
+
+/**
+ * @brief the response as seen by interceptors. Other response types are
+ * copied into copy.
+ */
+const RestClient::Response& interceptedResponse(
+    const RestClient::Response& r, RestClient::Response* /* copy */) {
+  return r;
+}
+
+const RestClient::Response& interceptedResponse(
+    const RestClient::ArenaResponse& r, RestClient::Response* copy) {
+  copy->code = r.code;
+  copy->body.assign(r.body.data(), r.body.size());
+  copy->headers.clear();
+  for (RestClient::ArenaResponse::Headers::const_iterator it =
+      r.headers.begin(); it != r.headers.end(); ++it) {
+    copy->headers[std::string(it->first.data(), it->first.size())].assign(
+        it->second.data(), it->second.size());
+  }
+  copy->digest.assign(r.digest.data(), r.digest.size());
+  return *copy;
+}
+
+const RestClient::Response& interceptedResponse(
+    const RestClient::BufferResponse& r, RestClient::Response* copy) {
+  copy->code = r.code;
+  copy->body.assign(r.body, r.size);
+  copy->headers = r.headers;
+  copy->digest = r.digest;
+  return *copy;
+}
+
+const RestClient::Response& interceptedResponse(
+    const RestClient::StreamResponse& r, RestClient::Response* copy) {
+  copy->code = r.code;
+  copy->body = r.body;
+  copy->headers = r.headers;
+  copy->digest = r.digest;
+  return *copy;
+}
+
+template <typename R>
+size_t headerCallback(void *data, size_t size, size_t nmemb,
+                      void *userdata) {
+  HeaderData<R>* d = reinterpret_cast<HeaderData<R>*>(userdata);
+  const size_t length = size * nmemb;
+  const char* line = reinterpret_cast<const char*>(data);
+  noteStatusLine(d->response, line, length);
+  if (RESTCLIENT_PROBE_ENABLED(headers__received) && length <= 2 &&
+      (line[0] == '\r' || line[0] == '\n')) {
+    // blank line, marks the end of the header block
+    RESTCLIENT_PROBE2(headers__received, d->response,
+                      d->response->headers.size());
+  }
+  if (d->capture == RestClient::Connection::HeaderCapture::None) {
+    if (d->fillBlock) {
+      d->block->AddLine(line, length);
+    }
+    return length;
+  }
+  size_t fields = d->block->Size();
+  d->block->AddLine(line, length);
+  if (d->capture == RestClient::Connection::HeaderCapture::All) {
+    storeAllHeaders(d, line, length, fields);
+    return length;
+  }
+  if (d->block->Size() <= fields) {
+    return length;
+  }
+  // only allowed fields get copied out of the block
+  size_t added = d->block->Size() - 1;
+  for (std::vector<std::string>::const_iterator it =
+      d->allowList->begin(); it != d->allowList->end(); ++it) {
+    if (d->block->Find(*it, added) == added) {
+      size_t nameLength, valueLength;
+      const char* name = d->block->NameData(added, &nameLength);
+      const char* value = d->block->ValueData(added, &valueLength);
+      storeHeader(d, name, nameLength, value, valueLength);
+      break;
+    }
+  }
+  return length;
+}
+
+/**
+ * @brief state for the header callback used while interceptors are
+ * registered. It reports the first response byte to the interceptor chain
+ * and then hands the header over to the regular header callback.
+ */
+template <typename R>
+struct InterceptedHeaderData {
+  HeaderData<R>* headers;
+  RestClient::RequestContext* context;
+  const std::vector<RestClient::Interceptor*>* interceptors;
+  bool firstByteSeen;
+};
+
+template <typename R>
+size_t interceptedHeaderCallback(void *data, size_t size, size_t nmemb,
+                                 void *userdata) {
+  InterceptedHeaderData<R>* d = reinterpret_cast<InterceptedHeaderData<R>*>(
+      userdata);
+  if (!d->firstByteSeen) {
+    d->firstByteSeen = true;
+    for (std::vector<RestClient::Interceptor*>::const_iterator it =
+        d->interceptors->begin(); it != d->interceptors->end(); ++it) {
+      (*it)->OnFirstByte(d->context);
+    }
+  }
+  return headerCallback<R>(data, size, nmemb, d->headers);
+}
+
+/**
+ * @brief get host name and port of a URL. IP literals are rejected as
+ * there is nothing to resolve for them.
+ */
+bool parseHostPort(const std::string& url, std::string* host, int* port) {
+  CURLU* u = curl_url();
+  if (!u) {
+    return false;
+  }
+  char* h = NULL;
+  char* p = NULL;
+  bool ok = curl_url_set(u, CURLUPART_URL, url.c_str(), 0) == CURLUE_OK &&
+            curl_url_get(u, CURLUPART_HOST, &h, 0) == CURLUE_OK &&
+            curl_url_get(u, CURLUPART_PORT, &p, CURLU_DEFAULT_PORT) ==
+              CURLUE_OK;
+  if (ok) {
+    *host = h;
+    *port = std::atoi(p);
+    in_addr v4;
+    ok = !host->empty() && (*host)[0] != '[' &&
+         inet_pton(AF_INET, host->c_str(), &v4) != 1;
+  }
+  curl_free(h);
+  curl_free(p);
+  curl_url_cleanup(u);
+  return ok;
+}
+
+/**
+ * @brief resolve host into the address list format of CURLOPT_RESOLVE
+ *
+ * @return comma separated addresses, empty if resolving failed
+ */
+std::string resolveAddresses(const std::string& host, int port) {
+  addrinfo hints;
+  std::memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo* result = NULL;
+  if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints,
+                  &result) != 0) {
+    return "";
+  }
+  std::vector<std::string> seen;
+  std::string addresses;
+  for (addrinfo* ai = result; ai; ai = ai->ai_next) {
+    char buffer[INET6_ADDRSTRLEN];
+    std::string address;
+    if (ai->ai_family == AF_INET &&
+        inet_ntop(AF_INET,
+                  &reinterpret_cast<sockaddr_in*>(ai->ai_addr)->sin_addr,
+                  buffer, sizeof(buffer))) {
+      address = buffer;
+    } else if (ai->ai_family == AF_INET6 &&
+               inet_ntop(AF_INET6,
+                  &reinterpret_cast<sockaddr_in6*>(ai->ai_addr)->sin6_addr,
+                  buffer, sizeof(buffer))) {
+      address = std::string("[") + buffer + "]";
+    }
+    if (address.empty() ||
+        std::find(seen.begin(), seen.end(), address) != seen.end()) {
+      continue;
+    }
+    seen.push_back(address);
+    addresses += (addresses.empty() ? "" : ",") + address;
+  }
+  freeaddrinfo(result);
+  return addresses;
+}
+
+/**
+ * @brief socket the last transfer used, if it is still open.
+ * CURLINFO_ACTIVESOCKET, which replaces CURLINFO_LASTSOCKET, only works for
+ * connect-only transfers.
+ */
+curl_socket_t lastSocket(CURL* handle) {
+  long socket = -1;  // NOLINT(runtime/int)
+#if defined(__GNUC__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+#endif
+  curl_easy_getinfo(handle, CURLINFO_LASTSOCKET, &socket);
+#if defined(__GNUC__)
+#pragma GCC diagnostic pop
+#endif
+  return socket == -1 ? CURL_SOCKET_BAD : static_cast<curl_socket_t>(socket);
+}
+
+/**
+ * @brief whether an idle socket can be read from, which means the peer
+ * closed it (or sent something nobody asked for)
+ */
+bool peerClosed(curl_socket_t socket) {
+#if defined(_WIN32)
+  WSAPOLLFD pfd;
+  pfd.fd = socket;
+  pfd.events = POLLRDNORM;
+  pfd.revents = 0;
+  return WSAPoll(&pfd, 1, 0) > 0;
+#else
+  pollfd pfd;
+  pfd.fd = socket;
+  pfd.events = POLLIN;
+  pfd.revents = 0;
+  return poll(&pfd, 1, 0) > 0;
+#endif
+}
+
+/**
+ * @brief whether a Content-Type is text/event-stream, whatever its
+ * parameters
+ */
+bool isEventStream(const std::string& contentType) {
+  static const char kType[] = "text/event-stream";
+  const size_t length = sizeof(kType) - 1;
+  if (contentType.size() < length) {
+    return false;
+  }
+  for (size_t i = 0; i < length; i++) {
+    if (std::tolower(static_cast<unsigned char>(contentType[i])) !=
+        kType[i]) {
+      return false;
+    }
+  }
+  size_t rest = contentType.find_first_not_of(" \t", length);
+  return rest == std::string::npos || contentType[rest] == ';';
+}
+
+/**
+ * @brief puts a variable back to the value it had when the guard was
+ * made, however the scope is left
+ */
+template <typename T>
+class RestoreOnExit {
+ public:
+    explicit RestoreOnExit(T* variable)
+      : variable(variable), saved(*variable) {
+    }
+    ~RestoreOnExit() {
+      *this->variable = this->saved;
+    }
+    RestoreOnExit(const RestoreOnExit&) = delete;
+    RestoreOnExit& operator=(const RestoreOnExit&) = delete;
+
+    const T& Saved() const {
+      return this->saved;
+    }
+
+ private:
+    T* variable;
+    T saved;
+};
+
+}  // namespace
 
 /**
  * @brief constructor for the Connection object
@@ -34,13 +728,45 @@ RestClient::Connection::Connection(const std::string& baseUrl)
   }
   this->baseUrl = baseUrl;
   this->timeout = 0;
+  this->timeoutMilliseconds = 0;
+  this->connectTimeout = 0;
+  this->lowSpeedLimit = 0;
+  this->lowSpeedTime = 0;
   this->followRedirects = false;
   this->maxRedirects = -1l;
   this->noSignal = false;
   this->progressFn = NULL;
   this->progressFnData = NULL;
   this->writeCallback = RestClient::Helpers::write_callback;
+  this->singleFlight = NULL;
+  this->metrics = NULL;
+  this->flightRecorder = &RestClient::FlightRecorder::Default();
+  this->trafficRecorder = NULL;
+  this->cancellationToken = NULL;
+  this->multiHandle = NULL;
+  this->keepHeaderBlock = false;
+  this->digestAlgorithm = RestClient::DigestAlgorithm::None;
+  this->verifyDigestHeaders = false;
+  this->requestBodySize = 0;
+  this->infoCapture = InfoCapture::Eager;
+  this->headerCapture = HeaderCapture::All;
+  this->lastRequestInfo = ExtendedRequestInfo();
+  this->infoPending = false;
+  this->resetPending = false;
   this->verifyPeer = true;
+  this->httpVersion = CURL_HTTP_VERSION_NONE;
+  this->happyEyeballsTimeout = 0;
+  this->dnsPinTtl = 0;
+  this->tcpKeepAlive = false;
+  this->tcpKeepIdle = 60;
+  this->tcpKeepInterval = 60;
+  this->tcpNoDelay = true;
+  this->maxIdleTime = 0;
+  this->maxConnectionAge = 0;
+  this->maxRequestsPerConnection = 0;
+  this->transferActive = false;
+  this->recycled = 0;
+  this->recyclerRunning = false;
 }
 
 /**
@@ -62,7 +788,11 @@ void RestClient::Connection::Terminate() {
 }
 
 RestClient::Connection::~Connection() {
+  this->StopRecycler();
   this->Terminate();
+  if (this->multiHandle) {
+    curl_multi_cleanup(this->multiHandle);
+  }
 }
 
 // getters/setters
@@ -78,6 +808,8 @@ RestClient::Connection::GetInfo() {
   ret.baseUrl = this->baseUrl;
   ret.headers = this->GetHeaders();
   ret.timeout = this->timeout;
+  ret.timeoutMilliseconds = this->timeoutMilliseconds;
+  ret.connectTimeout = this->connectTimeout;
   ret.followRedirects = this->followRedirects;
   ret.maxRedirects = this->maxRedirects;
   ret.noSignal = this->noSignal;
@@ -86,7 +818,11 @@ RestClient::Connection::GetInfo() {
   ret.basicAuth.username = this->basicAuth.username;
   ret.basicAuth.password = this->basicAuth.password;
   ret.customUserAgent = this->customUserAgent;
+  if (this->infoCapture == InfoCapture::Lazy) {
+    this->captureRequestInfo();
+  }
   ret.lastRequest = this->lastRequest;
+  ret.infoCapture = this->infoCapture;
 
   ret.certPath = this->certPath;
   ret.certType = this->certType;
@@ -99,6 +835,58 @@ RestClient::Connection::GetInfo() {
   return ret;
 }
 
+/**
+ * @brief set when diagnostics information of a request is read from curl.
+ * With InfoCapture::Lazy the curl handle is only reset right before the
+ * next request, so the information can still be read on demand.
+ *
+ * @param mode InfoCapture::Eager (default), Lazy or Disabled
+ */
+void
+RestClient::Connection::SetInfoCapture(InfoCapture mode) {
+  this->infoCapture = mode;
+}
+
+/**
+ * @brief set which response headers are stored. Services that only look
+ * at a few headers save the allocations of copying all others into
+ * Response::headers.
+ *
+ * @param mode HeaderCapture::All (default), AllowList or None
+ * @param allowList header names stored with HeaderCapture::AllowList
+ */
+void
+RestClient::Connection::SetHeaderCapture(
+    HeaderCapture mode, const std::vector<std::string>& allowList) {
+  this->headerCapture = mode;
+  this->headerAllowList = allowList;
+}
+
+/**
+ * @brief get the header fields of the last response. Unlike
+ * Response::headers this keeps repeated fields and looks names up
+ * case-insensitively. For redirects only the last response is kept.
+ *
+ * @return header block, overwritten by the next request
+ */
+const RestClient::HeaderBlock&
+RestClient::Connection::GetResponseHeaders() const {
+  return this->responseHeaders;
+}
+
+/**
+ * @brief get extended diagnostic information about the last request
+ *
+ * @return RestClient::Connection::ExtendedRequestInfo struct
+ */
+RestClient::Connection::ExtendedRequestInfo
+RestClient::Connection::GetRequestInfo() {
+  if (this->infoCapture == InfoCapture::Lazy) {
+    return this->captureRequestInfo();
+  }
+  return this->lastRequestInfo;
+}
+
 /**
  * @brief append a header to the internal map
  *
@@ -197,6 +985,66 @@ RestClient::Connection::GetUserAgent() {
 void
 RestClient::Connection::SetTimeout(int seconds) {
   this->timeout = seconds;
+  // clamped, seconds * 1000 doesn't fit into an int above ~24 days
+  int64_t milliseconds = static_cast<int64_t>(seconds) * 1000;
+  milliseconds = std::min<int64_t>(milliseconds,
+                                   std::numeric_limits<int>::max());
+  milliseconds = std::max<int64_t>(milliseconds,
+                                   std::numeric_limits<int>::min());
+  this->timeoutMilliseconds = static_cast<int>(milliseconds);
+}
+
+/**
+ * @brief set timeout for connection with millisecond resolution
+ *
+ * @param milliseconds - timeout in milliseconds
+ *
+ */
+void
+RestClient::Connection::SetTimeoutMilliseconds(int milliseconds) {
+  this->timeout = static_cast<int>(
+      (static_cast<int64_t>(milliseconds) + 999) / 1000);
+  this->timeoutMilliseconds = milliseconds;
+}
+
+/**
+ * @brief set the timeout for the connect phase of a request: name
+ * resolution, TCP and TLS handshake. Reused connections skip it.
+ *
+ * @param milliseconds - connect timeout in milliseconds
+ *
+ */
+void
+RestClient::Connection::SetConnectTimeout(int milliseconds) {
+  this->connectTimeout = milliseconds;
+}
+
+/**
+ * @brief abort transfers that stall or crawl. libcurl checks the average
+ * speed once per second, so the window has second resolution.
+ *
+ * @param bytesPerSecond - minimum average speed, 0 disables the check
+ * @param seconds - how long the transfer may stay below it
+ *
+ */
+void
+RestClient::Connection::SetLowSpeedLimit(int bytesPerSecond, int seconds) {
+  this->lowSpeedLimit = bytesPerSecond;
+  this->lowSpeedTime = seconds;
+}
+
+/**
+ * @brief set a deadline for all following requests. The timeout of each
+ * request is capped at the time that is left, and requests that start
+ * after the deadline fail with CURLE_OPERATION_TIMEDOUT without being
+ * sent. The deadline of the current Deadline::Scope applies as well.
+ *
+ * @param deadline - absolute deadline, Deadline() for none
+ *
+ */
+void
+RestClient::Connection::SetDeadline(const RestClient::Deadline& deadline) {
+  this->deadline = deadline;
 }
 
 /**
@@ -304,9 +1152,226 @@ RestClient::Connection::SetVerifyPeer(bool verifyPeer) {
 }
 
 /**
- * @brief set HTTP proxy address and port
+ * @brief set the HTTP version to use, e.g. CURL_HTTP_VERSION_2_PRIOR_KNOWLEDGE
+ * for cleartext HTTP/2 without upgrade
  *
- * @param proxy address with port number
+ * @param httpVersion one of the CURL_HTTP_VERSION_* values
+ *
+ */
+void
+RestClient::Connection::SetHttpVersion(int httpVersion) {
+  this->httpVersion = httpVersion;
+}
+
+/**
+ * @brief set how long to wait for a connection attempt over IPv6 before
+ * trying IPv4 in parallel (CURLOPT_HAPPY_EYEBALLS_TIMEOUT_MS)
+ *
+ * @param milliseconds - head start of IPv6, 0 uses libcurl's default (200)
+ *
+ */
+void
+RestClient::Connection::SetHappyEyeballsTimeout(int milliseconds) {
+  this->happyEyeballsTimeout = milliseconds;
+}
+
+/**
+ * @brief resolve host names once and pin the addresses for ttlSeconds.
+ * While pinned, requests and reconnects don't wait for DNS. After the TTL
+ * the name is resolved again on the next request; if that fails the old
+ * addresses stay in use. Pins are not used with a proxy or Unix socket.
+ *
+ * @param ttlSeconds - how long resolved addresses are used, 0 disables
+ * pinning (the default)
+ *
+ */
+void
+RestClient::Connection::SetDnsPinning(int ttlSeconds) {
+  this->dnsPinTtl = ttlSeconds;
+}
+
+/**
+ * @brief always connect to the given addresses for host and port,
+ * regardless of DNS (CURLOPT_RESOLVE)
+ *
+ * @param host - host name as used in URLs
+ * @param port - port as used in URLs
+ * @param addresses - comma separated IP addresses, IPv6 ones in brackets
+ *
+ */
+void
+RestClient::Connection::PinHost(const std::string& host, int port,
+                                const std::string& addresses) {
+  DnsPin& pin = this->dnsPins[host + ":" + std::to_string(port)];
+  pin.addresses = addresses;
+  pin.resolvedAt = std::chrono::steady_clock::now();
+  pin.fixed = true;
+  pin.changed = true;
+}
+
+/**
+ * @brief resolve the host of the base URL, connect and complete the TLS
+ * handshake ahead of the first request. libcurl doesn't reuse connections
+ * of connect-only transfers, so this warms the DNS cache (or pins, see
+ * SetDnsPinning) and the TLS session cache, and the first request still
+ * opens a new connection with an abbreviated handshake. Use
+ * Preconnect(warmupUri) to leave a connection the first request reuses.
+ *
+ * @return true if the connection could be established
+ */
+bool
+RestClient::Connection::Preconnect() {
+  return this->connectOnly(this->baseUrl);
+}
+
+/**
+ * @brief warm up by sending a HEAD request to warmupUri. The connection is
+ * kept alive and reused by the next request, so that one pays neither DNS
+ * nor TCP nor TLS set up.
+ *
+ * @param warmupUri - URI relative to the base URL, should be cheap and
+ * free of side effects (e.g. a health check)
+ *
+ * @return true if a response was received
+ */
+bool
+RestClient::Connection::Preconnect(const std::string& warmupUri) {
+  RestClient::Response response;
+  this->prepareHandle();
+  curl_easy_setopt(getCurlHandle(), CURLOPT_NOBODY, 1L);
+  this->performCurlRequest(warmupUri, &response, "HEAD");
+  return this->lastRequest.curlCode == CURLE_OK;
+}
+
+/**
+ * @brief connect-only transfers to a list of hosts, see Preconnect(). For
+ * connections that send requests with absolute URLs to several hosts.
+ *
+ * @param urls - absolute URLs, only scheme, host and port matter
+ *
+ * @return number of hosts a connection could be established to
+ */
+size_t
+RestClient::Connection::Warmup(const std::vector<std::string>& urls) {
+  size_t connected = 0;
+  for (size_t i = 0; i < urls.size(); i++) {
+    if (this->connectOnly(urls[i])) {
+      connected++;
+    }
+  }
+  return connected;
+}
+
+/**
+ * @brief enable or disable TCP keepalive probes on new connections, which
+ * keep NAT and firewall state alive and detect dead peers
+ *
+ * @param enable - whether to send keepalive probes
+ * @param idleSeconds - time without traffic before the first probe
+ * @param intervalSeconds - time between probes
+ *
+ */
+void
+RestClient::Connection::SetTcpKeepAlive(bool enable, int idleSeconds,
+                                        int intervalSeconds) {
+  this->tcpKeepAlive = enable;
+  this->tcpKeepIdle = idleSeconds;
+  this->tcpKeepInterval = intervalSeconds;
+}
+
+/**
+ * @brief set whether Nagle's algorithm is disabled on new connections
+ * (CURLOPT_TCP_NODELAY)
+ *
+ * @param noDelay - true sends small segments right away (the default)
+ *
+ */
+void
+RestClient::Connection::SetTcpNoDelay(bool noDelay) {
+  this->tcpNoDelay = noDelay;
+}
+
+/**
+ * @brief set how long a connection may be idle and still be reused. Set it
+ * below the idle timeout of load balancers and servers on the way, so
+ * requests don't go out on connections they already dropped.
+ *
+ * @param seconds - maximum idle time, 0 keeps libcurl's default
+ *
+ */
+void
+RestClient::Connection::SetMaxIdleTime(int seconds) {
+  this->maxIdleTime = seconds;
+}
+
+/**
+ * @brief set how long a connection may be used after it was opened
+ *
+ * @param seconds - maximum age, 0 means no limit
+ *
+ */
+void
+RestClient::Connection::SetMaxConnectionAge(int seconds) {
+  this->maxConnectionAge = seconds;
+}
+
+/**
+ * @brief set how many requests a connection may serve before it is closed
+ *
+ * @param requests - maximum number of requests, 0 means no limit
+ *
+ */
+void
+RestClient::Connection::SetMaxRequestsPerConnection(int requests) {
+  this->maxRequestsPerConnection = requests;
+}
+
+/**
+ * @brief start a background thread that closes idle connections which are
+ * past the idle time, age or request limits, or were closed by the peer.
+ * Closing means shutting the socket down: libcurl sees that when it next
+ * looks at the connection and opens a new one instead of sending a request
+ * that would fail. Must not be called while a request is running.
+ *
+ * @param intervalMilliseconds - time between checks
+ *
+ */
+void
+RestClient::Connection::StartRecycler(int intervalMilliseconds) {
+  this->StopRecycler();
+  this->recyclerRunning = true;
+  this->recycler = std::thread(&RestClient::Connection::recycleLoop, this,
+                               intervalMilliseconds);
+}
+
+/**
+ * @brief stop the thread started with StartRecycler()
+ *
+ */
+void
+RestClient::Connection::StopRecycler() {
+  this->recyclerRunning = false;
+  if (this->recycler.joinable()) {
+    this->recycler.join();
+  }
+}
+
+/**
+ * @brief get the number of connections closed because of the connection
+ * lifecycle limits
+ *
+ * @return number of recycled connections
+ */
+uint64_t
+RestClient::Connection::GetRecycledConnections() {
+  std::lock_guard<std::mutex> lock(this->socketsMutex);
+  return this->recycled;
+}
+
+/**
+ * @brief set HTTP proxy address and port
+ *
+ * @param proxy address with port number
  *
  */
 void
@@ -349,6 +1414,220 @@ writeCallback) {
   this->writeCallback = writeCallback;
 }
 
+/**
+ * @brief set the group used to coalesce identical concurrent GET requests.
+ * The group is usually shared between the connection objects of several
+ * threads and has to outlive all of them. Only the caller that starts a
+ * coalesced request records its stats in lastRequest, metrics and traffic.
+ * The others find lastRequest, GetRequestInfo() and GetResponseHeaders()
+ * emptied, they only get the shared response.
+ * Connections with interceptors, a write function, a progress function, a
+ * cancellation token or a deadline never coalesce.
+ *
+ * @param group - SingleFlight object to use, NULL disables coalescing
+ *
+ */
+void
+RestClient::Connection::SetSingleFlight(RestClient::SingleFlight* group) {
+  this->singleFlight = group;
+}
+
+/**
+ * @brief set the registry to record request metrics in. The registry is
+ * usually shared between connection objects and has to outlive all of them.
+ *
+ * @param registry - Metrics::Registry to use, NULL disables metrics
+ *
+ */
+void
+RestClient::Connection::SetMetrics(RestClient::Metrics::Registry* registry) {
+  this->metrics = registry;
+}
+
+/**
+ * @brief set the flight recorder finished requests are recorded in. By
+ * default all connections record into FlightRecorder::Default().
+ *
+ * @param recorder - FlightRecorder to use, NULL disables recording
+ *
+ */
+void
+RestClient::Connection::SetFlightRecorder(
+    RestClient::FlightRecorder* recorder) {
+  this->flightRecorder = recorder;
+}
+
+/**
+ * @brief set the token that cancels the following requests. The token is
+ * owned by the caller and has to outlive the connection (or be unset).
+ * Cancelled requests return a Response with code kCancelled.
+ *
+ * @param token - CancellationToken to use, NULL disables cancellation
+ *
+ */
+void
+RestClient::Connection::SetCancellationToken(
+    RestClient::CancellationToken* token) {
+  this->cancellationToken = token;
+}
+
+/**
+ * @brief compute digests of response and request bodies while they are
+ * transferred, so checking them takes no second pass over the data. POST
+ * bodies go to libcurl in one piece and are digested before the request.
+ *
+ * @param algorithm - DigestAlgorithm to use, None disables digests
+ *
+ */
+void
+RestClient::Connection::SetDigest(RestClient::DigestAlgorithm algorithm) {
+  this->digestAlgorithm = algorithm;
+}
+
+/**
+ * @brief set the digest the bodies of 2xx responses must have, for the
+ * algorithm set with SetDigest()
+ *
+ * @param hex - expected digest in hex, empty disables the check
+ *
+ */
+void
+RestClient::Connection::SetExpectedDigest(const std::string& hex) {
+  this->expectedDigest = hex;
+}
+
+/**
+ * @brief check the bodies of 2xx responses against the digest headers the
+ * server sent along. Responses without one for the algorithm set with
+ * SetDigest() pass, as do HEAD requests and partial content, whose headers
+ * describe more than the body. The headers are checked with
+ * HeaderCapture::None as well.
+ *
+ * @param verify - true to check
+ *
+ */
+void
+RestClient::Connection::SetVerifyDigestHeaders(bool verify) {
+  this->verifyDigestHeaders = verify;
+}
+
+/**
+ * @brief set the recorder outgoing requests are captured with. The
+ * recorder is owned by the caller and has to outlive the connection (or be
+ * unset).
+ *
+ * @param recorder - TrafficRecorder to use, NULL disables capturing
+ *
+ */
+void
+RestClient::Connection::SetTrafficRecorder(
+    RestClient::TrafficRecorder* recorder) {
+  this->trafficRecorder = recorder;
+}
+
+/**
+ * @brief add an interceptor to the end of the chain. Interceptors are owned
+ * by the caller and have to outlive the connection (or be removed with
+ * ClearInterceptors).
+ *
+ * @param interceptor - Interceptor to add
+ *
+ */
+void
+RestClient::Connection::AddInterceptor(RestClient::Interceptor* interceptor) {
+  this->interceptors.push_back(interceptor);
+}
+
+/**
+ * @brief remove all interceptors from the connection
+ *
+ */
+void
+RestClient::Connection::ClearInterceptors() {
+  this->interceptors.clear();
+}
+
+/**
+ * @brief build the key identifying a request for coalescing. Everything that
+ * can change the response a server sends has to be part of the key.
+ *
+ * @param method HTTP method of the request
+ * @param uri URI to query
+ *
+ * @return key as std::string
+ */
+std::string
+RestClient::Connection::singleFlightKey(const std::string& method,
+                                        const std::string& uri) {
+  std::string key = method;
+  key += ' ';
+  key += this->baseUrl;
+  key += uri;
+  key += '\n';
+  for (HeaderFields::const_iterator it = this->headerFields.begin();
+      it != this->headerFields.end(); ++it) {
+    key += it->first;
+    key += ": ";
+    key += it->second;
+    key += '\n';
+  }
+  key += this->customUserAgent;
+  key += '\n';
+  key += this->basicAuth.username;
+  key += ':';
+  key += this->basicAuth.password;
+  key += '\n';
+  key += this->certPath;
+  key += '\n';
+  key += this->certType;
+  key += '\n';
+  key += this->keyPath;
+  key += ':';
+  key += this->keyPassword;
+  key += '\n';
+  key += this->caInfoFilePath;
+  key += '\n';
+  key += this->uriProxy;
+  key += '\n';
+  key += this->unixSocketPath;
+  key += '\n';
+  const int options[] = {
+    this->verifyPeer, this->followRedirects, this->maxRedirects,
+    this->httpVersion, this->timeout, this->timeoutMilliseconds,
+    this->connectTimeout, this->lowSpeedLimit, this->lowSpeedTime,
+    static_cast<int>(this->headerCapture),
+    static_cast<int>(this->digestAlgorithm), this->verifyDigestHeaders
+  };
+  for (size_t i = 0; i < sizeof(options) / sizeof(options[0]); i++) {
+    key += std::to_string(options[i]);
+    key += ' ';
+  }
+  for (size_t i = 0; i < this->headerAllowList.size(); i++) {
+    key += this->headerAllowList[i];
+    key += ' ';
+  }
+  key += this->expectedDigest;
+  return key;
+}
+
+/**
+ * @brief whether GET requests may be coalesced. A shared response never
+ * runs the interceptors, the write function or the progress function of a
+ * follower, so connections using them always do their own transfer. The
+ * same goes for a cancellation token or a deadline, a follower waiting for
+ * someone else's transfer could neither be cancelled nor time out.
+ *
+ * @return true if a SingleFlight group is set and nothing needs to see or
+ * stop the transfer
+ */
+bool
+RestClient::Connection::coalesces() const {
+  return this->singleFlight != NULL && this->interceptors.empty() &&
+         this->writeCallback == RestClient::Helpers::write_callback &&
+         this->progressFn == NULL && this->cancellationToken == NULL &&
+         !this->deadline.Min(RestClient::Deadline::Current()).IsSet();
+}
+
 /**
  * @brief helper function to get called from the actual request methods to
  * prepare the curlHandle for transfer with generic options, perform the
@@ -358,14 +1637,16 @@ writeCallback) {
  * parameters on the object for another request.
  *
  * @param uri URI to query
+ * @param method HTTP method of the request, used for diagnostics
  *
  * @return Reference to the Response struct that should be filled
  */
 RestClient::Response
-RestClient::Connection::performCurlRequest(const std::string& uri) {
+RestClient::Connection::performCurlRequest(const std::string& uri,
+                                           const char* method) {
   // init return type
   RestClient::Response ret = {};
-  performCurlRequest(uri, &ret);
+  performCurlRequest(uri, &ret, method);
   return ret;
 }
 
@@ -378,19 +1659,24 @@ RestClient::Connection::performCurlRequest(const std::string& uri) {
  * parameters on the object for another request.
  *
  * @param uri URI to query
- * @param ret Reference to the response struct that should be filled
+ * @param ret Reference to the response struct that should be filled,
+ * Response or ArenaResponse
+ * @param method HTTP method of the request, used for diagnostics
  *
  * @return reference to response struct for chaining
  */
-RestClient::Response*
+template <typename R>
+R*
 RestClient::Connection::performCurlRequest(const std::string& uri,
-                                           RestClient::Response* ret) {
+                                           R* ret,
+                                           const char* method) {
+  this->prepareHandle();
   // init return type
-  ret->body.clear();
-  ret->code = 0;
-  ret->headers.clear();
+  beginResponse(ret);
 
-  std::string url = std::string(this->baseUrl + uri);
+  // kept in a member so its capacity is reused
+  this->requestUrl.assign(this->baseUrl).append(uri);
+  const std::string& url = this->requestUrl;
   std::string headerString;
   CURLcode res = CURLE_OK;
   curl_slist* headerList = NULL;
@@ -399,22 +1685,78 @@ RestClient::Connection::performCurlRequest(const std::string& uri,
   curl_easy_setopt(getCurlHandle(), CURLOPT_URL, url.c_str());
   /** set callback function */
   curl_easy_setopt(getCurlHandle(), CURLOPT_WRITEFUNCTION,
-                   this->writeCallback);
+                   writeCallbackFor(ret, this->writeCallback));
   /** set data object to pass to callback function */
   curl_easy_setopt(getCurlHandle(), CURLOPT_WRITEDATA, ret);
-  /** set the header callback function */
-  curl_easy_setopt(getCurlHandle(), CURLOPT_HEADERFUNCTION,
-                   Helpers::header_callback);
-  /** callback object for headers */
-  curl_easy_setopt(getCurlHandle(), CURLOPT_HEADERDATA, ret);
+  DigestedWrite digestedWrite;
+  if (this->digestAlgorithm != RestClient::DigestAlgorithm::None) {
+    // the digest sees exactly what the write callback took
+    this->bodyDigest.Reset(this->digestAlgorithm);
+    digestedWrite.callback = writeCallbackFor(ret, this->writeCallback);
+    digestedWrite.data = ret;
+    digestedWrite.digest = &this->bodyDigest;
+    curl_easy_setopt(getCurlHandle(), CURLOPT_WRITEFUNCTION,
+                     digestWriteCallback);
+    curl_easy_setopt(getCurlHandle(), CURLOPT_WRITEDATA, &digestedWrite);
+  }
+  // let interceptors see the request and add headers before it is sent.
+  // Without interceptors none of this costs more than the empty check.
+  const bool intercepted = !this->interceptors.empty();
+  RestClient::RequestContext context;
+  HeaderData<R> headerData;
+  headerData.response = ret;
+  headerData.block = &this->responseHeaders;
+  headerData.capture = this->headerCapture;
+  // the digest headers are checked whatever headers are captured
+  headerData.fillBlock = this->keepHeaderBlock || this->verifyDigestHeaders;
+  headerData.allowList = &this->headerAllowList;
+  headerData.nameBuffer = &this->headerName;
+  headerData.stored = ret->headers.empty() ? NULL : &this->storedHeaders;
+  this->storedHeaders.clear();
+  this->responseHeaders.Clear();
+  InterceptedHeaderData<R> interceptedHeaderData;
+  if (intercepted) {
+    context.method = method;
+    context.url = url;
+    for (std::vector<RestClient::Interceptor*>::const_iterator it =
+        this->interceptors.begin(); it != this->interceptors.end(); ++it) {
+      (*it)->BeforeSend(&context);
+    }
+    interceptedHeaderData.headers = &headerData;
+    interceptedHeaderData.context = &context;
+    interceptedHeaderData.interceptors = &this->interceptors;
+    interceptedHeaderData.firstByteSeen = false;
+    curl_easy_setopt(getCurlHandle(), CURLOPT_HEADERFUNCTION,
+                     interceptedHeaderCallback<R>);
+    curl_easy_setopt(getCurlHandle(), CURLOPT_HEADERDATA,
+                     &interceptedHeaderData);
+  } else {
+    /** set the header callback function */
+    curl_easy_setopt(getCurlHandle(), CURLOPT_HEADERFUNCTION,
+                     headerCallback<R>);
+    /** callback object for headers */
+    curl_easy_setopt(getCurlHandle(), CURLOPT_HEADERDATA, &headerData);
+  }
   /** set http headers */
   for (HeaderFields::const_iterator it = this->headerFields.begin();
       it != this->headerFields.end(); ++it) {
+    if (intercepted && context.headers.count(it->first) > 0) {
+      continue;
+    }
     headerString = it->first;
     headerString += ": ";
     headerString += it->second;
     headerList = curl_slist_append(headerList, headerString.c_str());
   }
+  if (intercepted) {
+    for (HeaderFields::const_iterator it = context.headers.begin();
+        it != context.headers.end(); ++it) {
+      headerString = it->first;
+      headerString += ": ";
+      headerString += it->second;
+      headerList = curl_slist_append(headerList, headerString.c_str());
+    }
+  }
   curl_easy_setopt(getCurlHandle(), CURLOPT_HTTPHEADER,
       headerList);
 
@@ -425,20 +1767,16 @@ RestClient::Connection::performCurlRequest(const std::string& uri,
     curl_easy_setopt(getCurlHandle(), CURLOPT_HTTPAUTH, CURLAUTH_BASIC);
     curl_easy_setopt(getCurlHandle(), CURLOPT_USERPWD, authString.c_str());
   }
-  /** set error buffer */
-  curl_easy_setopt(getCurlHandle(), CURLOPT_ERRORBUFFER,
-                   this->curlErrorBuf);
 
-  /** set user agent */
+  /** set user agent, built in a member so its capacity is reused */
+  this->userAgent.clear();
+  if (this->customUserAgent.length() > 0) {
+    this->userAgent.append(this->customUserAgent).append(" ");
+  }
+  this->userAgent.append("restclient-cpp/").append(RESTCLIENT_VERSION);
   curl_easy_setopt(getCurlHandle(), CURLOPT_USERAGENT,
-                   this->GetUserAgent().c_str());
+                   this->userAgent.c_str());
 
-  // set timeout
-  if (this->timeout) {
-    curl_easy_setopt(getCurlHandle(), CURLOPT_TIMEOUT, this->timeout);
-    // dont want to get a sig alarm on timeout
-    curl_easy_setopt(getCurlHandle(), CURLOPT_NOSIGNAL, 1);
-  }
   // set follow redirect
   if (this->followRedirects == true) {
     curl_easy_setopt(getCurlHandle(), CURLOPT_FOLLOWLOCATION, 1L);
@@ -446,13 +1784,14 @@ RestClient::Connection::performCurlRequest(const std::string& uri,
                      static_cast<int64_t>(this->maxRedirects));
   }
 
-  if (this->noSignal) {
-    // multi-threaded and prevent entering foreign signal handler (e.g. JNI)
-    curl_easy_setopt(getCurlHandle(), CURLOPT_NOSIGNAL, 1);
-  }
-
-  // set file progress callback
-  if (this->progressFn) {
+  // set file progress callback. With a cancellation token the transfer
+  // progress callback checks the token and calls progressFn itself
+  if (this->cancellationToken) {
+    curl_easy_setopt(getCurlHandle(), CURLOPT_NOPROGRESS, 0L);
+    curl_easy_setopt(getCurlHandle(), CURLOPT_XFERINFOFUNCTION,
+                     &RestClient::Connection::transferProgress);
+    curl_easy_setopt(getCurlHandle(), CURLOPT_XFERINFODATA, this);
+  } else if (this->progressFn) {
     curl_easy_setopt(getCurlHandle(), CURLOPT_NOPROGRESS, 0);
     curl_easy_setopt(getCurlHandle(),
                      CURLOPT_PROGRESSFUNCTION,
@@ -468,38 +1807,392 @@ RestClient::Connection::performCurlRequest(const std::string& uri,
     }
   }
 
-  // if provided, supply CA path
-  if (!this->caInfoFilePath.empty()) {
-    curl_easy_setopt(getCurlHandle(), CURLOPT_CAINFO,
-                     this->caInfoFilePath.c_str());
+  curl_slist* resolveList = this->setConnectOptions(url);
+
+  if (this->trafficRecorder) {
+    if (intercepted) {
+      HeaderFields headers = this->headerFields;
+      for (HeaderFields::const_iterator it = context.headers.begin();
+          it != context.headers.end(); ++it) {
+        headers[it->first] = it->second;
+      }
+      this->trafficRecorder->Record(method, url, headers,
+                                    this->requestBodySize);
+    } else {
+      this->trafficRecorder->Record(method, url, this->headerFields,
+                                    this->requestBodySize);
+    }
   }
-
-  // set cert file path
-  if (!this->certPath.empty()) {
-    curl_easy_setopt(getCurlHandle(), CURLOPT_SSLCERT,
-                     this->certPath.c_str());
+  this->requestBodySize = 0;
+
+  RESTCLIENT_PROBE2(request__start, method, url.c_str());
+  if (this->cancellationToken && this->cancellationToken->IsCancelled()) {
+    res = CURLE_ABORTED_BY_CALLBACK;
+    std::snprintf(this->curlErrorBuf, sizeof(this->curlErrorBuf),
+                  "Cancelled before the request was sent");
+  } else if (this->deadline.Min(RestClient::Deadline::Current()).Expired()) {
+    // no point in sending a request nobody waits for anymore
+    res = CURLE_OPERATION_TIMEDOUT;
+    std::snprintf(this->curlErrorBuf, sizeof(this->curlErrorBuf),
+                  "Deadline exceeded before the request was sent");
+  } else {
+    res = this->performTransfer();
   }
-
-  // set cert type
-  if (!this->certType.empty()) {
-    curl_easy_setopt(getCurlHandle(), CURLOPT_SSLCERTTYPE,
-                     this->certType.c_str());
+  finishHeaders(&headerData);
+  this->lastRequest.curlCode = res;
+  if (res == CURLE_WRITE_ERROR && writeErrorCode(ret) != CURLE_WRITE_ERROR) {
+    // keep the part of the body that fit, the consumer knows why it stopped
+    ret->code = writeErrorCode(ret);
+  } else if (res != CURLE_OK) {
+    int retCode = res;
+    if (retCode > 99) {
+      retCode = -1;
+    }
+    ret->code = retCode;
+    setErrorBody(ret, curl_easy_strerror(res));
+    if (res == CURLE_ABORTED_BY_CALLBACK && this->cancellationToken &&
+        this->cancellationToken->IsCancelled()) {
+      ret->code = RestClient::kCancelled;
+      setErrorBody(ret, "Request cancelled");
+    }
+  } else {
+    int64_t http_code = 0;
+    curl_easy_getinfo(getCurlHandle(), CURLINFO_RESPONSE_CODE, &http_code);
+    ret->code = static_cast<int>(http_code);
+    if (!finishBody(ret)) {
+      ret->code = writeErrorCode(ret);
+    }
   }
-  // set key file path
-  if (!this->keyPath.empty()) {
-    curl_easy_setopt(getCurlHandle(), CURLOPT_SSLKEY,
-                     this->keyPath.c_str());
+  if (this->digestAlgorithm != RestClient::DigestAlgorithm::None) {
+    std::string hex = this->bodyDigest.Hex();
+    ret->digest.assign(hex.data(), hex.size());
+    if (res == CURLE_OK && ret->code >= 200 && ret->code <= 299) {
+      const bool headersApply = ret->code != 206 &&
+                                std::strcmp(method, "HEAD") != 0;
+      std::string mismatch = digestMismatch(
+          this->bodyDigest, hex, this->expectedDigest,
+          this->verifyDigestHeaders && headersApply ? &this->responseHeaders
+                                                    : NULL);
+      if (!mismatch.empty()) {
+        ret->code = RestClient::kDigestMismatch;
+        setErrorBody(ret, mismatch.c_str());
+      }
+    }
   }
-  // set key password
-  if (!this->keyPassword.empty()) {
-    curl_easy_setopt(getCurlHandle(), CURLOPT_KEYPASSWD,
-                     this->keyPassword.c_str());
+  this->lastRequest.uploadDigest = this->uploadDigest.Hex();
+  this->uploadDigest.Reset(RestClient::DigestAlgorithm::None);
+
+  RESTCLIENT_PROBE4(request__done, method, url.c_str(),
+                    res == CURLE_OK ? ret->code : 0, static_cast<int>(res));
+#if defined(RESTCLIENT_USDT)
+  if (RESTCLIENT_PROBE_ENABLED(transfer__bytes)) {
+    curl_off_t uploaded = 0, downloaded = 0;
+    curl_easy_getinfo(getCurlHandle(), CURLINFO_SIZE_UPLOAD_T, &uploaded);
+    curl_easy_getinfo(getCurlHandle(), CURLINFO_SIZE_DOWNLOAD_T, &downloaded);
+    RESTCLIENT_PROBE3(transfer__bytes, url.c_str(),
+                      static_cast<int64_t>(uploaded),
+                      static_cast<int64_t>(downloaded));
   }
+#endif
 
-  // set peer verification
-  if (!this->verifyPeer) {
-    curl_easy_setopt(getCurlHandle(), CURLOPT_SSL_VERIFYPEER,
-                     this->verifyPeer);
+  this->lastRequest.curlError.assign(this->curlErrorBuf);
+
+  // interceptors see lastRequest whatever the mode
+  const bool captured = this->infoCapture == InfoCapture::Eager ||
+                        intercepted;
+  this->infoPending = captured ||
+                      this->infoCapture == InfoCapture::Lazy;
+  if (captured) {
+    this->captureRequestInfo();
+  }
+  if (this->metrics || this->flightRecorder) {
+    TransferTimes times;
+    this->readTransferTimes(captured, &times);
+    int statusCode = res == CURLE_OK ? ret->code : 0;
+    if (this->metrics) {
+      this->recordMetrics(url, method, statusCode, times);
+    }
+    if (this->flightRecorder) {
+      this->recordFlight(url, method, statusCode, times);
+    }
+  }
+
+  if (intercepted) {
+    RestClient::Response copy;
+    const RestClient::Response& seen = interceptedResponse(*ret, &copy);
+    for (std::vector<RestClient::Interceptor*>::const_iterator it =
+        this->interceptors.begin(); it != this->interceptors.end(); ++it) {
+      if (res == CURLE_OK) {
+        (*it)->OnComplete(&context, seen, this->lastRequest);
+      } else {
+        (*it)->OnError(&context, seen, this->lastRequest);
+      }
+    }
+  }
+  // free header list
+  curl_slist_free_all(headerList);
+  curl_slist_free_all(resolveList);
+  // reset curl handle, in lazy mode only before the next request so the
+  // transfer information can still be read
+  if (this->infoCapture == InfoCapture::Lazy) {
+    this->resetPending = true;
+  } else {
+    curl_easy_reset(getCurlHandle());
+  }
+  return ret;
+}
+
+/**
+ * @brief reset the curl handle if the last request left it untouched for
+ * lazy info capture. Has to run before any option for the next request is
+ * set.
+ */
+void
+RestClient::Connection::prepareHandle() {
+  if (!this->resetPending) {
+    return;
+  }
+  if (this->infoCapture == InfoCapture::Lazy) {
+    this->captureRequestInfo();
+  }
+  this->resetPending = false;
+  curl_easy_reset(getCurlHandle());
+}
+
+/**
+ * @brief read the transfer information of the last request from the curl
+ * handle into lastRequestInfo and lastRequest, unless that already happened
+ *
+ * @return extended information about the last request
+ */
+const RestClient::Connection::ExtendedRequestInfo&
+RestClient::Connection::captureRequestInfo() {
+  if (!this->infoPending) {
+    return this->lastRequestInfo;
+  }
+  this->infoPending = false;
+
+  ExtendedRequestInfo& info = this->lastRequestInfo;
+  curl_off_t totalTime = 0, queueTime = 0, nameLookupTime = 0,
+             connectTime = 0, appConnectTime = 0, preTransferTime = 0,
+             startTransferTime = 0, redirectTime = 0, uploaded = 0,
+             downloaded = 0;
+  int64_t redirectCount = 0, numConnects = 0, requestSize = 0,
+          headerSize = 0, remotePort = 0, httpVersion = 0;
+  char* remoteIp = NULL;
+  curl_easy_getinfo(getCurlHandle(), CURLINFO_TOTAL_TIME_T, &totalTime);
+#if LIBCURL_VERSION_NUM >= 0x080600
+  curl_easy_getinfo(getCurlHandle(), CURLINFO_QUEUE_TIME_T, &queueTime);
+#endif
+  curl_easy_getinfo(getCurlHandle(), CURLINFO_NAMELOOKUP_TIME_T,
+                    &nameLookupTime);
+  curl_easy_getinfo(getCurlHandle(), CURLINFO_CONNECT_TIME_T, &connectTime);
+  curl_easy_getinfo(getCurlHandle(), CURLINFO_APPCONNECT_TIME_T,
+                    &appConnectTime);
+  curl_easy_getinfo(getCurlHandle(), CURLINFO_PRETRANSFER_TIME_T,
+                    &preTransferTime);
+  curl_easy_getinfo(getCurlHandle(), CURLINFO_STARTTRANSFER_TIME_T,
+                    &startTransferTime);
+  curl_easy_getinfo(getCurlHandle(), CURLINFO_REDIRECT_TIME_T,
+                    &redirectTime);
+  curl_easy_getinfo(getCurlHandle(), CURLINFO_REDIRECT_COUNT,
+                    &redirectCount);
+  curl_easy_getinfo(getCurlHandle(), CURLINFO_NUM_CONNECTS, &numConnects);
+  curl_easy_getinfo(getCurlHandle(), CURLINFO_SIZE_UPLOAD_T, &uploaded);
+  curl_easy_getinfo(getCurlHandle(), CURLINFO_SIZE_DOWNLOAD_T, &downloaded);
+  curl_easy_getinfo(getCurlHandle(), CURLINFO_REQUEST_SIZE, &requestSize);
+  curl_easy_getinfo(getCurlHandle(), CURLINFO_HEADER_SIZE, &headerSize);
+  curl_easy_getinfo(getCurlHandle(), CURLINFO_PRIMARY_IP, &remoteIp);
+  curl_easy_getinfo(getCurlHandle(), CURLINFO_PRIMARY_PORT, &remotePort);
+  curl_easy_getinfo(getCurlHandle(), CURLINFO_HTTP_VERSION, &httpVersion);
+
+  info.totalTime = totalTime;
+  info.queueTime = queueTime;
+  info.nameLookupTime = nameLookupTime;
+  info.connectTime = connectTime;
+  info.appConnectTime = appConnectTime;
+  info.preTransferTime = preTransferTime;
+  info.startTransferTime = startTransferTime;
+  info.redirectTime = redirectTime;
+  info.redirectCount = redirectCount;
+  info.newConnections = numConnects;
+  info.connectionReused = numConnects == 0 &&
+                          this->lastRequest.curlCode == CURLE_OK;
+  info.uploadedBytes = uploaded;
+  info.downloadedBytes = downloaded;
+  info.requestHeaderBytes = requestSize;
+  info.responseHeaderBytes = headerSize;
+  info.remoteIp = remoteIp ? remoteIp : "";
+  info.remotePort = static_cast<int>(remotePort);
+  info.httpVersion = static_cast<int>(httpVersion);
+  info.curlCode = this->lastRequest.curlCode;
+
+  this->lastRequest.totalTime = totalTime / 1e6;
+  this->lastRequest.nameLookupTime = nameLookupTime / 1e6;
+  this->lastRequest.connectTime = connectTime / 1e6;
+  this->lastRequest.appConnectTime = appConnectTime / 1e6;
+  this->lastRequest.preTransferTime = preTransferTime / 1e6;
+  this->lastRequest.startTransferTime = startTransferTime / 1e6;
+  this->lastRequest.redirectTime = redirectTime / 1e6;
+  this->lastRequest.redirectCount = static_cast<uint64_t>(redirectCount);
+  return info;
+}
+
+/**
+ * @brief get the timings and sizes metrics and the flight recorder need
+ * from the transfer that just finished, without touching lastRequestInfo
+ *
+ * @param captured whether lastRequestInfo was just read from the handle
+ * @param times to fill
+ */
+void
+RestClient::Connection::readTransferTimes(bool captured,
+                                          TransferTimes* times) {
+  if (captured) {
+    const ExtendedRequestInfo& info = this->lastRequestInfo;
+    times->totalTime = info.totalTime;
+    times->nameLookupTime = info.nameLookupTime;
+    times->connectTime = info.connectTime;
+    times->appConnectTime = info.appConnectTime;
+    times->startTransferTime = info.startTransferTime;
+    times->uploadedBytes = info.uploadedBytes;
+    times->downloadedBytes = info.downloadedBytes;
+    return;
+  }
+  curl_off_t totalTime = 0, nameLookupTime = 0, connectTime = 0,
+             appConnectTime = 0, startTransferTime = 0, uploaded = 0,
+             downloaded = 0;
+  curl_easy_getinfo(getCurlHandle(), CURLINFO_TOTAL_TIME_T, &totalTime);
+  curl_easy_getinfo(getCurlHandle(), CURLINFO_NAMELOOKUP_TIME_T,
+                    &nameLookupTime);
+  curl_easy_getinfo(getCurlHandle(), CURLINFO_CONNECT_TIME_T, &connectTime);
+  curl_easy_getinfo(getCurlHandle(), CURLINFO_APPCONNECT_TIME_T,
+                    &appConnectTime);
+  curl_easy_getinfo(getCurlHandle(), CURLINFO_STARTTRANSFER_TIME_T,
+                    &startTransferTime);
+  curl_easy_getinfo(getCurlHandle(), CURLINFO_SIZE_UPLOAD_T, &uploaded);
+  curl_easy_getinfo(getCurlHandle(), CURLINFO_SIZE_DOWNLOAD_T, &downloaded);
+  times->totalTime = totalTime;
+  times->nameLookupTime = nameLookupTime;
+  times->connectTime = connectTime;
+  times->appConnectTime = appConnectTime;
+  times->startTransferTime = startTransferTime;
+  times->uploadedBytes = uploaded;
+  times->downloadedBytes = downloaded;
+}
+
+/**
+ * @brief record the measurements of the transfer that just finished in the
+ * metrics registry
+ *
+ * @param url full URL of the request
+ * @param method HTTP method of the request
+ * @param statusCode HTTP status code, 0 if the transfer failed
+ * @param times timings and sizes of the transfer
+ */
+void
+RestClient::Connection::recordMetrics(const std::string& url,
+                                      const char* method, int statusCode,
+                                      const TransferTimes& times) {
+  RestClient::Metrics::Sample sample;
+  sample.totalTime = times.totalTime;
+  sample.nameLookupTime = times.nameLookupTime;
+  sample.connectTime = times.connectTime;
+  sample.appConnectTime = times.appConnectTime;
+  sample.startTransferTime = times.startTransferTime;
+  sample.requestBytes = times.uploadedBytes > 0
+                        ? static_cast<uint64_t>(times.uploadedBytes) : 0;
+  sample.responseBytes = times.downloadedBytes > 0
+                         ? static_cast<uint64_t>(times.downloadedBytes) : 0;
+  sample.statusCode = statusCode;
+  sample.curlCode = this->lastRequest.curlCode;
+  this->metrics->Record(RestClient::Metrics::HostFromUrl(url), method,
+                        sample);
+}
+
+/**
+ * @brief set the options that decide how the connection for a transfer is
+ * set up. Shared between requests and connect-only transfers.
+ *
+ * @param url full URL of the transfer
+ *
+ * @return list passed as CURLOPT_RESOLVE, to be freed after the transfer
+ */
+curl_slist*
+RestClient::Connection::setConnectOptions(const std::string& url) {
+  /** set error buffer */
+  curl_easy_setopt(getCurlHandle(), CURLOPT_ERRORBUFFER,
+                   this->curlErrorBuf);
+
+  // set timeout, capped at what is left until the deadline
+  int64_t timeoutMs = this->timeoutMilliseconds;
+  RestClient::Deadline deadline =
+    this->deadline.Min(RestClient::Deadline::Current());
+  if (deadline.IsSet()) {
+    int64_t remaining = deadline.RemainingMilliseconds();
+    if (timeoutMs == 0 || remaining < timeoutMs) {
+      // 0 would mean no timeout
+      timeoutMs = remaining > 0 ? remaining : 1;
+    }
+  }
+  if (timeoutMs) {
+    curl_easy_setopt(getCurlHandle(), CURLOPT_TIMEOUT_MS, timeoutMs);
+    // dont want to get a sig alarm on timeout
+    curl_easy_setopt(getCurlHandle(), CURLOPT_NOSIGNAL, 1);
+  }
+  if (this->connectTimeout) {
+    curl_easy_setopt(getCurlHandle(), CURLOPT_CONNECTTIMEOUT_MS,
+                     static_cast<int64_t>(this->connectTimeout));
+  }
+  if (this->lowSpeedLimit) {
+    curl_easy_setopt(getCurlHandle(), CURLOPT_LOW_SPEED_LIMIT,
+                     static_cast<int64_t>(this->lowSpeedLimit));
+    curl_easy_setopt(getCurlHandle(), CURLOPT_LOW_SPEED_TIME,
+                     static_cast<int64_t>(this->lowSpeedTime));
+  }
+  if (this->noSignal) {
+    // multi-threaded and prevent entering foreign signal handler (e.g. JNI)
+    curl_easy_setopt(getCurlHandle(), CURLOPT_NOSIGNAL, 1);
+  }
+
+  // if provided, supply CA path
+  if (!this->caInfoFilePath.empty()) {
+    curl_easy_setopt(getCurlHandle(), CURLOPT_CAINFO,
+                     this->caInfoFilePath.c_str());
+  }
+
+  // set cert file path
+  if (!this->certPath.empty()) {
+    curl_easy_setopt(getCurlHandle(), CURLOPT_SSLCERT,
+                     this->certPath.c_str());
+  }
+
+  // set cert type
+  if (!this->certType.empty()) {
+    curl_easy_setopt(getCurlHandle(), CURLOPT_SSLCERTTYPE,
+                     this->certType.c_str());
+  }
+  // set key file path
+  if (!this->keyPath.empty()) {
+    curl_easy_setopt(getCurlHandle(), CURLOPT_SSLKEY,
+                     this->keyPath.c_str());
+  }
+  // set key password
+  if (!this->keyPassword.empty()) {
+    curl_easy_setopt(getCurlHandle(), CURLOPT_KEYPASSWD,
+                     this->keyPassword.c_str());
+  }
+
+  // set peer verification
+  if (!this->verifyPeer) {
+    curl_easy_setopt(getCurlHandle(), CURLOPT_SSL_VERIFYPEER,
+                     this->verifyPeer);
+  }
+
+  // set HTTP version
+  if (this->httpVersion != CURL_HTTP_VERSION_NONE) {
+    curl_easy_setopt(getCurlHandle(), CURLOPT_HTTP_VERSION,
+                     static_cast<int64_t>(this->httpVersion));
   }
 
   // set web proxy address
@@ -516,44 +2209,482 @@ RestClient::Connection::performCurlRequest(const std::string& uri,
                      this->unixSocketPath.c_str());
   }
 
-  res = curl_easy_perform(getCurlHandle());
-  this->lastRequest.curlCode = res;
-  if (res != CURLE_OK) {
-    int retCode = res;
-    if (retCode > 99) {
-      retCode = -1;
+
+  if (this->tcpKeepAlive) {
+    curl_easy_setopt(getCurlHandle(), CURLOPT_TCP_KEEPALIVE, 1L);
+    curl_easy_setopt(getCurlHandle(), CURLOPT_TCP_KEEPIDLE,
+                     static_cast<int64_t>(this->tcpKeepIdle));
+    curl_easy_setopt(getCurlHandle(), CURLOPT_TCP_KEEPINTVL,
+                     static_cast<int64_t>(this->tcpKeepInterval));
+  }
+  if (!this->tcpNoDelay) {
+    curl_easy_setopt(getCurlHandle(), CURLOPT_TCP_NODELAY, 0L);
+  }
+  if (this->maxIdleTime > 0) {
+    curl_easy_setopt(getCurlHandle(), CURLOPT_MAXAGE_CONN,
+                     static_cast<int64_t>(this->maxIdleTime));
+  }
+#if LIBCURL_VERSION_NUM >= 0x075000
+  if (this->maxConnectionAge > 0) {
+    curl_easy_setopt(getCurlHandle(), CURLOPT_MAXLIFETIME_CONN,
+                     static_cast<int64_t>(this->maxConnectionAge));
+  }
+#endif
+  if (this->tracksSockets()) {
+    curl_easy_setopt(getCurlHandle(), CURLOPT_SOCKOPTFUNCTION,
+                     &RestClient::Connection::openedSocket);
+    curl_easy_setopt(getCurlHandle(), CURLOPT_SOCKOPTDATA, this);
+    curl_easy_setopt(getCurlHandle(), CURLOPT_CLOSESOCKETFUNCTION,
+                     &RestClient::Connection::closeSocket);
+    curl_easy_setopt(getCurlHandle(), CURLOPT_CLOSESOCKETDATA, this);
+  }
+
+  if (this->happyEyeballsTimeout > 0) {
+    curl_easy_setopt(getCurlHandle(), CURLOPT_HAPPY_EYEBALLS_TIMEOUT_MS,
+                     static_cast<int64_t>(this->happyEyeballsTimeout));
+  }
+
+  return this->resolveDnsPins(url);
+}
+
+/**
+ * @brief refresh the pinned addresses of the host of url if pinning is on
+ * and they are missing or expired, and hand pins that changed to curl.
+ * Pins end up in curl's DNS cache without an expiry, so they only have to
+ * be passed again when they change.
+ *
+ * @param url full URL of the transfer
+ *
+ * @return list passed as CURLOPT_RESOLVE, NULL if nothing changed
+ */
+curl_slist*
+RestClient::Connection::resolveDnsPins(const std::string& url) {
+  if (this->dnsPinTtl > 0 && this->uriProxy.empty() &&
+      this->unixSocketPath.empty()) {
+    std::string host;
+    int port = 0;
+    if (parseHostPort(url, &host, &port)) {
+      std::string key = host + ":" + std::to_string(port);
+      std::map<std::string, DnsPin>::iterator pin = this->dnsPins.find(key);
+      std::chrono::steady_clock::time_point now =
+        std::chrono::steady_clock::now();
+      if (pin == this->dnsPins.end() ||
+          (!pin->second.fixed && now - pin->second.resolvedAt >=
+           std::chrono::seconds(this->dnsPinTtl))) {
+        std::string addresses = resolveAddresses(host, port);
+        if (!addresses.empty()) {
+          DnsPin& p = this->dnsPins[key];
+          p.changed = p.changed || p.addresses != addresses;
+          p.addresses = addresses;
+          p.resolvedAt = now;
+          p.fixed = false;
+        } else if (pin != this->dnsPins.end()) {
+          // keep serving the old addresses and retry after the next TTL
+          pin->second.resolvedAt = now;
+        }
+      }
     }
-    ret->code = retCode;
-    ret->body = curl_easy_strerror(res);
-  } else {
-    int64_t http_code = 0;
-    curl_easy_getinfo(getCurlHandle(), CURLINFO_RESPONSE_CODE, &http_code);
-    ret->code = static_cast<int>(http_code);
   }
 
-  this->lastRequest.curlError = std::string(this->curlErrorBuf);
-
-  curl_easy_getinfo(getCurlHandle(), CURLINFO_TOTAL_TIME,
-                    &this->lastRequest.totalTime);
-  curl_easy_getinfo(getCurlHandle(), CURLINFO_NAMELOOKUP_TIME,
-                    &this->lastRequest.nameLookupTime);
-  curl_easy_getinfo(getCurlHandle(), CURLINFO_CONNECT_TIME,
-                    &this->lastRequest.connectTime);
-  curl_easy_getinfo(getCurlHandle(), CURLINFO_APPCONNECT_TIME,
-                    &this->lastRequest.appConnectTime);
-  curl_easy_getinfo(getCurlHandle(), CURLINFO_PRETRANSFER_TIME,
-                    &this->lastRequest.preTransferTime);
-  curl_easy_getinfo(getCurlHandle(), CURLINFO_STARTTRANSFER_TIME,
-                    &this->lastRequest.startTransferTime);
-  curl_easy_getinfo(getCurlHandle(), CURLINFO_REDIRECT_TIME,
-                    &this->lastRequest.redirectTime);
-  curl_easy_getinfo(getCurlHandle(), CURLINFO_REDIRECT_COUNT,
-                    &this->lastRequest.redirectCount);
-  // free header list
-  curl_slist_free_all(headerList);
-  // reset curl handle
+  curl_slist* resolveList = NULL;
+  for (std::map<std::string, DnsPin>::iterator it = this->dnsPins.begin();
+       it != this->dnsPins.end(); ++it) {
+    if (it->second.changed) {
+      resolveList = curl_slist_append(resolveList,
+          (it->first + ":" + it->second.addresses).c_str());
+      it->second.changed = false;
+    }
+  }
+  if (resolveList) {
+    curl_easy_setopt(getCurlHandle(), CURLOPT_RESOLVE, resolveList);
+  }
+  return resolveList;
+}
+
+/**
+ * @brief CURLOPT_XFERINFOFUNCTION used with a cancellation token. Aborts
+ * the transfer once the token is cancelled and passes the progress on to
+ * the file progress callback, if there is one.
+ */
+int
+RestClient::Connection::transferProgress(void* clientp, curl_off_t dltotal,
+                                         curl_off_t dlnow,
+                                         curl_off_t ultotal,
+                                         curl_off_t ulnow) {
+  RestClient::Connection* conn =
+    reinterpret_cast<RestClient::Connection*>(clientp);
+  if (conn->cancellationToken->IsCancelled()) {
+    return 1;
+  }
+  if (conn->progressFn) {
+    return conn->progressFn(
+        conn->progressFnData ? conn->progressFnData : conn,
+        static_cast<double>(dltotal), static_cast<double>(dlnow),
+        static_cast<double>(ultotal), static_cast<double>(ulnow));
+  }
+  return 0;
+}
+
+/**
+ * @brief whether sockets have to be tracked for the lifecycle limits
+ */
+bool
+RestClient::Connection::tracksSockets() const {
+  return this->maxIdleTime > 0 || this->maxConnectionAge > 0 ||
+         this->maxRequestsPerConnection > 0 || this->recyclerRunning;
+}
+
+/**
+ * @brief perform the prepared transfer. With a cancellation token it runs
+ * on multiHandle, where Cancel() interrupts the wait for the socket instead
+ * of the next progress callback noticing it.
+ *
+ * @return the result of the transfer
+ */
+CURLcode
+RestClient::Connection::performTransfer() {
+  this->beginTransfer();
+#if LIBCURL_VERSION_NUM >= 0x074400
+  if (this->cancellationToken && !this->multiHandle) {
+    this->multiHandle = curl_multi_init();
+  }
+  if (this->cancellationToken && this->multiHandle &&
+      curl_multi_add_handle(this->multiHandle, getCurlHandle()) == CURLM_OK) {
+    this->cancellationToken->attach(this->multiHandle);
+    CURLcode res = CURLE_OK;
+    int running = 1;
+    while (running) {
+      if (this->cancellationToken->IsCancelled()) {
+        res = CURLE_ABORTED_BY_CALLBACK;
+        std::snprintf(this->curlErrorBuf, sizeof(this->curlErrorBuf),
+                      "Cancelled during the transfer");
+        break;
+      }
+      CURLMcode mc = curl_multi_perform(this->multiHandle, &running);
+      if (mc == CURLM_OK && running) {
+        mc = curl_multi_poll(this->multiHandle, NULL, 0, 1000, NULL);
+      }
+      if (mc != CURLM_OK) {
+        res = CURLE_FAILED_INIT;
+        std::snprintf(this->curlErrorBuf, sizeof(this->curlErrorBuf),
+                      "%s", curl_multi_strerror(mc));
+        break;
+      }
+    }
+    int queued = 0;
+    CURLMsg* msg;
+    while ((msg = curl_multi_info_read(this->multiHandle, &queued))) {
+      if (msg->msg == CURLMSG_DONE && res == CURLE_OK) {
+        res = msg->data.result;
+      }
+    }
+    this->cancellationToken->detach(this->multiHandle);
+    // the socket of the transfer is only known before the handle leaves
+    this->endTransfer();
+    curl_multi_remove_handle(this->multiHandle, getCurlHandle());
+    return res;
+  }
+#endif
+  CURLcode res = curl_easy_perform(getCurlHandle());
+  this->endTransfer();
+  return res;
+}
+
+/**
+ * @brief called right before a transfer. Retires expired connections, so
+ * libcurl doesn't pick them, and keeps the recycler away from the sockets
+ * while the transfer runs.
+ */
+void
+RestClient::Connection::beginTransfer() {
+  if (!this->tracksSockets()) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(this->socketsMutex);
+  this->transferActive = true;
+  this->retireExpired(false);
+}
+
+/**
+ * @brief called right after a transfer, counts the request against the
+ * connection it used
+ */
+void
+RestClient::Connection::endTransfer() {
+  if (!this->tracksSockets()) {
+    return;
+  }
+  curl_socket_t socket = lastSocket(getCurlHandle());
+  std::lock_guard<std::mutex> lock(this->socketsMutex);
+  this->transferActive = false;
+  std::map<curl_socket_t, SocketState>::iterator it =
+    this->sockets.find(socket);
+  if (it == this->sockets.end()) {
+    return;
+  }
+  it->second.lastUsed = std::chrono::steady_clock::now();
+  it->second.requests++;
+  if (this->maxRequestsPerConnection > 0 &&
+      it->second.requests >= this->maxRequestsPerConnection) {
+    this->retire(it->first, &it->second);
+  }
+}
+
+/**
+ * @brief retire connections past the idle time or age limit, and with
+ * checkPeer the ones the peer closed. Called with socketsMutex held.
+ */
+void
+RestClient::Connection::retireExpired(bool checkPeer) {
+  std::chrono::steady_clock::time_point now =
+    std::chrono::steady_clock::now();
+  for (std::map<curl_socket_t, SocketState>::iterator it =
+       this->sockets.begin(); it != this->sockets.end(); ++it) {
+    SocketState& state = it->second;
+    if (state.retired) {
+      continue;
+    }
+    if ((this->maxIdleTime > 0 && now - state.lastUsed >=
+         std::chrono::seconds(this->maxIdleTime)) ||
+        (this->maxConnectionAge > 0 && now - state.opened >=
+         std::chrono::seconds(this->maxConnectionAge)) ||
+        (checkPeer && peerClosed(it->first))) {
+      this->retire(it->first, &state);
+    }
+  }
+}
+
+/**
+ * @brief shut a connection's socket down. libcurl's liveness check finds
+ * it dead before the next reuse and closes it. Called with socketsMutex
+ * held.
+ */
+void
+RestClient::Connection::retire(curl_socket_t socket, SocketState* state) {
+#if defined(_WIN32)
+  shutdown(socket, SD_BOTH);
+#else
+  shutdown(socket, SHUT_RDWR);
+#endif
+  state->retired = true;
+  this->recycled++;
+}
+
+/**
+ * @brief body of the recycler thread
+ */
+void
+RestClient::Connection::recycleLoop(int intervalMilliseconds) {
+  std::chrono::steady_clock::time_point next =
+    std::chrono::steady_clock::now();
+  while (this->recyclerRunning) {
+    next += std::chrono::milliseconds(intervalMilliseconds);
+    // sleep in slices so StopRecycler() returns quickly
+    while (this->recyclerRunning &&
+           std::chrono::steady_clock::now() < next) {
+      std::this_thread::sleep_for(std::min<std::chrono::nanoseconds>(
+          next - std::chrono::steady_clock::now(),
+          std::chrono::milliseconds(10)));
+    }
+    std::lock_guard<std::mutex> lock(this->socketsMutex);
+    if (this->recyclerRunning && !this->transferActive) {
+      this->retireExpired(true);
+    }
+  }
+}
+
+/**
+ * @brief CURLOPT_SOCKOPTFUNCTION, registers a new connection
+ */
+int
+RestClient::Connection::openedSocket(void* clientp, curl_socket_t socket,
+                                     curlsocktype purpose) {
+  RestClient::Connection* conn =
+    reinterpret_cast<RestClient::Connection*>(clientp);
+  if (purpose == CURLSOCKTYPE_IPCXN) {
+    std::lock_guard<std::mutex> lock(conn->socketsMutex);
+    SocketState& state = conn->sockets[socket];
+    state.opened = std::chrono::steady_clock::now();
+    state.lastUsed = state.opened;
+    state.requests = 0;
+    state.retired = false;
+  }
+  return CURL_SOCKOPT_OK;
+}
+
+/**
+ * @brief CURLOPT_CLOSESOCKETFUNCTION, forgets a connection and closes its
+ * socket. libcurl keeps this for the lifetime of the connection, so it is
+ * also called from later transfers and from curl_easy_cleanup().
+ */
+int
+RestClient::Connection::closeSocket(void* clientp, curl_socket_t socket) {
+  RestClient::Connection* conn =
+    reinterpret_cast<RestClient::Connection*>(clientp);
+  {
+    std::lock_guard<std::mutex> lock(conn->socketsMutex);
+    conn->sockets.erase(socket);
+  }
+#if defined(_WIN32)
+  return closesocket(socket);
+#else
+  return close(socket);
+#endif
+}
+
+/**
+ * @brief run a connect-only transfer: resolve the host, connect and
+ * complete the TLS handshake, then stop.
+ *
+ * @param url full URL to connect to
+ *
+ * @return true if the connection was established
+ */
+bool
+RestClient::Connection::connectOnly(const std::string& url) {
+  this->prepareHandle();
+  curl_easy_setopt(getCurlHandle(), CURLOPT_URL, url.c_str());
+  curl_easy_setopt(getCurlHandle(), CURLOPT_CONNECT_ONLY, 1L);
+  curl_slist* resolveList = this->setConnectOptions(url);
+  this->beginTransfer();
+  CURLcode res = curl_easy_perform(getCurlHandle());
+  this->endTransfer();
+  curl_slist_free_all(resolveList);
   curl_easy_reset(getCurlHandle());
-  return ret;
+  return res == CURLE_OK;
+}
+
+/**
+ * @brief connect like connectOnly(), but keep the connection for the
+ * caller to talk over with curl_easy_send() and curl_easy_recv(). It is
+ * tunnelled through a proxy and negotiates HTTP/1.1 on TLS, so the caller
+ * can speak HTTP/1.1 on it.
+ *
+ * @param url full URL to connect to
+ *
+ * @return CURLE_OK if the connection was established
+ */
+CURLcode
+RestClient::Connection::openConnection(const std::string& url) {
+  this->prepareHandle();
+  curl_easy_setopt(getCurlHandle(), CURLOPT_URL, url.c_str());
+  curl_slist* resolveList = this->setConnectOptions(url);
+  curl_easy_setopt(getCurlHandle(), CURLOPT_CONNECT_ONLY, 1L);
+  curl_easy_setopt(getCurlHandle(), CURLOPT_HTTPPROXYTUNNEL, 1L);
+  curl_easy_setopt(getCurlHandle(), CURLOPT_HTTP_VERSION,
+                   CURL_HTTP_VERSION_1_1);
+  this->curlErrorBuf[0] = '\0';
+  this->beginTransfer();
+  CURLcode res = curl_easy_perform(getCurlHandle());
+  this->endTransfer();
+  curl_slist_free_all(resolveList);
+  this->lastRequest.curlCode = res;
+  this->lastRequest.curlError.assign(this->curlErrorBuf);
+  // the handle is reset before the next request, which drops the
+  // connection
+  this->resetPending = true;
+  return res;
+}
+
+#if LIBCURL_VERSION_NUM >= 0x080b00
+/**
+ * @brief connect like openConnection(), but let libcurl do the WebSocket
+ * handshake, so the caller can talk over the connection with curl_ws_send()
+ * and curl_ws_recv()
+ *
+ * @param url full ws:// or wss:// URL
+ * @param response filled with the server's answer to the upgrade request
+ *
+ * @return CURLE_OK if the server switched to the WebSocket protocol
+ */
+CURLcode
+RestClient::Connection::openWebSocket(const std::string& url,
+                                      RestClient::Response* response) {
+  this->prepareHandle();
+  curl_easy_setopt(getCurlHandle(), CURLOPT_URL, url.c_str());
+  curl_slist* resolveList = this->setConnectOptions(url);
+  curl_easy_setopt(getCurlHandle(), CURLOPT_CONNECT_ONLY, 2L);
+  curl_easy_setopt(getCurlHandle(), CURLOPT_HTTPPROXYTUNNEL, 1L);
+  curl_easy_setopt(getCurlHandle(), CURLOPT_HTTP_VERSION,
+                   CURL_HTTP_VERSION_1_1);
+  const std::string userAgent = this->GetUserAgent();
+  curl_easy_setopt(getCurlHandle(), CURLOPT_USERAGENT, userAgent.c_str());
+  if (this->basicAuth.username.length() > 0) {
+    curl_easy_setopt(getCurlHandle(), CURLOPT_HTTPAUTH, CURLAUTH_BASIC);
+    curl_easy_setopt(getCurlHandle(), CURLOPT_USERNAME,
+                     this->basicAuth.username.c_str());
+    curl_easy_setopt(getCurlHandle(), CURLOPT_PASSWORD,
+                     this->basicAuth.password.c_str());
+  }
+  curl_slist* headerList = NULL;
+  for (HeaderFields::const_iterator it = this->headerFields.begin();
+      it != this->headerFields.end(); ++it) {
+    headerList = curl_slist_append(headerList,
+                                   (it->first + ": " + it->second).c_str());
+  }
+  curl_easy_setopt(getCurlHandle(), CURLOPT_HTTPHEADER, headerList);
+  HeaderData<RestClient::Response> headerData;
+  headerData.response = response;
+  headerData.block = &this->responseHeaders;
+  headerData.capture = HeaderCapture::All;
+  headerData.fillBlock = false;
+  headerData.allowList = &this->headerAllowList;
+  headerData.nameBuffer = &this->headerName;
+  headerData.stored = NULL;
+  this->responseHeaders.Clear();
+  curl_easy_setopt(getCurlHandle(), CURLOPT_HEADERFUNCTION,
+                   headerCallback<RestClient::Response>);
+  curl_easy_setopt(getCurlHandle(), CURLOPT_HEADERDATA, &headerData);
+  curl_easy_setopt(getCurlHandle(), CURLOPT_WRITEFUNCTION,
+                   RestClient::Helpers::write_callback);
+  curl_easy_setopt(getCurlHandle(), CURLOPT_WRITEDATA, response);
+  this->curlErrorBuf[0] = '\0';
+  this->beginTransfer();
+  CURLcode res = curl_easy_perform(getCurlHandle());
+  this->endTransfer();
+  curl_slist_free_all(headerList);
+  curl_slist_free_all(resolveList);
+  int64_t code = 0;
+  curl_easy_getinfo(getCurlHandle(), CURLINFO_RESPONSE_CODE, &code);
+  response->code = static_cast<int>(code);
+  this->lastRequest.curlCode = res;
+  this->lastRequest.curlError.assign(this->curlErrorBuf);
+  this->resetPending = true;
+  return res;
+}
+#endif
+
+/**
+ * @brief add a compact record of the transfer that just finished to the
+ * flight recorder
+ *
+ * @param url full URL of the request
+ * @param method HTTP method of the request
+ * @param statusCode HTTP status code, 0 if the transfer failed
+ * @param times timings and sizes of the transfer
+ */
+void
+RestClient::Connection::recordFlight(const std::string& url,
+                                     const char* method, int statusCode,
+                                     const TransferTimes& times) {
+  RestClient::FlightRecord record;
+  record.timestamp = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::system_clock::now().time_since_epoch()).count();
+  record.totalTime = times.totalTime;
+  record.nameLookupTime = times.nameLookupTime;
+  record.connectTime = times.connectTime;
+  record.startTransferTime = times.startTransferTime;
+  record.requestBytes = times.uploadedBytes > 0
+                        ? static_cast<uint64_t>(times.uploadedBytes) : 0;
+  record.responseBytes = times.downloadedBytes > 0
+                         ? static_cast<uint64_t>(times.downloadedBytes) : 0;
+  record.statusCode = statusCode;
+  record.curlCode = this->lastRequest.curlCode;
+  std::strncpy(record.method, method, sizeof(record.method) - 1);
+  record.method[sizeof(record.method) - 1] = '\0';
+  RestClient::FlightRecorder::UrlTemplate(url.c_str(), record.url,
+                                          sizeof(record.url));
+  this->flightRecorder->Record(record);
 }
 
 /**
@@ -565,7 +2696,10 @@ RestClient::Connection::performCurlRequest(const std::string& uri,
  */
 RestClient::Response
 RestClient::Connection::get(const std::string& url) {
-  return this->performCurlRequest(url);
+  if (this->coalesces()) {
+    return *this->getShared(url);
+  }
+  return this->performCurlRequest(url, "GET");
 }
 /**
  * @brief HTTP GET method
@@ -578,7 +2712,125 @@ RestClient::Connection::get(const std::string& url) {
 RestClient::Response*
 RestClient::Connection::get(const std::string& url,
                             RestClient::Response* response) {
-  return this->performCurlRequest(url, response);
+  if (this->coalesces()) {
+    *response = *this->getShared(url);
+    return response;
+  }
+  return this->performCurlRequest(url, response, "GET");
+}
+/**
+ * @brief HTTP GET method into a response allocated from an arena. Bypasses
+ * a SingleFlight group since shared responses live on the heap.
+ *
+ * @param url to query
+ * @param response arena response, constructed with the arena to use
+ *
+ * @return response
+ */
+RestClient::ArenaResponse*
+RestClient::Connection::get(const std::string& url,
+                            RestClient::ArenaResponse* response) {
+  return this->performCurlRequest(url, response, "GET");
+}
+/**
+ * @brief HTTP GET method returning a reference counted response. If a
+ * SingleFlight group is set and an identical request is already in flight,
+ * this waits for it and shares its response instead of doing a transfer.
+ *
+ * @param url to query
+ *
+ * @return shared response
+ */
+RestClient::SharedResponse
+RestClient::Connection::getShared(const std::string& url) {
+  if (!this->coalesces()) {
+    return std::make_shared<const RestClient::Response>(
+        this->performCurlRequest(url, "GET"));
+  }
+  bool shared = false;
+  RestClient::SharedResponse ret = this->singleFlight->Do(
+      this->singleFlightKey("GET", url),
+      [this, &url]() { return this->performCurlRequest(url, "GET"); },
+      &shared);
+  if (shared) {
+    // this connection sent nothing, don't leave its previous request
+    // looking like the one that produced the response
+    this->lastRequest = RequestInfo();
+    this->lastRequestInfo = ExtendedRequestInfo();
+    this->infoPending = false;
+    this->responseHeaders.Clear();
+  }
+  return ret;
+}
+/**
+ * @brief set up the curl handle for an HTTP method and perform the request
+ *
+ * @param method GET, POST, PUT, PATCH, DELETE, HEAD or OPTIONS
+ * @param url to query
+ * @param data request body for POST, PUT and PATCH, NULL otherwise
+ * @param ret response to fill
+ *
+ * @return ret
+ */
+template <typename R>
+R*
+RestClient::Connection::performMethod(const char* method,
+                                      const std::string& url,
+                                      const std::string* data, R* ret) {
+  this->prepareHandle();
+  /** initialize upload object */
+  RestClient::Helpers::UploadObject up_obj;
+  DigestedRead digestedRead;
+  if (std::strcmp(method, "POST") == 0) {
+    /** Now specify we want to POST data */
+    curl_easy_setopt(getCurlHandle(), CURLOPT_POST, 1L);
+    /** set post fields */
+    curl_easy_setopt(getCurlHandle(), CURLOPT_POSTFIELDS, data->c_str());
+    curl_easy_setopt(getCurlHandle(), CURLOPT_POSTFIELDSIZE, data->size());
+    this->requestBodySize = data->size();
+    if (this->digestAlgorithm != RestClient::DigestAlgorithm::None) {
+      this->uploadDigest.Reset(this->digestAlgorithm);
+      this->uploadDigest.Update(data->data(), data->size());
+    }
+  } else if (std::strcmp(method, "PUT") == 0 ||
+             std::strcmp(method, "PATCH") == 0) {
+    up_obj.data = data->c_str();
+    up_obj.length = data->size();
+    if (std::strcmp(method, "PUT") == 0) {
+      /** Now specify we want to PUT data */
+      curl_easy_setopt(getCurlHandle(), CURLOPT_PUT, 1L);
+    } else {
+      /** set HTTP PATCH METHOD */
+      curl_easy_setopt(getCurlHandle(), CURLOPT_CUSTOMREQUEST, method);
+    }
+    curl_easy_setopt(getCurlHandle(), CURLOPT_UPLOAD, 1L);
+    /** set read callback function */
+    curl_easy_setopt(getCurlHandle(), CURLOPT_READFUNCTION,
+                     RestClient::Helpers::read_callback);
+    /** set data object to pass to callback function */
+    curl_easy_setopt(getCurlHandle(), CURLOPT_READDATA, &up_obj);
+    if (this->digestAlgorithm != RestClient::DigestAlgorithm::None) {
+      this->uploadDigest.Reset(this->digestAlgorithm);
+      digestedRead.upload = &up_obj;
+      digestedRead.digest = &this->uploadDigest;
+      curl_easy_setopt(getCurlHandle(), CURLOPT_READFUNCTION,
+                       digestReadCallback);
+      curl_easy_setopt(getCurlHandle(), CURLOPT_READDATA, &digestedRead);
+    }
+    /** set data size */
+    curl_easy_setopt(getCurlHandle(), CURLOPT_INFILESIZE,
+                       static_cast<int64_t>(up_obj.length));
+    this->requestBodySize = up_obj.length;
+  } else if (std::strcmp(method, "DELETE") == 0) {
+    /** set HTTP DELETE METHOD */
+    curl_easy_setopt(getCurlHandle(), CURLOPT_CUSTOMREQUEST, method);
+  } else if (std::strcmp(method, "HEAD") == 0 ||
+             std::strcmp(method, "OPTIONS") == 0) {
+    /** set HTTP HEAD or OPTIONS METHOD */
+    curl_easy_setopt(getCurlHandle(), CURLOPT_CUSTOMREQUEST, method);
+    curl_easy_setopt(getCurlHandle(), CURLOPT_NOBODY, 1L);
+  }
+  return this->performCurlRequest(url, ret, method);
 }
 /**
  * @brief HTTP POST method
@@ -591,13 +2843,9 @@ RestClient::Connection::get(const std::string& url,
 RestClient::Response
 RestClient::Connection::post(const std::string& url,
                              const std::string& data) {
-  /** Now specify we want to POST data */
-  curl_easy_setopt(getCurlHandle(), CURLOPT_POST, 1L);
-  /** set post fields */
-  curl_easy_setopt(getCurlHandle(), CURLOPT_POSTFIELDS, data.c_str());
-  curl_easy_setopt(getCurlHandle(), CURLOPT_POSTFIELDSIZE, data.size());
-
-  return this->performCurlRequest(url);
+  RestClient::Response ret = {};
+  this->performMethod("POST", url, &data, &ret);
+  return ret;
 }
 /**
  * @brief HTTP PUT method
@@ -610,24 +2858,9 @@ RestClient::Connection::post(const std::string& url,
 RestClient::Response
 RestClient::Connection::put(const std::string& url,
                             const std::string& data) {
-  /** initialize upload object */
-  RestClient::Helpers::UploadObject up_obj;
-  up_obj.data = data.c_str();
-  up_obj.length = data.size();
-
-  /** Now specify we want to PUT data */
-  curl_easy_setopt(getCurlHandle(), CURLOPT_PUT, 1L);
-  curl_easy_setopt(getCurlHandle(), CURLOPT_UPLOAD, 1L);
-  /** set read callback function */
-  curl_easy_setopt(getCurlHandle(), CURLOPT_READFUNCTION,
-                   RestClient::Helpers::read_callback);
-  /** set data object to pass to callback function */
-  curl_easy_setopt(getCurlHandle(), CURLOPT_READDATA, &up_obj);
-  /** set data size */
-  curl_easy_setopt(getCurlHandle(), CURLOPT_INFILESIZE,
-                     static_cast<int64_t>(up_obj.length));
-
-  return this->performCurlRequest(url);
+  RestClient::Response ret = {};
+  this->performMethod("PUT", url, &data, &ret);
+  return ret;
 }
 /**
  * @brief HTTP PATCH method
@@ -640,27 +2873,9 @@ RestClient::Connection::put(const std::string& url,
 RestClient::Response
 RestClient::Connection::patch(const std::string& url,
                             const std::string& data) {
-  /** initialize upload object */
-  RestClient::Helpers::UploadObject up_obj;
-  up_obj.data = data.c_str();
-  up_obj.length = data.size();
-
-  /** we want HTTP PATCH */
-  const char* http_patch = "PATCH";
-
-  /** set HTTP PATCH METHOD */
-  curl_easy_setopt(getCurlHandle(), CURLOPT_CUSTOMREQUEST, http_patch);
-  curl_easy_setopt(getCurlHandle(), CURLOPT_UPLOAD, 1L);
-  /** set read callback function */
-  curl_easy_setopt(getCurlHandle(), CURLOPT_READFUNCTION,
-                   RestClient::Helpers::read_callback);
-  /** set data object to pass to callback function */
-  curl_easy_setopt(getCurlHandle(), CURLOPT_READDATA, &up_obj);
-  /** set data size */
-  curl_easy_setopt(getCurlHandle(), CURLOPT_INFILESIZE,
-                     static_cast<int64_t>(up_obj.length));
-
-  return this->performCurlRequest(url);
+  RestClient::Response ret = {};
+  this->performMethod("PATCH", url, &data, &ret);
+  return ret;
 }
 /**
  * @brief HTTP DELETE method
@@ -671,13 +2886,9 @@ RestClient::Connection::patch(const std::string& url,
  */
 RestClient::Response
 RestClient::Connection::del(const std::string& url) {
-  /** we want HTTP DELETE */
-  const char* http_delete = "DELETE";
-
-  /** set HTTP DELETE METHOD */
-  curl_easy_setopt(getCurlHandle(), CURLOPT_CUSTOMREQUEST, http_delete);
-
-  return this->performCurlRequest(url);
+  RestClient::Response ret = {};
+  this->performMethod("DELETE", url, NULL, &ret);
+  return ret;
 }
 
 /**
@@ -689,14 +2900,9 @@ RestClient::Connection::del(const std::string& url) {
  */
 RestClient::Response
 RestClient::Connection::head(const std::string& url) {
-    /** we want HTTP HEAD */
-    const char* http_head = "HEAD";
-
-    /** set HTTP HEAD METHOD */
-    curl_easy_setopt(getCurlHandle(), CURLOPT_CUSTOMREQUEST, http_head);
-    curl_easy_setopt(getCurlHandle(), CURLOPT_NOBODY, 1L);
-
-    return this->performCurlRequest(url);
+  RestClient::Response ret = {};
+  this->performMethod("HEAD", url, NULL, &ret);
+  return ret;
 }
 
 /**
@@ -708,12 +2914,203 @@ RestClient::Connection::head(const std::string& url) {
  */
 RestClient::Response
 RestClient::Connection::options(const std::string& url) {
-    /** we want HTTP OPTIONS */
-    const char* http_options = "OPTIONS";
+  RestClient::Response ret = {};
+  this->performMethod("OPTIONS", url, NULL, &ret);
+  return ret;
+}
 
-    /** set HTTP HEAD METHOD */
-    curl_easy_setopt(getCurlHandle(), CURLOPT_CUSTOMREQUEST, http_options);
-    curl_easy_setopt(getCurlHandle(), CURLOPT_NOBODY, 1L);
+/**
+ * @brief HTTP POST method into a response of the caller
+ *
+ * @param url to query
+ * @param data HTTP POST body
+ * @param response to fill, its string capacity is reused
+ *
+ * @return response
+ */
+RestClient::Response*
+RestClient::Connection::post(const std::string& url, const std::string& data,
+                             RestClient::Response* response) {
+  return this->performMethod("POST", url, &data, response);
+}
 
-    return this->performCurlRequest(url);
+RestClient::Response*
+RestClient::Connection::put(const std::string& url, const std::string& data,
+                            RestClient::Response* response) {
+  return this->performMethod("PUT", url, &data, response);
+}
+
+RestClient::Response*
+RestClient::Connection::patch(const std::string& url, const std::string& data,
+                              RestClient::Response* response) {
+  return this->performMethod("PATCH", url, &data, response);
+}
+
+RestClient::Response*
+RestClient::Connection::del(const std::string& url,
+                            RestClient::Response* response) {
+  return this->performMethod("DELETE", url, NULL, response);
+}
+
+RestClient::Response*
+RestClient::Connection::head(const std::string& url,
+                             RestClient::Response* response) {
+  return this->performMethod("HEAD", url, NULL, response);
+}
+
+RestClient::Response*
+RestClient::Connection::options(const std::string& url,
+                                RestClient::Response* response) {
+  return this->performMethod("OPTIONS", url, NULL, response);
+}
+
+/**
+ * @brief HTTP GET method writing the body into a buffer of the caller.
+ * Bypasses a SingleFlight group.
+ *
+ * @param url to query
+ * @param response with body and capacity set to the buffer
+ *
+ * @return response, with code kBodyTooLarge if the body didn't fit
+ */
+RestClient::BufferResponse*
+RestClient::Connection::get(const std::string& url,
+                            RestClient::BufferResponse* response) {
+  return this->performMethod("GET", url, NULL, response);
+}
+
+RestClient::BufferResponse*
+RestClient::Connection::post(const std::string& url, const std::string& data,
+                             RestClient::BufferResponse* response) {
+  return this->performMethod("POST", url, &data, response);
+}
+
+RestClient::BufferResponse*
+RestClient::Connection::put(const std::string& url, const std::string& data,
+                            RestClient::BufferResponse* response) {
+  return this->performMethod("PUT", url, &data, response);
+}
+
+RestClient::BufferResponse*
+RestClient::Connection::patch(const std::string& url, const std::string& data,
+                              RestClient::BufferResponse* response) {
+  return this->performMethod("PATCH", url, &data, response);
+}
+
+RestClient::BufferResponse*
+RestClient::Connection::del(const std::string& url,
+                            RestClient::BufferResponse* response) {
+  return this->performMethod("DELETE", url, NULL, response);
+}
+
+RestClient::BufferResponse*
+RestClient::Connection::head(const std::string& url,
+                             RestClient::BufferResponse* response) {
+  return this->performMethod("HEAD", url, NULL, response);
+}
+
+RestClient::BufferResponse*
+RestClient::Connection::options(const std::string& url,
+                                RestClient::BufferResponse* response) {
+  return this->performMethod("OPTIONS", url, NULL, response);
+}
+
+/**
+ * @brief HTTP GET method handing the body to a consumer while it is
+ * transferred. Bypasses a SingleFlight group.
+ *
+ * @param url to query
+ * @param response with the consumer set
+ *
+ * @return response, with code kStreamAborted if the consumer stopped the
+ * transfer or rejected the end of the body
+ */
+RestClient::StreamResponse*
+RestClient::Connection::get(const std::string& url,
+                            RestClient::StreamResponse* response) {
+  return this->performMethod("GET", url, NULL, response);
+}
+
+RestClient::StreamResponse*
+RestClient::Connection::post(const std::string& url, const std::string& data,
+                             RestClient::StreamResponse* response) {
+  return this->performMethod("POST", url, &data, response);
+}
+
+/**
+ * @brief follow a Server-Sent Events stream. Every connection sends the
+ * id of the last event received as Last-Event-ID, and after a stream that
+ * ended or a connection that broke the next one is made after the
+ * consumer's reconnection time. Timeouts set on the connection apply to
+ * every connection of the stream, so a total timeout ends each one; use
+ * SetLowSpeedLimit() to notice a stalled stream instead.
+ *
+ * @param url to query
+ * @param consumer getting the events, Reset() before every connection
+ * @param response of the last connection
+ * @param maxReconnects connections after the first one, < 0 for no limit
+ *
+ * @return response: kStreamAborted if the consumer stopped, kCancelled,
+ * the HTTP status if it wasn't 2xx, was 204 (no reconnect) or came without
+ * Content-Type text/event-stream, or the
+ * result of the last connection once maxReconnects was reached or the
+ * deadline expired
+ */
+RestClient::StreamResponse*
+RestClient::Connection::subscribe(const std::string& url,
+                                  RestClient::SseConsumer* consumer,
+                                  RestClient::StreamResponse* response,
+                                  int maxReconnects) {
+  // the headers of the subscription go away when it ends, by exception
+  // as well
+  RestoreOnExit<RestClient::HeaderFields> headers(&this->headerFields);
+  // Content-Type is checked whatever headers are captured
+  RestoreOnExit<bool> keepHeaderBlock(&this->keepHeaderBlock);
+  this->keepHeaderBlock = true;
+  response->consumer = consumer;
+  for (int reconnects = 0; ; reconnects++) {
+    this->headerFields = headers.Saved();
+    this->headerFields["Accept"] = "text/event-stream";
+    this->headerFields["Cache-Control"] = "no-cache";
+    if (!consumer->LastEventId().empty()) {
+      this->headerFields["Last-Event-ID"] = consumer->LastEventId();
+    }
+    consumer->Reset();
+    this->performMethod("GET", url, NULL, response);
+
+    const int code = response->code;
+    // the stream ended (2xx) or the transfer failed (cURL error), anything
+    // else is final. 204 is how a server says not to reconnect.
+    // so is a 2xx that isn't an event stream, which would only be fetched
+    // again and again
+    const bool reconnect = code == -1 || (code > 0 && code < 100) ||
+                           (code >= 200 && code < 300 && code != 204 &&
+                            isEventStream(
+                                this->responseHeaders.Get("Content-Type")));
+    if (!reconnect || (maxReconnects >= 0 && reconnects >= maxReconnects)) {
+      break;
+    }
+    std::chrono::steady_clock::time_point until =
+      std::chrono::steady_clock::now() +
+      std::chrono::milliseconds(consumer->Retry());
+    bool cancelled = false;
+    while (std::chrono::steady_clock::now() < until) {
+      if (this->cancellationToken && this->cancellationToken->IsCancelled()) {
+        cancelled = true;
+        break;
+      }
+      // short naps so a cancellation is noticed
+      std::this_thread::sleep_for(std::min<std::chrono::nanoseconds>(
+          until - std::chrono::steady_clock::now(),
+          std::chrono::milliseconds(50)));
+    }
+    if (cancelled) {
+      response->code = RestClient::kCancelled;
+      break;
+    }
+    if (this->deadline.Min(RestClient::Deadline::Current()).Expired()) {
+      break;
+    }
+  }
+  return response;
 }
@@ -0,0 +1,127 @@
+/**
+ * @file deadline.cc
+ * @brief implementation of deadlines
+ * @author Daniel Schauenberg <d@unwiredcouch.com>
+ */
+
+#include "restclient-cpp/deadline.h"
+
+#include <chrono>  // NOLINT(build/c++11)
+#include <cstdint>
+#include <limits>
+
+namespace {
+
+// deadline of the innermost Scope of each thread
+thread_local RestClient::Deadline current;
+
+}  // namespace
+
+RestClient::Deadline::Deadline() : set(false), at() {
+}
+
+RestClient::Deadline::Deadline(Clock::time_point at) : set(true), at(at) {
+}
+
+/**
+ * @brief create a deadline relative to now
+ *
+ * @param milliseconds - time from now
+ *
+ * @return Deadline
+ */
+RestClient::Deadline
+RestClient::Deadline::After(int64_t milliseconds) {
+  return Deadline(Clock::now() + std::chrono::milliseconds(milliseconds));
+}
+
+/**
+ * @brief get the deadline of the innermost Scope of the calling thread
+ *
+ * @return Deadline, unset if there is no Scope
+ */
+RestClient::Deadline
+RestClient::Deadline::Current() {
+  return current;
+}
+
+bool
+RestClient::Deadline::IsSet() const {
+  return this->set;
+}
+
+bool
+RestClient::Deadline::Expired() const {
+  return this->set && Clock::now() >= this->at;
+}
+
+RestClient::Deadline::Clock::time_point
+RestClient::Deadline::When() const {
+  return this->at;
+}
+
+/**
+ * @brief get the budget that is left
+ *
+ * @return milliseconds until the deadline, rounded up, 0 if it passed and
+ * INT64_MAX if the deadline is not set
+ */
+int64_t
+RestClient::Deadline::RemainingMilliseconds() const {
+  if (!this->set) {
+    return std::numeric_limits<int64_t>::max();
+  }
+  Clock::duration left = this->at - Clock::now();
+  if (left <= Clock::duration::zero()) {
+    return 0;
+  }
+  // round up, so a deadline doesn't expire before its time
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+      left + std::chrono::milliseconds(1) - Clock::duration(1)).count();
+}
+
+/**
+ * @brief combine two deadlines
+ *
+ * @param other - deadline to compare with
+ *
+ * @return the earlier deadline, unset only if both are
+ */
+RestClient::Deadline
+RestClient::Deadline::Min(const Deadline& other) const {
+  if (!other.set || (this->set && this->at <= other.at)) {
+    return *this;
+  }
+  return other;
+}
+
+/**
+ * @brief shorter deadline for a part of an operation
+ *
+ * @param milliseconds - budget of the part
+ *
+ * @return the earlier of this deadline and milliseconds from now
+ */
+RestClient::Deadline
+RestClient::Deadline::Within(int64_t milliseconds) const {
+  return this->Min(After(milliseconds));
+}
+
+/**
+ * @brief make deadline the current one of the thread, unless the current
+ * one is earlier
+ *
+ * @param deadline - deadline for the scope
+ */
+RestClient::Deadline::Scope::Scope(const Deadline& deadline)
+  : previousSet(current.set), previousAt(current.at) {
+  current = current.Min(deadline);
+}
+
+/**
+ * @brief restore the deadline the thread had before the scope
+ */
+RestClient::Deadline::Scope::~Scope() {
+  current.set = this->previousSet;
+  current.at = this->previousAt;
+}
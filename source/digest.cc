@@ -0,0 +1,664 @@
+/**
+ * @file digest.cc
+ * @brief implementation of the body checksums
+ * @author Daniel Schauenberg <d@unwiredcouch.com>
+ */
+
+#include "restclient-cpp/digest.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstring>
+#include <string>
+
+#if (defined(__x86_64__) || defined(__i386__)) && \
+    (defined(__GNUC__) || defined(__clang__))
+#define RESTCLIENT_DIGEST_X86 1
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+#if defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#define RESTCLIENT_DIGEST_ARM_CRC32 1
+#include <arm_acle.h>
+#endif
+
+namespace {
+
+const uint32_t kSha256Init[8] = {
+  0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+  0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+const uint32_t kSha256Rounds[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+  0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+  0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+  0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+  0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+  0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+  0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+  0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+  0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+const uint32_t kMd5Init[4] = {
+  0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476
+};
+
+const uint32_t kMd5Rounds[64] = {
+  0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a,
+  0xa8304613, 0xfd469501, 0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be,
+  0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821, 0xf61e2562, 0xc040b340,
+  0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+  0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8,
+  0x676f02d9, 0x8d2a4c8a, 0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c,
+  0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70, 0x289b7ec6, 0xeaa127fa,
+  0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+  0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92,
+  0xffeff47d, 0x85845dd1, 0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1,
+  0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
+};
+
+const int kMd5Shifts[64] = {
+  7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+  5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20,
+  4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+  6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21
+};
+
+inline uint32_t rotateRight(uint32_t value, int bits) {
+  return (value >> bits) | (value << (32 - bits));
+}
+
+inline uint32_t rotateLeft(uint32_t value, int bits) {
+  return (value << bits) | (value >> (32 - bits));
+}
+
+void sha256Blocks(uint32_t* state, const unsigned char* data,
+                  size_t blocks) {
+  for (; blocks > 0; blocks--, data += 64) {
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++) {
+      w[i] = (static_cast<uint32_t>(data[i * 4]) << 24) |
+             (static_cast<uint32_t>(data[i * 4 + 1]) << 16) |
+             (static_cast<uint32_t>(data[i * 4 + 2]) << 8) |
+             static_cast<uint32_t>(data[i * 4 + 3]);
+    }
+    for (int i = 16; i < 64; i++) {
+      uint32_t s0 = rotateRight(w[i - 15], 7) ^ rotateRight(w[i - 15], 18) ^
+                    (w[i - 15] >> 3);
+      uint32_t s1 = rotateRight(w[i - 2], 17) ^ rotateRight(w[i - 2], 19) ^
+                    (w[i - 2] >> 10);
+      w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3],
+             e = state[4], f = state[5], g = state[6], h = state[7];
+    for (int i = 0; i < 64; i++) {
+      uint32_t s1 = rotateRight(e, 6) ^ rotateRight(e, 11) ^
+                    rotateRight(e, 25);
+      uint32_t t1 = h + s1 + ((e & f) ^ (~e & g)) + kSha256Rounds[i] + w[i];
+      uint32_t s0 = rotateRight(a, 2) ^ rotateRight(a, 13) ^
+                    rotateRight(a, 22);
+      uint32_t t2 = s0 + ((a & b) ^ (a & c) ^ (b & c));
+      h = g;
+      g = f;
+      f = e;
+      e = d + t1;
+      d = c;
+      c = b;
+      b = a;
+      a = t1 + t2;
+    }
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+  }
+}
+
+void md5Blocks(uint32_t* state, const unsigned char* data, size_t blocks) {
+  for (; blocks > 0; blocks--, data += 64) {
+    uint32_t m[16];
+    for (int i = 0; i < 16; i++) {
+      m[i] = static_cast<uint32_t>(data[i * 4]) |
+             (static_cast<uint32_t>(data[i * 4 + 1]) << 8) |
+             (static_cast<uint32_t>(data[i * 4 + 2]) << 16) |
+             (static_cast<uint32_t>(data[i * 4 + 3]) << 24);
+    }
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    for (int i = 0; i < 64; i++) {
+      uint32_t f;
+      int g;
+      if (i < 16) {
+        f = (b & c) | (~b & d);
+        g = i;
+      } else if (i < 32) {
+        f = (d & b) | (~d & c);
+        g = (5 * i + 1) % 16;
+      } else if (i < 48) {
+        f = b ^ c ^ d;
+        g = (3 * i + 5) % 16;
+      } else {
+        f = c ^ (b | ~d);
+        g = (7 * i) % 16;
+      }
+      uint32_t next = d;
+      d = c;
+      c = b;
+      b = b + rotateLeft(a + f + kMd5Rounds[i] + m[g], kMd5Shifts[i]);
+      a = next;
+    }
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+  }
+}
+
+/**
+ * @brief table driven CRC32C (Castagnoli, reflected), eight bytes per step
+ */
+struct Crc32cTables {
+  uint32_t table[8][256];
+
+  Crc32cTables() {
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t crc = i;
+      for (int bit = 0; bit < 8; bit++) {
+        crc = (crc >> 1) ^ (0x82f63b78 & (0 - (crc & 1)));
+      }
+      this->table[0][i] = crc;
+    }
+    for (int t = 1; t < 8; t++) {
+      for (int i = 0; i < 256; i++) {
+        uint32_t previous = this->table[t - 1][i];
+        this->table[t][i] = (previous >> 8) ^ this->table[0][previous & 0xff];
+      }
+    }
+  }
+};
+
+uint32_t crc32cSoftware(uint32_t crc, const unsigned char* data,
+                        size_t length) {
+  static const Crc32cTables tables;
+  const uint32_t (*t)[256] = tables.table;
+  while (length >= 8) {
+    uint32_t low = crc ^ (static_cast<uint32_t>(data[0]) |
+                          (static_cast<uint32_t>(data[1]) << 8) |
+                          (static_cast<uint32_t>(data[2]) << 16) |
+                          (static_cast<uint32_t>(data[3]) << 24));
+    crc = t[7][low & 0xff] ^ t[6][(low >> 8) & 0xff] ^
+          t[5][(low >> 16) & 0xff] ^ t[4][low >> 24] ^
+          t[3][data[4]] ^ t[2][data[5]] ^ t[1][data[6]] ^ t[0][data[7]];
+    data += 8;
+    length -= 8;
+  }
+  while (length-- > 0) {
+    crc = (crc >> 8) ^ t[0][(crc ^ *data++) & 0xff];
+  }
+  return crc;
+}
+
+#if defined(RESTCLIENT_DIGEST_X86)
+
+bool cpuHasCrc32() {
+  unsigned int a, b, c, d;
+  return __get_cpuid(1, &a, &b, &c, &d) && (c & bit_SSE4_2);
+}
+
+bool cpuHasSha() {
+  unsigned int a, b, c, d;
+  if (!__get_cpuid(1, &a, &b, &c, &d) || !(c & bit_SSSE3) ||
+      !(c & bit_SSE4_1)) {
+    return false;
+  }
+  return __get_cpuid_count(7, 0, &a, &b, &c, &d) && (b & (1u << 29));
+}
+
+__attribute__((target("sse4.2")))
+uint32_t crc32cHardware(uint32_t crc, const unsigned char* data,
+                        size_t length) {
+#if defined(__x86_64__)
+  uint64_t crc64 = crc;
+  while (length >= 8) {
+    uint64_t word;
+    std::memcpy(&word, data, 8);
+    crc64 = _mm_crc32_u64(crc64, word);
+    data += 8;
+    length -= 8;
+  }
+  crc = static_cast<uint32_t>(crc64);
+#endif
+  while (length >= 4) {
+    uint32_t word;
+    std::memcpy(&word, data, 4);
+    crc = _mm_crc32_u32(crc, word);
+    data += 4;
+    length -= 4;
+  }
+  while (length-- > 0) {
+    crc = _mm_crc32_u8(crc, *data++);
+  }
+  return crc;
+}
+
+/**
+ * @brief SHA-256 with the SHA extensions. The state is kept as ABEF and
+ * CDGH, which is how sha256rnds2 wants it.
+ */
+__attribute__((target("sha,sse4.1,ssse3")))
+void sha256BlocksHardware(uint32_t* state, const unsigned char* data,
+                          size_t blocks) {
+  const __m128i byteSwap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL,
+                                          0x0405060700010203ULL);
+  __m128i tmp = _mm_loadu_si128(reinterpret_cast<const __m128i*>(state));
+  __m128i state1 =
+    _mm_loadu_si128(reinterpret_cast<const __m128i*>(state + 4));
+  tmp = _mm_shuffle_epi32(tmp, 0xb1);
+  state1 = _mm_shuffle_epi32(state1, 0x1b);
+  __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);
+  state1 = _mm_blend_epi16(state1, tmp, 0xf0);
+
+  for (; blocks > 0; blocks--, data += 64) {
+    const __m128i abef = state0;
+    const __m128i cdgh = state1;
+    __m128i m[4];
+    for (int i = 0; i < 4; i++) {
+      m[i] = _mm_shuffle_epi8(_mm_loadu_si128(
+          reinterpret_cast<const __m128i*>(data + i * 16)), byteSwap);
+    }
+    // four rounds per group, the message schedule runs ahead in m
+    for (int g = 0; g < 16; g++) {
+      __m128i& current = m[g & 3];
+      __m128i msg = _mm_add_epi32(current, _mm_loadu_si128(
+          reinterpret_cast<const __m128i*>(kSha256Rounds + g * 4)));
+      state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+      if (g >= 3 && g <= 14) {
+        __m128i& next = m[(g + 1) & 3];
+        next = _mm_add_epi32(next, _mm_alignr_epi8(current, m[(g + 3) & 3],
+                                                   4));
+        next = _mm_sha256msg2_epu32(next, current);
+      }
+      msg = _mm_shuffle_epi32(msg, 0x0e);
+      state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+      if (g >= 1 && g <= 12) {
+        __m128i& previous = m[(g + 3) & 3];
+        previous = _mm_sha256msg1_epu32(previous, current);
+      }
+    }
+    state0 = _mm_add_epi32(state0, abef);
+    state1 = _mm_add_epi32(state1, cdgh);
+  }
+
+  tmp = _mm_shuffle_epi32(state0, 0x1b);
+  state1 = _mm_shuffle_epi32(state1, 0xb1);
+  state0 = _mm_blend_epi16(tmp, state1, 0xf0);
+  state1 = _mm_alignr_epi8(state1, tmp, 8);
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(state), state0);
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(state + 4), state1);
+}
+
+#elif defined(RESTCLIENT_DIGEST_ARM_CRC32)
+
+bool cpuHasCrc32() {
+  return true;
+}
+
+bool cpuHasSha() {
+  return false;
+}
+
+uint32_t crc32cHardware(uint32_t crc, const unsigned char* data,
+                        size_t length) {
+  while (length >= 8) {
+    uint64_t word;
+    std::memcpy(&word, data, 8);
+    crc = __crc32cd(crc, word);
+    data += 8;
+    length -= 8;
+  }
+  while (length-- > 0) {
+    crc = __crc32cb(crc, *data++);
+  }
+  return crc;
+}
+
+void sha256BlocksHardware(uint32_t* state, const unsigned char* data,
+                          size_t blocks) {
+  sha256Blocks(state, data, blocks);
+}
+
+#else
+
+bool cpuHasCrc32() {
+  return false;
+}
+
+bool cpuHasSha() {
+  return false;
+}
+
+uint32_t crc32cHardware(uint32_t crc, const unsigned char* data,
+                        size_t length) {
+  return crc32cSoftware(crc, data, length);
+}
+
+void sha256BlocksHardware(uint32_t* state, const unsigned char* data,
+                          size_t blocks) {
+  sha256Blocks(state, data, blocks);
+}
+
+#endif
+
+/**
+ * @brief the implementations for this CPU, picked once
+ */
+struct Implementations {
+  bool crc32cAccelerated;
+  bool sha256Accelerated;
+  uint32_t (*crc32c)(uint32_t, const unsigned char*, size_t);
+  void (*sha256)(uint32_t*, const unsigned char*, size_t);
+
+  Implementations()
+    : crc32cAccelerated(cpuHasCrc32()), sha256Accelerated(cpuHasSha()) {
+    this->crc32c = this->crc32cAccelerated ? crc32cHardware
+                                           : crc32cSoftware;
+    this->sha256 = this->sha256Accelerated ? sha256BlocksHardware
+                                           : sha256Blocks;
+  }
+};
+
+const Implementations& implementations() {
+  static const Implementations instance;
+  return instance;
+}
+
+// set with Digest::SetPortable()
+std::atomic<bool> portableOnly(false);
+
+uint32_t (*crc32cImplementation())(uint32_t, const unsigned char*, size_t) {
+  return portableOnly.load(std::memory_order_relaxed)
+         ? crc32cSoftware : implementations().crc32c;
+}
+
+void (*sha256Implementation())(uint32_t*, const unsigned char*, size_t) {
+  return portableOnly.load(std::memory_order_relaxed)
+         ? sha256Blocks : implementations().sha256;
+}
+
+void storeBigEndian(uint32_t value, std::string* out) {
+  for (int shift = 24; shift >= 0; shift -= 8) {
+    out->push_back(static_cast<char>((value >> shift) & 0xff));
+  }
+}
+
+bool equalsIgnoringCase(const std::string& a, const char* b) {
+  size_t length = std::strlen(b);
+  if (a.size() != length) {
+    return false;
+  }
+  for (size_t i = 0; i < length; i++) {
+    if (std::tolower(static_cast<unsigned char>(a[i])) !=
+        std::tolower(static_cast<unsigned char>(b[i]))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+std::string trim(const std::string& s) {
+  size_t begin = s.find_first_not_of(" \t");
+  if (begin == std::string::npos) {
+    return std::string();
+  }
+  return s.substr(begin, s.find_last_not_of(" \t") - begin + 1);
+}
+
+int base64Value(char c) {
+  if (c >= 'A' && c <= 'Z') return c - 'A';
+  if (c >= 'a' && c <= 'z') return c - 'a' + 26;
+  if (c >= '0' && c <= '9') return c - '0' + 52;
+  if (c == '+' || c == '-') return 62;
+  if (c == '/' || c == '_') return 63;
+  return -1;
+}
+
+/**
+ * @brief decode a digest value: hex if it has the length of hex for the
+ * algorithm, base64 (padded or not) otherwise
+ *
+ * @return empty if it is neither
+ */
+std::string decodeDigest(const std::string& value, size_t bytes) {
+  std::string decoded;
+  if (value.size() == bytes * 2 &&
+      std::all_of(value.begin(), value.end(), [](char c) {
+        return std::isxdigit(static_cast<unsigned char>(c)) != 0;
+      })) {
+    for (size_t i = 0; i < value.size(); i += 2) {
+      decoded.push_back(static_cast<char>(
+          std::stoi(value.substr(i, 2), NULL, 16)));
+    }
+    return decoded;
+  }
+  uint32_t bits = 0;
+  int count = 0;
+  size_t end = value.find_last_not_of('=');
+  for (size_t i = 0; end != std::string::npos && i <= end; i++) {
+    int v = base64Value(value[i]);
+    if (v < 0) {
+      return std::string();
+    }
+    bits = (bits << 6) | static_cast<uint32_t>(v);
+    count += 6;
+    if (count >= 8) {
+      count -= 8;
+      decoded.push_back(static_cast<char>((bits >> count) & 0xff));
+    }
+  }
+  return decoded.size() == bytes ? decoded : std::string();
+}
+
+}  // namespace
+
+RestClient::Digest::Digest(DigestAlgorithm algorithm) {
+  this->Reset(algorithm);
+}
+
+RestClient::DigestAlgorithm
+RestClient::Digest::Algorithm() const {
+  return this->algorithm;
+}
+
+void
+RestClient::Digest::Reset(DigestAlgorithm algorithm) {
+  this->algorithm = algorithm;
+  this->Reset();
+}
+
+void
+RestClient::Digest::Reset() {
+  this->length = 0;
+  this->buffered = 0;
+  std::memset(this->state, 0, sizeof(this->state));
+  if (this->algorithm == DigestAlgorithm::CRC32C) {
+    this->state[0] = 0xffffffff;
+  } else if (this->algorithm == DigestAlgorithm::SHA256) {
+    std::memcpy(this->state, kSha256Init, sizeof(kSha256Init));
+  } else if (this->algorithm == DigestAlgorithm::MD5) {
+    std::memcpy(this->state, kMd5Init, sizeof(kMd5Init));
+  }
+}
+
+/**
+ * @brief add data to the digest
+ *
+ * @param data bytes to add
+ * @param length number of bytes
+ */
+void
+RestClient::Digest::Update(const void* data, size_t length) {
+  const unsigned char* bytes = static_cast<const unsigned char*>(data);
+  switch (this->algorithm) {
+    case DigestAlgorithm::None:
+      return;
+    case DigestAlgorithm::CRC32C:
+      this->state[0] = crc32cImplementation()(this->state[0], bytes,
+                                              length);
+      this->length += length;
+      return;
+    default:
+      break;
+  }
+  void (*blocks)(uint32_t*, const unsigned char*, size_t) =
+    this->algorithm == DigestAlgorithm::SHA256 ? sha256Implementation()
+                                               : md5Blocks;
+  this->length += length;
+  if (this->buffered > 0) {
+    size_t take = std::min(length, sizeof(this->buffer) - this->buffered);
+    std::memcpy(this->buffer + this->buffered, bytes, take);
+    this->buffered += take;
+    bytes += take;
+    length -= take;
+    if (this->buffered < sizeof(this->buffer)) {
+      return;
+    }
+    blocks(this->state, this->buffer, 1);
+    this->buffered = 0;
+  }
+  // whole blocks straight from the data, without copying them
+  blocks(this->state, bytes, length / 64);
+  bytes += length - length % 64;
+  length %= 64;
+  std::memcpy(this->buffer, bytes, length);
+  this->buffered = length;
+}
+
+std::string
+RestClient::Digest::Bytes() const {
+  std::string out;
+  if (this->algorithm == DigestAlgorithm::None) {
+    return out;
+  }
+  if (this->algorithm == DigestAlgorithm::CRC32C) {
+    storeBigEndian(~this->state[0], &out);
+    return out;
+  }
+  // pad a copy, so that Update() can go on
+  Digest copy(*this);
+  const uint64_t bits = this->length * 8;
+  unsigned char padding[72] = {0x80};
+  size_t padLength = (this->buffered < 56 ? 56 : 120) - this->buffered;
+  for (int i = 0; i < 8; i++) {
+    int shift = this->algorithm == DigestAlgorithm::MD5 ? i * 8 : 56 - i * 8;
+    padding[padLength + i] = static_cast<unsigned char>(bits >> shift);
+  }
+  copy.Update(padding, padLength + 8);
+  if (this->algorithm == DigestAlgorithm::SHA256) {
+    for (int i = 0; i < 8; i++) {
+      storeBigEndian(copy.state[i], &out);
+    }
+  } else {
+    for (int i = 0; i < 4; i++) {
+      for (int shift = 0; shift < 32; shift += 8) {
+        out.push_back(static_cast<char>((copy.state[i] >> shift) & 0xff));
+      }
+    }
+  }
+  return out;
+}
+
+std::string
+RestClient::Digest::Hex() const {
+  static const char digits[] = "0123456789abcdef";
+  std::string bytes = this->Bytes();
+  std::string hex;
+  hex.reserve(bytes.size() * 2);
+  for (size_t i = 0; i < bytes.size(); i++) {
+    unsigned char c = static_cast<unsigned char>(bytes[i]);
+    hex.push_back(digits[c >> 4]);
+    hex.push_back(digits[c & 0xf]);
+  }
+  return hex;
+}
+
+bool
+RestClient::Digest::Accelerated(DigestAlgorithm algorithm) {
+  if (portableOnly.load(std::memory_order_relaxed)) {
+    return false;
+  }
+  if (algorithm == DigestAlgorithm::CRC32C) {
+    return implementations().crc32cAccelerated;
+  }
+  if (algorithm == DigestAlgorithm::SHA256) {
+    return implementations().sha256Accelerated;
+  }
+  return false;
+}
+
+void
+RestClient::Digest::SetPortable(bool portable) {
+  portableOnly.store(portable, std::memory_order_relaxed);
+}
+
+std::string
+RestClient::DigestFromHeader(DigestAlgorithm algorithm,
+                             const std::string& name,
+                             const std::string& value) {
+  const char* token;
+  size_t bytes;
+  switch (algorithm) {
+    case DigestAlgorithm::CRC32C:
+      token = "crc32c";
+      bytes = 4;
+      break;
+    case DigestAlgorithm::SHA256:
+      token = "sha-256";
+      bytes = 32;
+      break;
+    case DigestAlgorithm::MD5:
+      token = "md5";
+      bytes = 16;
+      break;
+    default:
+      return std::string();
+  }
+  if (equalsIgnoringCase(name, "Content-MD5")) {
+    return algorithm == DigestAlgorithm::MD5 ?
+           decodeDigest(trim(value), bytes) : std::string();
+  }
+  if (!equalsIgnoringCase(name, "Digest") &&
+      !equalsIgnoringCase(name, "Content-Digest") &&
+      !equalsIgnoringCase(name, "Repr-Digest")) {
+    return std::string();
+  }
+  // a list of algorithm=value, RFC 9530 puts the value between colons
+  size_t start = 0;
+  while (start <= value.size()) {
+    size_t comma = value.find(',', start);
+    if (comma == std::string::npos) {
+      comma = value.size();
+    }
+    std::string entry = value.substr(start, comma - start);
+    size_t equals = entry.find('=');
+    if (equals != std::string::npos &&
+        equalsIgnoringCase(trim(entry.substr(0, equals)), token)) {
+      std::string encoded = trim(entry.substr(equals + 1));
+      if (encoded.size() >= 2 && encoded[0] == ':' &&
+          encoded[encoded.size() - 1] == ':') {
+        encoded = encoded.substr(1, encoded.size() - 2);
+      }
+      return decodeDigest(encoded, bytes);
+    }
+    start = comma + 1;
+  }
+  return std::string();
+}
@@ -0,0 +1,564 @@
+/**
+ * @file download.cc
+ * @brief implementation of segmented, resumable downloads
+ * @author Daniel Schauenberg <d@unwiredcouch.com>
+ */
+
+#include "restclient-cpp/download.h"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>  // NOLINT(build/c++11)
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <thread>  // NOLINT(build/c++11)
+#include <vector>
+
+#include "restclient-cpp/stream.h"
+
+namespace {
+
+const char kStateMagic[] = "restclient-cpp segmented download 1";
+
+// length of a segment whose end isn't known, for a download without ranges
+const uint64_t kUnknownLength = std::numeric_limits<uint64_t>::max();
+
+bool seek(FILE* file, uint64_t offset) {
+#if defined(_WIN32)
+  return _fseeki64(file, static_cast<__int64>(offset), SEEK_SET) == 0;
+#else
+  return fseeko(file, static_cast<off_t>(offset), SEEK_SET) == 0;
+#endif
+}
+
+/**
+ * @brief size of the file at path, -1 if there is none
+ */
+int64_t fileSize(const std::string& path) {
+  FILE* file = std::fopen(path.c_str(), "rb");
+  if (!file) {
+    return -1;
+  }
+  int64_t size = -1;
+#if defined(_WIN32)
+  if (_fseeki64(file, 0, SEEK_END) == 0) {
+    size = _ftelli64(file);
+  }
+#else
+  if (fseeko(file, 0, SEEK_END) == 0) {
+    size = ftello(file);
+  }
+#endif
+  std::fclose(file);
+  return size;
+}
+
+bool readLine(FILE* file, std::string* line) {
+  line->clear();
+  int c;
+  while ((c = std::fgetc(file)) != EOF && c != '\n') {
+    line->push_back(static_cast<char>(c));
+  }
+  return c != EOF || !line->empty();
+}
+
+/**
+ * @brief value of a response header, whatever the case of its name
+ */
+std::string findHeader(const RestClient::HeaderFields& headers,
+                       const char* name) {
+  for (RestClient::HeaderFields::const_iterator it = headers.begin();
+      it != headers.end(); ++it) {
+    if (it->first.size() == std::strlen(name) &&
+        std::equal(it->first.begin(), it->first.end(), name,
+                   [](char a, char b) {
+                     return std::tolower(static_cast<unsigned char>(a)) ==
+                            std::tolower(static_cast<unsigned char>(b));
+                   })) {
+      return it->second;
+    }
+  }
+  return std::string();
+}
+
+/**
+ * @brief whether a failed segment request is worth another attempt:
+ * transport errors, a body that broke off, timeouts and server errors
+ */
+bool retryable(int code) {
+  return code == -1 || (code > 0 && code < 100) || code == 408 ||
+         code == 429 || code >= 500 || code == RestClient::kStreamAborted;
+}
+
+/**
+ * @brief writes the body of a request to its place in the output file or
+ * buffer while it arrives
+ */
+class SegmentWriter : public RestClient::StreamConsumer {
+ public:
+    SegmentWriter(FILE* file, char* buffer, uint64_t capacity,
+                  uint64_t position, uint64_t remaining, bool exact,
+                  const RestClient::StreamResponse* response,
+                  int expectedStatus, std::atomic<uint64_t>* progress)
+      : file(file), buffer(buffer), capacity(capacity), position(position),
+        remaining(remaining), exact(exact), response(response),
+        expectedStatus(expectedStatus), progress(progress), written(0),
+        problem(NULL), problemCode(0) {
+    }
+
+    bool Consume(const char* data, size_t length) {
+      if (this->response->code != this->expectedStatus) {
+        // a 200 to a Range request with If-Range
+        return this->fail("The resource changed during the download",
+                          RestClient::kStreamAborted);
+      }
+      if (length > this->remaining) {
+        return this->fail("The server sent more than was asked for",
+                          RestClient::kStreamAborted);
+      }
+      if (this->buffer) {
+        if (this->position + length > this->capacity) {
+          return this->fail("The resource doesn't fit into the buffer",
+                            RestClient::kBodyTooLarge);
+        }
+        std::memcpy(this->buffer + this->position, data, length);
+      } else if ((this->written == 0 && !seek(this->file, this->position)) ||
+                 std::fwrite(data, 1, length, this->file) != length) {
+        return this->fail("Writing the output file failed", -1);
+      }
+      this->position += length;
+      this->remaining -= length;
+      this->written += length;
+      this->progress->fetch_add(length);
+      return true;
+    }
+
+    bool Finish() {
+      return !this->exact || this->remaining == 0;
+    }
+
+    uint64_t Written() const { return this->written; }
+    // why the download can't go on, NULL if a retry could fix it
+    const char* Problem() const { return this->problem; }
+    int ProblemCode() const { return this->problemCode; }
+
+ private:
+    bool fail(const char* message, int code) {
+      this->problem = message;
+      this->problemCode = code;
+      return false;
+    }
+
+    FILE* const file;
+    char* const buffer;
+    const uint64_t capacity;
+    uint64_t position;
+    uint64_t remaining;
+    const bool exact;
+    const RestClient::StreamResponse* const response;
+    const int expectedStatus;
+    std::atomic<uint64_t>* const progress;
+    uint64_t written;
+    const char* problem;
+    int problemCode;
+};
+
+}  // namespace
+
+RestClient::SegmentedDownload::SegmentedDownload(const std::string& baseUrl,
+                                                 size_t connections)
+  : segmentSize(8 << 20), maxAttempts(3), stateFileSet(false), length(0),
+    ranged(false), bytesDone(0), bytesResumed(0), retries(0), failed(false) {
+  this->baseUrl = baseUrl;
+  this->connections.resize(std::max<size_t>(connections, 1));
+  for (size_t i = 0; i < this->connections.size(); i++) {
+    this->connections[i].reset(new Connection(baseUrl));
+  }
+}
+
+RestClient::SegmentedDownload::~SegmentedDownload() {
+}
+
+void
+RestClient::SegmentedDownload::ForEachConnection(
+    const std::function<void(Connection*)>& fn) {
+  for (size_t i = 0; i < this->connections.size(); i++) {
+    fn(this->connections[i].get());
+  }
+}
+
+void
+RestClient::SegmentedDownload::SetSegmentSize(uint64_t bytes) {
+  this->segmentSize = std::max<uint64_t>(bytes, 1);
+}
+
+void
+RestClient::SegmentedDownload::SetMaxAttempts(int attempts) {
+  this->maxAttempts = std::max(attempts, 1);
+}
+
+void
+RestClient::SegmentedDownload::SetStateFile(const std::string& path) {
+  this->stateFileSet = true;
+  this->stateFile = path;
+}
+
+/**
+ * @brief download a resource into a file, resuming an earlier download
+ * of it if the state file says how far that got
+ *
+ * @param uri URI relative to the base URL
+ * @param path output file, created or overwritten unless resumed
+ *
+ * @return code 200 once the file is complete, the headers of the HEAD
+ */
+RestClient::Response
+RestClient::SegmentedDownload::Download(const std::string& uri,
+                                        const std::string& path) {
+  return this->run(uri, path, NULL, 0);
+}
+
+/**
+ * @brief download a resource into a buffer of the caller
+ *
+ * @param uri URI relative to the base URL
+ * @param buffer where the resource goes, e.g. a mapped file
+ * @param capacity size of the buffer
+ *
+ * @return code 200 once the buffer holds the resource, kBodyTooLarge if
+ * it didn't fit
+ */
+RestClient::Response
+RestClient::SegmentedDownload::Download(const std::string& uri, char* buffer,
+                                        size_t capacity) {
+  return this->run(uri, std::string(), buffer, capacity);
+}
+
+RestClient::Response
+RestClient::SegmentedDownload::run(const std::string& uri,
+                                   const std::string& path, char* buffer,
+                                   size_t capacity) {
+  this->length = 0;
+  this->bytesDone = 0;
+  this->bytesResumed = 0;
+  this->retries = 0;
+  this->failed = false;
+  this->result = RestClient::Response();
+  this->segments.clear();
+
+  RestClient::Response probe = this->connections[0]->head(uri);
+  if (probe.code < 200 || probe.code >= 300) {
+    return probe;
+  }
+  std::string contentLength = findHeader(probe.headers, "Content-Length");
+  bool hasLength = !contentLength.empty() &&
+                   std::isdigit(static_cast<unsigned char>(contentLength[0]));
+  // If-Range only takes strong validators (RFC 7233, 3.2), a server
+  // answers a weak ETag in it with the whole resource
+  std::string validator = findHeader(probe.headers, "ETag");
+  if (validator.empty() || validator.compare(0, 2, "W/") == 0) {
+    validator = findHeader(probe.headers, "Last-Modified");
+  }
+  this->ranged = hasLength && findHeader(probe.headers, "Accept-Ranges")
+                              .find("bytes") != std::string::npos;
+  this->length = hasLength ? std::strtoull(contentLength.c_str(), NULL, 10)
+                           : 0;
+  this->result.headers = probe.headers;
+  if (buffer && hasLength && this->length > capacity) {
+    this->result.code = RestClient::kBodyTooLarge;
+    this->result.body = "The resource doesn't fit into the buffer";
+    return this->result;
+  }
+
+  // resume only what is known to be the same resource
+  this->statePath = this->stateFileSet ? this->stateFile :
+                    (path.empty() ? std::string() : path + ".state");
+  const std::string url = this->baseUrl + uri;
+  bool resumed = this->ranged && !validator.empty() &&
+                 !this->statePath.empty() &&
+                 this->loadState(url, validator) &&
+                 (path.empty() ||
+                  fileSize(path) >= static_cast<int64_t>(this->length));
+  if (!resumed) {
+    this->segments.clear();
+    if (this->ranged) {
+      for (uint64_t offset = 0; offset < this->length;
+           offset += this->segmentSize) {
+        Segment segment = {offset, std::min(this->segmentSize,
+                                            this->length - offset), 0, 0,
+                           false};
+        this->segments.push_back(segment);
+      }
+    } else {
+      Segment segment = {0, hasLength ? this->length : kUnknownLength, 0, 0,
+                         false};
+      this->segments.push_back(segment);
+    }
+    if (!path.empty()) {
+      // the segments are written into a file of the final size
+      FILE* file = std::fopen(path.c_str(), "wb");
+      bool created = file != NULL;
+      if (file && this->ranged && this->length > 0) {
+        created = seek(file, this->length - 1) && std::fputc(0, file) != EOF;
+      }
+      if (file && std::fclose(file) != 0) {
+        created = false;
+      }
+      if (!created) {
+        this->result.code = -1;
+        this->result.body = "Can't create " + path;
+        return this->result;
+      }
+    }
+    if (this->ranged && !validator.empty() && !this->statePath.empty()) {
+      this->saveState(url, validator);
+    }
+  }
+  for (size_t i = 0; i < this->segments.size(); i++) {
+    this->bytesResumed += this->segments[i].done;
+  }
+  this->bytesDone = this->bytesResumed;
+
+  size_t pending = 0;
+  for (size_t i = 0; i < this->segments.size(); i++) {
+    if (this->segments[i].done < this->segments[i].length) {
+      pending++;
+    }
+  }
+  size_t workers = std::min(this->connections.size(), pending);
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < workers; i++) {
+    threads.push_back(std::thread(&RestClient::SegmentedDownload::work, this,
+                                  i, uri, validator, path, buffer, capacity,
+                                  url));
+  }
+  if (workers > 0) {
+    this->work(0, uri, validator, path, buffer, capacity, url);
+  }
+  for (size_t i = 0; i < threads.size(); i++) {
+    threads[i].join();
+  }
+
+  if (!this->failed) {
+    this->result.code = 200;
+    this->result.body.clear();
+    if (!this->statePath.empty()) {
+      std::remove(this->statePath.c_str());
+    }
+  }
+  return this->result;
+}
+
+/**
+ * @brief fetch segments with one of the connections until none are left
+ * or the download failed
+ */
+void
+RestClient::SegmentedDownload::work(size_t index, const std::string& uri,
+                                    const std::string& validator,
+                                    const std::string& path, char* buffer,
+                                    size_t capacity, const std::string& url) {
+  Connection* connection = this->connections[index].get();
+  RestClient::HeaderFields headers = connection->GetHeaders();
+  FILE* file = NULL;
+  if (!path.empty()) {
+    file = std::fopen(path.c_str(), "r+b");
+    if (!file) {
+      std::lock_guard<std::mutex> lock(this->mutex);
+      if (!this->failed) {
+        this->failed = true;
+        this->result.code = -1;
+        this->result.body = "Can't open " + path;
+      }
+      return;
+    }
+  }
+  size_t current;
+  while (this->nextSegment(&current)) {
+    uint64_t position, remaining;
+    {
+      std::lock_guard<std::mutex> lock(this->mutex);
+      const Segment& segment = this->segments[current];
+      position = segment.offset + segment.done;
+      remaining = segment.length - segment.done;
+    }
+    if (this->ranged) {
+      connection->AppendHeader("Range", "bytes=" + std::to_string(position) +
+                               "-" + std::to_string(position + remaining - 1));
+      if (!validator.empty()) {
+        connection->AppendHeader("If-Range", validator);
+      }
+    }
+    RestClient::StreamResponse response = {};
+    SegmentWriter writer(file, buffer, capacity, position, remaining,
+                         remaining != kUnknownLength, &response,
+                         this->ranged ? 206 : 200, &this->bytesDone);
+    response.consumer = &writer;
+    connection->get(uri, &response);
+    if (file) {
+      std::fflush(file);
+    }
+    int attempts = 0;
+    {
+      std::lock_guard<std::mutex> lock(this->mutex);
+      Segment& segment = this->segments[current];
+      segment.busy = false;
+      segment.done += writer.Written();
+      bool complete = response.code == (this->ranged ? 206 : 200);
+      if (!complete && !this->ranged) {
+        // without ranges a retry starts over
+        this->bytesDone -= segment.done;
+        segment.done = 0;
+      }
+      if (complete) {
+        segment.done = segment.length;
+      } else if (writer.Problem() || !retryable(response.code) ||
+                 ++segment.attempts >= this->maxAttempts) {
+        if (!this->failed) {
+          this->failed = true;
+          this->result.code = writer.Problem() ? writer.ProblemCode()
+                                               : response.code;
+          this->result.body = writer.Problem() ? writer.Problem()
+                                               : response.body;
+        }
+      } else {
+        this->retries++;
+        attempts = segment.attempts;
+      }
+      if (this->ranged && !validator.empty() && !this->statePath.empty()) {
+        this->saveState(url, validator);
+      }
+    }
+    if (attempts > 0) {
+      // back off a little before the segment is tried again
+      std::this_thread::sleep_for(std::chrono::milliseconds(50 * attempts));
+    }
+  }
+  connection->SetHeaders(headers);
+  if (file) {
+    std::fclose(file);
+  }
+}
+
+/**
+ * @brief claim the next segment that isn't complete and isn't being
+ * fetched
+ *
+ * @return false once there is none or the download failed
+ */
+bool
+RestClient::SegmentedDownload::nextSegment(size_t* index) {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  if (this->failed) {
+    return false;
+  }
+  for (size_t i = 0; i < this->segments.size(); i++) {
+    Segment& segment = this->segments[i];
+    if (!segment.busy && segment.done < segment.length) {
+      segment.busy = true;
+      *index = i;
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * @brief read the segments of an earlier download of the same resource
+ *
+ * @return false if there is no state file or it is for another URL,
+ * length or version of the resource
+ */
+bool
+RestClient::SegmentedDownload::loadState(const std::string& url,
+                                         const std::string& validator) {
+  FILE* file = std::fopen(this->statePath.c_str(), "rb");
+  if (!file) {
+    return false;
+  }
+  std::string line;
+  bool valid = readLine(file, &line) && line == kStateMagic &&
+               readLine(file, &line) && line == "url " + url &&
+               readLine(file, &line) &&
+               line == "length " + std::to_string(this->length) &&
+               readLine(file, &line) && line == "validator " + validator;
+  std::vector<Segment> loaded;
+  uint64_t next = 0;
+  while (valid && readLine(file, &line)) {
+    char* end = NULL;
+    Segment segment = {0, 0, 0, 0, false};
+    valid = line.compare(0, 8, "segment ") == 0;
+    if (valid) {
+      segment.offset = std::strtoull(line.c_str() + 8, &end, 10);
+      segment.length = std::strtoull(end, &end, 10);
+      segment.done = std::strtoull(end, &end, 10);
+      // the segments have to cover the resource in order
+      valid = segment.offset == next && segment.length > 0 &&
+              segment.done <= segment.length;
+      next = segment.offset + segment.length;
+      loaded.push_back(segment);
+    }
+  }
+  std::fclose(file);
+  if (!valid || next != this->length) {
+    return false;
+  }
+  this->segments.swap(loaded);
+  return true;
+}
+
+/**
+ * @brief write how far the segments got. Written to a temporary file that
+ * replaces the state file, so it is never half written.
+ */
+void
+RestClient::SegmentedDownload::saveState(const std::string& url,
+                                         const std::string& validator) {
+  std::string temporary = this->statePath + ".tmp";
+  FILE* file = std::fopen(temporary.c_str(), "wb");
+  if (!file) {
+    return;
+  }
+  std::string state = std::string(kStateMagic) + "\nurl " + url +
+                      "\nlength " + std::to_string(this->length) +
+                      "\nvalidator " + validator + "\n";
+  for (size_t i = 0; i < this->segments.size(); i++) {
+    const Segment& segment = this->segments[i];
+    state += "segment " + std::to_string(segment.offset) + " " +
+             std::to_string(segment.length) + " " +
+             std::to_string(segment.done) + "\n";
+  }
+  bool written = std::fwrite(state.data(), 1, state.size(), file) ==
+                 state.size();
+  if (std::fclose(file) != 0 || !written) {
+    std::remove(temporary.c_str());
+    return;
+  }
+#if defined(_WIN32)
+  std::remove(this->statePath.c_str());
+#endif
+  std::rename(temporary.c_str(), this->statePath.c_str());
+}
+
+uint64_t
+RestClient::SegmentedDownload::Length() const {
+  return this->length;
+}
+
+uint64_t
+RestClient::SegmentedDownload::BytesDone() const {
+  return this->bytesDone;
+}
+
+uint64_t
+RestClient::SegmentedDownload::BytesResumed() const {
+  return this->bytesResumed;
+}
+
+uint64_t
+RestClient::SegmentedDownload::Retries() const {
+  return this->retries;
+}
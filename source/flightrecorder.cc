@@ -0,0 +1,352 @@
+/**
+ * @file flightrecorder.cpp
+ * @brief implementation of the request flight recorder
+ * @author Daniel Schauenberg <d@unwiredcouch.com>
+ */
+
+#include "restclient-cpp/flightrecorder.h"
+
+#if defined(_WIN32)
+#include <io.h>
+#else
+#include <signal.h>
+#include <unistd.h>
+#endif
+
+#include <atomic>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+namespace {
+
+/**
+ * @brief tiny allocation free line builder. Everything in here has to stay
+ * async-signal-safe, which rules out snprintf and friends.
+ */
+struct LineBuffer {
+  char data[512];
+  size_t length;
+
+  LineBuffer() : length(0) {}
+
+  void append(const char* s) {
+    while (*s && this->length < sizeof(this->data) - 1) {
+      this->data[this->length++] = *s++;
+    }
+  }
+
+  void append(const char* s, size_t max) {
+    for (size_t i = 0; i < max && s[i]; i++) {
+      if (this->length >= sizeof(this->data) - 1) {
+        return;
+      }
+      this->data[this->length++] = s[i];
+    }
+  }
+
+  void append(int64_t value) {
+    char digits[24];
+    size_t n = 0;
+    bool negative = value < 0;
+    uint64_t v = negative ? static_cast<uint64_t>(-(value + 1)) + 1
+                          : static_cast<uint64_t>(value);
+    do {
+      digits[n++] = static_cast<char>('0' + v % 10);
+      v /= 10;
+    } while (v > 0);
+    if (negative) {
+      digits[n++] = '-';
+    }
+    while (n > 0 && this->length < sizeof(this->data) - 1) {
+      this->data[this->length++] = digits[--n];
+    }
+  }
+};
+
+void writeAll(int fd, const char* data, size_t length) {
+  while (length > 0) {
+#if defined(_WIN32)
+    int n = _write(fd, data, static_cast<unsigned int>(length));
+#else
+    ssize_t n = write(fd, data, length);
+#endif
+    if (n <= 0) {
+      return;
+    }
+    data += n;
+    length -= static_cast<size_t>(n);
+  }
+}
+
+bool isIdSegment(const char* begin, const char* end) {
+  size_t length = static_cast<size_t>(end - begin);
+  if (length == 0) {
+    return false;
+  }
+  bool digits = true;
+  bool hex = true;
+  for (const char* c = begin; c != end; ++c) {
+    if (*c < '0' || *c > '9') {
+      digits = false;
+    }
+    if (!((*c >= '0' && *c <= '9') || (*c >= 'a' && *c <= 'f') ||
+          (*c >= 'A' && *c <= 'F') || *c == '-')) {
+      hex = false;
+    }
+  }
+  return digits || (hex && length >= 8);
+}
+
+size_t roundUpToPowerOfTwo(size_t n) {
+  size_t ret = 1;
+  while (ret < n) {
+    ret <<= 1;
+  }
+  return ret;
+}
+
+#if !defined(_WIN32)
+std::atomic<int> signalFd(-1);
+
+void dumpOnSignal(int) {
+  RestClient::FlightRecorder::Default().DumpTo(signalFd.load());
+}
+#endif
+
+}  // namespace
+
+/**
+ * @brief constructor for the FlightRecorder
+ *
+ * @param capacity - number of records to keep, rounded up to the next power
+ * of two
+ */
+RestClient::FlightRecorder::FlightRecorder(size_t capacity)
+  : capacity(roundUpToPowerOfTwo(capacity > 0 ? capacity : 1)),
+    mask(roundUpToPowerOfTwo(capacity > 0 ? capacity : 1) - 1),
+    slots(new Slot[roundUpToPowerOfTwo(capacity > 0 ? capacity : 1)]),
+    head(0) {
+  for (size_t i = 0; i < this->capacity; i++) {
+    this->slots[i].sequence.store(0, std::memory_order_relaxed);
+    std::memset(&this->slots[i].record, 0, sizeof(FlightRecord));
+  }
+}
+
+RestClient::FlightRecorder::~FlightRecorder() {
+}
+
+/**
+ * @brief get the process wide recorder
+ *
+ * @return default recorder
+ */
+RestClient::FlightRecorder&
+RestClient::FlightRecorder::Default() {
+  static FlightRecorder recorder;
+  return recorder;
+}
+
+/**
+ * @brief add a record. The slot is marked as being written (odd sequence)
+ * before and published (even sequence) after copying the record, so readers
+ * can detect torn reads.
+ *
+ * @param record to add
+ */
+void
+RestClient::FlightRecorder::Record(const FlightRecord& record) {
+  uint64_t ticket = this->head.fetch_add(1, std::memory_order_relaxed);
+  Slot& slot = this->slots[ticket & this->mask];
+  slot.sequence.store(2 * ticket + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  std::memcpy(&slot.record, &record, sizeof(FlightRecord));
+  slot.record.sequence = ticket;
+  slot.sequence.store(2 * ticket + 2, std::memory_order_release);
+}
+
+/**
+ * @brief read the record with the given ticket if it is complete and has not
+ * been overwritten
+ *
+ * @param ticket sequence number of the record
+ * @param out record to fill
+ *
+ * @return true if out holds a consistent copy
+ */
+bool
+RestClient::FlightRecorder::read(uint64_t ticket, FlightRecord* out) const {
+  const Slot& slot = this->slots[ticket & this->mask];
+  uint64_t before = slot.sequence.load(std::memory_order_acquire);
+  if (before != 2 * ticket + 2) {
+    return false;
+  }
+  std::memcpy(out, &slot.record, sizeof(FlightRecord));
+  std::atomic_thread_fence(std::memory_order_acquire);
+  return slot.sequence.load(std::memory_order_relaxed) == before;
+}
+
+/**
+ * @brief copy all complete records
+ *
+ * @return records, oldest first
+ */
+std::vector<RestClient::FlightRecord>
+RestClient::FlightRecorder::Dump() const {
+  std::vector<FlightRecord> ret;
+  uint64_t end = this->head.load(std::memory_order_acquire);
+  uint64_t start = end > this->capacity ? end - this->capacity : 0;
+  ret.reserve(static_cast<size_t>(end - start));
+  FlightRecord record;
+  for (uint64_t ticket = start; ticket < end; ticket++) {
+    if (this->read(ticket, &record)) {
+      ret.push_back(record);
+    }
+  }
+  return ret;
+}
+
+/**
+ * @brief write all complete records as one text line each, oldest first.
+ * This neither allocates nor locks and may be called from a signal handler.
+ *
+ * @param fd file descriptor to write to
+ */
+void
+RestClient::FlightRecorder::DumpTo(int fd) const {
+  if (fd < 0) {
+    return;
+  }
+  uint64_t end = this->head.load(std::memory_order_acquire);
+  uint64_t start = end > this->capacity ? end - this->capacity : 0;
+  FlightRecord r;
+  for (uint64_t ticket = start; ticket < end; ticket++) {
+    if (!this->read(ticket, &r)) {
+      continue;
+    }
+    LineBuffer line;
+    line.append("seq=");
+    line.append(static_cast<int64_t>(r.sequence));
+    line.append(" ts_us=");
+    line.append(r.timestamp);
+    line.append(" ");
+    line.append(r.method, sizeof(r.method));
+    line.append(" ");
+    line.append(r.url, sizeof(r.url));
+    line.append(" status=");
+    line.append(static_cast<int64_t>(r.statusCode));
+    line.append(" curl=");
+    line.append(static_cast<int64_t>(r.curlCode));
+    line.append(" total_us=");
+    line.append(r.totalTime);
+    line.append(" dns_us=");
+    line.append(r.nameLookupTime);
+    line.append(" connect_us=");
+    line.append(r.connectTime);
+    line.append(" ttfb_us=");
+    line.append(r.startTransferTime);
+    line.append(" up=");
+    line.append(static_cast<int64_t>(r.requestBytes));
+    line.append(" down=");
+    line.append(static_cast<int64_t>(r.responseBytes));
+    line.data[line.length++] = '\n';
+    writeAll(fd, line.data, line.length);
+  }
+}
+
+/**
+ * @brief get the number of records ever recorded, including overwritten ones
+ *
+ * @return number of records
+ */
+uint64_t
+RestClient::FlightRecorder::Recorded() const {
+  return this->head.load(std::memory_order_relaxed);
+}
+
+/**
+ * @brief get the number of records the recorder keeps
+ *
+ * @return capacity
+ */
+size_t
+RestClient::FlightRecorder::Capacity() const {
+  return this->capacity;
+}
+
+/**
+ * @brief install a handler that dumps the default recorder to fd when signum
+ * is received (e.g. SIGUSR2 and STDERR_FILENO). Not available on Windows.
+ *
+ * @param signum signal to handle
+ * @param fd file descriptor to dump to
+ *
+ * @return true if the handler was installed
+ */
+bool
+RestClient::FlightRecorder::InstallSignalHandler(int signum, int fd) {
+#if defined(_WIN32)
+  return false;
+#else
+  // make sure the default recorder exists before the first signal arrives
+  Default();
+  signalFd.store(fd);
+  struct sigaction action;
+  std::memset(&action, 0, sizeof(action));
+  action.sa_handler = dumpOnSignal;
+  sigemptyset(&action.sa_mask);
+  action.sa_flags = SA_RESTART;
+  return sigaction(signum, &action, NULL) == 0;
+#endif
+}
+
+/**
+ * @brief build the template of a URL without allocating
+ *
+ * @param url to turn into a template
+ * @param out buffer to write the NUL terminated template to
+ * @param size of out
+ */
+void
+RestClient::FlightRecorder::UrlTemplate(const char* url, char* out,
+                                        size_t size) {
+  if (size == 0) {
+    return;
+  }
+  size_t n = 0;
+  const char* p = url;
+  // copy scheme and host verbatim, leaving out user name and password
+  const char* scheme = std::strstr(url, "://");
+  const char* authority = scheme ? scheme + 3 : url;
+  const char* pathStart = authority + std::strcspn(authority, "/?#");
+  for (const char* c = authority; c != pathStart; ++c) {
+    if (*c == '@') {
+      authority = c + 1;
+    }
+  }
+  for (; scheme && p != scheme + 3 && n < size - 1; ++p) {
+    out[n++] = *p;
+  }
+  for (p = authority; p != pathStart && n < size - 1; ++p) {
+    out[n++] = *p;
+  }
+  // copy path segments, replacing ids
+  while (*p && *p != '?' && *p != '#' && n < size - 1) {
+    if (*p == '/') {
+      out[n++] = *p++;
+      continue;
+    }
+    const char* segmentEnd = p + std::strcspn(p, "/?#");
+    if (isIdSegment(p, segmentEnd)) {
+      for (const char* id = ":id"; *id && n < size - 1; ++id) {
+        out[n++] = *id;
+      }
+    } else {
+      for (const char* c = p; c != segmentEnd && n < size - 1; ++c) {
+        out[n++] = *c;
+      }
+    }
+    p = segmentEnd;
+  }
+  out[n] = '\0';
+}
@@ -0,0 +1,174 @@
+/**
+ * @file headers.cc
+ * @brief implementation of the response header block
+ * @author Daniel Schauenberg <d@unwiredcouch.com>
+ */
+
+#include "restclient-cpp/headers.h"
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace {
+
+bool isSpace(char c) {
+  return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+char lower(char c) {
+  return (c >= 'A' && c <= 'Z') ? static_cast<char>(c - 'A' + 'a') : c;
+}
+
+bool equalsIgnoreCase(const char* a, const char* b, size_t length) {
+  for (size_t i = 0; i < length; i++) {
+    if (lower(a[i]) != lower(b[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+RestClient::HeaderBlock::HeaderBlock() {
+}
+
+/**
+ * @brief add a raw header line
+ *
+ * @param line - header line, with or without the trailing CRLF
+ * @param length - length of the line
+ *
+ */
+void
+RestClient::HeaderBlock::AddLine(const char* line, size_t length) {
+  if (length >= 5 && std::memcmp(line, "HTTP/", 5) == 0) {
+    this->Clear();
+    return;
+  }
+  const char* colon = static_cast<const char*>(
+      std::memchr(line, ':', length));
+  if (!colon) {
+    return;
+  }
+  const char* end = line + length;
+  const char* name = line;
+  const char* nameEnd = colon;
+  while (name < nameEnd && isSpace(*name)) {
+    name++;
+  }
+  while (nameEnd > name && isSpace(nameEnd[-1])) {
+    nameEnd--;
+  }
+  const char* value = colon + 1;
+  while (value < end && isSpace(*value)) {
+    value++;
+  }
+  while (end > value && isSpace(end[-1])) {
+    end--;
+  }
+
+  if (this->fields.capacity() == 0) {
+    // room for a typical response, instead of growing step by step
+    this->fields.reserve(16);
+    this->raw.reserve(1024);
+  }
+  uint32_t offset = static_cast<uint32_t>(this->raw.size());
+  this->raw.append(line, length);
+  Field field;
+  field.name = offset + static_cast<uint32_t>(name - line);
+  field.nameLength = static_cast<uint32_t>(nameEnd - name);
+  field.value = offset + static_cast<uint32_t>(value - line);
+  field.valueLength = static_cast<uint32_t>(end - value);
+  this->fields.push_back(field);
+}
+
+void
+RestClient::HeaderBlock::Clear() {
+  this->raw.clear();
+  this->fields.clear();
+}
+
+size_t
+RestClient::HeaderBlock::Size() const {
+  return this->fields.size();
+}
+
+bool
+RestClient::HeaderBlock::Empty() const {
+  return this->fields.empty();
+}
+
+std::string
+RestClient::HeaderBlock::Name(size_t index) const {
+  const Field& field = this->fields[index];
+  return this->raw.substr(field.name, field.nameLength);
+}
+
+std::string
+RestClient::HeaderBlock::Value(size_t index) const {
+  const Field& field = this->fields[index];
+  return this->raw.substr(field.value, field.valueLength);
+}
+
+const char*
+RestClient::HeaderBlock::NameData(size_t index, size_t* length) const {
+  const Field& field = this->fields[index];
+  *length = field.nameLength;
+  return this->raw.data() + field.name;
+}
+
+const char*
+RestClient::HeaderBlock::ValueData(size_t index, size_t* length) const {
+  const Field& field = this->fields[index];
+  *length = field.valueLength;
+  return this->raw.data() + field.value;
+}
+
+/**
+ * @brief find a field by name, ignoring case
+ *
+ * @param name - field name
+ * @param start - index to start searching at
+ *
+ * @return index of the field, Size() if not found
+ */
+size_t
+RestClient::HeaderBlock::Find(const std::string& name, size_t start) const {
+  for (size_t i = start; i < this->fields.size(); i++) {
+    const Field& field = this->fields[i];
+    if (field.nameLength == name.size() &&
+        equalsIgnoreCase(this->raw.data() + field.name, name.data(),
+                         name.size())) {
+      return i;
+    }
+  }
+  return this->fields.size();
+}
+
+bool
+RestClient::HeaderBlock::Has(const std::string& name) const {
+  return this->Find(name) < this->fields.size();
+}
+
+std::string
+RestClient::HeaderBlock::Get(const std::string& name) const {
+  size_t i = this->Find(name);
+  return i < this->fields.size() ? this->Value(i) : std::string();
+}
+
+std::vector<std::string>
+RestClient::HeaderBlock::GetAll(const std::string& name) const {
+  std::vector<std::string> ret;
+  for (size_t i = this->Find(name); i < this->fields.size();
+       i = this->Find(name, i + 1)) {
+    ret.push_back(this->Value(i));
+  }
+  return ret;
+}
+
+const std::string&
+RestClient::HeaderBlock::Raw() const {
+  return this->raw;
+}
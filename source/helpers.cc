@@ -10,6 +10,7 @@
 #include <string>
 
 #include "restclient-cpp/restclient.h"
+#include "probes.h"
 
 /**
  * @brief write callback function for libcurl
@@ -25,6 +26,9 @@ size_t RestClient::Helpers::write_callback(void *data, size_t size,
                                            size_t nmemb, void *userdata) {
   RestClient::Response* r;
   r = reinterpret_cast<RestClient::Response*>(userdata);
+  if (r->body.empty()) {
+    RESTCLIENT_PROBE2(first__byte, r, size*nmemb);
+  }
   r->body.append(reinterpret_cast<char*>(data), size*nmemb);
 
   return (size * nmemb);
@@ -49,7 +53,9 @@ size_t RestClient::Helpers::header_callback(void *data, size_t size,
     // roll with non seperated headers...
     trim(header);
     if (0 == header.length()) {
-      return (size * nmemb);  // blank line;
+      // blank line, marks the end of the header block
+      RESTCLIENT_PROBE2(headers__received, r, r->headers.size());
+      return (size * nmemb);
     }
     r->headers[header] = "present";
   } else {
@@ -0,0 +1,652 @@
+/**
+ * @file json.cc
+ * @brief implementation of the incremental JSON parser
+ * @author Daniel Schauenberg <d@unwiredcouch.com>
+ */
+
+#include "restclient-cpp/json.h"
+
+#include <cstdlib>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace {
+
+bool isSpace(char c) {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+bool isDigit(char c) {
+  return c >= '0' && c <= '9';
+}
+
+bool isNumberChar(char c) {
+  return isDigit(c) || c == '-' || c == '+' || c == '.' || c == 'e' ||
+         c == 'E';
+}
+
+/**
+ * @brief check a number against the JSON grammar,
+ * -?(0|[1-9][0-9]*)(\.[0-9]+)?([eE][+-]?[0-9]+)?
+ */
+bool validNumber(const std::string& number) {
+  const char* p = number.c_str();
+  if (*p == '-') {
+    p++;
+  }
+  if (*p == '0') {
+    p++;
+  } else if (isDigit(*p)) {
+    while (isDigit(*p)) {
+      p++;
+    }
+  } else {
+    return false;
+  }
+  if (*p == '.') {
+    p++;
+    if (!isDigit(*p)) {
+      return false;
+    }
+    while (isDigit(*p)) {
+      p++;
+    }
+  }
+  if (*p == 'e' || *p == 'E') {
+    p++;
+    if (*p == '+' || *p == '-') {
+      p++;
+    }
+    if (!isDigit(*p)) {
+      return false;
+    }
+    while (isDigit(*p)) {
+      p++;
+    }
+  }
+  return *p == '\0';
+}
+
+int hexValue(char c) {
+  if (isDigit(c)) {
+    return c - '0';
+  }
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+
+}  // namespace
+
+RestClient::JsonParser::JsonParser(JsonHandler* handler, size_t maxDepth)
+  : handler(handler), maxDepth(maxDepth), state(State::Value),
+    tokenIsKey(false), escapeState(0), codeUnit(0), highSurrogate(0),
+    literal(NULL), literalPosition(0), offset(0), chunk(NULL),
+    chunkOffset(0) {
+}
+
+/**
+ * @brief start over with a new document. Keeps the capacity of the buffers.
+ */
+void
+RestClient::JsonParser::Reset() {
+  this->state = State::Value;
+  this->stack.clear();
+  this->token.clear();
+  this->escapeState = 0;
+  this->highSurrogate = 0;
+  this->offset = 0;
+  this->error.clear();
+}
+
+bool
+RestClient::JsonParser::Done() const {
+  return this->state == State::Done;
+}
+
+bool
+RestClient::JsonParser::Failed() const {
+  return this->state == State::Failed;
+}
+
+const std::string&
+RestClient::JsonParser::Error() const {
+  return this->error;
+}
+
+uint64_t
+RestClient::JsonParser::Offset() const {
+  return this->offset;
+}
+
+/**
+ * @brief offset of a byte in the current piece within the document
+ */
+uint64_t
+RestClient::JsonParser::at(const char* p) const {
+  return this->chunkOffset + (p - this->chunk);
+}
+
+/**
+ * @brief parse the next piece of the document
+ *
+ * @param data - piece of the document, may end anywhere
+ * @param length - its length
+ *
+ * @return false if the document is invalid or the handler stopped
+ */
+bool
+RestClient::JsonParser::Consume(const char* data, size_t length) {
+  this->chunk = data;
+  this->chunkOffset = this->offset;
+  const char* p = data;
+  const char* end = data + length;
+  while (p < end && this->state != State::Failed) {
+    if (this->state == State::String) {
+      p = this->string(p, end);
+      continue;
+    }
+    const char c = *p;
+    if (this->state == State::Number) {
+      if (isNumberChar(c)) {
+        this->token.push_back(c);
+        p++;
+      } else {
+        // c belongs to whatever follows the number
+        this->endNumber(this->at(p));
+      }
+      continue;
+    }
+    if (this->state == State::Literal) {
+      if (c != this->literal[this->literalPosition]) {
+        this->fail("Invalid literal", this->at(p));
+        continue;
+      }
+      p++;
+      if (this->literal[++this->literalPosition] == '\0') {
+        bool ok = this->literal[0] == 'n' ? this->handler->Null() :
+                  this->handler->Bool(this->literal[0] == 't');
+        if (ok) {
+          this->valueDone();
+        } else {
+          this->stopped(this->at(p));
+        }
+      }
+      continue;
+    }
+    if (isSpace(c)) {
+      p++;
+      continue;
+    }
+    const uint64_t position = this->at(p);
+    p++;
+    switch (this->state) {
+      case State::Value:
+        this->startValue(c, position);
+        break;
+      case State::ValueOrEnd:
+        if (c == ']') {
+          this->endContainer(c, position);
+        } else {
+          this->startValue(c, position);
+        }
+        break;
+      case State::KeyOrEnd:
+        if (c == '}') {
+          this->endContainer(c, position);
+        } else if (c == '"') {
+          this->beginString(true);
+        } else {
+          this->fail("Expected a key or '}'", position);
+        }
+        break;
+      case State::Key:
+        if (c == '"') {
+          this->beginString(true);
+        } else {
+          this->fail("Expected a key", position);
+        }
+        break;
+      case State::Colon:
+        if (c == ':') {
+          this->state = State::Value;
+        } else {
+          this->fail("Expected ':'", position);
+        }
+        break;
+      case State::CommaOrEnd:
+        if (c == ',') {
+          this->state = this->stack.back() == '{' ? State::Key : State::Value;
+        } else if ((c == '}' && this->stack.back() == '{') ||
+                   (c == ']' && this->stack.back() == '[')) {
+          this->endContainer(c, position);
+        } else {
+          this->fail("Expected ',' or the end of the container", position);
+        }
+        break;
+      case State::Done:
+        this->fail("Unexpected data after the document", position);
+        break;
+      default:
+        break;
+    }
+  }
+  if (this->state == State::Failed) {
+    return false;
+  }
+  this->offset = this->chunkOffset + length;
+  return true;
+}
+
+/**
+ * @brief the document ended
+ *
+ * @return false if it was incomplete or invalid
+ */
+bool
+RestClient::JsonParser::Finish() {
+  if (this->state == State::Number) {
+    // a number only ends with the next character or the document
+    this->endNumber(this->offset);
+  }
+  if (this->state == State::Failed) {
+    return false;
+  }
+  if (this->state != State::Done) {
+    return this->fail("Unexpected end of the document", this->offset);
+  }
+  return true;
+}
+
+bool
+RestClient::JsonParser::startValue(char c, uint64_t position) {
+  switch (c) {
+    case '{':
+    case '[':
+      if (this->stack.size() >= this->maxDepth) {
+        return this->fail("Nesting too deep", position);
+      }
+      this->stack.push_back(c);
+      if (!(c == '{' ? this->handler->StartObject() :
+                       this->handler->StartArray())) {
+        return this->stopped(position);
+      }
+      this->state = c == '{' ? State::KeyOrEnd : State::ValueOrEnd;
+      return true;
+    case '"':
+      this->beginString(false);
+      return true;
+    case 't':
+      this->literal = "true";
+      break;
+    case 'f':
+      this->literal = "false";
+      break;
+    case 'n':
+      this->literal = "null";
+      break;
+    default:
+      if (c == '-' || isDigit(c)) {
+        this->token.assign(1, c);
+        this->state = State::Number;
+        return true;
+      }
+      return this->fail("Unexpected character", position);
+  }
+  this->literalPosition = 1;
+  this->state = State::Literal;
+  return true;
+}
+
+bool
+RestClient::JsonParser::endContainer(char c, uint64_t position) {
+  this->stack.pop_back();
+  if (!(c == '}' ? this->handler->EndObject() : this->handler->EndArray())) {
+    return this->stopped(position);
+  }
+  this->valueDone();
+  return true;
+}
+
+void
+RestClient::JsonParser::valueDone() {
+  this->state = this->stack.empty() ? State::Done : State::CommaOrEnd;
+}
+
+void
+RestClient::JsonParser::beginString(bool isKey) {
+  this->token.clear();
+  this->tokenIsKey = isKey;
+  this->escapeState = 0;
+  this->highSurrogate = 0;
+  this->state = State::String;
+}
+
+/**
+ * @brief read a string up to its end or the end of the piece. Runs of
+ * plain characters are copied at once.
+ *
+ * @return where parsing continues
+ */
+const char*
+RestClient::JsonParser::string(const char* p, const char* end) {
+  while (p < end) {
+    if (this->escapeState != 0) {
+      if (!this->escape(*p, this->at(p))) {
+        return end;
+      }
+      p++;
+      continue;
+    }
+    const char* run = p;
+    while (p < end && *p != '"' && *p != '\\' &&
+           static_cast<unsigned char>(*p) >= 0x20) {
+      p++;
+    }
+    if (p > run) {
+      this->flushSurrogate();
+      this->token.append(run, p - run);
+    }
+    if (p == end) {
+      break;
+    }
+    if (*p == '\\') {
+      this->escapeState = 1;
+      p++;
+      continue;
+    }
+    if (*p != '"') {
+      this->fail("Control character in string", this->at(p));
+      return end;
+    }
+    this->flushSurrogate();
+    p++;
+    bool ok = this->tokenIsKey ?
+              this->handler->Key(this->token.data(), this->token.size()) :
+              this->handler->String(this->token.data(), this->token.size());
+    if (!ok) {
+      this->stopped(this->at(p - 1));
+      return end;
+    }
+    if (this->tokenIsKey) {
+      this->state = State::Colon;
+    } else {
+      this->valueDone();
+    }
+    return p;
+  }
+  return p;
+}
+
+/**
+ * @brief handle a character of an escape sequence. Unpaired surrogates of
+ * \\u escapes become U+FFFD.
+ */
+bool
+RestClient::JsonParser::escape(char c, uint64_t position) {
+  if (this->escapeState == 1) {
+    char unescaped;
+    switch (c) {
+      case '"': unescaped = '"'; break;
+      case '\\': unescaped = '\\'; break;
+      case '/': unescaped = '/'; break;
+      case 'b': unescaped = '\b'; break;
+      case 'f': unescaped = '\f'; break;
+      case 'n': unescaped = '\n'; break;
+      case 'r': unescaped = '\r'; break;
+      case 't': unescaped = '\t'; break;
+      case 'u':
+        this->escapeState = 2;
+        this->codeUnit = 0;
+        return true;
+      default:
+        return this->fail("Invalid escape", position);
+    }
+    this->flushSurrogate();
+    this->token.push_back(unescaped);
+    this->escapeState = 0;
+    return true;
+  }
+  int value = hexValue(c);
+  if (value < 0) {
+    return this->fail("Invalid \\u escape", position);
+  }
+  this->codeUnit = (this->codeUnit << 4) | value;
+  if (++this->escapeState < 6) {
+    return true;
+  }
+  this->escapeState = 0;
+  if (this->codeUnit >= 0xD800 && this->codeUnit <= 0xDBFF) {
+    this->flushSurrogate();
+    this->highSurrogate = this->codeUnit;
+  } else if (this->codeUnit >= 0xDC00 && this->codeUnit <= 0xDFFF) {
+    if (this->highSurrogate != 0) {
+      this->appendCodePoint(0x10000 + ((this->highSurrogate - 0xD800) << 10) +
+                            (this->codeUnit - 0xDC00));
+      this->highSurrogate = 0;
+    } else {
+      this->appendCodePoint(0xFFFD);
+    }
+  } else {
+    this->flushSurrogate();
+    this->appendCodePoint(this->codeUnit);
+  }
+  return true;
+}
+
+bool
+RestClient::JsonParser::endNumber(uint64_t position) {
+  if (!validNumber(this->token)) {
+    return this->fail("Invalid number", position - this->token.size());
+  }
+  double value = std::strtod(this->token.c_str(), NULL);
+  if (!this->handler->Number(value, this->token.data(), this->token.size())) {
+    return this->stopped(position);
+  }
+  this->valueDone();
+  return true;
+}
+
+/**
+ * @brief append a code point to the token as UTF-8
+ */
+void
+RestClient::JsonParser::appendCodePoint(uint32_t codePoint) {
+  if (codePoint < 0x80) {
+    this->token.push_back(static_cast<char>(codePoint));
+  } else if (codePoint < 0x800) {
+    this->token.push_back(static_cast<char>(0xC0 | (codePoint >> 6)));
+    this->token.push_back(static_cast<char>(0x80 | (codePoint & 0x3F)));
+  } else if (codePoint < 0x10000) {
+    this->token.push_back(static_cast<char>(0xE0 | (codePoint >> 12)));
+    this->token.push_back(static_cast<char>(0x80 |
+                                            ((codePoint >> 6) & 0x3F)));
+    this->token.push_back(static_cast<char>(0x80 | (codePoint & 0x3F)));
+  } else {
+    this->token.push_back(static_cast<char>(0xF0 | (codePoint >> 18)));
+    this->token.push_back(static_cast<char>(0x80 |
+                                            ((codePoint >> 12) & 0x3F)));
+    this->token.push_back(static_cast<char>(0x80 |
+                                            ((codePoint >> 6) & 0x3F)));
+    this->token.push_back(static_cast<char>(0x80 | (codePoint & 0x3F)));
+  }
+}
+
+/**
+ * @brief a high surrogate that isn't followed by a low one
+ */
+void
+RestClient::JsonParser::flushSurrogate() {
+  if (this->highSurrogate != 0) {
+    this->appendCodePoint(0xFFFD);
+    this->highSurrogate = 0;
+  }
+}
+
+bool
+RestClient::JsonParser::fail(const char* message, uint64_t position) {
+  this->state = State::Failed;
+  this->error.assign(message);
+  this->offset = position;
+  return false;
+}
+
+bool
+RestClient::JsonParser::stopped(uint64_t position) {
+  return this->fail("Stopped by the handler", position);
+}
+
+RestClient::JsonValue::JsonValue()
+  : type(Type::Null), boolean(false), number(0) {
+}
+
+/**
+ * @brief look up a member of an object
+ *
+ * @param key - member name
+ *
+ * @return first member with that key, NULL if there is none
+ */
+const RestClient::JsonValue*
+RestClient::JsonValue::Find(const std::string& key) const {
+  for (std::vector<std::pair<std::string, JsonValue> >::const_iterator it =
+      this->members.begin(); it != this->members.end(); ++it) {
+    if (it->first == key) {
+      return &it->second;
+    }
+  }
+  return NULL;
+}
+
+size_t
+RestClient::JsonValue::Size() const {
+  return this->type == Type::Object ? this->members.size() :
+                                      this->elements.size();
+}
+
+void
+RestClient::JsonValue::Clear() {
+  this->type = Type::Null;
+  this->boolean = false;
+  this->number = 0;
+  this->string.clear();
+  this->elements.clear();
+  this->members.clear();
+}
+
+RestClient::JsonDomBuilder::JsonDomBuilder(JsonValue* root)
+  : root(root), arrayDepth(0), callback() {
+}
+
+RestClient::JsonDomBuilder::JsonDomBuilder(JsonValue* root,
+                                           size_t arrayDepth,
+                                           const ElementCallback& callback)
+  : root(root), arrayDepth(arrayDepth), callback(callback) {
+}
+
+void
+RestClient::JsonDomBuilder::Reset() {
+  this->stack.clear();
+  this->key.clear();
+  this->root->Clear();
+}
+
+/**
+ * @brief add a value to the open container, or make it the root
+ *
+ * @return the new value, valid until its container grows again
+ */
+RestClient::JsonValue*
+RestClient::JsonDomBuilder::add(JsonValue::Type type) {
+  JsonValue* value;
+  if (this->stack.empty()) {
+    this->root->Clear();
+    value = this->root;
+  } else if (this->stack.back()->type == JsonValue::Type::Array) {
+    this->stack.back()->elements.push_back(JsonValue());
+    value = &this->stack.back()->elements.back();
+  } else {
+    this->stack.back()->members.push_back(
+        std::make_pair(this->key, JsonValue()));
+    value = &this->stack.back()->members.back().second;
+  }
+  value->type = type;
+  return value;
+}
+
+/**
+ * @brief hand a completed element of a streamed array to the callback
+ */
+bool
+RestClient::JsonDomBuilder::elementDone() {
+  if (!this->callback || this->stack.size() != this->arrayDepth + 1 ||
+      this->stack.back()->type != JsonValue::Type::Array) {
+    return true;
+  }
+  std::vector<JsonValue>& elements = this->stack.back()->elements;
+  bool ok = this->callback(elements.back());
+  elements.pop_back();
+  return ok;
+}
+
+bool
+RestClient::JsonDomBuilder::Null() {
+  this->add(JsonValue::Type::Null);
+  return this->elementDone();
+}
+
+bool
+RestClient::JsonDomBuilder::Bool(bool value) {
+  this->add(JsonValue::Type::Bool)->boolean = value;
+  return this->elementDone();
+}
+
+bool
+RestClient::JsonDomBuilder::Number(double value, const char* text,
+                                   size_t length) {
+  JsonValue* number = this->add(JsonValue::Type::Number);
+  number->number = value;
+  number->string.assign(text, length);
+  return this->elementDone();
+}
+
+bool
+RestClient::JsonDomBuilder::String(const char* value, size_t length) {
+  this->add(JsonValue::Type::String)->string.assign(value, length);
+  return this->elementDone();
+}
+
+bool
+RestClient::JsonDomBuilder::StartObject() {
+  this->stack.push_back(this->add(JsonValue::Type::Object));
+  return true;
+}
+
+bool
+RestClient::JsonDomBuilder::Key(const char* name, size_t length) {
+  this->key.assign(name, length);
+  return true;
+}
+
+bool
+RestClient::JsonDomBuilder::EndObject() {
+  this->stack.pop_back();
+  return this->elementDone();
+}
+
+bool
+RestClient::JsonDomBuilder::StartArray() {
+  this->stack.push_back(this->add(JsonValue::Type::Array));
+  return true;
+}
+
+bool
+RestClient::JsonDomBuilder::EndArray() {
+  this->stack.pop_back();
+  return this->elementDone();
+}
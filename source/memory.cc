@@ -0,0 +1,339 @@
+/**
+ * @file memory.cc
+ * @brief implementation of the allocators for libcurl's memory
+ * @author Daniel Schauenberg <d@unwiredcouch.com>
+ */
+
+#include "restclient-cpp/memory.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>  // NOLINT(build/c++11)
+#include <thread>  // NOLINT(build/c++11)
+#include <vector>
+
+namespace {
+
+// every block starts with a header holding its size, padded so the memory
+// after it keeps the alignment malloc guarantees
+const size_t kHeaderSize = alignof(std::max_align_t) > sizeof(size_t) ?
+                           alignof(std::max_align_t) : sizeof(size_t);
+
+void* withHeader(void* block, size_t size) {
+  if (!block) {
+    return NULL;
+  }
+  *static_cast<size_t*>(block) = size;
+  return static_cast<char*>(block) + kHeaderSize;
+}
+
+void* headerOf(void* p) {
+  return static_cast<char*>(p) - kHeaderSize;
+}
+
+size_t sizeOf(void* p) {
+  return *static_cast<size_t*>(headerOf(p));
+}
+
+/**
+ * @brief size class of an allocation, PoolAllocator::kClasses if it is too
+ * large for the pool
+ */
+size_t classOf(size_t size) {
+  size_t index = 0;
+  size_t blockSize = RestClient::PoolAllocator::kMinBlockSize;
+  while (blockSize < size && index < RestClient::PoolAllocator::kClasses) {
+    blockSize <<= 1;
+    index++;
+  }
+  return index;
+}
+
+size_t classSize(size_t index) {
+  return RestClient::PoolAllocator::kMinBlockSize << index;
+}
+
+// source of allocator ids, so thread local caches never confuse a
+// destroyed allocator with a new one at the same address
+std::atomic<uint64_t> nextAccountingId(1);
+
+/**
+ * @brief per thread cache of the counters last used, so that counting an
+ * allocation needs neither a lock nor a map lookup
+ */
+struct LocalCache {
+  uint64_t allocator;
+  void* counters;
+};
+
+thread_local LocalCache localCache = {0, NULL};
+
+void bump(std::atomic<uint64_t>* counter, uint64_t value) {
+  // only the owning thread writes, see Metrics::Histogram
+  counter->store(counter->load(std::memory_order_relaxed) + value,
+                 std::memory_order_relaxed);
+}
+
+}  // namespace
+
+RestClient::MemoryAllocator::~MemoryAllocator() {
+}
+
+RestClient::PoolAllocator::PoolAllocator(size_t maxCachedBlocks)
+  : maxCachedBlocks(maxCachedBlocks), hits(0), misses(0) {
+  // caching a block must not allocate
+  for (size_t i = 0; i < kClasses; i++) {
+    this->classes[i].blocks.reserve(maxCachedBlocks);
+  }
+}
+
+RestClient::PoolAllocator::~PoolAllocator() {
+  this->Trim();
+}
+
+/**
+ * @brief allocate a block of at least size bytes
+ *
+ * @param size - requested size
+ *
+ * @return memory, NULL if malloc failed
+ */
+void*
+RestClient::PoolAllocator::Allocate(size_t size) {
+  size_t index = classOf(size);
+  if (index == kClasses) {
+    return withHeader(std::malloc(kHeaderSize + size), size);
+  }
+  SizeClass& sizeClass = this->classes[index];
+  {
+    std::lock_guard<std::mutex> lock(sizeClass.mutex);
+    if (!sizeClass.blocks.empty()) {
+      void* block = sizeClass.blocks.back();
+      sizeClass.blocks.pop_back();
+      this->hits.fetch_add(1, std::memory_order_relaxed);
+      return block;
+    }
+  }
+  this->misses.fetch_add(1, std::memory_order_relaxed);
+  return withHeader(std::malloc(kHeaderSize + classSize(index)),
+                    classSize(index));
+}
+
+/**
+ * @brief resize a block, in place if it still fits its size class
+ *
+ * @param p - block from Allocate() or NULL
+ * @param size - new size
+ *
+ * @return memory, NULL if malloc failed (p is still valid then)
+ */
+void*
+RestClient::PoolAllocator::Reallocate(void* p, size_t size) {
+  if (!p) {
+    return this->Allocate(size);
+  }
+  size_t capacity = sizeOf(p);
+  const size_t largest = classSize(kClasses - 1);
+  if (capacity > largest && size > largest) {
+    // large blocks always know their exact size
+    return withHeader(std::realloc(headerOf(p), kHeaderSize + size), size);
+  }
+  if (capacity <= largest && size <= capacity) {
+    return p;
+  }
+  void* moved = this->Allocate(size);
+  if (moved) {
+    std::memcpy(moved, p, capacity < size ? capacity : size);
+    this->Free(p);
+  }
+  return moved;
+}
+
+/**
+ * @brief give a block back to its size class, or to malloc if the class
+ * has enough blocks cached
+ *
+ * @param p - block from Allocate() or NULL
+ */
+void
+RestClient::PoolAllocator::Free(void* p) {
+  if (!p) {
+    return;
+  }
+  size_t capacity = sizeOf(p);
+  if (capacity <= classSize(kClasses - 1)) {
+    SizeClass& sizeClass = this->classes[classOf(capacity)];
+    std::lock_guard<std::mutex> lock(sizeClass.mutex);
+    if (sizeClass.blocks.size() < this->maxCachedBlocks) {
+      sizeClass.blocks.push_back(p);
+      return;
+    }
+  }
+  std::free(headerOf(p));
+}
+
+uint64_t
+RestClient::PoolAllocator::Hits() const {
+  return this->hits.load(std::memory_order_relaxed);
+}
+
+uint64_t
+RestClient::PoolAllocator::Misses() const {
+  return this->misses.load(std::memory_order_relaxed);
+}
+
+size_t
+RestClient::PoolAllocator::Cached() const {
+  size_t cached = 0;
+  for (size_t i = 0; i < kClasses; i++) {
+    std::lock_guard<std::mutex> lock(this->classes[i].mutex);
+    cached += this->classes[i].blocks.size();
+  }
+  return cached;
+}
+
+/**
+ * @brief free all cached blocks
+ */
+void
+RestClient::PoolAllocator::Trim() {
+  for (size_t i = 0; i < kClasses; i++) {
+    std::lock_guard<std::mutex> lock(this->classes[i].mutex);
+    std::vector<void*>& blocks = this->classes[i].blocks;
+    for (size_t j = 0; j < blocks.size(); j++) {
+      std::free(headerOf(blocks[j]));
+    }
+    blocks.clear();
+  }
+}
+
+RestClient::AccountingAllocator::AccountingAllocator(
+    MemoryAllocator* upstream)
+  : upstream(upstream), id(nextAccountingId.fetch_add(1)), threads() {
+}
+
+RestClient::AccountingAllocator::~AccountingAllocator() {
+}
+
+/**
+ * @brief get the counters of the calling thread, creating them on first
+ * use
+ *
+ * @return counters only the calling thread writes to
+ */
+RestClient::AccountingAllocator::Counters*
+RestClient::AccountingAllocator::localCounters() {
+  if (localCache.allocator == this->id) {
+    return reinterpret_cast<Counters*>(localCache.counters);
+  }
+  std::lock_guard<std::mutex> lock(this->mutex);
+  std::unique_ptr<Counters>& counters =
+    this->threads[std::this_thread::get_id()];
+  if (!counters) {
+    counters.reset(new Counters());
+    counters->allocations = 0;
+    counters->reallocations = 0;
+    counters->frees = 0;
+    counters->bytesAllocated = 0;
+    counters->bytesFreed = 0;
+  }
+  localCache.allocator = this->id;
+  localCache.counters = counters.get();
+  return counters.get();
+}
+
+void*
+RestClient::AccountingAllocator::Allocate(size_t size) {
+  void* block = this->upstream ?
+                this->upstream->Allocate(kHeaderSize + size) :
+                std::malloc(kHeaderSize + size);
+  if (!block) {
+    return NULL;
+  }
+  Counters* counters = this->localCounters();
+  bump(&counters->allocations, 1);
+  bump(&counters->bytesAllocated, size);
+  return withHeader(block, size);
+}
+
+void*
+RestClient::AccountingAllocator::Reallocate(void* p, size_t size) {
+  if (!p) {
+    return this->Allocate(size);
+  }
+  size_t previous = sizeOf(p);
+  void* block = this->upstream ?
+                this->upstream->Reallocate(headerOf(p), kHeaderSize + size) :
+                std::realloc(headerOf(p), kHeaderSize + size);
+  if (!block) {
+    return NULL;
+  }
+  Counters* counters = this->localCounters();
+  bump(&counters->reallocations, 1);
+  bump(&counters->bytesAllocated, size);
+  bump(&counters->bytesFreed, previous);
+  return withHeader(block, size);
+}
+
+void
+RestClient::AccountingAllocator::Free(void* p) {
+  if (!p) {
+    return;
+  }
+  Counters* counters = this->localCounters();
+  bump(&counters->frees, 1);
+  bump(&counters->bytesFreed, sizeOf(p));
+  if (this->upstream) {
+    this->upstream->Free(headerOf(p));
+  } else {
+    std::free(headerOf(p));
+  }
+}
+
+RestClient::MemoryStats
+RestClient::AccountingAllocator::read(const Counters& counters) {
+  MemoryStats stats;
+  stats.allocations = counters.allocations.load(std::memory_order_relaxed);
+  stats.reallocations =
+    counters.reallocations.load(std::memory_order_relaxed);
+  stats.frees = counters.frees.load(std::memory_order_relaxed);
+  stats.bytesAllocated =
+    counters.bytesAllocated.load(std::memory_order_relaxed);
+  stats.bytesFreed = counters.bytesFreed.load(std::memory_order_relaxed);
+  return stats;
+}
+
+RestClient::MemoryStats
+RestClient::AccountingAllocator::ThreadStats() {
+  return read(*this->localCounters());
+}
+
+RestClient::MemoryStats
+RestClient::AccountingAllocator::ThreadStats(std::thread::id thread) {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  std::map<std::thread::id, std::unique_ptr<Counters> >::const_iterator it =
+    this->threads.find(thread);
+  if (it == this->threads.end()) {
+    MemoryStats none = {0, 0, 0, 0, 0};
+    return none;
+  }
+  return read(*it->second);
+}
+
+RestClient::MemoryStats
+RestClient::AccountingAllocator::Totals() {
+  MemoryStats totals = {0, 0, 0, 0, 0};
+  std::lock_guard<std::mutex> lock(this->mutex);
+  for (std::map<std::thread::id, std::unique_ptr<Counters> >::const_iterator
+      it = this->threads.begin(); it != this->threads.end(); ++it) {
+    MemoryStats stats = read(*it->second);
+    totals.allocations += stats.allocations;
+    totals.reallocations += stats.reallocations;
+    totals.frees += stats.frees;
+    totals.bytesAllocated += stats.bytesAllocated;
+    totals.bytesFreed += stats.bytesFreed;
+  }
+  return totals;
+}
@@ -0,0 +1,569 @@
+/**
+ * @file metrics.cpp
+ * @brief implementation of request metrics
+ * @author Daniel Schauenberg <d@unwiredcouch.com>
+ */
+
+#include "restclient-cpp/metrics.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <mutex>  // NOLINT(build/c++11)
+#include <string>
+#include <thread>  // NOLINT(build/c++11)
+#include <utility>
+#include <vector>
+
+namespace {
+
+/**
+ * @brief increment a counter that only ever gets written by one thread.
+ * A plain load and store is enough for readers to see a consistent value
+ * and avoids the cost of a locked read-modify-write instruction.
+ */
+inline void bump(std::atomic<uint64_t>* counter, uint64_t n) {
+  counter->store(counter->load(std::memory_order_relaxed) + n,
+                 std::memory_order_relaxed);
+}
+
+inline uint64_t nonNegative(int64_t value) {
+  return value > 0 ? static_cast<uint64_t>(value) : 0;
+}
+
+inline unsigned int highestBit(uint64_t value) {
+#if defined(__GNUC__) || defined(__clang__)
+  return 63 - __builtin_clzll(value);
+#else
+  unsigned int bit = 0;
+  while (value >>= 1) {
+    bit++;
+  }
+  return bit;
+#endif
+}
+
+// source of registry ids, so thread local caches never confuse a destroyed
+// registry with a new one at the same address
+std::atomic<uint64_t> nextRegistryId(1);
+
+/**
+ * @brief per thread cache of the last used shard and series, so that the
+ * common case of a thread talking to the same host over and over again
+ * needs neither a lock nor a map lookup
+ */
+struct LocalCache {
+  uint64_t shardRegistry;
+  void* shard;
+  uint64_t seriesRegistry;
+  std::string host;
+  std::string method;
+  RestClient::Metrics::Series* series;
+};
+
+thread_local LocalCache localCache = {0, NULL, 0, "", "", NULL};
+
+const uint64_t kTimeBuckets[] = {
+  500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000,
+  1000000, 2500000, 5000000, 10000000
+};
+
+const uint64_t kSizeBuckets[] = {
+  64, 256, 1024, 4096, 16384, 65536, 262144, 1048576, 4194304, 16777216,
+  67108864
+};
+
+std::string escapeLabel(const std::string& value) {
+  std::string ret;
+  ret.reserve(value.size());
+  for (std::string::const_iterator it = value.begin(); it != value.end();
+      ++it) {
+    if (*it == '\\' || *it == '"') {
+      ret += '\\';
+      ret += *it;
+    } else if (*it == '\n') {
+      ret += "\\n";
+    } else {
+      ret += *it;
+    }
+  }
+  return ret;
+}
+
+std::string formatNumber(double value) {
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%.9g", value);
+  return std::string(buf);
+}
+
+std::string formatCount(uint64_t value) {
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%llu", static_cast<unsigned long long>(value));  // NOLINT(runtime/int)
+  return std::string(buf);
+}
+
+void writeHistogram(std::string* out, const std::string& name,
+                    const std::string& labels,
+                    const RestClient::Metrics::HistogramSnapshot& h,
+                    const uint64_t* bounds, size_t boundCount,
+                    double scale) {
+  for (size_t i = 0; i < boundCount; i++) {
+    *out += name + "_bucket{" + labels + ",le=\"" +
+      formatNumber(bounds[i] / scale) + "\"} " +
+      formatCount(h.CountAtOrBelow(bounds[i])) + "\n";
+  }
+  *out += name + "_bucket{" + labels + ",le=\"+Inf\"} " +
+    formatCount(h.count) + "\n";
+  *out += name + "_sum{" + labels + "} " + formatNumber(h.sum / scale) + "\n";
+  *out += name + "_count{" + labels + "} " + formatCount(h.count) + "\n";
+}
+
+}  // namespace
+
+RestClient::Metrics::HistogramSnapshot::HistogramSnapshot()
+  : counts(Histogram::kBucketCount, 0), count(0), sum(0), max(0) {
+}
+
+/**
+ * @brief add all observations of another snapshot to this one
+ *
+ * @param other snapshot to merge
+ */
+void
+RestClient::Metrics::HistogramSnapshot::Merge(const HistogramSnapshot& other) {
+  for (size_t i = 0; i < this->counts.size() && i < other.counts.size();
+      i++) {
+    this->counts[i] += other.counts[i];
+  }
+  this->count += other.count;
+  this->sum += other.sum;
+  this->max = std::max(this->max, other.max);
+}
+
+/**
+ * @brief get the approximate value at a given quantile
+ *
+ * @param q quantile between 0.0 and 1.0
+ *
+ * @return upper bound of the bucket the quantile falls into, capped at the
+ * largest recorded value
+ */
+uint64_t
+RestClient::Metrics::HistogramSnapshot::Percentile(double q) const {
+  if (this->count == 0) {
+    return 0;
+  }
+  q = std::min(std::max(q, 0.0), 1.0);
+  uint64_t target = static_cast<uint64_t>(std::ceil(q * this->count));
+  if (target == 0) {
+    target = 1;
+  }
+  uint64_t seen = 0;
+  for (unsigned int i = 0; i < this->counts.size(); i++) {
+    seen += this->counts[i];
+    if (seen >= target) {
+      return std::min(Histogram::BucketUpperBound(i), this->max);
+    }
+  }
+  return this->max;
+}
+
+/**
+ * @brief count observations that are guaranteed to be <= value, i.e. all
+ * buckets whose upper bound does not exceed value
+ *
+ * @param value to compare against
+ *
+ * @return number of observations
+ */
+uint64_t
+RestClient::Metrics::HistogramSnapshot::CountAtOrBelow(uint64_t value) const {
+  uint64_t ret = 0;
+  for (unsigned int i = 0; i < this->counts.size(); i++) {
+    if (Histogram::BucketUpperBound(i) > value) {
+      break;
+    }
+    ret += this->counts[i];
+  }
+  return ret;
+}
+
+RestClient::Metrics::Histogram::Histogram() : count(0), sum(0), max(0) {
+  for (unsigned int i = 0; i < kBucketCount; i++) {
+    this->counts[i].store(0, std::memory_order_relaxed);
+  }
+}
+
+/**
+ * @brief get the bucket index for a value
+ *
+ * @param value to look up, clamped to 2^kMaxValueBits - 1
+ *
+ * @return bucket index
+ */
+unsigned int
+RestClient::Metrics::Histogram::BucketIndex(uint64_t value) {
+  const uint64_t maxValue = (static_cast<uint64_t>(1) << kMaxValueBits) - 1;
+  if (value > maxValue) {
+    value = maxValue;
+  }
+  if (value < kSubBuckets) {
+    return static_cast<unsigned int>(value);
+  }
+  unsigned int bit = highestBit(value);
+  unsigned int sub = static_cast<unsigned int>(
+      (value >> (bit - kSubBucketBits)) & (kSubBuckets - 1));
+  return (bit - kSubBucketBits + 1) * kSubBuckets + sub;
+}
+
+/**
+ * @brief get the largest value stored in a bucket
+ *
+ * @param index of the bucket
+ *
+ * @return inclusive upper bound of the bucket
+ */
+uint64_t
+RestClient::Metrics::Histogram::BucketUpperBound(unsigned int index) {
+  if (index < kSubBuckets) {
+    return index;
+  }
+  unsigned int shift = index / kSubBuckets - 1;
+  uint64_t sub = index % kSubBuckets;
+  uint64_t lower = (kSubBuckets + sub) << shift;
+  return lower + (static_cast<uint64_t>(1) << shift) - 1;
+}
+
+/**
+ * @brief record a value. Only the thread owning the histogram may call this.
+ *
+ * @param value to record
+ */
+void
+RestClient::Metrics::Histogram::Record(uint64_t value) {
+  bump(&this->counts[BucketIndex(value)], 1);
+  bump(&this->count, 1);
+  bump(&this->sum, value);
+  if (value > this->max.load(std::memory_order_relaxed)) {
+    this->max.store(value, std::memory_order_relaxed);
+  }
+}
+
+/**
+ * @brief copy the current state of the histogram. Since the owning thread
+ * keeps recording, count and sum may be slightly ahead of the buckets.
+ *
+ * @return snapshot of the histogram
+ */
+RestClient::Metrics::HistogramSnapshot
+RestClient::Metrics::Histogram::Snapshot() const {
+  HistogramSnapshot ret;
+  for (unsigned int i = 0; i < kBucketCount; i++) {
+    ret.counts[i] = this->counts[i].load(std::memory_order_relaxed);
+  }
+  ret.count = this->count.load(std::memory_order_relaxed);
+  ret.sum = this->sum.load(std::memory_order_relaxed);
+  ret.max = this->max.load(std::memory_order_relaxed);
+  return ret;
+}
+
+RestClient::Metrics::Series::Series() {
+  for (int i = 0; i < kMaxStatusCode; i++) {
+    this->statusCodes[i].store(0, std::memory_order_relaxed);
+  }
+  for (int i = 0; i < kMaxCurlCode; i++) {
+    this->curlErrors[i].store(0, std::memory_order_relaxed);
+  }
+}
+
+/**
+ * @brief record a finished request
+ *
+ * @param sample measurements of the request
+ */
+void
+RestClient::Metrics::Series::Record(const Sample& sample) {
+  uint64_t nameLookup = nonNegative(sample.nameLookupTime);
+  uint64_t connect = nonNegative(sample.connectTime);
+  uint64_t appConnect = nonNegative(sample.appConnectTime);
+  uint64_t firstByte = nonNegative(sample.startTransferTime);
+
+  this->totalTime.Record(nonNegative(sample.totalTime));
+  if (nameLookup > 0) {
+    this->nameLookupTime.Record(nameLookup);
+  }
+  if (connect > 0) {
+    this->connectTime.Record(connect > nameLookup ? connect - nameLookup : 0);
+  }
+  if (appConnect > 0) {
+    this->tlsTime.Record(appConnect > connect ? appConnect - connect : 0);
+  }
+  if (firstByte > 0) {
+    this->firstByteTime.Record(firstByte);
+  }
+  this->requestSize.Record(sample.requestBytes);
+  this->responseSize.Record(sample.responseBytes);
+  if (sample.statusCode > 0 && sample.statusCode < kMaxStatusCode) {
+    bump(&this->statusCodes[sample.statusCode], 1);
+  }
+  if (sample.curlCode > 0 && sample.curlCode < kMaxCurlCode) {
+    bump(&this->curlErrors[sample.curlCode], 1);
+  }
+}
+
+RestClient::Metrics::Registry::Registry()
+  : id(nextRegistryId.fetch_add(1)), shards() {
+}
+
+RestClient::Metrics::Registry::~Registry() {
+}
+
+/**
+ * @brief get the process wide registry
+ *
+ * @return default registry
+ */
+RestClient::Metrics::Registry&
+RestClient::Metrics::Registry::Default() {
+  static Registry registry;
+  return registry;
+}
+
+/**
+ * @brief get the shard of the calling thread, creating it on first use
+ *
+ * @return shard owned by the calling thread
+ */
+RestClient::Metrics::Registry::Shard*
+RestClient::Metrics::Registry::localShard() {
+  if (localCache.shardRegistry == this->id) {
+    return reinterpret_cast<Shard*>(localCache.shard);
+  }
+  std::lock_guard<std::mutex> lock(this->mutex);
+  std::unique_ptr<Shard>& shard = this->shards[std::this_thread::get_id()];
+  if (!shard) {
+    shard.reset(new Shard());
+  }
+  localCache.shardRegistry = this->id;
+  localCache.shard = shard.get();
+  return shard.get();
+}
+
+/**
+ * @brief get the series for host and method of the calling thread. Only the
+ * calling thread ever inserts into its shard, so looking up an existing
+ * series does not need the shard lock.
+ *
+ * @param host of the request
+ * @param method of the request
+ *
+ * @return series owned by the calling thread
+ */
+RestClient::Metrics::Series*
+RestClient::Metrics::Registry::localSeries(const std::string& host,
+                                           const std::string& method) {
+  if (localCache.seriesRegistry == this->id && localCache.host == host &&
+      localCache.method == method) {
+    return localCache.series;
+  }
+  Shard* shard = this->localShard();
+  std::pair<std::string, std::string> key(host, method);
+  Series* series = NULL;
+  SeriesMap::iterator it = shard->series.find(key);
+  if (it != shard->series.end()) {
+    series = it->second.get();
+  } else {
+    std::lock_guard<std::mutex> lock(shard->mutex);
+    std::unique_ptr<Series>& slot = shard->series[key];
+    slot.reset(new Series());
+    series = slot.get();
+  }
+  localCache.seriesRegistry = this->id;
+  localCache.host = host;
+  localCache.method = method;
+  localCache.series = series;
+  return series;
+}
+
+/**
+ * @brief record a finished request
+ *
+ * @param host the request was sent to (see HostFromUrl)
+ * @param method HTTP method of the request
+ * @param sample measurements of the request
+ */
+void
+RestClient::Metrics::Registry::Record(const std::string& host,
+                                      const std::string& method,
+                                      const Sample& sample) {
+  this->localSeries(host, method)->Record(sample);
+}
+
+/**
+ * @brief merge the series of all threads into a snapshot. This can be
+ * called from any thread while requests are being recorded.
+ *
+ * @return one SeriesSnapshot per host and method, ordered by host
+ */
+RestClient::Metrics::Snapshot
+RestClient::Metrics::Registry::Snapshot() {
+  std::map<std::pair<std::string, std::string>, SeriesSnapshot> merged;
+  std::lock_guard<std::mutex> lock(this->mutex);
+  for (std::map<std::thread::id, std::unique_ptr<Shard> >::iterator shard =
+      this->shards.begin(); shard != this->shards.end(); ++shard) {
+    std::lock_guard<std::mutex> shardLock(shard->second->mutex);
+    for (SeriesMap::iterator it = shard->second->series.begin();
+        it != shard->second->series.end(); ++it) {
+      SeriesSnapshot& s = merged[it->first];
+      const Series& series = *it->second;
+      s.host = it->first.first;
+      s.method = it->first.second;
+      s.totalTime.Merge(series.totalTime.Snapshot());
+      s.nameLookupTime.Merge(series.nameLookupTime.Snapshot());
+      s.connectTime.Merge(series.connectTime.Snapshot());
+      s.tlsTime.Merge(series.tlsTime.Snapshot());
+      s.firstByteTime.Merge(series.firstByteTime.Snapshot());
+      s.requestSize.Merge(series.requestSize.Snapshot());
+      s.responseSize.Merge(series.responseSize.Snapshot());
+      for (int i = 0; i < Series::kMaxStatusCode; i++) {
+        uint64_t n = series.statusCodes[i].load(std::memory_order_relaxed);
+        if (n > 0) {
+          s.statusCodes[i] += n;
+        }
+      }
+      for (int i = 0; i < Series::kMaxCurlCode; i++) {
+        uint64_t n = series.curlErrors[i].load(std::memory_order_relaxed);
+        if (n > 0) {
+          s.curlErrors[i] += n;
+        }
+      }
+    }
+  }
+
+  RestClient::Metrics::Snapshot ret;
+  ret.reserve(merged.size());
+  for (std::map<std::pair<std::string, std::string>,
+                SeriesSnapshot>::iterator it = merged.begin();
+      it != merged.end(); ++it) {
+    ret.push_back(it->second);
+  }
+  return ret;
+}
+
+/**
+ * @brief render the current state in the Prometheus text exposition format
+ *
+ * @return metrics as std::string
+ */
+std::string
+RestClient::Metrics::Registry::PrometheusText() {
+  return RestClient::Metrics::PrometheusText(this->Snapshot());
+}
+
+/**
+ * @brief render a snapshot in the Prometheus text exposition format (see
+ * https://prometheus.io/docs/instrumenting/exposition_formats/). Bucket
+ * counts are derived from the log-linear buckets and therefore rounded down
+ * to the nearest bucket boundary.
+ *
+ * @param snapshot to render
+ *
+ * @return metrics as std::string
+ */
+std::string
+RestClient::Metrics::PrometheusText(
+    const RestClient::Metrics::Snapshot& snapshot) {
+  const size_t timeBucketCount = sizeof(kTimeBuckets) / sizeof(uint64_t);
+  const size_t sizeBucketCount = sizeof(kSizeBuckets) / sizeof(uint64_t);
+  std::string out;
+
+  out += "# HELP restclient_request_duration_seconds Duration of requests "
+         "and their phases.\n";
+  out += "# TYPE restclient_request_duration_seconds histogram\n";
+  for (Snapshot::const_iterator s = snapshot.begin(); s != snapshot.end();
+      ++s) {
+    std::string labels = "host=\"" + escapeLabel(s->host) +
+      "\",method=\"" + escapeLabel(s->method) + "\",phase=";
+    const HistogramSnapshot* phases[] = {&s->totalTime, &s->nameLookupTime,
+      &s->connectTime, &s->tlsTime, &s->firstByteTime};
+    const char* phaseNames[] = {"total", "dns", "connect", "tls", "ttfb"};
+    for (size_t i = 0; i < 5; i++) {
+      writeHistogram(&out, "restclient_request_duration_seconds",
+                     labels + "\"" + phaseNames[i] + "\"", *phases[i],
+                     kTimeBuckets, timeBucketCount, 1e6);
+    }
+  }
+
+  out += "# HELP restclient_request_size_bytes Size of uploaded request "
+         "bodies.\n";
+  out += "# TYPE restclient_request_size_bytes histogram\n";
+  for (Snapshot::const_iterator s = snapshot.begin(); s != snapshot.end();
+      ++s) {
+    writeHistogram(&out, "restclient_request_size_bytes",
+                   "host=\"" + escapeLabel(s->host) + "\",method=\"" +
+                   escapeLabel(s->method) + "\"", s->requestSize,
+                   kSizeBuckets, sizeBucketCount, 1.0);
+  }
+
+  out += "# HELP restclient_response_size_bytes Size of downloaded response "
+         "bodies.\n";
+  out += "# TYPE restclient_response_size_bytes histogram\n";
+  for (Snapshot::const_iterator s = snapshot.begin(); s != snapshot.end();
+      ++s) {
+    writeHistogram(&out, "restclient_response_size_bytes",
+                   "host=\"" + escapeLabel(s->host) + "\",method=\"" +
+                   escapeLabel(s->method) + "\"", s->responseSize,
+                   kSizeBuckets, sizeBucketCount, 1.0);
+  }
+
+  out += "# HELP restclient_responses_total Responses by HTTP status code.\n";
+  out += "# TYPE restclient_responses_total counter\n";
+  for (Snapshot::const_iterator s = snapshot.begin(); s != snapshot.end();
+      ++s) {
+    for (std::map<int, uint64_t>::const_iterator it = s->statusCodes.begin();
+        it != s->statusCodes.end(); ++it) {
+      out += "restclient_responses_total{host=\"" + escapeLabel(s->host) +
+        "\",method=\"" + escapeLabel(s->method) + "\",code=\"" +
+        formatCount(it->first) + "\"} " + formatCount(it->second) + "\n";
+    }
+  }
+
+  out += "# HELP restclient_curl_errors_total Failed transfers by cURL "
+         "code.\n";
+  out += "# TYPE restclient_curl_errors_total counter\n";
+  for (Snapshot::const_iterator s = snapshot.begin(); s != snapshot.end();
+      ++s) {
+    for (std::map<int, uint64_t>::const_iterator it = s->curlErrors.begin();
+        it != s->curlErrors.end(); ++it) {
+      out += "restclient_curl_errors_total{host=\"" + escapeLabel(s->host) +
+        "\",method=\"" + escapeLabel(s->method) + "\",curl_code=\"" +
+        formatCount(it->first) + "\"} " + formatCount(it->second) + "\n";
+    }
+  }
+  return out;
+}
+
+/**
+ * @brief extract the host part (including an explicit port) of a URL
+ *
+ * @param url to parse
+ *
+ * @return host as std::string, empty if there is none
+ */
+std::string
+RestClient::Metrics::HostFromUrl(const std::string& url) {
+  size_t start = url.find("://");
+  start = (start == std::string::npos) ? 0 : start + 3;
+  size_t end = url.find_first_of("/?#", start);
+  if (end == std::string::npos) {
+    end = url.size();
+  }
+  size_t at = url.rfind('@', end);
+  if (at != std::string::npos && at >= start) {
+    start = at + 1;
+  }
+  return url.substr(start, end - start);
+}
@@ -0,0 +1,62 @@
+/**
+ * @file probes.h
+ * @brief USDT static tracepoints for restclient-cpp
+ * @author Daniel Schauenberg <d@unwiredcouch.com>
+ *
+ * The probes are only compiled in when the library is built with
+ * RESTCLIENT_USDT defined (cmake -DRESTCLIENT_ENABLE_USDT=ON or
+ * ./configure --enable-usdt). Otherwise all macros expand to nothing and
+ * their arguments are not evaluated. Compiled in probes are a single nop
+ * until a tracer attaches to them. Each probe has a semaphore the tracer
+ * increments while attached, RESTCLIENT_PROBE_ENABLED(name) tests it so
+ * arguments that are expensive to compute can be skipped, e.g.
+ *
+ *   bpftrace -e 'usdt:/usr/lib/librestclient-cpp.so:restclient:request__done
+ *                { @[arg2] = count(); }'
+ *
+ * Provider "restclient" defines the following probes:
+ *
+ *   request__start(const char* method, const char* url)
+ *   headers__received(void* response, size_t headerCount)
+ *   first__byte(void* response, size_t bytes)
+ *   request__done(const char* method, const char* url, int statusCode,
+ *                 int curlCode)
+ *   transfer__bytes(const char* url, int64_t uploaded, int64_t downloaded)
+ */
+
+#ifndef SOURCE_PROBES_H_
+#define SOURCE_PROBES_H_
+
+#if defined(RESTCLIENT_USDT)
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+
+#define RESTCLIENT_PROBE_SEMAPHORE(name) restclient_##name##_semaphore
+// used once, in connection.cc
+#define RESTCLIENT_DEFINE_PROBE_SEMAPHORE(name) \
+  volatile unsigned short RESTCLIENT_PROBE_SEMAPHORE(name) \
+  __attribute__((unused)) __attribute__((section(".probes")))
+
+extern volatile unsigned short RESTCLIENT_PROBE_SEMAPHORE(request__start);
+extern volatile unsigned short RESTCLIENT_PROBE_SEMAPHORE(headers__received);
+extern volatile unsigned short RESTCLIENT_PROBE_SEMAPHORE(first__byte);
+extern volatile unsigned short RESTCLIENT_PROBE_SEMAPHORE(request__done);
+extern volatile unsigned short RESTCLIENT_PROBE_SEMAPHORE(transfer__bytes);
+
+#define RESTCLIENT_PROBE_ENABLED(name) \
+  __builtin_expect(RESTCLIENT_PROBE_SEMAPHORE(name) != 0, 0)
+
+#define RESTCLIENT_PROBE2(name, a, b) \
+  DTRACE_PROBE2(restclient, name, a, b)
+#define RESTCLIENT_PROBE3(name, a, b, c) \
+  DTRACE_PROBE3(restclient, name, a, b, c)
+#define RESTCLIENT_PROBE4(name, a, b, c, d) \
+  DTRACE_PROBE4(restclient, name, a, b, c, d)
+#else
+#define RESTCLIENT_PROBE_ENABLED(name) false
+#define RESTCLIENT_PROBE2(name, a, b) do {} while (0)
+#define RESTCLIENT_PROBE3(name, a, b, c) do {} while (0)
+#define RESTCLIENT_PROBE4(name, a, b, c, d) do {} while (0)
+#endif
+
+#endif  // SOURCE_PROBES_H_
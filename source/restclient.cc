@@ -14,6 +14,8 @@
 #include "restclient-cpp/restclient.h"
 
 #include <curl/curl.h>
+#include <cstdint>
+#include <cstring>
 #if __cplusplus >= 201402L
 #include <memory>
 #endif
@@ -22,6 +24,46 @@
 
 #include "restclient-cpp/version.h"
 #include "restclient-cpp/connection.h"
+#include "restclient-cpp/memory.h"
+
+namespace {
+
+// allocator installed with init(MemoryAllocator*)
+RestClient::MemoryAllocator* curlAllocator = NULL;
+
+void* curlMalloc(size_t size) {
+  return curlAllocator->Allocate(size);
+}
+
+void curlFree(void* p) {
+  curlAllocator->Free(p);
+}
+
+void* curlRealloc(void* p, size_t size) {
+  return curlAllocator->Reallocate(p, size);
+}
+
+char* curlStrdup(const char* s) {
+  size_t size = std::strlen(s) + 1;
+  char* copy = static_cast<char*>(curlAllocator->Allocate(size));
+  if (copy) {
+    std::memcpy(copy, s, size);
+  }
+  return copy;
+}
+
+void* curlCalloc(size_t count, size_t size) {
+  if (size && count > SIZE_MAX / size) {
+    return NULL;
+  }
+  void* p = curlAllocator->Allocate(count * size);
+  if (p) {
+    std::memset(p, 0, count * size);
+  }
+  return p;
+}
+
+}  // namespace
 
 /**
  * @brief global init function. Call this before you start any threads.
@@ -35,6 +77,33 @@ int RestClient::init() {
   }
 }
 
+/**
+ * @brief global init function routing all memory libcurl allocates through
+ * allocator. Call this before you start any threads and before anything
+ * else in the process uses libcurl; libcurl keeps the allocator it was
+ * first initialized with.
+ *
+ * @param allocator - allocator for libcurl's memory, not owned
+ *
+ * @return 0 on success, 1 if libcurl failed or another allocator is
+ * installed already
+ */
+int RestClient::init(RestClient::MemoryAllocator* allocator) {
+  if (curlAllocator && curlAllocator != allocator) {
+    return 1;
+  }
+  RestClient::MemoryAllocator* previous = curlAllocator;
+  curlAllocator = allocator;
+  CURLcode res = curl_global_init_mem(CURL_GLOBAL_ALL, curlMalloc, curlFree,
+                                      curlRealloc, curlStrdup, curlCalloc);
+  if (res == CURLE_OK) {
+    return 0;
+  } else {
+    curlAllocator = previous;
+    return 1;
+  }
+}
+
 /**
  * @brief global disable function. Call this before you terminate your
  * program.
@@ -0,0 +1,88 @@
+/**
+ * @file singleflight.cpp
+ * @brief implementation of request coalescing
+ * @author Daniel Schauenberg <d@unwiredcouch.com>
+ */
+
+#include "restclient-cpp/singleflight.h"
+
+#include <exception>
+#include <future>  // NOLINT(build/c++11)
+#include <memory>
+#include <mutex>  // NOLINT(build/c++11)
+#include <string>
+
+#include "restclient-cpp/restclient.h"
+
+RestClient::SingleFlight::SingleFlight() : calls() {
+}
+
+RestClient::SingleFlight::~SingleFlight() {
+}
+
+/**
+ * @brief execute fn for the given key. If another thread is already
+ * executing a call for the same key, block until that call finishes and
+ * return its result instead of running fn again. Exceptions thrown by fn
+ * are propagated to every caller waiting on the key.
+ *
+ * @param key identifying the request (method, URL and headers)
+ * @param fn function performing the actual request
+ * @param shared optional out parameter, set to true if the result was
+ * produced by another caller
+ *
+ * @return reference counted response shared by all callers of this flight
+ */
+RestClient::SharedResponse
+RestClient::SingleFlight::Do(const std::string& key,
+                             const std::function<Response()>& fn,
+                             bool* shared) {
+  std::unique_lock<std::mutex> lock(this->mutex);
+  std::map<std::string,
+           std::shared_future<SharedResponse> >::iterator it =
+    this->calls.find(key);
+  if (it != this->calls.end()) {
+    std::shared_future<SharedResponse> pending = it->second;
+    lock.unlock();
+    if (shared) {
+      *shared = true;
+    }
+    return pending.get();
+  }
+
+  std::promise<SharedResponse> promise;
+  this->calls[key] = promise.get_future().share();
+  lock.unlock();
+  if (shared) {
+    *shared = false;
+  }
+
+  SharedResponse ret;
+  try {
+    ret = std::make_shared<const Response>(fn());
+  } catch (...) {
+    lock.lock();
+    this->calls.erase(key);
+    lock.unlock();
+    promise.set_exception(std::current_exception());
+    throw;
+  }
+  // forget the key before publishing the result, so callers arriving from
+  // now on start a fresh transfer instead of getting a stale response
+  lock.lock();
+  this->calls.erase(key);
+  lock.unlock();
+  promise.set_value(ret);
+  return ret;
+}
+
+/**
+ * @brief get the number of requests currently in flight
+ *
+ * @return number of distinct keys with a running transfer
+ */
+size_t
+RestClient::SingleFlight::InFlight() {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  return this->calls.size();
+}
@@ -0,0 +1,301 @@
+/**
+ * @file stream.cc
+ * @brief implementation of the line, NDJSON and Server-Sent Events
+ * consumers
+ * @author Daniel Schauenberg <d@unwiredcouch.com>
+ */
+
+#include "restclient-cpp/stream.h"
+
+#include <cstring>
+#include <string>
+
+namespace {
+
+bool isField(const char* name, size_t length, const char* field) {
+  return std::strlen(field) == length && std::memcmp(name, field, length) == 0;
+}
+
+}  // namespace
+
+RestClient::LineConsumer::LineConsumer(size_t maxLineLength,
+                                       bool carriageReturnEndsLine)
+  : maxLineLength(maxLineLength),
+    carriageReturnEndsLine(carriageReturnEndsLine),
+    afterCarriageReturn(false) {
+}
+
+/**
+ * @brief split the next piece of the body into lines
+ *
+ * @param data - piece of the body
+ * @param length - its length
+ *
+ * @return false if a line was too long or Line() stopped the stream
+ */
+bool
+RestClient::LineConsumer::Consume(const char* data, size_t length) {
+  if (!this->error.empty()) {
+    return false;
+  }
+  const char* p = data;
+  const char* end = data + length;
+  if (this->afterCarriageReturn && p < end) {
+    this->afterCarriageReturn = false;
+    if (*p == '\n') {
+      p++;
+    }
+  }
+  while (p < end) {
+    const char* lineEnd;
+    if (this->carriageReturnEndsLine) {
+      lineEnd = p;
+      while (lineEnd < end && *lineEnd != '\n' && *lineEnd != '\r') {
+        lineEnd++;
+      }
+    } else {
+      lineEnd = static_cast<const char*>(std::memchr(p, '\n', end - p));
+      if (!lineEnd) {
+        lineEnd = end;
+      }
+    }
+    if (lineEnd == end) {
+      // the line continues in the next piece
+      return this->append(p, end - p);
+    }
+    const char* next = lineEnd + 1;
+    if (*lineEnd == '\r') {
+      if (next == end) {
+        this->afterCarriageReturn = true;
+      } else if (*next == '\n') {
+        next++;
+      }
+    }
+    bool ok;
+    if (this->buffer.empty()) {
+      size_t n = lineEnd - p;
+      if (n > this->maxLineLength) {
+        return this->fail("Line too long");
+      }
+      if (n > 0 && p[n - 1] == '\r') {
+        n--;
+      }
+      ok = this->Line(p, n);
+    } else {
+      if (!this->append(p, lineEnd - p)) {
+        return false;
+      }
+      if (this->buffer[this->buffer.size() - 1] == '\r') {
+        this->buffer.resize(this->buffer.size() - 1);
+      }
+      ok = this->Line(this->buffer.data(), this->buffer.size());
+      this->buffer.clear();
+    }
+    if (!ok) {
+      if (this->error.empty()) {
+        this->error.assign("Stopped by the callback");
+      }
+      return false;
+    }
+    p = next;
+  }
+  return true;
+}
+
+/**
+ * @brief collect the part of a line that spans pieces
+ */
+bool
+RestClient::LineConsumer::append(const char* data, size_t length) {
+  if (this->buffer.size() + length > this->maxLineLength) {
+    return this->fail("Line too long");
+  }
+  this->buffer.append(data, length);
+  return true;
+}
+
+void
+RestClient::LineConsumer::Reset() {
+  this->buffer.clear();
+  this->afterCarriageReturn = false;
+  this->error.clear();
+}
+
+const std::string&
+RestClient::LineConsumer::Error() const {
+  return this->error;
+}
+
+bool
+RestClient::LineConsumer::fail(const char* message) {
+  this->error.assign(message);
+  return false;
+}
+
+const std::string&
+RestClient::LineConsumer::pending() const {
+  return this->buffer;
+}
+
+RestClient::NdjsonConsumer::NdjsonConsumer(const RecordCallback& callback,
+                                           size_t maxRecordSize)
+  : LineConsumer(maxRecordSize, false), callback(callback), records(0) {
+}
+
+bool
+RestClient::NdjsonConsumer::Line(const char* data, size_t length) {
+  size_t i = 0;
+  while (i < length && (data[i] == ' ' || data[i] == '\t' ||
+                        data[i] == '\r')) {
+    i++;
+  }
+  if (i == length) {
+    return true;
+  }
+  this->records++;
+  return this->callback(data, length);
+}
+
+/**
+ * @brief hand over a last record that wasn't terminated by a newline
+ */
+bool
+RestClient::NdjsonConsumer::Finish() {
+  if (!this->Error().empty()) {
+    return false;
+  }
+  bool ok = this->pending().empty() ||
+            this->Line(this->pending().data(), this->pending().size());
+  this->Reset();
+  return ok;
+}
+
+uint64_t
+RestClient::NdjsonConsumer::Records() const {
+  return this->records;
+}
+
+RestClient::SseConsumer::SseConsumer(const EventCallback& callback,
+                                     size_t maxEventSize)
+  : LineConsumer(maxEventSize, true), callback(callback),
+    maxEventSize(maxEventSize), retry(3000), events(0), firstLine(true) {
+}
+
+/**
+ * @brief interpret a line of the stream: a field, a comment or the blank
+ * line that dispatches the event
+ */
+bool
+RestClient::SseConsumer::Line(const char* data, size_t length) {
+  if (this->firstLine) {
+    this->firstLine = false;
+    if (length >= 3 && std::memcmp(data, "\xEF\xBB\xBF", 3) == 0) {
+      data += 3;
+      length -= 3;
+    }
+  }
+  if (length == 0) {
+    return this->dispatch();
+  }
+  if (data[0] == ':') {
+    return true;
+  }
+  const char* colon = static_cast<const char*>(std::memchr(data, ':', length));
+  size_t nameLength = colon ? colon - data : length;
+  const char* value = colon ? colon + 1 : data + length;
+  size_t valueLength = data + length - value;
+  if (valueLength > 0 && *value == ' ') {
+    value++;
+    valueLength--;
+  }
+  if (isField(data, nameLength, "data")) {
+    if (this->event.data.size() + valueLength + 1 > this->maxEventSize) {
+      return this->fail("Event too large");
+    }
+    this->event.data.append(value, valueLength);
+    this->event.data.push_back('\n');
+  } else if (isField(data, nameLength, "event")) {
+    this->event.event.assign(value, valueLength);
+  } else if (isField(data, nameLength, "id")) {
+    if (!std::memchr(value, '\0', valueLength)) {
+      this->lastEventId.assign(value, valueLength);
+    }
+  } else if (isField(data, nameLength, "retry")) {
+    int milliseconds = 0;
+    size_t i = 0;
+    while (i < valueLength && value[i] >= '0' && value[i] <= '9' &&
+           milliseconds < 100000000) {
+      milliseconds = milliseconds * 10 + (value[i] - '0');
+      i++;
+    }
+    if (valueLength > 0 && i == valueLength) {
+      this->retry = milliseconds;
+    }
+  }
+  return true;
+}
+
+/**
+ * @brief hand the collected event to the callback, events without data
+ * are dropped
+ */
+bool
+RestClient::SseConsumer::dispatch() {
+  if (this->event.data.empty()) {
+    this->event.event.clear();
+    return true;
+  }
+  // the last data line's newline
+  this->event.data.resize(this->event.data.size() - 1);
+  if (this->event.event.empty()) {
+    this->event.event.assign("message");
+  }
+  this->event.id.assign(this->lastEventId);
+  this->events++;
+  bool ok = this->callback(this->event);
+  this->event.data.clear();
+  this->event.event.clear();
+  return ok;
+}
+
+bool
+RestClient::SseConsumer::Finish() {
+  if (!this->Error().empty()) {
+    return false;
+  }
+  this->Reset();
+  return true;
+}
+
+void
+RestClient::SseConsumer::Reset() {
+  LineConsumer::Reset();
+  this->event.data.clear();
+  this->event.event.clear();
+  this->firstLine = true;
+}
+
+const std::string&
+RestClient::SseConsumer::LastEventId() const {
+  return this->lastEventId;
+}
+
+void
+RestClient::SseConsumer::SetLastEventId(const std::string& id) {
+  this->lastEventId = id;
+}
+
+int
+RestClient::SseConsumer::Retry() const {
+  return this->retry;
+}
+
+void
+RestClient::SseConsumer::SetRetry(int milliseconds) {
+  this->retry = milliseconds;
+}
+
+uint64_t
+RestClient::SseConsumer::Events() const {
+  return this->events;
+}
@@ -0,0 +1,299 @@
+/**
+ * @file traffic.cc
+ * @brief implementation of the traffic capture
+ * @author Daniel Schauenberg <d@unwiredcouch.com>
+ *
+ * A capture file starts with an 8 byte magic followed by records of
+ *
+ *   varint  microseconds since the previous record
+ *   string  method
+ *   string  URL
+ *   varint  number of headers, then a name and a value string for each
+ *   varint  body size
+ *
+ * A string is a varint (index << 1) | 1 referring to an earlier string, or
+ * (length << 1) followed by the bytes. Writer and reader both add literal
+ * strings to their table under the same limits, so indexes agree without
+ * storing the table.
+ */
+
+#include "restclient-cpp/traffic.h"
+
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace {
+
+const char kMagic[8] = {'R', 'C', 'T', 'R', 'A', 'F', '\0', '\1'};
+// bounds for the string table, unique URLs stop being interned once the
+// table is full
+const size_t kMaxStrings = 65536;
+const size_t kMaxInternedLength = 1024;
+
+/**
+ * @brief whether a request header carries credentials
+ */
+bool isSecret(const std::string& name) {
+  static const char* const secrets[] = {
+    "authorization", "proxy-authorization", "cookie"
+  };
+  for (size_t i = 0; i < sizeof(secrets) / sizeof(secrets[0]); i++) {
+    const char* secret = secrets[i];
+    if (name.size() != std::strlen(secret)) {
+      continue;
+    }
+    size_t c = 0;
+    while (c < name.size() &&
+           std::tolower(static_cast<unsigned char>(name[c])) == secret[c]) {
+      c++;
+    }
+    if (c == name.size()) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * @brief position and length of the user name and password in a URL,
+ * including the '@'
+ *
+ * @return false if the URL has none
+ */
+bool findUserInfo(const std::string& url, size_t* start, size_t* length) {
+  size_t scheme = url.find("://");
+  size_t authority = scheme == std::string::npos ? 0 : scheme + 3;
+  size_t end = url.find_first_of("/?#", authority);
+  size_t at = url.rfind('@', end == std::string::npos ? url.size() : end);
+  if (at == std::string::npos || at < authority) {
+    return false;
+  }
+  *start = authority;
+  *length = at + 1 - authority;
+  return true;
+}
+
+int64_t nowMicros() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void putVarint(std::string* out, uint64_t value) {
+  while (value >= 0x80) {
+    out->push_back(static_cast<char>((value & 0x7f) | 0x80));
+    value >>= 7;
+  }
+  out->push_back(static_cast<char>(value));
+}
+
+bool getVarint(FILE* in, uint64_t* value) {
+  *value = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    int c = std::fgetc(in);
+    if (c == EOF) {
+      return false;
+    }
+    *value |= static_cast<uint64_t>(c & 0x7f) << shift;
+    if (!(c & 0x80)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool getString(FILE* in, std::vector<std::string>* table,
+               std::string* value) {
+  uint64_t tag;
+  if (!getVarint(in, &tag)) {
+    return false;
+  }
+  if (tag & 1) {
+    if ((tag >> 1) >= table->size()) {
+      return false;
+    }
+    *value = (*table)[tag >> 1];
+    return true;
+  }
+  uint64_t length = tag >> 1;
+  if (length > (1u << 24)) {
+    return false;
+  }
+  value->resize(length);
+  if (length > 0 && std::fread(&(*value)[0], 1, length, in) != length) {
+    return false;
+  }
+  if (table->size() < kMaxStrings && length <= kMaxInternedLength) {
+    table->push_back(*value);
+  }
+  return true;
+}
+
+}  // namespace
+
+const char RestClient::TrafficRecorder::kRedacted[] = "[redacted]";
+
+RestClient::TrafficRecorder::TrafficRecorder()
+  : file(NULL), start(0), lastOffset(0), recorded(0), recordSecrets(false) {
+}
+
+RestClient::TrafficRecorder::~TrafficRecorder() {
+  this->Close();
+}
+
+bool
+RestClient::TrafficRecorder::Open(const std::string& path) {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  if (this->file) {
+    std::fclose(this->file);
+  }
+  this->file = std::fopen(path.c_str(), "wb");
+  if (!this->file) {
+    return false;
+  }
+  if (std::fwrite(kMagic, 1, sizeof(kMagic), this->file) != sizeof(kMagic)) {
+    std::fclose(this->file);
+    this->file = NULL;
+    return false;
+  }
+  this->start = nowMicros();
+  this->lastOffset = 0;
+  this->recorded = 0;
+  this->strings.clear();
+  return true;
+}
+
+void
+RestClient::TrafficRecorder::Close() {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  if (this->file) {
+    std::fclose(this->file);
+    this->file = NULL;
+  }
+}
+
+bool
+RestClient::TrafficRecorder::IsOpen() const {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  return this->file != NULL;
+}
+
+void
+RestClient::TrafficRecorder::SetRecordSecrets(bool record) {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  this->recordSecrets = record;
+}
+
+void
+RestClient::TrafficRecorder::Record(const char* method,
+                                    const std::string& url,
+                                    const HeaderFields& headers,
+                                    uint64_t bodySize) {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  if (!this->file) {
+    return;
+  }
+  // taking the time under the lock keeps offsets in file order
+  int64_t offset = nowMicros() - this->start;
+  if (offset < this->lastOffset) {
+    offset = this->lastOffset;
+  }
+  this->buffer.clear();
+  putVarint(&this->buffer, static_cast<uint64_t>(offset - this->lastOffset));
+  this->lastOffset = offset;
+  this->writeString(method);
+  size_t userInfo, userInfoLength;
+  if (!this->recordSecrets && findUserInfo(url, &userInfo, &userInfoLength)) {
+    this->writeString(std::string(url).erase(userInfo, userInfoLength));
+  } else {
+    this->writeString(url);
+  }
+  putVarint(&this->buffer, headers.size());
+  for (HeaderFields::const_iterator it = headers.begin();
+       it != headers.end(); ++it) {
+    this->writeString(it->first);
+    if (!this->recordSecrets && isSecret(it->first)) {
+      this->writeString(kRedacted);
+    } else {
+      this->writeString(it->second);
+    }
+  }
+  putVarint(&this->buffer, bodySize);
+  std::fwrite(this->buffer.data(), 1, this->buffer.size(), this->file);
+  this->recorded++;
+}
+
+uint64_t
+RestClient::TrafficRecorder::Recorded() const {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  return this->recorded;
+}
+
+/**
+ * @brief append a string or a reference to an earlier one to the record
+ * buffer. Has to follow the same interning rules as getString()
+ */
+void
+RestClient::TrafficRecorder::writeString(const std::string& value) {
+  std::map<std::string, uint64_t>::const_iterator it =
+    this->strings.find(value);
+  if (it != this->strings.end()) {
+    putVarint(&this->buffer, (it->second << 1) | 1);
+    return;
+  }
+  putVarint(&this->buffer, static_cast<uint64_t>(value.size()) << 1);
+  this->buffer.append(value);
+  if (this->strings.size() < kMaxStrings &&
+      value.size() <= kMaxInternedLength) {
+    uint64_t index = this->strings.size();
+    this->strings[value] = index;
+  }
+}
+
+bool
+RestClient::TrafficRecorder::Load(const std::string& path,
+                                  std::vector<TrafficRecord>* records) {
+  FILE* in = std::fopen(path.c_str(), "rb");
+  if (!in) {
+    return false;
+  }
+  char magic[sizeof(kMagic)];
+  if (std::fread(magic, 1, sizeof(magic), in) != sizeof(magic) ||
+      std::string(magic, sizeof(magic)) !=
+      std::string(kMagic, sizeof(kMagic))) {
+    std::fclose(in);
+    return false;
+  }
+  std::vector<std::string> table;
+  int64_t offset = 0;
+  for (;;) {
+    uint64_t delta, headerCount, bodySize;
+    TrafficRecord record;
+    if (!getVarint(in, &delta) ||
+        !getString(in, &table, &record.method) ||
+        !getString(in, &table, &record.url) ||
+        !getVarint(in, &headerCount)) {
+      break;
+    }
+    bool complete = true;
+    for (uint64_t i = 0; complete && i < headerCount; i++) {
+      std::string name, value;
+      complete = getString(in, &table, &name) &&
+                 getString(in, &table, &value);
+      record.headers[name] = value;
+    }
+    if (!complete || !getVarint(in, &bodySize)) {
+      break;
+    }
+    offset += static_cast<int64_t>(delta);
+    record.offset = offset;
+    record.bodySize = bodySize;
+    records->push_back(record);
+  }
+  std::fclose(in);
+  return true;
+}
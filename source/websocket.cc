@@ -0,0 +1,965 @@
+/**
+ * @file websocket.cc
+ * @brief implementation of the WebSocket client
+ * @author Daniel Schauenberg <d@unwiredcouch.com>
+ */
+
+#include "restclient-cpp/websocket.h"
+
+#include <curl/curl.h>
+
+#if defined(_WIN32)
+#include <winsock2.h>
+#else
+#include <poll.h>
+#endif
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>  // NOLINT(build/c++11)
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+
+namespace {
+
+// opcodes of RFC 6455 5.2
+const int kContinuation = 0x0;
+const int kText = 0x1;
+const int kBinary = 0x2;
+const int kClose = 0x8;
+const int kPing = 0x9;
+const int kPong = 0xA;
+
+// close code for a close frame without one (RFC 6455 7.4.1)
+const int kNoStatusCode = 1005;
+
+// a response head larger than this isn't a WebSocket handshake
+const size_t kMaxHeadSize = 64 * 1024;
+
+int elapsedMilliseconds(std::chrono::steady_clock::time_point since) {
+  return static_cast<int>(std::chrono::duration_cast<
+      std::chrono::milliseconds>(std::chrono::steady_clock::now() -
+                                 since).count());
+}
+
+std::string toLower(std::string s) {
+  for (size_t i = 0; i < s.size(); i++) {
+    s[i] = static_cast<char>(std::tolower(static_cast<unsigned char>(s[i])));
+  }
+  return s;
+}
+
+std::string trim(const std::string& s) {
+  size_t first = s.find_first_not_of(" \t\r");
+  if (first == std::string::npos) {
+    return std::string();
+  }
+  return s.substr(first, s.find_last_not_of(" \t\r") - first + 1);
+}
+
+std::string base64(const std::string& data) {
+  const char alphabet[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  std::string out;
+  for (size_t i = 0; i < data.size(); i += 3) {
+    uint32_t n = static_cast<uint32_t>(static_cast<unsigned char>(data[i]))
+                 << 16;
+    if (i + 1 < data.size()) {
+      n |= static_cast<uint32_t>(static_cast<unsigned char>(data[i + 1])) << 8;
+    }
+    if (i + 2 < data.size()) {
+      n |= static_cast<unsigned char>(data[i + 2]);
+    }
+    out.push_back(alphabet[(n >> 18) & 63]);
+    out.push_back(alphabet[(n >> 12) & 63]);
+    out.push_back(i + 1 < data.size() ? alphabet[(n >> 6) & 63] : '=');
+    out.push_back(i + 2 < data.size() ? alphabet[n & 63] : '=');
+  }
+  return out;
+}
+
+uint32_t rotate(uint32_t value, int bits) {
+  return (value << bits) | (value >> (32 - bits));
+}
+
+/**
+ * @brief SHA-1 (RFC 3174), which the handshake uses to prove the server
+ * understood it. Not for anything that needs a secure hash.
+ */
+std::string sha1(const std::string& message) {
+  uint32_t h[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476,
+                   0xC3D2E1F0};
+  std::string data = message;
+  data.push_back('\x80');
+  while (data.size() % 64 != 56) {
+    data.push_back('\0');
+  }
+  uint64_t bits = static_cast<uint64_t>(message.size()) * 8;
+  for (int i = 7; i >= 0; i--) {
+    data.push_back(static_cast<char>((bits >> (i * 8)) & 0xff));
+  }
+  for (size_t block = 0; block < data.size(); block += 64) {
+    uint32_t w[80];
+    const unsigned char* p =
+      reinterpret_cast<const unsigned char*>(data.data() + block);
+    for (int i = 0; i < 16; i++) {
+      w[i] = (static_cast<uint32_t>(p[i * 4]) << 24) |
+             (static_cast<uint32_t>(p[i * 4 + 1]) << 16) |
+             (static_cast<uint32_t>(p[i * 4 + 2]) << 8) | p[i * 4 + 3];
+    }
+    for (int i = 16; i < 80; i++) {
+      w[i] = rotate(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+    }
+    uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+    for (int i = 0; i < 80; i++) {
+      uint32_t f, k;
+      if (i < 20) {
+        f = (b & c) | (~b & d);
+        k = 0x5A827999;
+      } else if (i < 40) {
+        f = b ^ c ^ d;
+        k = 0x6ED9EBA1;
+      } else if (i < 60) {
+        f = (b & c) | (b & d) | (c & d);
+        k = 0x8F1BBCDC;
+      } else {
+        f = b ^ c ^ d;
+        k = 0xCA62C1D6;
+      }
+      uint32_t t = rotate(a, 5) + f + e + k + w[i];
+      e = d;
+      d = c;
+      c = rotate(b, 30);
+      b = a;
+      a = t;
+    }
+    h[0] += a;
+    h[1] += b;
+    h[2] += c;
+    h[3] += d;
+    h[4] += e;
+  }
+  std::string digest;
+  for (int i = 0; i < 5; i++) {
+    for (int j = 3; j >= 0; j--) {
+      digest.push_back(static_cast<char>((h[i] >> (j * 8)) & 0xff));
+    }
+  }
+  return digest;
+}
+
+#if LIBCURL_VERSION_NUM >= 0x080b00
+/**
+ * @brief whether the libcurl in use speaks WebSocket. Its support was
+ * experimental before 8.11, and builds only have it when it was enabled.
+ */
+bool libcurlWebSockets() {
+  const curl_version_info_data* info = curl_version_info(CURLVERSION_NOW);
+  if (info->version_num < 0x080b00) {
+    return false;
+  }
+  for (const char* const* protocol = info->protocols; *protocol;
+       protocol++) {
+    if (std::strcmp(*protocol, "ws") == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+#endif
+
+}  // namespace
+
+RestClient::WebSocket::WebSocket(RestClient::Connection* connection,
+                                 size_t maxMessageSize)
+  : connection(connection), maxMessageSize(maxMessageSize),
+    curlFrames(false), open(false), closing(false),
+    inFrame(false), frameOpcode(0), frameFinal(false), frameRemaining(0),
+    partial(false), partialType(RestClient::WebSocketMessageType::Text),
+    keepaliveInterval(0), pingSent(false), pongs(0) {
+}
+
+/**
+ * @brief say goodbye to the peer if the WebSocket is still open
+ */
+RestClient::WebSocket::~WebSocket() {
+  if (this->open && !this->closing) {
+    this->Close(1001);
+  }
+}
+
+/**
+ * @brief connect through the Connection and upgrade a GET of uri to a
+ * WebSocket
+ *
+ * @param uri URI relative to the Connection's base URL, which can be
+ * http://, https://, ws:// or wss://
+ *
+ * @return response of the handshake: code 101 if the WebSocket is open,
+ * another HTTP status if the server refused the upgrade, a cURL error
+ * code or -1 if the server's answer wasn't a valid upgrade. When libcurl
+ * does the handshake, the body of a refused upgrade stays empty because
+ * libcurl doesn't read it.
+ */
+RestClient::Response
+RestClient::WebSocket::Open(const std::string& uri) {
+  this->open = false;
+  this->closing = false;
+  this->input.clear();
+  this->inFrame = false;
+  this->partial = false;
+  this->pingSent = false;
+  this->error.clear();
+  RestClient::Response response = {};
+  std::string url = this->connection->baseUrl + uri;
+#if LIBCURL_VERSION_NUM >= 0x080b00
+  this->curlFrames = libcurlWebSockets();
+  if (this->curlFrames) {
+    if (url.compare(0, 4, "http") == 0) {
+      // libcurl only upgrades ws:// and wss:// URLs
+      url.replace(0, 4, "ws");
+    }
+    CURLcode res = this->connection->openWebSocket(url, &response);
+    if (res == CURLE_OK && response.code == 101) {
+      this->open = true;
+      this->lastReceived = std::chrono::steady_clock::now();
+    } else if (response.code == 101) {
+      response.code = -1;
+      response.body = "Invalid WebSocket handshake";
+    } else if (response.code == 0) {
+      response.code = res;
+      response.body = curl_easy_strerror(res);
+    }
+    return response;
+  }
+#endif
+  if (url.compare(0, 2, "ws") == 0) {
+    // ws:// and wss:// connect like http:// and https://
+    url.replace(0, 2, "http");
+  }
+  CURLcode res = this->connection->openConnection(url);
+  if (res != CURLE_OK) {
+    response.code = res;
+    response.body = curl_easy_strerror(res);
+    return response;
+  }
+  if (this->handshake(url, &response)) {
+    this->open = true;
+    this->lastReceived = std::chrono::steady_clock::now();
+  }
+  return response;
+}
+
+/**
+ * @brief send the upgrade request and read the server's answer
+ *
+ * @return true if the server switched to the WebSocket protocol
+ */
+bool
+RestClient::WebSocket::handshake(const std::string& url,
+                                 RestClient::Response* response) {
+  size_t authorityStart = url.find("://");
+  authorityStart = authorityStart == std::string::npos ? 0 : authorityStart + 3;
+  size_t pathStart = url.find_first_of("/?#", authorityStart);
+  std::string authority = url.substr(authorityStart,
+                                     pathStart - authorityStart);
+  size_t at = authority.rfind('@');
+  if (at != std::string::npos) {
+    authority.erase(0, at + 1);
+  }
+  std::string path = pathStart == std::string::npos ? "/" :
+                     url.substr(pathStart, url.find('#', pathStart) -
+                                           pathStart);
+  if (path.empty() || path[0] != '/') {
+    path.insert(0, "/");
+  }
+
+  std::string nonce;
+  for (int i = 0; i < 16; i++) {
+    nonce.push_back(static_cast<char>(this->random() & 0xff));
+  }
+  const std::string key = base64(nonce);
+  std::string request = "GET " + path + " HTTP/1.1\r\nHost: " + authority +
+    "\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Key: " +
+    key + "\r\nSec-WebSocket-Version: 13\r\nUser-Agent: " +
+    this->connection->GetUserAgent() + "\r\n";
+  if (this->connection->basicAuth.username.length() > 0) {
+    request += "Authorization: Basic " +
+               base64(this->connection->basicAuth.username + ":" +
+                      this->connection->basicAuth.password) + "\r\n";
+  }
+  for (RestClient::HeaderFields::const_iterator it =
+      this->connection->headerFields.begin();
+      it != this->connection->headerFields.end(); ++it) {
+    request += it->first + ": " + it->second + "\r\n";
+  }
+  request += "\r\n";
+  CURLcode res = this->sendAll(request.data(), request.size());
+
+  // read the head of the answer within the Connection's timeout
+  int timeoutMilliseconds = this->connection->timeoutMilliseconds;
+  std::chrono::steady_clock::time_point start =
+    std::chrono::steady_clock::now();
+  size_t headEnd = std::string::npos;
+  while (res == CURLE_OK &&
+         (headEnd = this->input.find("\r\n\r\n")) == std::string::npos) {
+    if (this->input.size() > kMaxHeadSize) {
+      res = CURLE_WEIRD_SERVER_REPLY;
+      break;
+    }
+    res = this->receiveMore();
+    if (res == CURLE_AGAIN) {
+      int remaining = -1;
+      if (timeoutMilliseconds > 0) {
+        remaining = timeoutMilliseconds - elapsedMilliseconds(start);
+        if (remaining <= 0) {
+          res = CURLE_OPERATION_TIMEDOUT;
+          break;
+        }
+      }
+      res = this->wait(false, remaining) ? CURLE_OK
+                                         : CURLE_ABORTED_BY_CALLBACK;
+    }
+  }
+  if (res != CURLE_OK) {
+    response->code = res;
+    response->body = curl_easy_strerror(res);
+    return false;
+  }
+
+  std::string head = this->input.substr(0, headEnd);
+  this->input.erase(0, headEnd + 4);
+  size_t lineEnd = head.find("\r\n");
+  std::string statusLine = head.substr(0, lineEnd);
+  size_t space = statusLine.find(' ');
+  response->code = space == std::string::npos ? 0 :
+                   std::atoi(statusLine.c_str() + space + 1);
+  bool upgrade = false, connectionUpgrade = false, accepted = false;
+  size_t contentLength = 0;
+  while (lineEnd != std::string::npos) {
+    size_t lineStart = lineEnd + 2;
+    lineEnd = head.find("\r\n", lineStart);
+    std::string line = head.substr(lineStart,
+                                   lineEnd == std::string::npos ?
+                                   std::string::npos : lineEnd - lineStart);
+    size_t colon = line.find(':');
+    if (colon == std::string::npos) {
+      continue;
+    }
+    std::string name = trim(line.substr(0, colon));
+    std::string value = trim(line.substr(colon + 1));
+    response->headers[name] = value;
+    name = toLower(name);
+    if (name == "upgrade") {
+      upgrade = toLower(value) == "websocket";
+    } else if (name == "connection") {
+      connectionUpgrade = toLower(value).find("upgrade") != std::string::npos;
+    } else if (name == "sec-websocket-accept") {
+      accepted = value == base64(sha1(key +
+                                      "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"));
+    } else if (name == "content-length") {
+      contentLength = std::strtoul(value.c_str(), NULL, 10);
+    }
+  }
+  if (response->code != 101) {
+    // the part of the error page that arrived with the head
+    response->body = this->input.substr(0, contentLength);
+    this->input.clear();
+    return false;
+  }
+  if (!upgrade || !connectionUpgrade || !accepted) {
+    response->code = -1;
+    response->body = "Invalid WebSocket handshake";
+    this->input.clear();
+    return false;
+  }
+  // frames that came right behind the handshake stay in input
+  return true;
+}
+
+bool
+RestClient::WebSocket::IsOpen() const {
+  return this->open;
+}
+
+CURLcode
+RestClient::WebSocket::SendText(const std::string& text) {
+  return this->send(text.data(), text.size(), kText);
+}
+
+CURLcode
+RestClient::WebSocket::SendBinary(const void* data, size_t length) {
+  return this->send(data, length, kBinary);
+}
+
+CURLcode
+RestClient::WebSocket::Ping(const std::string& payload) {
+  return this->send(payload.data(), std::min<size_t>(payload.size(), 125),
+                    kPing);
+}
+
+/**
+ * @brief send a close frame, the connection stays open until the peer
+ * answers it
+ *
+ * @param code status code, 1000 for a normal closure
+ * @param reason UTF-8 text of at most 123 bytes
+ *
+ * @return CURLE_OK if the frame was sent
+ */
+CURLcode
+RestClient::WebSocket::Close(int code, const std::string& reason) {
+  std::string payload;
+  payload.push_back(static_cast<char>((code >> 8) & 0xff));
+  payload.push_back(static_cast<char>(code & 0xff));
+  payload.append(reason, 0, 123);
+  CURLcode res = this->send(payload.data(), payload.size(), kClose);
+  if (res == CURLE_OK) {
+    this->closing = true;
+  }
+  return res;
+}
+
+/**
+ * @brief send a whole message as a single masked frame
+ */
+CURLcode
+RestClient::WebSocket::send(const void* data, size_t length, int opcode) {
+  if (!this->open) {
+    return CURLE_SEND_ERROR;
+  }
+#if LIBCURL_VERSION_NUM >= 0x080b00
+  if (this->curlFrames) {
+    return this->sendFrame(data, length, opcode);
+  }
+#endif
+  // kept in a member so its capacity is reused
+  std::string& frame = this->output;
+  frame.clear();
+  frame.push_back(static_cast<char>(0x80 | opcode));
+  if (length < 126) {
+    frame.push_back(static_cast<char>(0x80 | length));
+  } else if (length < 65536) {
+    frame.push_back(static_cast<char>(0x80 | 126));
+    frame.push_back(static_cast<char>(length >> 8));
+    frame.push_back(static_cast<char>(length & 0xff));
+  } else {
+    frame.push_back(static_cast<char>(0x80 | 127));
+    for (int i = 7; i >= 0; i--) {
+      frame.push_back(static_cast<char>(
+          (static_cast<uint64_t>(length) >> (i * 8)) & 0xff));
+    }
+  }
+  uint32_t mask = this->random();
+  char key[4];
+  for (int i = 0; i < 4; i++) {
+    key[i] = static_cast<char>((mask >> (i * 8)) & 0xff);
+    frame.push_back(key[i]);
+  }
+  size_t payload = frame.size();
+  frame.append(static_cast<const char*>(data), length);
+  for (size_t i = 0; i < length; i++) {
+    frame[payload + i] ^= key[i & 3];
+  }
+  return this->sendAll(frame.data(), frame.size());
+}
+
+/**
+ * @brief write all of data to the connection, waiting while the socket
+ * can't take more
+ */
+CURLcode
+RestClient::WebSocket::sendAll(const char* data, size_t length) {
+  CURL* handle = this->connection->getCurlHandle();
+  size_t offset = 0;
+  while (offset < length) {
+    size_t sent = 0;
+    CURLcode res = curl_easy_send(handle, data + offset, length - offset,
+                                  &sent);
+    if (res == CURLE_AGAIN) {
+      if (!this->wait(true, -1)) {
+        this->fail("Cancelled");
+        return CURLE_ABORTED_BY_CALLBACK;
+      }
+    } else if (res != CURLE_OK) {
+      this->fail(curl_easy_strerror(res));
+      return res;
+    }
+    offset += sent;
+  }
+  return CURLE_OK;
+}
+
+/**
+ * @brief append what the connection has to input without waiting
+ *
+ * @return CURLE_OK if something arrived, CURLE_AGAIN if nothing did and
+ * CURLE_GOT_NOTHING if the peer closed the connection
+ */
+CURLcode
+RestClient::WebSocket::receiveMore() {
+  char buffer[16384];
+  size_t received = 0;
+  CURLcode res = curl_easy_recv(this->connection->getCurlHandle(), buffer,
+                                sizeof(buffer), &received);
+  if (res == CURLE_OK && received == 0) {
+    return CURLE_GOT_NOTHING;
+  }
+  if (res == CURLE_OK) {
+    this->input.append(buffer, received);
+  }
+  return res;
+}
+
+/**
+ * @brief take a complete message from what was received, or receive more
+ *
+ * @param done set with status if a message is complete, the connection
+ * was closed or broke
+ *
+ * @return CURLE_OK if done is set or something arrived, CURLE_AGAIN if
+ * nothing did, another error if the connection broke
+ */
+CURLcode
+RestClient::WebSocket::receiveSome(RestClient::WebSocketMessage* message,
+                                   Status* status, bool* done) {
+#if LIBCURL_VERSION_NUM >= 0x080b00
+  if (this->curlFrames) {
+    return this->receiveFrame(message, status, done);
+  }
+#endif
+  *done = this->parse(message, status);
+  return *done ? CURLE_OK : this->receiveMore();
+}
+
+/**
+ * @brief receive frames until a message is complete or the time is up
+ *
+ * @param message written with a complete message or the peer's close
+ * frame, its data keeps its capacity
+ * @param timeoutMilliseconds 0 never waits, negative waits forever
+ *
+ * @return whether a message arrived, the connection was closed or broke
+ */
+RestClient::WebSocket::Status
+RestClient::WebSocket::Receive(RestClient::WebSocketMessage* message,
+                               int timeoutMilliseconds) {
+  if (!this->open) {
+    return this->error.empty() ? Status::Closed : Status::Error;
+  }
+  std::chrono::steady_clock::time_point start =
+    std::chrono::steady_clock::now();
+  for (;;) {
+    Status status;
+    bool done = false;
+    CURLcode res = this->receiveSome(message, &status, &done);
+    if (done) {
+      return status;
+    }
+    if (res == CURLE_OK) {
+      this->lastReceived = std::chrono::steady_clock::now();
+      this->pingSent = false;
+      continue;
+    }
+    if (res != CURLE_AGAIN) {
+      return this->fail(res == CURLE_GOT_NOTHING
+                        ? "Connection closed without a close frame"
+                        : curl_easy_strerror(res));
+    }
+    if (!this->keepalive()) {
+      return this->fail("No answer to the keepalive ping");
+    }
+    int waitFor = -1;
+    if (timeoutMilliseconds >= 0) {
+      waitFor = timeoutMilliseconds - elapsedMilliseconds(start);
+      if (waitFor <= 0) {
+        return Status::WouldBlock;
+      }
+    }
+    if (this->keepaliveInterval > 0) {
+      // wake up for the next keepalive step
+      int due = this->keepaliveInterval * (this->pingSent ? 2 : 1) -
+                elapsedMilliseconds(this->lastReceived);
+      due = std::max(due, 1);
+      waitFor = waitFor < 0 ? due : std::min(waitFor, due);
+    }
+    if (!this->wait(false, waitFor)) {
+      return this->fail("Cancelled");
+    }
+  }
+}
+
+/**
+ * @brief take the frames in input apart. Data frames are collected into
+ * the message being reassembled, control frames (which can arrive
+ * between its fragments) are handled on their own.
+ *
+ * @return true with status set if a message is complete, the connection
+ * was closed or the peer broke the protocol
+ */
+bool
+RestClient::WebSocket::parse(RestClient::WebSocketMessage* message,
+                             Status* status) {
+  size_t pos = 0;
+  bool done = false;
+  while (!done) {
+    if (!this->inFrame) {
+      size_t available = this->input.size() - pos;
+      if (available < 2) {
+        break;
+      }
+      unsigned char first = static_cast<unsigned char>(this->input[pos]);
+      unsigned char second = static_cast<unsigned char>(this->input[pos + 1]);
+      uint64_t length = second & 0x7f;
+      size_t headLength = 2;
+      if (length >= 126) {
+        // 16 or 64 bit extended payload length
+        size_t extra = length == 126 ? 2 : 8;
+        if (available < headLength + extra) {
+          break;
+        }
+        length = 0;
+        for (size_t i = 0; i < extra; i++) {
+          length = (length << 8) |
+                   static_cast<unsigned char>(this->input[pos + 2 + i]);
+        }
+        headLength += extra;
+      }
+      int opcode = first & 0x0f;
+      bool fin = (first & 0x80) != 0;
+      bool isControl = (opcode & 0x8) != 0;
+      const char* problem = NULL;
+      if (second & 0x80) {
+        problem = "Masked frame from the server";
+      } else if (first & 0x70) {
+        problem = "Frame uses an extension that wasn't negotiated";
+      } else if (opcode != kContinuation && opcode != kText &&
+                 opcode != kBinary && opcode != kClose && opcode != kPing &&
+                 opcode != kPong) {
+        problem = "Unknown opcode";
+      } else if (isControl && (!fin || length > 125)) {
+        problem = "Invalid control frame";
+      } else if (!isControl && (opcode == kContinuation) != this->partial) {
+        problem = "Unexpected fragment";
+      } else if (!isControl &&
+                 this->partialData.size() + length > this->maxMessageSize) {
+        problem = "Message too large";
+      }
+      if (problem) {
+        *status = this->fail(problem);
+        return true;
+      }
+      if (isControl) {
+        this->control.clear();
+      } else if (!this->partial) {
+        this->partial = true;
+        this->partialType = opcode == kBinary
+                            ? RestClient::WebSocketMessageType::Binary
+                            : RestClient::WebSocketMessageType::Text;
+        this->partialData.clear();
+      }
+      this->inFrame = true;
+      this->frameOpcode = opcode;
+      this->frameFinal = fin;
+      this->frameRemaining = length;
+      pos += headLength;
+    }
+    size_t take = static_cast<size_t>(std::min<uint64_t>(
+        this->frameRemaining, this->input.size() - pos));
+    std::string& payload = (this->frameOpcode & 0x8) ? this->control
+                                                     : this->partialData;
+    payload.append(this->input, pos, take);
+    pos += take;
+    this->frameRemaining -= take;
+    if (this->frameRemaining > 0) {
+      break;
+    }
+    this->inFrame = false;
+    if (this->frameOpcode & 0x8) {
+      done = this->controlFrame(message, status);
+    } else if (this->frameFinal) {
+      this->partial = false;
+      message->type = this->partialType;
+      message->closeCode = 0;
+      // the caller's buffer collects the next message
+      message->data.swap(this->partialData);
+      *status = Status::Message;
+      done = true;
+    }
+  }
+  this->input.erase(0, pos);
+  return done;
+}
+
+#if LIBCURL_VERSION_NUM >= 0x080b00
+/**
+ * @brief send a whole message as a single frame with curl_ws_send(), which
+ * masks it
+ */
+CURLcode
+RestClient::WebSocket::sendFrame(const void* data, size_t length,
+                                 int opcode) {
+  unsigned int flags = CURLWS_CLOSE;
+  if (opcode == kText) {
+    flags = CURLWS_TEXT;
+  } else if (opcode == kBinary) {
+    flags = CURLWS_BINARY;
+  } else if (opcode == kPing) {
+    flags = CURLWS_PING;
+  } else if (opcode == kPong) {
+    flags = CURLWS_PONG;
+  }
+  CURL* handle = this->connection->getCurlHandle();
+  const char* bytes = static_cast<const char*>(data);
+  size_t offset = 0;
+  for (;;) {
+    size_t sent = 0;
+    CURLcode res = curl_ws_send(handle, bytes + offset, length - offset,
+                                &sent, 0, flags);
+    offset += sent;
+    if (res == CURLE_OK && offset >= length) {
+      return CURLE_OK;
+    }
+    if (res == CURLE_AGAIN) {
+      if (!this->wait(true, -1)) {
+        this->fail("Cancelled");
+        return CURLE_ABORTED_BY_CALLBACK;
+      }
+    } else if (res != CURLE_OK) {
+      this->fail(curl_easy_strerror(res));
+      return res;
+    }
+  }
+}
+
+/**
+ * @brief receive a piece of a frame with curl_ws_recv(). Data frames are
+ * collected into the message being reassembled, control frames are
+ * handled once complete; libcurl answers pings itself.
+ *
+ * @param done set with status if a message is complete, the connection
+ * was closed or broke
+ *
+ * @return CURLE_OK if something arrived, CURLE_AGAIN if nothing did and
+ * another error if the connection broke
+ */
+CURLcode
+RestClient::WebSocket::receiveFrame(RestClient::WebSocketMessage* message,
+                                    Status* status, bool* done) {
+  char buffer[16384];
+  size_t received = 0;
+  const struct curl_ws_frame* meta = NULL;
+  CURLcode res = curl_ws_recv(this->connection->getCurlHandle(), buffer,
+                              sizeof(buffer), &received, &meta);
+  if (res != CURLE_OK) {
+    return res;
+  }
+  if (meta->offset == 0) {
+    // the first piece of a frame
+    if (meta->flags & CURLWS_CLOSE) {
+      this->frameOpcode = kClose;
+    } else if (meta->flags & CURLWS_PING) {
+      this->frameOpcode = kPing;
+    } else if (meta->flags & CURLWS_PONG) {
+      this->frameOpcode = kPong;
+    } else {
+      this->frameOpcode = (meta->flags & CURLWS_BINARY) ? kBinary : kText;
+    }
+    // CURLWS_CONT marks all but the last fragment of a message
+    this->frameFinal = (meta->flags & CURLWS_CONT) == 0;
+    if (this->frameOpcode & 0x8) {
+      this->control.clear();
+    } else {
+      if (!this->partial) {
+        this->partial = true;
+        this->partialType = this->frameOpcode == kBinary
+                            ? RestClient::WebSocketMessageType::Binary
+                            : RestClient::WebSocketMessageType::Text;
+        this->partialData.clear();
+      }
+      if (this->partialData.size() + received +
+          static_cast<uint64_t>(meta->bytesleft) > this->maxMessageSize) {
+        *status = this->fail("Message too large");
+        *done = true;
+        return CURLE_OK;
+      }
+    }
+  }
+  std::string& payload = (this->frameOpcode & 0x8) ? this->control
+                                                   : this->partialData;
+  payload.append(buffer, received);
+  if (meta->bytesleft > 0) {
+    return CURLE_OK;
+  }
+  if (this->frameOpcode & 0x8) {
+    *done = this->frameOpcode != kPing &&
+            this->controlFrame(message, status);
+  } else if (this->frameFinal) {
+    this->partial = false;
+    message->type = this->partialType;
+    message->closeCode = 0;
+    // the caller's buffer collects the next message
+    message->data.swap(this->partialData);
+    *status = Status::Message;
+    *done = true;
+  }
+  return CURLE_OK;
+}
+#endif
+
+/**
+ * @brief answer a ping, count a pong or complete the closing handshake
+ *
+ * @return true with status set if the connection was closed or broke
+ */
+bool
+RestClient::WebSocket::controlFrame(RestClient::WebSocketMessage* message,
+                                    Status* status) {
+  if (this->frameOpcode == kPing) {
+    if (this->send(this->control.data(), this->control.size(), kPong) !=
+        CURLE_OK && !this->open) {
+      *status = Status::Error;
+      return true;
+    }
+    return false;
+  }
+  if (this->frameOpcode == kPong) {
+    this->pongs++;
+    return false;
+  }
+  message->type = RestClient::WebSocketMessageType::Close;
+  message->closeCode = kNoStatusCode;
+  message->data.clear();
+  if (this->control.size() >= 2) {
+    message->closeCode =
+      (static_cast<unsigned char>(this->control[0]) << 8) |
+      static_cast<unsigned char>(this->control[1]);
+    message->data.assign(this->control, 2, std::string::npos);
+  }
+  if (!this->closing) {
+    // answer with the same code to complete the closing handshake
+    this->send(this->control.data(),
+               std::min<size_t>(this->control.size(), 2), kClose);
+  }
+  this->open = false;
+  this->closing = false;
+  this->partial = false;
+  *status = Status::Closed;
+  return true;
+}
+
+/**
+ * @brief ping when the connection has been idle for the keepalive
+ * interval
+ *
+ * @return false if the ping went unanswered for another interval
+ */
+bool
+RestClient::WebSocket::keepalive() {
+  if (this->keepaliveInterval <= 0) {
+    return true;
+  }
+  int idle = elapsedMilliseconds(this->lastReceived);
+  if (this->pingSent) {
+    return idle < 2 * this->keepaliveInterval;
+  }
+  if (idle >= this->keepaliveInterval) {
+    this->pingSent = this->Ping() == CURLE_OK;
+  }
+  return true;
+}
+
+/**
+ * @brief wait until the socket can be read from or written to. With a
+ * cancellation token on the Connection it waits in short naps so a
+ * cancellation is noticed
+ *
+ * @return false if the Connection's token was cancelled
+ */
+bool
+RestClient::WebSocket::wait(bool writable, int timeoutMilliseconds) {
+  curl_socket_t socket = CURL_SOCKET_BAD;
+  curl_easy_getinfo(this->connection->getCurlHandle(),
+                    CURLINFO_ACTIVESOCKET, &socket);
+  RestClient::CancellationToken* token = this->connection->cancellationToken;
+  std::chrono::steady_clock::time_point start =
+    std::chrono::steady_clock::now();
+  for (;;) {
+    if (token && token->IsCancelled()) {
+      return false;
+    }
+    int nap = timeoutMilliseconds;
+    if (timeoutMilliseconds >= 0) {
+      nap = timeoutMilliseconds - elapsedMilliseconds(start);
+      if (nap <= 0) {
+        return true;
+      }
+    }
+    if (token) {
+      nap = nap < 0 ? 50 : std::min(nap, 50);
+    }
+#if defined(_WIN32)
+    WSAPOLLFD pfd;
+    pfd.fd = socket;
+    pfd.events = writable ? POLLWRNORM : POLLRDNORM;
+    pfd.revents = 0;
+    int ready = WSAPoll(&pfd, 1, nap);
+#else
+    pollfd pfd;
+    pfd.fd = socket;
+    pfd.events = writable ? POLLOUT : POLLIN;
+    pfd.revents = 0;
+    int ready = poll(&pfd, 1, nap);
+#endif
+    if (ready != 0 || !token) {
+      return true;
+    }
+  }
+}
+
+/**
+ * @brief the connection is unusable, remember why
+ */
+RestClient::WebSocket::Status
+RestClient::WebSocket::fail(const std::string& message) {
+  this->open = false;
+  this->partial = false;
+  this->inFrame = false;
+  this->error = message;
+  return Status::Error;
+}
+
+void
+RestClient::WebSocket::SetKeepalive(int intervalMilliseconds) {
+  this->keepaliveInterval = intervalMilliseconds;
+  this->lastReceived = std::chrono::steady_clock::now();
+  this->pingSent = false;
+}
+
+curl_socket_t
+RestClient::WebSocket::Socket() const {
+  if (!this->open) {
+    return CURL_SOCKET_BAD;
+  }
+  curl_socket_t socket = CURL_SOCKET_BAD;
+  curl_easy_getinfo(this->connection->getCurlHandle(),
+                    CURLINFO_ACTIVESOCKET, &socket);
+  return socket;
+}
+
+uint64_t
+RestClient::WebSocket::Pongs() const {
+  return this->pongs;
+}
+
+const std::string&
+RestClient::WebSocket::Error() const {
+  return this->error;
+}
+
+bool
+RestClient::WebSocket::LibcurlFrames() const {
+  return this->curlFrames;
+}
@@ -0,0 +1,342 @@
+/**
+ * Allocation budgets for the request path.
+ *
+ * This is a test program of its own: it replaces the global operator new
+ * and delete and routes libcurl's memory through an AccountingAllocator
+ * with RestClient::init(), which has to happen before anything else in the
+ * process uses libcurl. Only allocations made on the measuring thread are
+ * counted, so the loopback server threads don't show up.
+ *
+ * Budgets for operator new are exact for libstdc++, libcurl's depend on its version and
+ * build options and have some headroom.
+ *
+ * A failing budget means a change added heap allocations to a hot path.
+ * If that is intended, raise the budget in the same change and say why;
+ * if a change removes allocations, lower it so they can't come back
+ * unnoticed.
+ */
+
+#include <gtest/gtest.h>
+#include <curl/curl.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+
+#include "restclient-cpp/connection.h"
+#include "restclient-cpp/memory.h"
+#include "restclient-cpp/restclient.h"
+#include "loopback_server.h"
+
+namespace {
+
+struct AllocationCount {
+  uint64_t news;
+  uint64_t newBytes;
+  uint64_t curl;
+  uint64_t curlBytes;
+};
+
+thread_local bool tracking = false;
+thread_local AllocationCount counts = {0, 0, 0, 0};
+
+void* countedNew(size_t size) {
+  if (tracking) {
+    counts.news++;
+    counts.newBytes += size;
+  }
+  void* p = std::malloc(size ? size : 1);
+  if (!p) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+// libcurl's memory, counted per thread and pooled
+RestClient::PoolAllocator curlPool;
+RestClient::AccountingAllocator curlMemory(&curlPool);
+
+}  // namespace
+
+void* operator new(size_t size) {
+  return countedNew(size);
+}
+
+void* operator new[](size_t size) {
+  return countedNew(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+  try {
+    return countedNew(size);
+  } catch (...) {
+    return NULL;
+  }
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+  try {
+    return countedNew(size);
+  } catch (...) {
+    return NULL;
+  }
+}
+
+void operator delete(void* p) noexcept {
+  std::free(p);
+}
+
+void operator delete[](void* p) noexcept {
+  std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+  std::free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept {
+  std::free(p);
+}
+
+class AllocationBudgetTest : public ::testing::Test
+{
+ protected:
+
+    RestClient::Testing::LoopbackServer server;
+
+    AllocationBudgetTest()
+    {
+    }
+
+    virtual ~AllocationBudgetTest()
+    {
+    }
+
+    virtual void SetUp()
+    {
+      ASSERT_TRUE(server.Start());
+    }
+
+    virtual void TearDown()
+    {
+      server.Stop();
+    }
+
+    // warm up (connection set up, capacity of reused buffers), then return
+    // the largest count of a few runs
+    template <typename Request>
+    static AllocationCount measure(Request request)
+    {
+      for (int i = 0; i < 3; i++) {
+        request();
+      }
+      AllocationCount worst = {0, 0, 0, 0};
+      for (int i = 0; i < 5; i++) {
+        counts = AllocationCount();
+        RestClient::MemoryStats before = curlMemory.ThreadStats();
+        tracking = true;
+        request();
+        tracking = false;
+        RestClient::MemoryStats after = curlMemory.ThreadStats();
+        counts.curl = after.allocations + after.reallocations -
+                      before.allocations - before.reallocations;
+        counts.curlBytes = after.bytesAllocated - before.bytesAllocated;
+        if (counts.news + counts.curl > worst.news + worst.curl) {
+          worst = counts;
+        }
+      }
+      return worst;
+    }
+
+    static void expectBudget(const char* name, const AllocationCount& count,
+                             uint64_t newBudget, uint64_t curlBudget)
+    {
+      std::printf("[ ALLOCS   ] %s: %llu new (%llu bytes), %llu curl "
+                  "(%llu bytes)\n", name,
+                  static_cast<unsigned long long>(count.news),  // NOLINT
+                  static_cast<unsigned long long>(count.newBytes),  // NOLINT
+                  static_cast<unsigned long long>(count.curl),  // NOLINT
+                  static_cast<unsigned long long>(count.curlBytes));  // NOLINT
+      EXPECT_LE(count.news, newBudget) << name;
+      EXPECT_LE(count.curl, curlBudget) << name;
+    }
+};
+
+TEST_F(AllocationBudgetTest, TestCounting)
+{
+  counts = AllocationCount();
+  RestClient::MemoryStats before = curlMemory.ThreadStats();
+  tracking = true;
+  std::string* s = new std::string(100, 'x');
+  delete s;
+  void* c = curlMemory.Allocate(10);
+  c = curlMemory.Reallocate(c, 20);
+  curlMemory.Free(c);
+  tracking = false;
+  RestClient::MemoryStats after = curlMemory.ThreadStats();
+  EXPECT_EQ(2u, counts.news);
+  EXPECT_EQ(1u, after.allocations - before.allocations);
+  EXPECT_EQ(1u, after.reallocations - before.reallocations);
+  EXPECT_EQ(1u, after.frees - before.frees);
+  EXPECT_EQ(30u, after.bytesAllocated - before.bytesAllocated);
+  EXPECT_EQ(30u, after.bytesFreed - before.bytesFreed);
+}
+
+TEST_F(AllocationBudgetTest, TestGet)
+{
+  RestClient::Connection conn(server.Url());
+  expectBudget("GET", measure([&conn]() { conn.get("/bytes/100"); }),
+               4, 50);
+}
+
+TEST_F(AllocationBudgetTest, TestGetIntoResponse)
+{
+  RestClient::Connection conn(server.Url());
+  RestClient::Response response;
+  expectBudget("GET Response*",
+               measure([&conn, &response]() {
+                 conn.get("/bytes/100", &response);
+               }), 0, 50);
+}
+
+TEST_F(AllocationBudgetTest, TestGetManyHeaders)
+{
+  RestClient::Connection conn(server.Url());
+  expectBudget("GET 32 headers",
+               measure([&conn]() { conn.get("/headers/32"); }), 99, 90);
+}
+
+TEST_F(AllocationBudgetTest, TestGetManyHeadersIntoResponse)
+{
+  RestClient::Connection conn(server.Url());
+  RestClient::Response response;
+  // the header map keeps its nodes between requests
+  expectBudget("GET 32 headers, Response*",
+               measure([&conn, &response]() {
+                 conn.get("/headers/32", &response);
+               }), 0, 90);
+}
+
+TEST_F(AllocationBudgetTest, TestGetManyHeadersAllowList)
+{
+  RestClient::Connection conn(server.Url());
+  conn.SetHeaderCapture(RestClient::Connection::HeaderCapture::AllowList,
+                        {"Content-Type"});
+  expectBudget("GET 32 headers, allow list",
+               measure([&conn]() { conn.get("/headers/32"); }), 1, 90);
+}
+
+TEST_F(AllocationBudgetTest, TestGetManyHeadersIntoArena)
+{
+  RestClient::Connection conn(server.Url());
+  RestClient::Arena arena;
+  RestClient::ArenaAllocator<char> allocator(&arena);
+  expectBudget("GET 32 headers, arena",
+               measure([&conn, &arena, &allocator]() {
+                 arena.Reset();
+                 RestClient::ArenaResponse response(allocator);
+                 conn.get("/headers/32", &response);
+               }), 0, 90);
+}
+
+TEST_F(AllocationBudgetTest, TestGetWithRequestHeaders)
+{
+  RestClient::Connection conn(server.Url());
+  for (int i = 0; i < 8; i++) {
+    conn.AppendHeader("X-Request-Header-" + std::to_string(i), "value");
+  }
+  expectBudget("GET 8 request headers",
+               measure([&conn]() { conn.get("/bytes/100"); }), 5, 70);
+}
+
+TEST_F(AllocationBudgetTest, TestLargeBody)
+{
+  RestClient::Connection conn(server.Url());
+  expectBudget("GET 1MB", measure([&conn]() { conn.get("/bytes/1048576"); }),
+               11, 50);
+}
+
+TEST_F(AllocationBudgetTest, TestPost)
+{
+  RestClient::Connection conn(server.Url());
+  const std::string body(1000, 'x');
+  expectBudget("POST", measure([&conn, &body]() { conn.post("/", body); }),
+               3, 48);
+}
+
+TEST_F(AllocationBudgetTest, TestPostIntoResponse)
+{
+  RestClient::Connection conn(server.Url());
+  RestClient::Response response;
+  const std::string body(1000, 'x');
+  expectBudget("POST Response*",
+               measure([&conn, &body, &response]() {
+                 conn.post("/", body, &response);
+               }), 0, 48);
+}
+
+TEST_F(AllocationBudgetTest, TestGetIntoBuffer)
+{
+  RestClient::Connection conn(server.Url());
+  char buffer[4096];
+  RestClient::BufferResponse response = {};
+  response.body = buffer;
+  response.capacity = sizeof(buffer);
+  expectBudget("GET buffer",
+               measure([&conn, &response]() {
+                 conn.get("/bytes/1000", &response);
+               }), 0, 50);
+}
+
+TEST_F(AllocationBudgetTest, TestPut)
+{
+  RestClient::Connection conn(server.Url());
+  const std::string body(1000, 'x');
+  // libcurl sends PUT bodies with Expect: 100-continue, the interim
+  // response adds an entry to Response::headers
+  expectBudget("PUT", measure([&conn, &body]() { conn.put("/", body); }),
+               5, 48);
+}
+
+TEST_F(AllocationBudgetTest, TestHead)
+{
+  RestClient::Connection conn(server.Url());
+  expectBudget("HEAD", measure([&conn]() { conn.head("/"); }), 3, 48);
+}
+
+TEST_F(AllocationBudgetTest, TestPooledCurlMemory)
+{
+  RestClient::Connection conn(server.Url());
+  for (int i = 0; i < 3; i++) {
+    conn.get("/bytes/100");
+  }
+  // libcurl's steady state allocations all come from the pool
+  uint64_t misses = curlPool.Misses();
+  uint64_t hits = curlPool.Hits();
+  for (int i = 0; i < 5; i++) {
+    conn.get("/bytes/100");
+  }
+  EXPECT_EQ(misses, curlPool.Misses());
+  EXPECT_GT(curlPool.Hits(), hits);
+}
+
+TEST_F(AllocationBudgetTest, TestSimpleGet)
+{
+  const std::string url = server.Url() + "/bytes/100";
+  expectBudget("RestClient::get",
+               measure([&url]() { RestClient::get(url); }), 9, 85);
+}
+
+int main(int argc, char** argv) {
+  // has to come before any other use of libcurl in the process
+  if (RestClient::init(&curlMemory) != 0) {
+    std::fprintf(stderr, "RestClient::init failed\n");
+    return 1;
+  }
+  ::testing::InitGoogleTest(&argc, argv);
+  int result = RUN_ALL_TESTS();
+  RestClient::disable();
+  return result;
+}
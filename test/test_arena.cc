@@ -0,0 +1,116 @@
+#include "restclient-cpp/arena.h"
+#include "restclient-cpp/connection.h"
+#include "loopback_server.h"
+#include <gtest/gtest.h>
+#include <cstdint>
+#include <string>
+
+class ArenaTest : public ::testing::Test
+{
+ protected:
+
+    RestClient::Testing::LoopbackServer server;
+
+    ArenaTest()
+    {
+    }
+
+    virtual ~ArenaTest()
+    {
+    }
+
+    virtual void SetUp()
+    {
+      ASSERT_TRUE(server.Start());
+    }
+
+    virtual void TearDown()
+    {
+      server.Stop();
+    }
+
+    static std::string str(const RestClient::ArenaResponse::String& s)
+    {
+      return std::string(s.data(), s.size());
+    }
+};
+
+TEST_F(ArenaTest, TestAllocate)
+{
+  RestClient::Arena arena(256);
+  char* a = static_cast<char*>(arena.Allocate(3, 1));
+  void* b = arena.Allocate(8, 8);
+  EXPECT_EQ(0u, reinterpret_cast<uintptr_t>(b) % 8);
+  EXPECT_NE(a, b);
+  EXPECT_EQ(11u, arena.Used());
+  EXPECT_EQ(256u, arena.Capacity());
+
+  // larger than a block gets a block of its own
+  void* big = arena.Allocate(1000, 16);
+  EXPECT_EQ(0u, reinterpret_cast<uintptr_t>(big) % 16);
+  EXPECT_GE(arena.Capacity(), 1256u);
+
+  size_t capacity = arena.Capacity();
+  arena.Reset();
+  EXPECT_EQ(0u, arena.Used());
+  EXPECT_EQ(a, arena.Allocate(3, 1));
+  arena.Allocate(1000, 16);
+  EXPECT_EQ(capacity, arena.Capacity());
+
+  arena.Release();
+  EXPECT_EQ(0u, arena.Capacity());
+}
+
+TEST_F(ArenaTest, TestCallerBuffer)
+{
+  alignas(16) char buffer[128];
+  RestClient::Arena arena(buffer, sizeof(buffer), 256);
+  char* p = static_cast<char*>(arena.Allocate(64, 16));
+  EXPECT_EQ(buffer, p);
+  arena.Allocate(128, 16);
+  EXPECT_EQ(128u + 256u, arena.Capacity());
+  // the buffer isn't the arena's to free
+  arena.Release();
+  EXPECT_EQ(128u, arena.Capacity());
+  EXPECT_EQ(buffer, arena.Allocate(8, 8));
+}
+
+TEST_F(ArenaTest, TestGetIntoArenaResponse)
+{
+  RestClient::Arena arena;
+  RestClient::ArenaAllocator<char> allocator(&arena);
+  RestClient::Connection conn(server.Url());
+  for (int i = 0; i < 3; i++) {
+    arena.Reset();
+    RestClient::ArenaResponse response(allocator);
+    ASSERT_EQ(&response, conn.get("/headers/4", &response));
+    EXPECT_EQ(200, response.code);
+    EXPECT_EQ("ok", str(response.body));
+    EXPECT_GT(arena.Used(), 0u);
+    RestClient::ArenaResponse::String name("X-Loopback-Header-3", allocator);
+    ASSERT_EQ(1u, response.headers.count(name));
+    EXPECT_EQ("value-3-abcdefghijklmnopqrstuvwxyz",
+              str(response.headers.find(name)->second));
+  }
+  EXPECT_EQ("value-3-abcdefghijklmnopqrstuvwxyz",
+            conn.GetResponseHeaders().Get("x-loopback-header-3"));
+
+  conn.SetHeaderCapture(RestClient::Connection::HeaderCapture::AllowList,
+                        {"content-length"});
+  RestClient::ArenaResponse response(allocator);
+  conn.get("/headers/4", &response);
+  ASSERT_EQ(1u, response.headers.size());
+  EXPECT_EQ("Content-Length", str(response.headers.begin()->first));
+  EXPECT_EQ("2", str(response.headers.begin()->second));
+}
+
+TEST_F(ArenaTest, TestGetErrorIntoArenaResponse)
+{
+  RestClient::Arena arena;
+  RestClient::ArenaAllocator<char> allocator(&arena);
+  RestClient::Connection conn("http://127.0.0.1:1");
+  RestClient::ArenaResponse response(allocator);
+  conn.get("/", &response);
+  EXPECT_EQ(CURLE_COULDNT_CONNECT, response.code);
+  EXPECT_FALSE(response.body.empty());
+}
@@ -0,0 +1,152 @@
+#include "restclient-cpp/balancer.h"
+#include "restclient-cpp/connection.h"
+#include "fault_proxy.h"
+#include "loopback_server.h"
+#include <gtest/gtest.h>
+#include <chrono>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+class BalancedConnectionTest : public ::testing::Test
+{
+ protected:
+
+    RestClient::Testing::LoopbackServer first;
+    RestClient::Testing::LoopbackServer second;
+
+    BalancedConnectionTest()
+    {
+    }
+
+    virtual ~BalancedConnectionTest()
+    {
+    }
+
+    virtual void SetUp()
+    {
+      ASSERT_TRUE(first.Start());
+      ASSERT_TRUE(second.Start());
+    }
+
+    virtual void TearDown()
+    {
+      second.Stop();
+      first.Stop();
+    }
+};
+
+TEST_F(BalancedConnectionTest, TestNewEndpointsAreTriedFirst)
+{
+  RestClient::Testing::LoopbackServer third;
+  ASSERT_TRUE(third.Start());
+  RestClient::BalancedConnection conn({first.Url(), second.Url(),
+                                       third.Url()});
+  conn.SetStrategy(RestClient::BalancedConnection::Strategy::PeakEwma);
+  EXPECT_EQ(3u, conn.Endpoints());
+  std::set<size_t> used;
+  for (int i = 0; i < 3; i++) {
+    EXPECT_EQ(200, conn.get("/").code);
+    used.insert(conn.LastEndpoint());
+  }
+  EXPECT_EQ(3u, used.size());
+  EXPECT_GT(conn.GetEndpointStats(0).latency, 0);
+  EXPECT_EQ(first.Url(), conn.GetEndpointStats(0).baseUrl);
+  third.Stop();
+}
+
+TEST_F(BalancedConnectionTest, TestAvoidsSlowEndpoint)
+{
+  RestClient::Testing::FaultProxy proxy;
+  proxy.SetUpstream("127.0.0.1", second.Port());
+  RestClient::Testing::FaultConfig faults;
+  faults.latency = RestClient::Testing::LatencyDistribution::Fixed(50000);
+  proxy.SetFaults(faults);
+  ASSERT_TRUE(proxy.Start());
+
+  RestClient::BalancedConnection conn({first.Url(), proxy.Url()});
+  for (int i = 0; i < 20; i++) {
+    EXPECT_EQ(200, conn.get("/").code);
+  }
+  // one request to learn it is slow
+  EXPECT_EQ(1u, conn.GetEndpointStats(1).requests);
+  EXPECT_EQ(19u, conn.GetEndpointStats(0).requests);
+  EXPECT_GE(conn.GetEndpointStats(1).latency, 40000);
+  proxy.Stop();
+}
+
+TEST_F(BalancedConnectionTest, TestOutlierEjection)
+{
+  RestClient::BalancedConnection conn({first.Url(), "http://127.0.0.1:1"});
+  conn.SetStrategy(RestClient::BalancedConnection::Strategy::PeakEwma);
+  conn.SetOutlierEjection(2, 200);
+  // a short decay time lets the failing endpoint look cheap again right
+  // after its cooldown
+  conn.SetDecayTime(10);
+  for (int i = 0; i < 20; i++) {
+    conn.get("/");
+  }
+  RestClient::BalancedConnection::EndpointStats stats =
+    conn.GetEndpointStats(1);
+  EXPECT_TRUE(stats.ejected);
+  EXPECT_EQ(1u, stats.ejections);
+  EXPECT_EQ(2u, stats.failures);
+  EXPECT_EQ(18u, conn.GetEndpointStats(0).requests);
+  EXPECT_EQ(0, conn.GetEndpointStats(0).consecutiveFailures);
+
+  // after the cooldown a single failure ejects it again
+  std::this_thread::sleep_for(std::chrono::milliseconds(250));
+  EXPECT_FALSE(conn.GetEndpointStats(1).ejected);
+  for (int i = 0; i < 50 && conn.GetEndpointStats(1).failures == 2; i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    conn.get("/");
+  }
+  stats = conn.GetEndpointStats(1);
+  EXPECT_EQ(3u, stats.failures);
+  EXPECT_TRUE(stats.ejected);
+  EXPECT_EQ(2u, stats.ejections);
+}
+
+TEST_F(BalancedConnectionTest, TestNoEndpoints)
+{
+  EXPECT_THROW(RestClient::BalancedConnection(std::vector<std::string>()),
+               std::invalid_argument);
+}
+
+TEST_F(BalancedConnectionTest, TestAllEndpointsEjected)
+{
+  RestClient::BalancedConnection conn({"http://127.0.0.1:1",
+                                       "http://127.0.0.1:2"});
+  conn.SetOutlierEjection(1, 10000);
+  for (int i = 0; i < 4; i++) {
+    EXPECT_EQ(CURLE_COULDNT_CONNECT, conn.get("/").code);
+  }
+  EXPECT_TRUE(conn.GetEndpointStats(0).ejected);
+  EXPECT_TRUE(conn.GetEndpointStats(1).ejected);
+}
+
+TEST_F(BalancedConnectionTest, TestWarmup)
+{
+  RestClient::BalancedConnection conn({first.Url(), second.Url()});
+  conn.SetWarmup("/health", 0);
+  conn.ForEachEndpoint([](RestClient::Connection* c) {
+    c->SetTimeout(5);
+  });
+  EXPECT_EQ(5, conn.GetEndpoint(1)->GetInfo().timeout);
+  EXPECT_EQ(2u, conn.Warmup());
+  EXPECT_EQ(2u, conn.KeepWarm());
+  EXPECT_EQ(2u, first.Requests());
+  EXPECT_EQ(2u, second.Requests());
+  for (int i = 0; i < 4; i++) {
+    EXPECT_EQ(200, conn.get("/").code);
+    EXPECT_EQ(0, conn.GetEndpoint(conn.LastEndpoint())->GetRequestInfo()
+                 .newConnections);
+  }
+  EXPECT_EQ(1u, first.Connections());
+  EXPECT_EQ(1u, second.Connections());
+
+  conn.SetWarmup("/health", 60000);
+  EXPECT_EQ(0u, conn.KeepWarm());
+}
@@ -0,0 +1,144 @@
+#include "restclient-cpp/connection.h"
+#include "restclient-cpp/restclient.h"
+#include "loopback_server.h"
+#include <gtest/gtest.h>
+#include <cstring>
+#include <string>
+
+class BufferResponseTest : public ::testing::Test
+{
+ protected:
+
+    RestClient::Testing::LoopbackServer server;
+
+    BufferResponseTest()
+    {
+    }
+
+    virtual ~BufferResponseTest()
+    {
+    }
+
+    virtual void SetUp()
+    {
+      server.SetHandler(serveMethod);
+      ASSERT_TRUE(server.Start());
+    }
+
+    virtual void TearDown()
+    {
+      server.Stop();
+    }
+
+    // answers with the method in a header and the request body, or a
+    // sized body for /bytes/N
+    static void serveMethod(const RestClient::Testing::LoopbackRequest& request,
+                            RestClient::Testing::LoopbackResponse* response)
+    {
+      RestClient::Testing::LoopbackServer::DefaultHandler(request, response);
+      response->headers.push_back(std::make_pair("X-Method", request.method));
+      if (request.path == "/") {
+        response->headers.push_back(std::make_pair("X-Root", "yes"));
+        response->body = request.body;
+      }
+    }
+};
+
+TEST_F(BufferResponseTest, TestVerbsIntoResponse)
+{
+  RestClient::Connection conn(server.Url());
+  RestClient::Response response;
+  EXPECT_EQ(&response, conn.post("/", "posted", &response));
+  EXPECT_EQ(200, response.code);
+  EXPECT_EQ("posted", response.body);
+  EXPECT_EQ("POST", response.headers["X-Method"]);
+
+  conn.put("/", "put", &response);
+  EXPECT_EQ("put", response.body);
+  EXPECT_EQ("PUT", response.headers["X-Method"]);
+  conn.patch("/", "patched", &response);
+  EXPECT_EQ("patched", response.body);
+  EXPECT_EQ("PATCH", response.headers["X-Method"]);
+  conn.del("/", &response);
+  EXPECT_EQ("", response.body);
+  EXPECT_EQ("DELETE", response.headers["X-Method"]);
+  conn.head("/", &response);
+  EXPECT_EQ("HEAD", response.headers["X-Method"]);
+  conn.options("/", &response);
+  EXPECT_EQ(200, response.code);
+  EXPECT_EQ("OPTIONS", response.headers["X-Method"]);
+}
+
+TEST_F(BufferResponseTest, TestStaleHeadersAreDropped)
+{
+  RestClient::Connection conn(server.Url());
+  RestClient::Response response;
+  conn.get("/", &response);
+  EXPECT_EQ("yes", response.headers["X-Root"]);
+  size_t withRoot = response.headers.size();
+
+  // the same response, a request without X-Root
+  conn.get("/bytes/10", &response);
+  EXPECT_EQ(200, response.code);
+  EXPECT_EQ(std::string(10, 'x'), response.body);
+  EXPECT_EQ(0u, response.headers.count("X-Root"));
+  EXPECT_EQ(withRoot - 1, response.headers.size());
+  EXPECT_EQ("GET", response.headers["X-Method"]);
+
+  // headers a caller added before the request are gone as well
+  response.headers["X-Mine"] = "1";
+  conn.get("/bytes/10", &response);
+  EXPECT_EQ(0u, response.headers.count("X-Mine"));
+}
+
+TEST_F(BufferResponseTest, TestBodyFits)
+{
+  RestClient::Connection conn(server.Url());
+  char buffer[64];
+  RestClient::BufferResponse response = {};
+  response.body = buffer;
+  response.capacity = sizeof(buffer);
+  EXPECT_EQ(&response, conn.get("/bytes/64", &response));
+  EXPECT_EQ(200, response.code);
+  EXPECT_EQ(64u, response.size);
+  EXPECT_EQ(std::string(64, 'x'), std::string(buffer, response.size));
+  EXPECT_EQ("GET", response.headers["X-Method"]);
+
+  conn.post("/", "posted", &response);
+  EXPECT_EQ(200, response.code);
+  EXPECT_EQ("posted", std::string(buffer, response.size));
+  EXPECT_EQ("POST", response.headers["X-Method"]);
+  conn.head("/", &response);
+  EXPECT_EQ(200, response.code);
+  EXPECT_EQ(0u, response.size);
+}
+
+TEST_F(BufferResponseTest, TestBodyTooLarge)
+{
+  RestClient::Connection conn(server.Url());
+  char buffer[65];
+  std::memset(buffer, 0, sizeof(buffer));
+  RestClient::BufferResponse response = {};
+  response.body = buffer;
+  response.capacity = 64;
+  conn.get("/bytes/100000", &response);
+  EXPECT_EQ(RestClient::kBodyTooLarge, response.code);
+  // what fit is kept, nothing is written past the capacity
+  EXPECT_EQ(64u, response.size);
+  EXPECT_EQ(std::string(64, 'x'), std::string(buffer, response.size));
+  EXPECT_EQ(0, buffer[64]);
+  EXPECT_EQ(CURLE_WRITE_ERROR, conn.GetInfo().lastRequest.curlCode);
+
+  // the connection is fine afterwards
+  response.capacity = sizeof(buffer);
+  conn.get("/bytes/10", &response);
+  EXPECT_EQ(200, response.code);
+  EXPECT_EQ(10u, response.size);
+
+  // without a buffer every body is too large
+  RestClient::BufferResponse empty = {};
+  conn.get("/bytes/1", &empty);
+  EXPECT_EQ(RestClient::kBodyTooLarge, empty.code);
+  conn.get("/bytes/0", &empty);
+  EXPECT_EQ(200, empty.code);
+}
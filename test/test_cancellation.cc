@@ -0,0 +1,148 @@
+#include "restclient-cpp/cancellation.h"
+#include "restclient-cpp/balancer.h"
+#include "restclient-cpp/connection.h"
+#include "fault_proxy.h"
+#include "loopback_server.h"
+#include <gtest/gtest.h>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <thread>
+
+namespace {
+
+int progressCalls = 0;
+
+int countProgress(void* /* clientp */, double /* dltotal */,
+                  double /* dlnow */, double /* ultotal */,
+                  double /* ulnow */) {
+  progressCalls++;
+  return 0;
+}
+
+}  // namespace
+
+class CancellationTest : public ::testing::Test
+{
+ protected:
+
+    RestClient::Testing::LoopbackServer server;
+    RestClient::Testing::FaultProxy proxy;
+    RestClient::CancellationToken token;
+
+    CancellationTest()
+    {
+    }
+
+    virtual ~CancellationTest()
+    {
+    }
+
+    virtual void SetUp()
+    {
+      ASSERT_TRUE(server.Start());
+      proxy.SetUpstream("127.0.0.1", server.Port());
+      ASSERT_TRUE(proxy.Start());
+    }
+
+    virtual void TearDown()
+    {
+      proxy.Stop();
+      server.Stop();
+    }
+
+    // cancel the token from another thread after delayMillis
+    std::thread cancelAfter(int delayMillis)
+    {
+      return std::thread([this, delayMillis]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(delayMillis));
+        token.Cancel();
+      });
+    }
+
+    static int64_t millisSince(std::chrono::steady_clock::time_point start)
+    {
+      return std::chrono::duration_cast<std::chrono::milliseconds>(
+          std::chrono::steady_clock::now() - start).count();
+    }
+};
+
+TEST_F(CancellationTest, TestCancelWaitingRequest)
+{
+  RestClient::Testing::FaultConfig faults;
+  faults.latency = RestClient::Testing::LatencyDistribution::Fixed(3000000);
+  proxy.SetFaults(faults);
+  RestClient::Connection conn(proxy.Url());
+  conn.SetCancellationToken(&token);
+
+  std::chrono::steady_clock::time_point start =
+    std::chrono::steady_clock::now();
+  std::thread canceller = cancelAfter(100);
+  RestClient::Response res = conn.get("/");
+  canceller.join();
+  EXPECT_EQ(RestClient::kCancelled, res.code);
+  EXPECT_EQ("Request cancelled", res.body);
+  EXPECT_EQ(CURLE_ABORTED_BY_CALLBACK, conn.GetInfo().lastRequest.curlCode);
+  EXPECT_GE(millisSince(start), 100);
+  // Cancel() wakes the transfer up, it doesn't wait for the progress
+  // callback that runs once a second
+  EXPECT_LT(millisSince(start), 500);
+}
+
+TEST_F(CancellationTest, TestCancelDuringBody)
+{
+  RestClient::Testing::FaultConfig faults;
+  faults.dripBytes = 1000;
+  faults.dripMicros = 50000;
+  proxy.SetFaults(faults);
+  RestClient::Connection conn(proxy.Url());
+  conn.SetCancellationToken(&token);
+
+  std::thread canceller = cancelAfter(200);
+  // 100 pieces, 5 seconds if it wasn't cancelled
+  RestClient::Response res = conn.get("/bytes/100000");
+  canceller.join();
+  EXPECT_EQ(RestClient::kCancelled, res.code);
+}
+
+TEST_F(CancellationTest, TestCancelledBeforeSend)
+{
+  RestClient::Connection conn(server.Url());
+  conn.SetCancellationToken(&token);
+  token.Cancel();
+  EXPECT_TRUE(token.IsCancelled());
+  RestClient::Response res = conn.get("/");
+  EXPECT_EQ(RestClient::kCancelled, res.code);
+  EXPECT_EQ("Cancelled before the request was sent",
+            conn.GetInfo().lastRequest.curlError);
+  EXPECT_EQ(0u, server.Requests());
+
+  token.Reset();
+  EXPECT_EQ(200, conn.get("/").code);
+  conn.SetCancellationToken(NULL);
+  token.Cancel();
+  EXPECT_EQ(200, conn.get("/").code);
+}
+
+TEST_F(CancellationTest, TestProgressCallbackIsKept)
+{
+  RestClient::Connection conn(server.Url());
+  conn.SetCancellationToken(&token);
+  conn.SetFileProgressCallback(countProgress);
+  progressCalls = 0;
+  EXPECT_EQ(200, conn.get("/bytes/100000").code);
+  EXPECT_GT(progressCalls, 0);
+}
+
+TEST_F(CancellationTest, TestCancelledRequestsDontEjectEndpoints)
+{
+  RestClient::BalancedConnection conn({server.Url()});
+  conn.SetOutlierEjection(1, 10000);
+  conn.ForEachEndpoint([this](RestClient::Connection* c) {
+    c->SetCancellationToken(&token);
+  });
+  token.Cancel();
+  EXPECT_EQ(RestClient::kCancelled, conn.get("/").code);
+  EXPECT_EQ(0u, conn.GetEndpointStats(0).failures);
+  EXPECT_FALSE(conn.GetEndpointStats(0).ejected);
+}
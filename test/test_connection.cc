@@ -1,10 +1,15 @@
 #include "restclient-cpp/restclient.h"
 #include "restclient-cpp/connection.h"
+#include "restclient-cpp/flightrecorder.h"
 #include <gtest/gtest.h>
 #include <json/json.h>
+#include <chrono>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include "tests.h"
+#include "loopback_server.h"
 
 class ConnectionTest : public ::testing::Test
 {
@@ -390,3 +395,217 @@ TEST_F(ConnectionTest, TestSetWriteFunction)
   EXPECT_EQ(200, res.code);
   EXPECT_EQ(ret, lineReceived.size() + lines);
 }
+
+TEST_F(ConnectionTest, TestGetRequestInfo)
+{
+  RestClient::Connection local("file://");
+  RestClient::Response res = local.get(std::string(__FILE__));
+  RestClient::Connection::ExtendedRequestInfo info = local.GetRequestInfo();
+
+  EXPECT_EQ(CURLE_OK, info.curlCode);
+  EXPECT_EQ(static_cast<int64_t>(res.body.size()), info.downloadedBytes);
+  EXPECT_GT(info.totalTime, 0);
+  EXPECT_EQ(0, info.redirectCount);
+  EXPECT_DOUBLE_EQ(info.totalTime / 1e6,
+                   local.GetInfo().lastRequest.totalTime);
+  EXPECT_EQ(RestClient::Connection::InfoCapture::Eager,
+            local.GetInfo().infoCapture);
+}
+
+TEST_F(ConnectionTest, TestLazyRequestInfo)
+{
+  RestClient::Connection local("file://");
+  local.SetInfoCapture(RestClient::Connection::InfoCapture::Lazy);
+  RestClient::Response res = local.get(std::string(__FILE__));
+  EXPECT_EQ(static_cast<int64_t>(res.body.size()),
+            local.GetRequestInfo().downloadedBytes);
+
+  // the next request reads the pending information before resetting
+  local.get(std::string(__FILE__) + ".missing");
+  RestClient::Connection::ExtendedRequestInfo info = local.GetRequestInfo();
+  EXPECT_EQ(CURLE_FILE_COULDNT_READ_FILE, info.curlCode);
+  EXPECT_EQ(0, info.downloadedBytes);
+  EXPECT_EQ(CURLE_FILE_COULDNT_READ_FILE,
+            local.GetInfo().lastRequest.curlCode);
+}
+
+TEST_F(ConnectionTest, TestDisabledRequestInfo)
+{
+  RestClient::Connection local("file://");
+  local.SetInfoCapture(RestClient::Connection::InfoCapture::Disabled);
+  local.get(std::string(__FILE__));
+  RestClient::Connection::ExtendedRequestInfo info = local.GetRequestInfo();
+
+  EXPECT_EQ(0, info.totalTime);
+  EXPECT_EQ(0, info.downloadedBytes);
+  EXPECT_EQ(0, local.GetInfo().lastRequest.totalTime);
+  EXPECT_EQ(CURLE_OK, local.GetInfo().lastRequest.curlCode);
+
+  // the flight recorder reads its timings on its own
+  RestClient::FlightRecorder recorder(16);
+  local.SetFlightRecorder(&recorder);
+  RestClient::Response res = local.get(std::string(__FILE__));
+  std::vector<RestClient::FlightRecord> records = recorder.Dump();
+  ASSERT_EQ(1u, records.size());
+  EXPECT_GT(records[0].totalTime, 0);
+  EXPECT_EQ(res.body.size(), records[0].responseBytes);
+  EXPECT_EQ(0, local.GetRequestInfo().totalTime);
+  EXPECT_EQ(0, local.GetInfo().lastRequest.totalTime);
+}
+
+class ConnectionLoopbackTest : public ::testing::Test
+{
+ protected:
+
+    RestClient::Testing::LoopbackServer server;
+
+    ConnectionLoopbackTest()
+    {
+    }
+
+    virtual ~ConnectionLoopbackTest()
+    {
+    }
+
+    virtual void SetUp()
+    {
+      ASSERT_TRUE(server.Start());
+    }
+
+    virtual void TearDown()
+    {
+      server.Stop();
+    }
+
+    // connections are counted when the server accepts them, which can be
+    // after the client considers itself connected
+    static uint64_t connections(
+        const RestClient::Testing::LoopbackServer& s, uint64_t expected)
+    {
+      for (int i = 0; i < 100 && s.Connections() < expected; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      }
+      return s.Connections();
+    }
+};
+
+TEST_F(ConnectionLoopbackTest, TestPreconnect)
+{
+  RestClient::Connection conn(server.Url());
+  EXPECT_TRUE(conn.Preconnect());
+  EXPECT_EQ(1u, connections(server, 1));
+  EXPECT_EQ(0u, server.Requests());
+  // connect-only connections are not reused by libcurl
+  EXPECT_EQ(200, conn.get("/").code);
+
+  RestClient::Connection closed("http://127.0.0.1:1");
+  EXPECT_FALSE(closed.Preconnect());
+}
+
+TEST_F(ConnectionLoopbackTest, TestPreconnectWithWarmupRequest)
+{
+  RestClient::Connection conn(server.Url());
+  EXPECT_TRUE(conn.Preconnect("/health"));
+  EXPECT_EQ(1u, server.Requests());
+  EXPECT_EQ(200, conn.get("/bytes/10").code);
+  RestClient::Connection::ExtendedRequestInfo info = conn.GetRequestInfo();
+  EXPECT_TRUE(info.connectionReused);
+  EXPECT_EQ(0, info.newConnections);
+  EXPECT_EQ(0, info.connectTime);
+  EXPECT_EQ(1u, server.Connections());
+}
+
+TEST_F(ConnectionLoopbackTest, TestWarmup)
+{
+  RestClient::Testing::LoopbackServer other;
+  ASSERT_TRUE(other.Start());
+  RestClient::Connection conn("");
+  std::vector<std::string> urls;
+  urls.push_back(server.Url());
+  urls.push_back(other.Url() + "/ignored/path");
+  urls.push_back("http://127.0.0.1:1");
+  EXPECT_EQ(2u, conn.Warmup(urls));
+  EXPECT_EQ(1u, connections(server, 1));
+  EXPECT_EQ(1u, connections(other, 1));
+  other.Stop();
+}
+
+TEST_F(ConnectionLoopbackTest, TestPinHost)
+{
+  RestClient::Connection conn("http://restclient-pinned.invalid:" +
+                              std::to_string(server.Port()));
+  conn.PinHost("restclient-pinned.invalid", server.Port(), "127.0.0.1");
+  EXPECT_EQ(200, conn.get("/").code);
+  EXPECT_EQ("127.0.0.1", conn.GetRequestInfo().remoteIp);
+  EXPECT_EQ(200, conn.get("/").code);
+  EXPECT_TRUE(conn.Preconnect());
+}
+
+TEST_F(ConnectionLoopbackTest, TestDnsPinning)
+{
+  RestClient::Connection conn("http://localhost:" +
+                              std::to_string(server.Port()));
+  conn.SetDnsPinning(1);
+  conn.SetHappyEyeballsTimeout(50);
+  EXPECT_EQ(200, conn.get("/").code);
+  EXPECT_EQ(200, conn.get("/").code);
+  // refreshed on the next request after the TTL
+  std::this_thread::sleep_for(std::chrono::milliseconds(1100));
+  EXPECT_EQ(200, conn.get("/").code);
+}
+
+TEST_F(ConnectionLoopbackTest, TestTcpOptions)
+{
+  RestClient::Connection conn(server.Url());
+  conn.SetTcpKeepAlive(true, 10, 5);
+  conn.SetTcpNoDelay(false);
+  EXPECT_EQ(200, conn.get("/").code);
+  EXPECT_EQ(200, conn.get("/").code);
+  EXPECT_EQ(1u, connections(server, 1));
+}
+
+TEST_F(ConnectionLoopbackTest, TestMaxRequestsPerConnection)
+{
+  RestClient::Connection conn(server.Url());
+  conn.SetMaxRequestsPerConnection(2);
+  for (int i = 0; i < 6; i++) {
+    RestClient::Response res = conn.get("/");
+    EXPECT_EQ(200, res.code);
+    EXPECT_EQ(i % 2 == 0 ? 1 : 0, conn.GetRequestInfo().newConnections)
+      << i;
+  }
+  EXPECT_EQ(3u, connections(server, 3));
+  EXPECT_EQ(3u, conn.GetRecycledConnections());
+}
+
+TEST_F(ConnectionLoopbackTest, TestMaxIdleTime)
+{
+  RestClient::Connection conn(server.Url());
+  conn.SetMaxIdleTime(1);
+  EXPECT_EQ(200, conn.get("/").code);
+  EXPECT_EQ(200, conn.get("/").code);
+  EXPECT_EQ(0u, conn.GetRecycledConnections());
+  std::this_thread::sleep_for(std::chrono::milliseconds(1100));
+  EXPECT_EQ(200, conn.get("/").code);
+  EXPECT_EQ(1, conn.GetRequestInfo().newConnections);
+  EXPECT_EQ(1u, conn.GetRecycledConnections());
+  EXPECT_EQ(2u, connections(server, 2));
+}
+
+TEST_F(ConnectionLoopbackTest, TestRecycler)
+{
+  RestClient::Connection conn(server.Url());
+  conn.SetMaxIdleTime(1);
+  conn.StartRecycler(50);
+  EXPECT_EQ(200, conn.get("/").code);
+  // closed in the background, before the next request comes along
+  for (int i = 0; i < 100 && conn.GetRecycledConnections() == 0; i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  }
+  EXPECT_EQ(1u, conn.GetRecycledConnections());
+  EXPECT_EQ(200, conn.get("/").code);
+  EXPECT_EQ(1, conn.GetRequestInfo().newConnections);
+  conn.StopRecycler();
+  EXPECT_EQ(200, conn.get("/").code);
+  EXPECT_EQ(0, conn.GetRequestInfo().newConnections);
+}
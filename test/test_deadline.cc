@@ -0,0 +1,199 @@
+#include "restclient-cpp/deadline.h"
+#include "restclient-cpp/connection.h"
+#include "fault_proxy.h"
+#include "loopback_server.h"
+#include <gtest/gtest.h>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <thread>
+
+class DeadlineTest : public ::testing::Test
+{
+ protected:
+
+    RestClient::Testing::LoopbackServer server;
+    RestClient::Testing::FaultProxy proxy;
+
+    DeadlineTest()
+    {
+    }
+
+    virtual ~DeadlineTest()
+    {
+    }
+
+    virtual void SetUp()
+    {
+      ASSERT_TRUE(server.Start());
+      proxy.SetUpstream("127.0.0.1", server.Port());
+      ASSERT_TRUE(proxy.Start());
+    }
+
+    virtual void TearDown()
+    {
+      proxy.Stop();
+      server.Stop();
+    }
+
+    // every response through the proxy takes delayMillis
+    void slowDown(int64_t delayMillis)
+    {
+      RestClient::Testing::FaultConfig faults;
+      faults.latency =
+        RestClient::Testing::LatencyDistribution::Fixed(delayMillis * 1000);
+      proxy.SetFaults(faults);
+    }
+
+    static int64_t millisSince(std::chrono::steady_clock::time_point start)
+    {
+      return std::chrono::duration_cast<std::chrono::milliseconds>(
+          std::chrono::steady_clock::now() - start).count();
+    }
+};
+
+TEST_F(DeadlineTest, TestDeadline)
+{
+  RestClient::Deadline none;
+  EXPECT_FALSE(none.IsSet());
+  EXPECT_FALSE(none.Expired());
+  EXPECT_EQ(std::numeric_limits<int64_t>::max(), none.RemainingMilliseconds());
+
+  RestClient::Deadline soon = RestClient::Deadline::After(100);
+  EXPECT_TRUE(soon.IsSet());
+  EXPECT_FALSE(soon.Expired());
+  EXPECT_GT(soon.RemainingMilliseconds(), 50);
+  EXPECT_LE(soon.RemainingMilliseconds(), 100);
+
+  RestClient::Deadline later = RestClient::Deadline::After(1000);
+  EXPECT_EQ(soon.When(), soon.Min(later).When());
+  EXPECT_EQ(soon.When(), later.Min(soon).When());
+  EXPECT_EQ(soon.When(), none.Min(soon).When());
+  EXPECT_EQ(later.When(), later.Within(5000).When());
+  EXPECT_LE(later.Within(10).RemainingMilliseconds(), 10);
+  EXPECT_FALSE(none.Min(none).IsSet());
+
+  RestClient::Deadline past = RestClient::Deadline::After(-1);
+  EXPECT_TRUE(past.Expired());
+  EXPECT_EQ(0, past.RemainingMilliseconds());
+}
+
+TEST_F(DeadlineTest, TestScopesNest)
+{
+  EXPECT_FALSE(RestClient::Deadline::Current().IsSet());
+  RestClient::Deadline outer = RestClient::Deadline::After(100);
+  {
+    RestClient::Deadline::Scope scope(outer);
+    EXPECT_EQ(outer.When(), RestClient::Deadline::Current().When());
+    {
+      // an inner scope can't extend the budget
+      RestClient::Deadline::Scope inner(RestClient::Deadline::After(1000));
+      EXPECT_EQ(outer.When(), RestClient::Deadline::Current().When());
+    }
+    {
+      RestClient::Deadline shorter = RestClient::Deadline::After(10);
+      RestClient::Deadline::Scope inner(shorter);
+      EXPECT_EQ(shorter.When(), RestClient::Deadline::Current().When());
+    }
+    EXPECT_EQ(outer.When(), RestClient::Deadline::Current().When());
+    // other threads don't see it
+    bool otherSet = true;
+    std::thread([&otherSet]() {
+      otherSet = RestClient::Deadline::Current().IsSet();
+    }).join();
+    EXPECT_FALSE(otherSet);
+  }
+  EXPECT_FALSE(RestClient::Deadline::Current().IsSet());
+}
+
+TEST_F(DeadlineTest, TestMillisecondTimeout)
+{
+  slowDown(500);
+  RestClient::Connection conn(proxy.Url());
+  conn.SetTimeoutMilliseconds(100);
+  EXPECT_EQ(1, conn.GetInfo().timeout);
+  EXPECT_EQ(100, conn.GetInfo().timeoutMilliseconds);
+  std::chrono::steady_clock::time_point start =
+    std::chrono::steady_clock::now();
+  RestClient::Response res = conn.get("/");
+  EXPECT_EQ(CURLE_OPERATION_TIMEDOUT, res.code);
+  EXPECT_GE(millisSince(start), 90);
+  EXPECT_LT(millisSince(start), 400);
+
+  conn.SetTimeout(2);
+  EXPECT_EQ(2000, conn.GetInfo().timeoutMilliseconds);
+  EXPECT_EQ(200, conn.get("/").code);
+}
+
+TEST_F(DeadlineTest, TestLargeTimeout)
+{
+  RestClient::Connection conn(server.Url());
+  conn.SetTimeout(std::numeric_limits<int>::max());
+  EXPECT_EQ(std::numeric_limits<int>::max(),
+            conn.GetInfo().timeoutMilliseconds);
+  conn.SetTimeoutMilliseconds(std::numeric_limits<int>::max());
+  EXPECT_EQ(2147484, conn.GetInfo().timeout);
+  EXPECT_EQ(200, conn.get("/").code);
+}
+
+TEST_F(DeadlineTest, TestConnectTimeout)
+{
+  RestClient::Connection conn(proxy.Url());
+  conn.SetConnectTimeout(1000);
+  EXPECT_EQ(1000, conn.GetInfo().connectTimeout);
+  EXPECT_EQ(200, conn.get("/").code);
+}
+
+TEST_F(DeadlineTest, TestLowSpeedLimit)
+{
+  RestClient::Testing::FaultConfig faults;
+  faults.dripBytes = 100;
+  faults.dripMicros = 200000;
+  proxy.SetFaults(faults);
+  RestClient::Connection conn(proxy.Url());
+  conn.SetLowSpeedLimit(10000, 1);
+  std::chrono::steady_clock::time_point start =
+    std::chrono::steady_clock::now();
+  RestClient::Response res = conn.get("/bytes/100000");
+  EXPECT_EQ(CURLE_OPERATION_TIMEDOUT, res.code);
+  EXPECT_LT(millisSince(start), 5000);
+}
+
+TEST_F(DeadlineTest, TestRequestsShareTheScopeBudget)
+{
+  slowDown(100);
+  RestClient::Connection conn(proxy.Url());
+  conn.SetTimeout(10);
+  std::chrono::steady_clock::time_point start =
+    std::chrono::steady_clock::now();
+  {
+    RestClient::Deadline::Scope scope(RestClient::Deadline::After(250));
+    EXPECT_EQ(200, conn.get("/").code);
+    EXPECT_EQ(200, conn.get("/").code);
+    // only 50ms left
+    EXPECT_EQ(CURLE_OPERATION_TIMEDOUT, conn.get("/").code);
+    EXPECT_LT(millisSince(start), 400);
+    // not even sent once the deadline passed
+    uint64_t sent = proxy.Requests();
+    RestClient::Response res = conn.get("/");
+    EXPECT_EQ(CURLE_OPERATION_TIMEDOUT, res.code);
+    EXPECT_EQ(sent, proxy.Requests());
+    EXPECT_EQ("Deadline exceeded before the request was sent",
+              conn.GetInfo().lastRequest.curlError);
+  }
+  EXPECT_EQ(200, conn.get("/").code);
+}
+
+TEST_F(DeadlineTest, TestConnectionDeadline)
+{
+  slowDown(500);
+  RestClient::Connection conn(proxy.Url());
+  conn.SetDeadline(RestClient::Deadline::After(100));
+  std::chrono::steady_clock::time_point start =
+    std::chrono::steady_clock::now();
+  EXPECT_EQ(CURLE_OPERATION_TIMEDOUT, conn.get("/").code);
+  EXPECT_LT(millisSince(start), 400);
+  conn.SetDeadline(RestClient::Deadline());
+  EXPECT_EQ(200, conn.get("/").code);
+}
@@ -0,0 +1,313 @@
+#include "restclient-cpp/digest.h"
+#include "restclient-cpp/connection.h"
+#include "restclient-cpp/stream.h"
+#include "loopback_server.h"
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+std::string digestHex(RestClient::DigestAlgorithm algorithm,
+                      const std::string& data) {
+  RestClient::Digest digest(algorithm);
+  digest.Update(data.data(), data.size());
+  return digest.Hex();
+}
+
+std::string base64(const std::string& bytes) {
+  static const char alphabet[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  std::string out;
+  for (size_t i = 0; i < bytes.size(); i += 3) {
+    uint32_t n = static_cast<unsigned char>(bytes[i]) << 16;
+    if (i + 1 < bytes.size()) {
+      n |= static_cast<unsigned char>(bytes[i + 1]) << 8;
+    }
+    if (i + 2 < bytes.size()) {
+      n |= static_cast<unsigned char>(bytes[i + 2]);
+    }
+    out.push_back(alphabet[(n >> 18) & 63]);
+    out.push_back(alphabet[(n >> 12) & 63]);
+    out.push_back(i + 1 < bytes.size() ? alphabet[(n >> 6) & 63] : '=');
+    out.push_back(i + 2 < bytes.size() ? alphabet[n & 63] : '=');
+  }
+  return out;
+}
+
+class CollectingConsumer : public RestClient::StreamConsumer {
+ public:
+    bool Consume(const char* data, size_t length) {
+      this->body.append(data, length);
+      return true;
+    }
+
+    bool Finish() {
+      return true;
+    }
+
+    std::string body;
+};
+
+void expectKnownValues() {
+  EXPECT_EQ("e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855",
+            digestHex(RestClient::DigestAlgorithm::SHA256, ""));
+  EXPECT_EQ("ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad",
+            digestHex(RestClient::DigestAlgorithm::SHA256, "abc"));
+  EXPECT_EQ("cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0",
+            digestHex(RestClient::DigestAlgorithm::SHA256,
+                      std::string(1000000, 'a')));
+  EXPECT_EQ("900150983cd24fb0d6963f7d28e17f72",
+            digestHex(RestClient::DigestAlgorithm::MD5, "abc"));
+  EXPECT_EQ("57edf4a22be3c955ac49da2e2107b67a",
+            digestHex(RestClient::DigestAlgorithm::MD5,
+                      "1234567890123456789012345678901234567890"
+                      "1234567890123456789012345678901234567890"));
+  EXPECT_EQ("e3069283",
+            digestHex(RestClient::DigestAlgorithm::CRC32C, "123456789"));
+  // RFC 3720, B.4
+  EXPECT_EQ("8a9136aa", digestHex(RestClient::DigestAlgorithm::CRC32C,
+                                  std::string(32, '\0')));
+  EXPECT_EQ("62a8ab43", digestHex(RestClient::DigestAlgorithm::CRC32C,
+                                  std::string(32, '\xff')));
+  EXPECT_EQ("", digestHex(RestClient::DigestAlgorithm::None, "abc"));
+}
+
+}  // namespace
+
+TEST(DigestTest, TestKnownValues)
+{
+  expectKnownValues();
+}
+
+TEST(DigestTest, TestPortableImplementations)
+{
+  std::mt19937 random(11);
+  std::string data;
+  for (int i = 0; i < 100000; i++) {
+    data.push_back(static_cast<char>(random()));
+  }
+  std::string crc = digestHex(RestClient::DigestAlgorithm::CRC32C, data);
+  std::string sha = digestHex(RestClient::DigestAlgorithm::SHA256, data);
+
+  RestClient::Digest::SetPortable(true);
+  EXPECT_FALSE(RestClient::Digest::Accelerated(
+      RestClient::DigestAlgorithm::CRC32C));
+  EXPECT_FALSE(RestClient::Digest::Accelerated(
+      RestClient::DigestAlgorithm::SHA256));
+  expectKnownValues();
+  EXPECT_EQ(crc, digestHex(RestClient::DigestAlgorithm::CRC32C, data));
+  EXPECT_EQ(sha, digestHex(RestClient::DigestAlgorithm::SHA256, data));
+  RestClient::Digest::SetPortable(false);
+}
+
+TEST(DigestTest, TestIncremental)
+{
+  std::mt19937 random(7);
+  std::string data;
+  for (int i = 0; i < 100000; i++) {
+    data.push_back(static_cast<char>(random()));
+  }
+  const RestClient::DigestAlgorithm algorithms[] = {
+    RestClient::DigestAlgorithm::CRC32C, RestClient::DigestAlgorithm::SHA256,
+    RestClient::DigestAlgorithm::MD5
+  };
+  for (size_t a = 0; a < 3; a++) {
+    std::string whole = digestHex(algorithms[a], data);
+    RestClient::Digest digest(algorithms[a]);
+    size_t offset = 0;
+    while (offset < data.size()) {
+      size_t piece = std::min<size_t>(random() % 200, data.size() - offset);
+      digest.Update(data.data() + offset, piece);
+      offset += piece;
+      if (piece == 0) {
+        // reading the digest in between doesn't change it
+        digest.Hex();
+      }
+    }
+    EXPECT_EQ(whole, digest.Hex());
+    digest.Reset();
+    digest.Update(data.data(), 10);
+    EXPECT_EQ(digestHex(algorithms[a], data.substr(0, 10)), digest.Hex());
+  }
+}
+
+TEST(DigestTest, TestDigestFromHeader)
+{
+  std::string md5 = RestClient::Digest(RestClient::DigestAlgorithm::MD5)
+                      .Bytes();
+  EXPECT_EQ(md5, RestClient::DigestFromHeader(
+      RestClient::DigestAlgorithm::MD5, "content-md5", base64(md5)));
+  EXPECT_EQ("", RestClient::DigestFromHeader(
+      RestClient::DigestAlgorithm::SHA256, "Content-MD5", base64(md5)));
+
+  RestClient::Digest sha(RestClient::DigestAlgorithm::SHA256);
+  sha.Update("abc", 3);
+  EXPECT_EQ(sha.Bytes(), RestClient::DigestFromHeader(
+      RestClient::DigestAlgorithm::SHA256, "Digest",
+      "MD5=" + base64(md5) + ", SHA-256=" + base64(sha.Bytes())));
+  EXPECT_EQ(sha.Bytes(), RestClient::DigestFromHeader(
+      RestClient::DigestAlgorithm::SHA256, "Content-Digest",
+      "sha-256=:" + base64(sha.Bytes()) + ":"));
+  EXPECT_EQ(sha.Bytes(), RestClient::DigestFromHeader(
+      RestClient::DigestAlgorithm::SHA256, "Repr-Digest",
+      "sha-256=" + sha.Hex()));
+  EXPECT_EQ("", RestClient::DigestFromHeader(
+      RestClient::DigestAlgorithm::CRC32C, "Digest",
+      "sha-256=" + base64(sha.Bytes())));
+  EXPECT_EQ("", RestClient::DigestFromHeader(
+      RestClient::DigestAlgorithm::SHA256, "ETag", sha.Hex()));
+  EXPECT_EQ("", RestClient::DigestFromHeader(
+      RestClient::DigestAlgorithm::SHA256, "Digest", "sha-256=!!!"));
+  EXPECT_EQ(std::string("\xe3\x06\x92\x83", 4),
+            RestClient::DigestFromHeader(RestClient::DigestAlgorithm::CRC32C,
+                                         "Digest", "crc32c=4waSgw=="));
+}
+
+class DigestConnectionTest : public ::testing::Test
+{
+ protected:
+
+    RestClient::Testing::LoopbackServer server;
+    std::string body;
+
+    DigestConnectionTest()
+    {
+    }
+
+    virtual ~DigestConnectionTest()
+    {
+    }
+
+    virtual void SetUp()
+    {
+      for (int i = 0; i < 300000; i++) {
+        body.push_back(static_cast<char>('a' + i % 26));
+      }
+      server.SetHandler([this](
+          const RestClient::Testing::LoopbackRequest& request,
+          RestClient::Testing::LoopbackResponse* response) {
+        serve(request, response);
+      });
+      ASSERT_TRUE(server.Start());
+    }
+
+    virtual void TearDown()
+    {
+      server.Stop();
+    }
+
+    // /good comes with the right digest headers, /bad with a wrong one,
+    // /upload answers with the digest of the request body
+    void serve(const RestClient::Testing::LoopbackRequest& request,
+               RestClient::Testing::LoopbackResponse* response)
+    {
+      RestClient::Digest md5(RestClient::DigestAlgorithm::MD5);
+      md5.Update(body.data(), body.size());
+      RestClient::Digest sha(RestClient::DigestAlgorithm::SHA256);
+      sha.Update(body.data(), body.size());
+      if (request.path == "/good") {
+        response->headers.push_back(std::make_pair("Content-MD5",
+                                                   base64(md5.Bytes())));
+        response->headers.push_back(std::make_pair("Digest",
+          "sha-256=" + base64(sha.Bytes())));
+      } else if (request.path == "/bad") {
+        sha.Update("x", 1);
+        response->headers.push_back(std::make_pair("Content-Digest",
+          "sha-256=:" + base64(sha.Bytes()) + ":"));
+      } else if (request.path == "/upload") {
+        response->body = digestHex(RestClient::DigestAlgorithm::CRC32C,
+                                   request.body);
+        return;
+      }
+      response->body = body;
+    }
+};
+
+TEST_F(DigestConnectionTest, TestResponseDigest)
+{
+  RestClient::Connection conn(server.Url());
+  RestClient::Response res = conn.get("/good");
+  EXPECT_EQ(200, res.code);
+  EXPECT_EQ("", res.digest);
+
+  conn.SetDigest(RestClient::DigestAlgorithm::SHA256);
+  conn.SetVerifyDigestHeaders(true);
+  res = conn.get("/good");
+  EXPECT_EQ(200, res.code);
+  EXPECT_EQ(digestHex(RestClient::DigestAlgorithm::SHA256, body), res.digest);
+
+  std::vector<char> buffer(body.size());
+  RestClient::BufferResponse bufferResponse = {0, buffer.data(),
+                                               buffer.size(), 0, {}, ""};
+  conn.get("/good", &bufferResponse);
+  EXPECT_EQ(200, bufferResponse.code);
+  EXPECT_EQ(res.digest, bufferResponse.digest);
+
+  CollectingConsumer consumer;
+  RestClient::StreamResponse streamResponse = {};
+  streamResponse.consumer = &consumer;
+  conn.get("/good", &streamResponse);
+  EXPECT_EQ(200, streamResponse.code);
+  EXPECT_EQ(res.digest, streamResponse.digest);
+  EXPECT_EQ(body.size(), consumer.body.size());
+
+  // Content-MD5 is only checked when the digest is MD5
+  conn.SetDigest(RestClient::DigestAlgorithm::MD5);
+  res = conn.get("/good");
+  EXPECT_EQ(200, res.code);
+  EXPECT_EQ(digestHex(RestClient::DigestAlgorithm::MD5, body), res.digest);
+  EXPECT_EQ(200, conn.head("/good").code);
+}
+
+TEST_F(DigestConnectionTest, TestMismatch)
+{
+  RestClient::Connection conn(server.Url());
+  conn.SetDigest(RestClient::DigestAlgorithm::SHA256);
+  EXPECT_EQ(200, conn.get("/bad").code);
+
+  conn.SetVerifyDigestHeaders(true);
+  RestClient::Response res = conn.get("/bad");
+  EXPECT_EQ(RestClient::kDigestMismatch, res.code);
+  EXPECT_EQ(digestHex(RestClient::DigestAlgorithm::SHA256, body), res.digest);
+  EXPECT_NE(std::string::npos, res.body.find("Digest mismatch"));
+  EXPECT_NE(std::string::npos, res.body.find("Content-Digest"));
+  // no headers are captured, the digest headers are checked anyway
+  conn.SetHeaderCapture(RestClient::Connection::HeaderCapture::None);
+  res = conn.get("/bad");
+  EXPECT_EQ(RestClient::kDigestMismatch, res.code);
+  EXPECT_TRUE(res.headers.empty());
+  EXPECT_EQ(200, conn.get("/good").code);
+  conn.SetHeaderCapture(RestClient::Connection::HeaderCapture::All);
+
+  conn.SetVerifyDigestHeaders(false);
+  conn.SetDigest(RestClient::DigestAlgorithm::CRC32C);
+  std::string crc = digestHex(RestClient::DigestAlgorithm::CRC32C, body);
+  for (size_t i = 0; i < crc.size(); i++) {
+    crc[i] = static_cast<char>(std::toupper(crc[i]));
+  }
+  conn.SetExpectedDigest(crc);
+  EXPECT_EQ(200, conn.get("/bad").code);
+  conn.SetExpectedDigest("00000000");
+  res = conn.get("/bad");
+  EXPECT_EQ(RestClient::kDigestMismatch, res.code);
+  EXPECT_EQ("Digest mismatch: expected 00000000, got " +
+            digestHex(RestClient::DigestAlgorithm::CRC32C, body), res.body);
+}
+
+TEST_F(DigestConnectionTest, TestUploadDigest)
+{
+  RestClient::Connection conn(server.Url());
+  conn.SetDigest(RestClient::DigestAlgorithm::CRC32C);
+  RestClient::Response res = conn.put("/upload", body);
+  EXPECT_EQ(200, res.code);
+  EXPECT_EQ(res.body, conn.GetInfo().lastRequest.uploadDigest);
+  res = conn.post("/upload", "posted");
+  EXPECT_EQ(res.body, conn.GetInfo().lastRequest.uploadDigest);
+  conn.get("/good");
+  EXPECT_EQ("", conn.GetInfo().lastRequest.uploadDigest);
+}
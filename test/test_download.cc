@@ -0,0 +1,275 @@
+#include "restclient-cpp/download.h"
+#include "restclient-cpp/connection.h"
+#include "loopback_server.h"
+#include <gtest/gtest.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class DownloadTest : public ::testing::Test
+{
+ protected:
+
+    RestClient::Testing::LoopbackServer server;
+    std::string blob;
+    std::string path;
+    std::mutex mutex;
+    std::string etag;
+    std::string lastModified;
+    // 503s still to send per Range header
+    std::map<std::string, int> failures;
+    std::vector<std::string> ranges;
+    std::vector<std::string> ifRanges;
+    // the resource changes when a 503 is sent
+    bool changeOnFailure;
+    int active;
+    int maxActive;
+
+    DownloadTest() : etag("\"v1\""), changeOnFailure(false), active(0),
+                     maxActive(0)
+    {
+    }
+
+    virtual ~DownloadTest()
+    {
+    }
+
+    virtual void SetUp()
+    {
+      for (int i = 0; i < (1 << 20); i++) {
+        blob.push_back(static_cast<char>((i * 131) % 251));
+      }
+      // ctest runs the tests in parallel
+      path = ::testing::TempDir() + "restclient-download-" +
+             ::testing::UnitTest::GetInstance()->current_test_info()->name();
+      std::remove(path.c_str());
+      std::remove((path + ".state").c_str());
+      server.SetHandler([this](
+          const RestClient::Testing::LoopbackRequest& request,
+          RestClient::Testing::LoopbackResponse* response) {
+        serve(request, response);
+      });
+      ASSERT_TRUE(server.Start());
+    }
+
+    virtual void TearDown()
+    {
+      server.Stop();
+      std::remove(path.c_str());
+      std::remove((path + ".state").c_str());
+    }
+
+    // /blob takes Range requests, /norange doesn't
+    void serve(const RestClient::Testing::LoopbackRequest& request,
+               RestClient::Testing::LoopbackResponse* response)
+    {
+      std::string range;
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (request.path != "/blob" && request.path != "/norange") {
+          response->status = 404;
+          return;
+        }
+        response->headers.push_back(std::make_pair("ETag", etag));
+        if (!lastModified.empty()) {
+          response->headers.push_back(std::make_pair("Last-Modified",
+                                                     lastModified));
+        }
+        if (request.path == "/blob") {
+          response->headers.push_back(std::make_pair("Accept-Ranges",
+                                                     "bytes"));
+        }
+        if (request.method == "HEAD") {
+          response->body = blob;
+          return;
+        }
+        std::map<std::string, std::string>::const_iterator it =
+          request.headers.find("range");
+        if (it != request.headers.end()) {
+          range = it->second;
+          ranges.push_back(range);
+          it = request.headers.find("if-range");
+          ifRanges.push_back(it == request.headers.end() ? "" : it->second);
+          // weak validators never match If-Range
+          if (it != request.headers.end() &&
+              (it->second.compare(0, 2, "W/") == 0 ||
+               (it->second != etag && it->second != lastModified))) {
+            range.clear();
+          } else if (failures[range] > 0) {
+            failures[range]--;
+            response->status = 503;
+            if (changeOnFailure) {
+              etag = "\"v2\"";
+            }
+            return;
+          }
+        }
+        maxActive = std::max(maxActive, ++active);
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(20));
+      if (range.empty() || request.path != "/blob") {
+        response->body = blob;
+      } else {
+        char* end = NULL;
+        size_t first = std::strtoul(range.c_str() + 6, &end, 10);
+        size_t last = std::strtoul(end + 1, NULL, 10);
+        response->status = 206;
+        response->headers.push_back(std::make_pair("Content-Range",
+          "bytes " + range.substr(6) + "/" + std::to_string(blob.size())));
+        response->body = blob.substr(first, last - first + 1);
+      }
+      std::lock_guard<std::mutex> lock(mutex);
+      active--;
+    }
+
+    std::string readFile(const std::string& name)
+    {
+      std::string content;
+      FILE* file = std::fopen(name.c_str(), "rb");
+      if (file) {
+        char buffer[65536];
+        size_t n;
+        while ((n = std::fread(buffer, 1, sizeof(buffer), file)) > 0) {
+          content.append(buffer, n);
+        }
+        std::fclose(file);
+      }
+      return content;
+    }
+};
+
+TEST_F(DownloadTest, TestParallelDownload)
+{
+  RestClient::SegmentedDownload download(server.Url(), 4);
+  download.SetSegmentSize(128 << 10);
+  RestClient::Response res = download.Download("/blob", path);
+  EXPECT_EQ(200, res.code);
+  EXPECT_EQ(blob.size(), download.Length());
+  EXPECT_EQ(blob.size(), download.BytesDone());
+  EXPECT_EQ(0u, download.BytesResumed());
+  EXPECT_TRUE(readFile(path) == blob);
+  EXPECT_EQ(8u, ranges.size());
+  EXPECT_GT(maxActive, 1);
+  for (size_t i = 0; i < ifRanges.size(); i++) {
+    EXPECT_EQ("\"v1\"", ifRanges[i]);
+  }
+  // the state file is gone once the download is complete
+  EXPECT_EQ(NULL, std::fopen((path + ".state").c_str(), "rb"));
+}
+
+TEST_F(DownloadTest, TestSegmentRetry)
+{
+  failures["bytes=262144-393215"] = 2;
+  RestClient::SegmentedDownload download(server.Url(), 3);
+  download.SetSegmentSize(128 << 10);
+  RestClient::Response res = download.Download("/blob", path);
+  EXPECT_EQ(200, res.code);
+  EXPECT_EQ(2u, download.Retries());
+  EXPECT_TRUE(readFile(path) == blob);
+  // only the failed segment was fetched again
+  EXPECT_EQ(10u, ranges.size());
+}
+
+TEST_F(DownloadTest, TestResume)
+{
+  failures["bytes=917504-1048575"] = 100;
+  {
+    RestClient::SegmentedDownload download(server.Url(), 4);
+    download.SetSegmentSize(128 << 10);
+    download.SetMaxAttempts(2);
+    RestClient::Response res = download.Download("/blob", path);
+    EXPECT_EQ(503, res.code);
+    EXPECT_NE("", readFile(path + ".state"));
+  }
+  failures.clear();
+  ranges.clear();
+  RestClient::SegmentedDownload download(server.Url(), 4);
+  download.SetSegmentSize(128 << 10);
+  RestClient::Response res = download.Download("/blob", path);
+  EXPECT_EQ(200, res.code);
+  EXPECT_GT(download.BytesResumed(), 0u);
+  EXPECT_EQ(blob.size(), download.BytesDone());
+  EXPECT_EQ(blob.size() - download.BytesResumed(), 131072u * ranges.size());
+  EXPECT_TRUE(readFile(path) == blob);
+
+  // a state file for another version of the resource is ignored
+  failures["bytes=917504-1048575"] = 100;
+  download.SetMaxAttempts(1);
+  EXPECT_EQ(503, download.Download("/blob", path).code);
+  failures.clear();
+  etag = "\"v2\"";
+  res = download.Download("/blob", path);
+  EXPECT_EQ(200, res.code);
+  EXPECT_EQ(0u, download.BytesResumed());
+  EXPECT_TRUE(readFile(path) == blob);
+}
+
+TEST_F(DownloadTest, TestChangedResource)
+{
+  RestClient::SegmentedDownload download(server.Url(), 2);
+  download.SetSegmentSize(128 << 10);
+  download.ForEachConnection([](RestClient::Connection* conn) {
+    conn->AppendHeader("X-Test", "yes");
+  });
+  // the server answers If-Range with the whole resource once it changed
+  failures["bytes=131072-262143"] = 1;
+  changeOnFailure = true;
+  RestClient::Response res = download.Download("/blob", path);
+  EXPECT_EQ(RestClient::kStreamAborted, res.code);
+  EXPECT_EQ("The resource changed during the download", res.body);
+  // the headers of the connections are left as they were
+  download.ForEachConnection([](RestClient::Connection* conn) {
+    EXPECT_EQ(1u, conn->GetHeaders().size());
+  });
+}
+
+TEST_F(DownloadTest, TestWeakETag)
+{
+  etag = "W/\"v1\"";
+  RestClient::SegmentedDownload download(server.Url(), 4);
+  download.SetSegmentSize(128 << 10);
+  RestClient::Response res = download.Download("/blob", path);
+  EXPECT_EQ(200, res.code);
+  EXPECT_TRUE(readFile(path) == blob);
+  EXPECT_EQ(8u, ifRanges.size());
+  for (size_t i = 0; i < ifRanges.size(); i++) {
+    EXPECT_EQ("", ifRanges[i]);
+  }
+
+  // Last-Modified takes the place of the weak ETag
+  lastModified = "Wed, 21 Oct 2026 07:28:00 GMT";
+  ifRanges.clear();
+  std::remove(path.c_str());
+  res = download.Download("/blob", path);
+  EXPECT_EQ(200, res.code);
+  EXPECT_TRUE(readFile(path) == blob);
+  EXPECT_EQ(8u, ifRanges.size());
+  for (size_t i = 0; i < ifRanges.size(); i++) {
+    EXPECT_EQ(lastModified, ifRanges[i]);
+  }
+}
+
+TEST_F(DownloadTest, TestNoRangesAndBuffer)
+{
+  RestClient::SegmentedDownload download(server.Url(), 4);
+  download.SetSegmentSize(128 << 10);
+  RestClient::Response res = download.Download("/norange", path);
+  EXPECT_EQ(200, res.code);
+  EXPECT_TRUE(ranges.empty());
+  EXPECT_TRUE(readFile(path) == blob);
+
+  std::vector<char> buffer(blob.size());
+  res = download.Download("/blob", buffer.data(), buffer.size());
+  EXPECT_EQ(200, res.code);
+  EXPECT_TRUE(std::string(buffer.data(), buffer.size()) == blob);
+  EXPECT_EQ(8u, ranges.size());
+
+  res = download.Download("/blob", buffer.data(), buffer.size() - 1);
+  EXPECT_EQ(RestClient::kBodyTooLarge, res.code);
+  EXPECT_EQ(404, download.Download("/missing", path).code);
+}
@@ -0,0 +1,163 @@
+#include "fault_proxy.h"
+#include "loopback_server.h"
+#include "restclient-cpp/connection.h"
+#include <gtest/gtest.h>
+#include <chrono>
+#include <random>
+#include <string>
+
+class FaultProxyTest : public ::testing::Test
+{
+ protected:
+
+    RestClient::Testing::LoopbackServer server;
+    RestClient::Testing::FaultProxy proxy;
+
+    FaultProxyTest()
+    {
+    }
+
+    virtual ~FaultProxyTest()
+    {
+    }
+
+    virtual void SetUp()
+    {
+      ASSERT_TRUE(server.Start());
+      proxy.SetUpstream("127.0.0.1", server.Port());
+      ASSERT_TRUE(proxy.Start());
+    }
+
+    virtual void TearDown()
+    {
+      proxy.Stop();
+      server.Stop();
+    }
+
+    static int64_t millisSince(std::chrono::steady_clock::time_point start)
+    {
+      return std::chrono::duration_cast<std::chrono::milliseconds>(
+          std::chrono::steady_clock::now() - start).count();
+    }
+};
+
+TEST_F(FaultProxyTest, TestForwardsWithoutFaults)
+{
+  RestClient::Connection conn(proxy.Url());
+  RestClient::Response res = conn.get("/bytes/100000");
+  EXPECT_EQ(200, res.code);
+  EXPECT_EQ(100000u, res.body.size());
+  res = conn.put("/echo", "hello");
+  EXPECT_EQ("hello", res.body);
+  res = conn.head("/bytes/10");
+  EXPECT_EQ(200, res.code);
+  EXPECT_EQ(3u, proxy.Requests());
+  EXPECT_EQ(0u, proxy.Faults());
+  EXPECT_EQ(1u, server.Connections());
+}
+
+TEST_F(FaultProxyTest, TestErrorStatus)
+{
+  RestClient::Testing::FaultConfig faults;
+  faults.errorRate = 1.0;
+  faults.errorStatus = 503;
+  proxy.SetFaults(faults);
+
+  RestClient::Connection conn(proxy.Url());
+  RestClient::Response res = conn.get("/");
+  EXPECT_EQ(503, res.code);
+  EXPECT_EQ(0u, server.Requests());
+}
+
+TEST_F(FaultProxyTest, TestConnectionReset)
+{
+  RestClient::Testing::FaultConfig faults;
+  faults.resetRate = 1.0;
+  proxy.SetFaults(faults);
+
+  RestClient::Connection conn(proxy.Url());
+  conn.get("/");
+  int curlCode = conn.GetInfo().lastRequest.curlCode;
+  EXPECT_TRUE(curlCode == CURLE_RECV_ERROR || curlCode == CURLE_GOT_NOTHING)
+    << curlCode;
+}
+
+TEST_F(FaultProxyTest, TestLatencyTimesOut)
+{
+  RestClient::Testing::FaultConfig faults;
+  faults.latency = RestClient::Testing::LatencyDistribution::Fixed(3000000);
+  proxy.SetFaults(faults);
+
+  RestClient::Connection conn(proxy.Url());
+  conn.SetTimeout(1);
+  std::chrono::steady_clock::time_point start =
+    std::chrono::steady_clock::now();
+  RestClient::Response res = conn.get("/");
+  EXPECT_EQ(CURLE_OPERATION_TIMEDOUT, res.code);
+  EXPECT_LT(millisSince(start), 2500);
+}
+
+TEST_F(FaultProxyTest, TestStalledHeadersAndSlowBody)
+{
+  RestClient::Testing::FaultConfig faults;
+  faults.stallRate = 1.0;
+  faults.stallMicros = 100000;
+  faults.dripBytes = 1000;
+  faults.dripMicros = 20000;
+  proxy.SetFaults(faults);
+
+  RestClient::Connection conn(proxy.Url());
+  std::chrono::steady_clock::time_point start =
+    std::chrono::steady_clock::now();
+  RestClient::Response res = conn.get("/bytes/5000");
+  EXPECT_EQ(200, res.code);
+  EXPECT_EQ(5000u, res.body.size());
+  // 100ms stall plus four gaps of 20ms between the body pieces
+  EXPECT_GE(millisSince(start), 180);
+  EXPECT_GE(conn.GetRequestInfo().totalTime, 180000);
+}
+
+TEST_F(FaultProxyTest, TestConnectProxy)
+{
+  RestClient::Testing::FaultConfig faults;
+  faults.errorRate = 1.0;
+  faults.errorStatus = 429;
+  proxy.SetFaults(faults);
+
+  RestClient::Connection conn(server.Url());
+  conn.SetProxy(proxy.Url());
+  RestClient::Response res = conn.get("/");
+  EXPECT_EQ(429, res.code);
+  EXPECT_EQ(1u, proxy.Requests());
+
+  proxy.SetFaults(RestClient::Testing::FaultConfig());
+  res = conn.get("/bytes/10");
+  EXPECT_EQ(200, res.code);
+  EXPECT_EQ("xxxxxxxxxx", res.body);
+}
+
+TEST_F(FaultProxyTest, TestLatencyDistributions)
+{
+  std::mt19937_64 rng(42);
+  RestClient::Testing::LatencyDistribution none;
+  RestClient::Testing::LatencyDistribution uniform =
+    RestClient::Testing::LatencyDistribution::Uniform(1000, 2000);
+  RestClient::Testing::LatencyDistribution exponential =
+    RestClient::Testing::LatencyDistribution::Exponential(1000);
+  RestClient::Testing::LatencyDistribution logNormal =
+    RestClient::Testing::LatencyDistribution::LogNormal(1000, 1.0);
+  int64_t exponentialSum = 0;
+  int logNormalBelowMedian = 0;
+  for (int i = 0; i < 10000; i++) {
+    EXPECT_EQ(0, none.Sample(&rng));
+    int64_t u = uniform.Sample(&rng);
+    EXPECT_GE(u, 1000);
+    EXPECT_LE(u, 2000);
+    exponentialSum += exponential.Sample(&rng);
+    logNormalBelowMedian += logNormal.Sample(&rng) < 1000 ? 1 : 0;
+  }
+  EXPECT_NEAR(1000, exponentialSum / 10000, 100);
+  EXPECT_NEAR(5000, logNormalBelowMedian, 300);
+  EXPECT_EQ(250,
+            RestClient::Testing::LatencyDistribution::Fixed(250).Sample(&rng));
+}
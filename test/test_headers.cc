@@ -0,0 +1,145 @@
+#include "restclient-cpp/headers.h"
+#include "restclient-cpp/connection.h"
+#include "restclient-cpp/helpers.h"
+#include "loopback_server.h"
+#include <gtest/gtest.h>
+#include <cstring>
+#include <string>
+#include <vector>
+
+class HeaderBlockTest : public ::testing::Test
+{
+ protected:
+
+    RestClient::HeaderBlock block;
+
+    HeaderBlockTest()
+    {
+    }
+
+    virtual ~HeaderBlockTest()
+    {
+    }
+
+    virtual void SetUp()
+    {
+    }
+
+    virtual void TearDown()
+    {
+    }
+
+    void add(const char* line)
+    {
+      block.AddLine(line, std::strlen(line));
+    }
+
+    static void serveCookies(const RestClient::Testing::LoopbackRequest&,
+                             RestClient::Testing::LoopbackResponse* response)
+    {
+      response->headers.push_back(std::make_pair("Content-Type",
+                                                 "text/plain"));
+      response->headers.push_back(std::make_pair("Set-Cookie", "a=1"));
+      response->headers.push_back(std::make_pair("set-cookie", "b=2"));
+      response->headers.push_back(std::make_pair("X-Other", "x"));
+      response->body = "ok";
+    }
+};
+
+TEST_F(HeaderBlockTest, TestLookup)
+{
+  add("HTTP/1.1 200 OK\r\n");
+  add("Content-Type: application/json\r\n");
+  add("Set-Cookie: a=1; Path=/\r\n");
+  add("  X-Spaces  :   padded value \t\r\n");
+  add("SET-COOKIE: b=2\r\n");
+  add("Empty:\r\n");
+  add("no separator\r\n");
+  add("\r\n");
+
+  ASSERT_EQ(5u, block.Size());
+  EXPECT_EQ("Content-Type", block.Name(0));
+  EXPECT_EQ("application/json", block.Value(0));
+  EXPECT_EQ("application/json", block.Get("content-type"));
+  EXPECT_EQ("padded value", block.Get("x-spaces"));
+  EXPECT_TRUE(block.Has("empty"));
+  EXPECT_EQ("", block.Get("Empty"));
+  EXPECT_FALSE(block.Has("Content"));
+  EXPECT_EQ("", block.Get("Missing"));
+  EXPECT_EQ(block.Size(), block.Find("Missing"));
+
+  std::vector<std::string> cookies = block.GetAll("Set-Cookie");
+  ASSERT_EQ(2u, cookies.size());
+  EXPECT_EQ("a=1; Path=/", cookies[0]);
+  EXPECT_EQ("b=2", cookies[1]);
+  EXPECT_EQ(3u, block.Find("set-cookie", 2));
+
+  size_t length = 0;
+  const char* value = block.ValueData(3, &length);
+  EXPECT_EQ("b=2", std::string(value, length));
+  EXPECT_NE(std::string::npos, block.Raw().find("SET-COOKIE: b=2"));
+}
+
+TEST_F(HeaderBlockTest, TestStatusLineStartsNewResponse)
+{
+  add("HTTP/1.1 301 Moved Permanently\r\n");
+  add("Location: /new\r\n");
+  add("\r\n");
+  add("HTTP/1.1 200 OK\r\n");
+  add("Content-Length: 2\r\n");
+  EXPECT_EQ(1u, block.Size());
+  EXPECT_FALSE(block.Has("Location"));
+  block.Clear();
+  EXPECT_TRUE(block.Empty());
+  EXPECT_TRUE(block.Raw().empty());
+}
+
+TEST_F(HeaderBlockTest, TestHeaderCallback)
+{
+  RestClient::Response response = {};
+  const char* lines[] = {"HTTP/1.1 200 OK\r\n", "Content-Type: text/plain\r\n",
+                         " X-Padded :  value  \r\n", "\r\n"};
+  for (const char* line : lines) {
+    RestClient::Helpers::header_callback(const_cast<char*>(line), 1,
+                                         std::strlen(line), &response);
+  }
+  EXPECT_EQ(3u, response.headers.size());
+  EXPECT_EQ("present", response.headers["HTTP/1.1 200 OK"]);
+  EXPECT_EQ("text/plain", response.headers["Content-Type"]);
+  EXPECT_EQ("value", response.headers["X-Padded"]);
+}
+
+TEST_F(HeaderBlockTest, TestConnectionCapture)
+{
+  RestClient::Testing::LoopbackServer server;
+  server.SetHandler(serveCookies);
+  ASSERT_TRUE(server.Start());
+  RestClient::Connection conn(server.Url());
+
+  RestClient::Response res = conn.get("/");
+  EXPECT_EQ(200, res.code);
+  EXPECT_EQ("text/plain", res.headers["Content-Type"]);
+  const RestClient::HeaderBlock& headers = conn.GetResponseHeaders();
+  EXPECT_EQ("text/plain", headers.Get("content-type"));
+  EXPECT_EQ(2u, headers.GetAll("Set-Cookie").size());
+  EXPECT_EQ("2", headers.Get("Content-Length"));
+
+  conn.SetHeaderCapture(RestClient::Connection::HeaderCapture::AllowList,
+                        {"content-type", "Set-Cookie"});
+  res = conn.get("/");
+  EXPECT_EQ(200, res.code);
+  // the map still overwrites repeated names
+  EXPECT_EQ(3u, res.headers.size());
+  EXPECT_EQ("text/plain", res.headers["Content-Type"]);
+  EXPECT_EQ("a=1", res.headers["Set-Cookie"]);
+  EXPECT_EQ("b=2", res.headers["set-cookie"]);
+  EXPECT_EQ("x", conn.GetResponseHeaders().Get("X-Other"));
+
+  conn.SetHeaderCapture(RestClient::Connection::HeaderCapture::None);
+  res = conn.get("/");
+  EXPECT_EQ(200, res.code);
+  EXPECT_EQ("ok", res.body);
+  EXPECT_TRUE(res.headers.empty());
+  EXPECT_TRUE(conn.GetResponseHeaders().Empty());
+  server.Stop();
+}
@@ -0,0 +1,103 @@
+#include "restclient-cpp/interceptor.h"
+#include "restclient-cpp/connection.h"
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+
+class RecordingInterceptor : public RestClient::Interceptor
+{
+ public:
+    explicit RecordingInterceptor(const std::string& name) : name(name)
+    {
+    }
+
+    void BeforeSend(RestClient::RequestContext* ctx) override
+    {
+      events.push_back("before " + std::string(ctx->method) + " " + ctx->url);
+      ctx->headers["X-Trace-Id"] = "abc123";
+      ctx->tags[name] = "started";
+    }
+
+    void OnFirstByte(RestClient::RequestContext* ctx) override
+    {
+      events.push_back("first byte " + ctx->tags[name]);
+    }
+
+    void OnComplete(RestClient::RequestContext* /* ctx */,
+                    const RestClient::Response& /* response */,
+                    const RestClient::Connection::RequestInfo& info) override
+    {
+      events.push_back("complete " + std::to_string(info.curlCode));
+    }
+
+    void OnError(RestClient::RequestContext* /* ctx */,
+                 const RestClient::Response& response,
+                 const RestClient::Connection::RequestInfo& info) override
+    {
+      events.push_back("error " + std::to_string(info.curlCode) + " " +
+                       std::to_string(response.code));
+    }
+
+    std::string name;
+    std::vector<std::string> events;
+};
+
+class InterceptorTest : public ::testing::Test
+{
+ protected:
+
+    InterceptorTest() : first("first"), second("second")
+    {
+    }
+
+    virtual ~InterceptorTest()
+    {
+    }
+
+    virtual void SetUp()
+    {
+    }
+
+    virtual void TearDown()
+    {
+    }
+
+    RecordingInterceptor first;
+    RecordingInterceptor second;
+};
+
+TEST_F(InterceptorTest, TestHooksOnComplete)
+{
+  RestClient::Connection conn("file://");
+  conn.AddInterceptor(&first);
+  conn.AddInterceptor(&second);
+  RestClient::Response res = conn.get(std::string(__FILE__));
+
+  EXPECT_EQ(0, res.code);
+  ASSERT_EQ(3u, first.events.size());
+  EXPECT_EQ("before GET file://" + std::string(__FILE__), first.events[0]);
+  EXPECT_EQ("first byte started", first.events[1]);
+  EXPECT_EQ("complete 0", first.events[2]);
+  EXPECT_EQ(first.events, second.events);
+}
+
+TEST_F(InterceptorTest, TestHooksOnError)
+{
+  RestClient::Connection conn("http://127.0.0.1:1");
+  conn.AddInterceptor(&first);
+  conn.del("/delete");
+
+  ASSERT_EQ(2u, first.events.size());
+  EXPECT_EQ("before DELETE http://127.0.0.1:1/delete", first.events[0]);
+  EXPECT_EQ("error 7 7", first.events[1]);
+}
+
+TEST_F(InterceptorTest, TestClearInterceptors)
+{
+  RestClient::Connection conn("http://127.0.0.1:1");
+  conn.AddInterceptor(&first);
+  conn.ClearInterceptors();
+  conn.get("/get");
+
+  EXPECT_EQ(0u, first.events.size());
+}
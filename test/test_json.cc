@@ -0,0 +1,299 @@
+#include "restclient-cpp/json.h"
+#include "restclient-cpp/connection.h"
+#include "loopback_server.h"
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace {
+
+// writes every event into a string
+class RecordingHandler : public RestClient::JsonHandler {
+ public:
+    std::string events;
+    int stopAfter = -1;
+
+    bool Null() { return add("null"); }
+    bool Bool(bool value) { return add(value ? "true" : "false"); }
+    bool Number(double value, const char* text, size_t length) {
+      return add("n:" + std::string(text, length) + "=" +
+                 std::to_string(static_cast<int64_t>(value)));
+    }
+    bool String(const char* value, size_t length) {
+      return add("s:" + std::string(value, length));
+    }
+    bool StartObject() { return add("{"); }
+    bool Key(const char* name, size_t length) {
+      return add("k:" + std::string(name, length));
+    }
+    bool EndObject() { return add("}"); }
+    bool StartArray() { return add("["); }
+    bool EndArray() { return add("]"); }
+
+ private:
+    bool add(const std::string& event) {
+      events += event + " ";
+      return stopAfter < 0 || --stopAfter > 0;
+    }
+};
+
+}  // namespace
+
+class JsonTest : public ::testing::Test
+{
+ protected:
+
+    RestClient::Testing::LoopbackServer server;
+
+    JsonTest()
+    {
+    }
+
+    virtual ~JsonTest()
+    {
+    }
+
+    virtual void SetUp()
+    {
+      server.SetHandler(serveJson);
+      ASSERT_TRUE(server.Start());
+    }
+
+    virtual void TearDown()
+    {
+      server.Stop();
+    }
+
+    // /items/N is an object with an array of N objects, /invalid and
+    // /truncated are broken documents
+    static void serveJson(const RestClient::Testing::LoopbackRequest& request,
+                          RestClient::Testing::LoopbackResponse* response)
+    {
+      response->headers.push_back(std::make_pair("Content-Type",
+                                                 "application/json"));
+      if (request.path.compare(0, 7, "/items/") == 0) {
+        int n = std::atoi(request.path.c_str() + 7);
+        response->body = "{\"count\": " + std::to_string(n) + ", \"items\": [";
+        for (int i = 0; i < n; i++) {
+          response->body += (i > 0 ? "," : "") +
+            std::string("{\"id\": ") + std::to_string(i) +
+            ", \"name\": \"item " + std::to_string(i) + "\"}";
+        }
+        response->body += "]}";
+      } else if (request.path == "/invalid") {
+        response->body = "{\"a\": tru}";
+      } else if (request.path == "/truncated") {
+        response->body = "{\"a\": [1, 2";
+      } else {
+        response->status = 404;
+        response->body = "not found";
+      }
+    }
+
+    // parse a document fed in pieces of the given size
+    static bool parse(const std::string& document, RestClient::JsonHandler* h,
+                      size_t piece, RestClient::JsonParser* parser = NULL)
+    {
+      RestClient::JsonParser own(h);
+      RestClient::JsonParser* p = parser ? parser : &own;
+      for (size_t i = 0; i < document.size(); i += piece) {
+        if (!p->Consume(document.data() + i,
+                        std::min(piece, document.size() - i))) {
+          return false;
+        }
+      }
+      return p->Finish();
+    }
+};
+
+TEST_F(JsonTest, TestEvents)
+{
+  const std::string document =
+    " {\"a\": [1, -2.5e1, true, false, null, \"x\"], \"b\": {}, \"c\": []} ";
+  const std::string expected = "{ k:a [ n:1=1 n:-2.5e1=-25 true false null "
+                               "s:x ] k:b { } k:c [ ] } ";
+  // the same events however the document is split
+  for (size_t piece = 1; piece <= document.size(); piece++) {
+    RecordingHandler handler;
+    EXPECT_TRUE(parse(document, &handler, piece)) << piece;
+    EXPECT_EQ(expected, handler.events) << piece;
+  }
+
+  RecordingHandler handler;
+  EXPECT_TRUE(parse("12345678901234567890", &handler, 3));
+  EXPECT_EQ(0u, handler.events.find("n:12345678901234567890="));
+  handler.events.clear();
+  EXPECT_TRUE(parse("\"top\"", &handler, 2));
+  EXPECT_EQ("s:top ", handler.events);
+}
+
+TEST_F(JsonTest, TestEscapes)
+{
+  RestClient::JsonValue value;
+  RestClient::JsonDomBuilder builder(&value);
+  const std::string document =
+    "[\"a\\\"b\\\\c\\/d\\b\\f\\n\\r\\t\", \"\\u00e9\\u20AC\", "
+    "\"\\ud83d\\ude00\", \"\\ud83dx\", \"\\ude00\", \"caf\xc3\xa9\"]";
+  for (size_t piece = 1; piece <= 7; piece++) {
+    ASSERT_TRUE(parse(document, &builder, piece)) << piece;
+    ASSERT_EQ(6u, value.Size());
+    EXPECT_EQ("a\"b\\c/d\b\f\n\r\t", value.elements[0].string);
+    EXPECT_EQ("\xc3\xa9\xe2\x82\xac", value.elements[1].string);
+    EXPECT_EQ("\xf0\x9f\x98\x80", value.elements[2].string);
+    // unpaired surrogates
+    EXPECT_EQ("\xef\xbf\xbdx", value.elements[3].string);
+    EXPECT_EQ("\xef\xbf\xbd", value.elements[4].string);
+    EXPECT_EQ("caf\xc3\xa9", value.elements[5].string);
+  }
+}
+
+TEST_F(JsonTest, TestInvalidDocuments)
+{
+  const char* invalid[] = {
+    "", "   ", "{", "[1,]", "[1 2]", "{\"a\" 1}", "{\"a\":}", "{1: 2}",
+    "{\"a\": 1,}", "01", "1.", "-", "1e", "+1", "tru", "nul", "[1] x",
+    "\"open", "\"\\x\"", "\"\\u12g4\"", "\"a\nb\"", "]", "[}", "{]"
+  };
+  for (const char* document : invalid) {
+    RecordingHandler handler;
+    RestClient::JsonParser parser(&handler);
+    EXPECT_FALSE(parse(document, &handler, 1, &parser)) << document;
+    EXPECT_TRUE(parser.Failed()) << document;
+    EXPECT_FALSE(parser.Error().empty()) << document;
+  }
+
+  RecordingHandler handler;
+  RestClient::JsonParser parser(&handler);
+  const char document[] = "{\"a\": [1, 2, x]}";
+  EXPECT_FALSE(parser.Consume(document, std::strlen(document)));
+  EXPECT_EQ("Unexpected character", parser.Error());
+  EXPECT_EQ(13u, parser.Offset());
+  // failed stays failed until Reset()
+  EXPECT_FALSE(parser.Consume("1", 1));
+  parser.Reset();
+  EXPECT_TRUE(parser.Error().empty());
+  EXPECT_TRUE(parser.Consume("[1]", 3));
+  EXPECT_TRUE(parser.Finish());
+  EXPECT_TRUE(parser.Done());
+}
+
+TEST_F(JsonTest, TestDepthLimitAndStop)
+{
+  RecordingHandler handler;
+  RestClient::JsonParser parser(&handler, 3);
+  EXPECT_TRUE(parse("[[[1]]]", &handler, 1, &parser));
+  parser.Reset();
+  EXPECT_FALSE(parse("[[[[1]]]]", &handler, 1, &parser));
+  EXPECT_EQ("Nesting too deep", parser.Error());
+
+  RecordingHandler stopping;
+  stopping.stopAfter = 3;
+  RestClient::JsonParser stopped(&stopping);
+  EXPECT_FALSE(parse("[1, 2, 3, 4]", &stopping, 100, &stopped));
+  EXPECT_EQ("Stopped by the handler", stopped.Error());
+  EXPECT_EQ("[ n:1=1 n:2=2 ", stopping.events);
+}
+
+TEST_F(JsonTest, TestDom)
+{
+  RestClient::JsonValue root;
+  RestClient::JsonDomBuilder builder(&root);
+  ASSERT_TRUE(parse("{\"z\": 1, \"a\": [true, null, {\"x\": \"y\"}], "
+                    "\"z\": 2}", &builder, 4));
+  EXPECT_EQ(RestClient::JsonValue::Type::Object, root.type);
+  ASSERT_EQ(3u, root.Size());
+  // document order, repeated keys kept
+  EXPECT_EQ("z", root.members[0].first);
+  EXPECT_EQ("a", root.members[1].first);
+  EXPECT_EQ(1, root.Find("z")->number);
+  EXPECT_EQ(NULL, root.Find("missing"));
+  const RestClient::JsonValue* a = root.Find("a");
+  ASSERT_EQ(3u, a->Size());
+  EXPECT_TRUE(a->elements[0].boolean);
+  EXPECT_EQ(RestClient::JsonValue::Type::Null, a->elements[1].type);
+  EXPECT_EQ("y", a->elements[2].Find("x")->string);
+
+  builder.Reset();
+  EXPECT_EQ(RestClient::JsonValue::Type::Null, root.type);
+  ASSERT_TRUE(parse("[1.5]", &builder, 1));
+  EXPECT_EQ(1.5, root.elements[0].number);
+  EXPECT_EQ("1.5", root.elements[0].string);
+}
+
+TEST_F(JsonTest, TestStreamedElements)
+{
+  RestClient::JsonValue root;
+  std::vector<std::string> seen;
+  RestClient::JsonDomBuilder builder(&root, 0,
+      [&seen](const RestClient::JsonValue& element) {
+        seen.push_back(element.type == RestClient::JsonValue::Type::Object ?
+                       element.Find("id")->string : element.string);
+        return true;
+      });
+  ASSERT_TRUE(parse("[{\"id\": 1, \"n\": [1, 2]}, \"two\", {\"id\": 3}]",
+                    &builder, 2));
+  ASSERT_EQ(3u, seen.size());
+  EXPECT_EQ("1", seen[0]);
+  EXPECT_EQ("two", seen[1]);
+  EXPECT_EQ("3", seen[2]);
+  // nothing is kept of the elements
+  EXPECT_EQ(RestClient::JsonValue::Type::Array, root.type);
+  EXPECT_EQ(0u, root.Size());
+
+  // arrays one level down, the callback can stop
+  seen.clear();
+  RestClient::JsonDomBuilder nested(&root, 1,
+      [&seen](const RestClient::JsonValue& element) {
+        seen.push_back(element.string);
+        return seen.size() < 2;
+      });
+  EXPECT_FALSE(parse("{\"total\": 3, \"items\": [\"a\", \"b\", \"c\"]}",
+                     &nested, 5));
+  EXPECT_EQ(2u, seen.size());
+  EXPECT_EQ("3", root.Find("total")->string);
+}
+
+TEST_F(JsonTest, TestStreamResponse)
+{
+  RestClient::Connection conn(server.Url());
+  RestClient::JsonValue root;
+  int items = 0;
+  RestClient::JsonDomBuilder builder(&root, 1,
+      [&items](const RestClient::JsonValue& item) {
+        EXPECT_EQ(std::to_string(items), item.Find("id")->string);
+        items++;
+        return true;
+      });
+  RestClient::JsonParser parser(&builder);
+  RestClient::StreamResponse response = {};
+  response.consumer = &parser;
+  EXPECT_EQ(&response, conn.get("/items/20000", &response));
+  EXPECT_EQ(200, response.code);
+  EXPECT_TRUE(response.body.empty());
+  EXPECT_EQ("application/json", response.headers["Content-Type"]);
+  EXPECT_EQ(20000, items);
+  EXPECT_EQ(20000, root.Find("count")->number);
+  EXPECT_EQ(0u, root.Find("items")->Size());
+  EXPECT_TRUE(parser.Done());
+
+  // error pages don't reach the consumer
+  parser.Reset();
+  conn.post("/missing", "{}", &response);
+  EXPECT_EQ(404, response.code);
+  EXPECT_EQ("not found", response.body);
+  EXPECT_EQ(0u, parser.Offset());
+
+  conn.get("/invalid", &response);
+  EXPECT_EQ(RestClient::kStreamAborted, response.code);
+  EXPECT_EQ(CURLE_WRITE_ERROR, conn.GetInfo().lastRequest.curlCode);
+  EXPECT_EQ("Invalid literal", parser.Error());
+
+  parser.Reset();
+  conn.get("/truncated", &response);
+  EXPECT_EQ(RestClient::kStreamAborted, response.code);
+  EXPECT_EQ("Unexpected end of the document", parser.Error());
+}
@@ -0,0 +1,111 @@
+#include "loopback_server.h"
+#include "restclient-cpp/connection.h"
+#include "restclient-cpp/restclient.h"
+#include <gtest/gtest.h>
+#include <string>
+
+class LoopbackServerTest : public ::testing::Test
+{
+ protected:
+
+    RestClient::Testing::LoopbackServer server;
+
+    LoopbackServerTest()
+    {
+    }
+
+    virtual ~LoopbackServerTest()
+    {
+    }
+
+    virtual void SetUp()
+    {
+      ASSERT_TRUE(server.Start());
+    }
+
+    virtual void TearDown()
+    {
+      server.Stop();
+    }
+};
+
+TEST_F(LoopbackServerTest, TestBuiltinRoutes)
+{
+  RestClient::Connection conn(server.Url());
+  RestClient::Response res = conn.get("/bytes/12345");
+  EXPECT_EQ(200, res.code);
+  EXPECT_EQ(12345u, res.body.size());
+
+  res = conn.get("/headers/20");
+  EXPECT_EQ("ok", res.body);
+  EXPECT_EQ("value-19-abcdefghijklmnopqrstuvwxyz",
+            res.headers["X-Loopback-Header-19"]);
+
+  res = conn.get("/status/503");
+  EXPECT_EQ(503, res.code);
+
+  res = conn.put("/echo", std::string(200000, 'a'));
+  EXPECT_EQ(200000u, res.body.size());
+
+  res = conn.head("/bytes/10");
+  EXPECT_EQ("10", res.headers["Content-Length"]);
+  EXPECT_EQ("", res.body);
+  EXPECT_EQ(5u, server.Requests());
+}
+
+TEST_F(LoopbackServerTest, TestKeepAlive)
+{
+  RestClient::Connection conn(server.Url());
+  for (int i = 0; i < 5; i++) {
+    conn.get("/");
+  }
+  EXPECT_TRUE(conn.GetRequestInfo().connectionReused);
+  EXPECT_EQ(1u, server.Connections());
+
+  RestClient::get(server.Url() + "/");
+  EXPECT_EQ(2u, server.Connections());
+}
+
+TEST_F(LoopbackServerTest, TestCustomHandler)
+{
+  server.Stop();
+  server.SetHandler([](const RestClient::Testing::LoopbackRequest& request,
+                       RestClient::Testing::LoopbackResponse* response) {
+    response->status = 201;
+    response->body = request.method + " " + request.path + " " +
+                     request.headers.at("x-test");
+  });
+  ASSERT_TRUE(server.Start());
+
+  RestClient::Connection conn(server.Url());
+  conn.AppendHeader("X-Test", "yes");
+  RestClient::Response res = conn.post("/things?a=1", "{}");
+  EXPECT_EQ(201, res.code);
+  EXPECT_EQ("POST /things?a=1 yes", res.body);
+}
+
+TEST_F(LoopbackServerTest, TestHttp2)
+{
+  server.Stop();
+  server.SetHttp2Path("/bytes/40000");
+  ASSERT_TRUE(server.Start());
+
+  // upgrade from HTTP/1.1, then reuse the h2c connection
+  RestClient::Connection conn(server.Url());
+  conn.SetHttpVersion(CURL_HTTP_VERSION_2_0);
+  for (int i = 0; i < 3; i++) {
+    RestClient::Response res = conn.get("/bytes/40000");
+    EXPECT_EQ(200, res.code);
+    EXPECT_EQ(40000u, res.body.size());
+  }
+  EXPECT_EQ(CURL_HTTP_VERSION_2_0, conn.GetRequestInfo().httpVersion);
+  EXPECT_EQ(1u, server.Connections());
+
+  // prior knowledge
+  RestClient::Connection direct(server.Url());
+  direct.SetHttpVersion(CURL_HTTP_VERSION_2_PRIOR_KNOWLEDGE);
+  RestClient::Response res = direct.get("/");
+  EXPECT_EQ(200, res.code);
+  EXPECT_EQ(40000u, res.body.size());
+  EXPECT_EQ(CURL_HTTP_VERSION_2_0, direct.GetRequestInfo().httpVersion);
+}
@@ -0,0 +1,125 @@
+#include "restclient-cpp/memory.h"
+#include <gtest/gtest.h>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+class MemoryAllocatorTest : public ::testing::Test
+{
+ protected:
+
+    MemoryAllocatorTest()
+    {
+    }
+
+    virtual ~MemoryAllocatorTest()
+    {
+    }
+
+    virtual void SetUp()
+    {
+    }
+
+    virtual void TearDown()
+    {
+    }
+};
+
+TEST_F(MemoryAllocatorTest, TestPoolReusesBlocks)
+{
+  RestClient::PoolAllocator pool(2);
+  void* a = pool.Allocate(100);
+  EXPECT_EQ(0u, reinterpret_cast<uintptr_t>(a) % alignof(std::max_align_t));
+  pool.Free(a);
+  EXPECT_EQ(1u, pool.Cached());
+  // same size class
+  void* b = pool.Allocate(128);
+  EXPECT_EQ(a, b);
+  EXPECT_EQ(1u, pool.Hits());
+  EXPECT_EQ(1u, pool.Misses());
+
+  // only two blocks per class are kept
+  void* c = pool.Allocate(128);
+  void* d = pool.Allocate(128);
+  pool.Free(b);
+  pool.Free(c);
+  pool.Free(d);
+  EXPECT_EQ(2u, pool.Cached());
+
+  // too large for the pool
+  void* large = pool.Allocate(1 << 20);
+  pool.Free(large);
+  EXPECT_EQ(2u, pool.Cached());
+
+  pool.Trim();
+  EXPECT_EQ(0u, pool.Cached());
+  pool.Free(NULL);
+}
+
+TEST_F(MemoryAllocatorTest, TestPoolReallocate)
+{
+  RestClient::PoolAllocator pool;
+  char* p = static_cast<char*>(pool.Reallocate(NULL, 20));
+  std::memcpy(p, "0123456789", 10);
+  // still fits the 32 byte class
+  EXPECT_EQ(p, pool.Reallocate(p, 32));
+  p = static_cast<char*>(pool.Reallocate(p, 1000));
+  EXPECT_EQ(0, std::memcmp(p, "0123456789", 10));
+  p = static_cast<char*>(pool.Reallocate(p, 200000));
+  EXPECT_EQ(0, std::memcmp(p, "0123456789", 10));
+  p = static_cast<char*>(pool.Reallocate(p, 300000));
+  EXPECT_EQ(0, std::memcmp(p, "0123456789", 10));
+  p = static_cast<char*>(pool.Reallocate(p, 10));
+  EXPECT_EQ(0, std::memcmp(p, "0123456789", 10));
+  pool.Free(p);
+}
+
+TEST_F(MemoryAllocatorTest, TestAccountingPerThread)
+{
+  RestClient::PoolAllocator pool;
+  RestClient::AccountingAllocator accounting(&pool);
+  void* a = accounting.Allocate(100);
+  a = accounting.Reallocate(a, 300);
+  RestClient::MemoryStats stats = accounting.ThreadStats();
+  EXPECT_EQ(1u, stats.allocations);
+  EXPECT_EQ(1u, stats.reallocations);
+  EXPECT_EQ(400u, stats.bytesAllocated);
+  EXPECT_EQ(100u, stats.bytesFreed);
+
+  // freed on another thread, counted there
+  std::thread::id other;
+  std::thread([&accounting, &other, a]() {
+    other = std::this_thread::get_id();
+    accounting.Free(a);
+    accounting.Free(accounting.Allocate(50));
+  }).join();
+  stats = accounting.ThreadStats();
+  EXPECT_EQ(0u, stats.frees);
+  RestClient::MemoryStats otherStats = accounting.ThreadStats(other);
+  EXPECT_EQ(1u, otherStats.allocations);
+  EXPECT_EQ(2u, otherStats.frees);
+  EXPECT_EQ(350u, otherStats.bytesFreed);
+
+  RestClient::MemoryStats totals = accounting.Totals();
+  EXPECT_EQ(2u, totals.allocations);
+  EXPECT_EQ(totals.bytesAllocated, totals.bytesFreed);
+  EXPECT_EQ(0u, accounting.ThreadStats(std::thread::id()).allocations);
+}
+
+TEST_F(MemoryAllocatorTest, TestAccountingWithoutUpstream)
+{
+  RestClient::AccountingAllocator accounting;
+  std::vector<void*> blocks;
+  for (size_t i = 1; i <= 10; i++) {
+    blocks.push_back(accounting.Allocate(i * 10));
+  }
+  for (size_t i = 0; i < blocks.size(); i++) {
+    accounting.Free(blocks[i]);
+  }
+  RestClient::MemoryStats stats = accounting.ThreadStats();
+  EXPECT_EQ(10u, stats.allocations);
+  EXPECT_EQ(10u, stats.frees);
+  EXPECT_EQ(550u, stats.bytesAllocated);
+  EXPECT_EQ(550u, stats.bytesFreed);
+}
@@ -0,0 +1,222 @@
+#include "restclient-cpp/singleflight.h"
+#include "restclient-cpp/connection.h"
+#include "loopback_server.h"
+#include <gtest/gtest.h>
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+class SingleFlightTest : public ::testing::Test
+{
+ protected:
+
+    SingleFlightTest()
+    {
+    }
+
+    virtual ~SingleFlightTest()
+    {
+    }
+
+    virtual void SetUp()
+    {
+    }
+
+    virtual void TearDown()
+    {
+    }
+
+    RestClient::SingleFlight group;
+};
+
+TEST_F(SingleFlightTest, TestSingleCall)
+{
+  bool shared = true;
+  RestClient::SharedResponse res = group.Do("GET /foo", []() {
+    RestClient::Response r = {};
+    r.code = 200;
+    r.body = "foo";
+    return r;
+  }, &shared);
+
+  EXPECT_FALSE(shared);
+  EXPECT_EQ(200, res->code);
+  EXPECT_EQ("foo", res->body);
+  EXPECT_EQ(0u, group.InFlight());
+}
+
+TEST_F(SingleFlightTest, TestConcurrentCallsAreCoalesced)
+{
+  std::atomic<int> calls(0);
+  std::atomic<int> sharedCount(0);
+  std::atomic<bool> release(false);
+  const int threadCount = 8;
+  std::vector<RestClient::SharedResponse> results(threadCount);
+  std::vector<std::thread> threads;
+
+  for (int i = 0; i < threadCount; i++) {
+    threads.push_back(std::thread([&, i]() {
+      bool shared = false;
+      results[i] = group.Do("GET /coalesced", [&]() {
+        calls++;
+        while (!release) {
+          std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        RestClient::Response r = {};
+        r.code = 200;
+        r.body = "shared body";
+        return r;
+      }, &shared);
+      if (shared) {
+        sharedCount++;
+      }
+    }));
+  }
+
+  // give all threads time to join the flight before releasing the leader
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+  EXPECT_EQ(1u, group.InFlight());
+  release = true;
+  for (auto& t : threads) {
+    t.join();
+  }
+
+  EXPECT_EQ(1, calls.load());
+  EXPECT_EQ(threadCount - 1, sharedCount.load());
+  for (int i = 0; i < threadCount; i++) {
+    // every caller holds a reference to the very same response
+    EXPECT_EQ(results[0].get(), results[i].get());
+  }
+  EXPECT_EQ("shared body", results[0]->body);
+  EXPECT_EQ(0u, group.InFlight());
+}
+
+TEST_F(SingleFlightTest, TestDistinctKeysAreNotCoalesced)
+{
+  int calls = 0;
+  auto fn = [&calls]() {
+    calls++;
+    RestClient::Response r = {};
+    return r;
+  };
+  RestClient::SharedResponse a = group.Do("GET /a", fn);
+  RestClient::SharedResponse b = group.Do("GET /b", fn);
+  RestClient::SharedResponse c = group.Do("GET /a", fn);
+
+  EXPECT_EQ(3, calls);
+  EXPECT_NE(a.get(), c.get());
+}
+
+TEST_F(SingleFlightTest, TestExceptionIsPropagated)
+{
+  EXPECT_THROW(group.Do("GET /fail", []() -> RestClient::Response {
+    throw std::runtime_error("Connection terminated");
+  }), std::runtime_error);
+  EXPECT_EQ(0u, group.InFlight());
+}
+
+TEST_F(SingleFlightTest, TestConnectionGetShared)
+{
+  RestClient::Connection conn("http://127.0.0.1:1");
+  conn.SetSingleFlight(&group);
+  RestClient::SharedResponse res = conn.getShared("/get");
+  EXPECT_EQ(CURLE_COULDNT_CONNECT, res->code);
+  EXPECT_EQ(0u, group.InFlight());
+}
+
+namespace {
+
+size_t discardBody(void* /* ptr */, size_t size, size_t nmemb,
+                   void* /* userdata */) {
+  return size * nmemb;
+}
+
+}  // namespace
+
+TEST_F(SingleFlightTest, TestConnectionOptionsAndBypass)
+{
+  std::atomic<int> requests(0);
+  RestClient::Testing::LoopbackServer server;
+  server.SetHandler([&requests](
+      const RestClient::Testing::LoopbackRequest& /* request */,
+      RestClient::Testing::LoopbackResponse* response) {
+    requests++;
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    response->body = "slow";
+  });
+  ASSERT_TRUE(server.Start());
+
+  // issue the same GET from two connections at once, the second one
+  // configured by setup, and count the transfers the server saw
+  auto concurrent = [&](void (*setup)(RestClient::Connection*)) {
+    requests = 0;
+    RestClient::Connection first(server.Url());
+    RestClient::Connection second(server.Url());
+    first.SetSingleFlight(&group);
+    second.SetSingleFlight(&group);
+    setup(&second);
+    std::thread leader([&first]() { first.get("/slow"); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    second.get("/slow");
+    leader.join();
+    return requests.load();
+  };
+
+  EXPECT_EQ(1, concurrent([](RestClient::Connection*) {}));
+  EXPECT_EQ(2, concurrent([](RestClient::Connection* conn) {
+    conn->SetVerifyPeer(false);
+  }));
+  EXPECT_EQ(2, concurrent([](RestClient::Connection* conn) {
+    conn->FollowRedirects(true);
+  }));
+  EXPECT_EQ(2, concurrent([](RestClient::Connection* conn) {
+    conn->SetWriteFunction(discardBody);
+  }));
+  // a follower has to be able to time out on its own
+  EXPECT_EQ(2, concurrent([](RestClient::Connection* conn) {
+    conn->SetDeadline(RestClient::Deadline::After(5000));
+  }));
+  // and to be cancelled on its own
+  EXPECT_EQ(2, concurrent([](RestClient::Connection* conn) {
+    static RestClient::CancellationToken token;
+    conn->SetCancellationToken(&token);
+  }));
+  server.Stop();
+}
+
+TEST_F(SingleFlightTest, TestFollowerInfoIsCleared)
+{
+  std::atomic<int> requests(0);
+  RestClient::Testing::LoopbackServer server;
+  server.SetHandler([&requests](
+      const RestClient::Testing::LoopbackRequest& /* request */,
+      RestClient::Testing::LoopbackResponse* response) {
+    requests++;
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    response->body = "slow";
+  });
+  ASSERT_TRUE(server.Start());
+
+  RestClient::Connection first(server.Url());
+  RestClient::Connection second(server.Url());
+  first.SetSingleFlight(&group);
+  second.SetSingleFlight(&group);
+  // a request of its own leaves info and headers behind
+  EXPECT_EQ(200, second.get("/slow").code);
+  EXPECT_GT(second.GetResponseHeaders().Size(), 0u);
+  EXPECT_GT(second.GetInfo().lastRequest.totalTime, 0);
+
+  std::thread leader([&first]() { first.get("/slow"); });
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  EXPECT_EQ("slow", second.get("/slow").body);
+  leader.join();
+  EXPECT_EQ(2, requests.load());
+  EXPECT_EQ(0u, second.GetResponseHeaders().Size());
+  EXPECT_EQ(0, second.GetInfo().lastRequest.totalTime);
+  EXPECT_EQ(0, second.GetRequestInfo().totalTime);
+  EXPECT_GT(first.GetInfo().lastRequest.totalTime, 0);
+  server.Stop();
+}
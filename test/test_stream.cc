@@ -0,0 +1,313 @@
+#include "restclient-cpp/stream.h"
+#include "restclient-cpp/cancellation.h"
+#include "restclient-cpp/connection.h"
+#include "restclient-cpp/json.h"
+#include "loopback_server.h"
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+class StreamConsumerTest : public ::testing::Test
+{
+ protected:
+
+    RestClient::Testing::LoopbackServer server;
+    std::mutex mutex;
+    // Last-Event-ID of every request the server saw
+    std::vector<std::string> lastEventIds;
+    std::string accept;
+    int recordRequests;
+
+    StreamConsumerTest() : recordRequests(0)
+    {
+    }
+
+    virtual ~StreamConsumerTest()
+    {
+    }
+
+    virtual void SetUp()
+    {
+      server.SetHandler([this](
+          const RestClient::Testing::LoopbackRequest& request,
+          RestClient::Testing::LoopbackResponse* response) {
+        serve(request, response);
+      });
+      ASSERT_TRUE(server.Start());
+    }
+
+    virtual void TearDown()
+    {
+      server.Stop();
+    }
+
+    // /events sends two events per connection, continuing after the
+    // Last-Event-ID, and 204 after event 4. /slow asks for a minute
+    // between connections. /records is NDJSON, without a Content-Type.
+    void serve(const RestClient::Testing::LoopbackRequest& request,
+               RestClient::Testing::LoopbackResponse* response)
+    {
+      if (request.path == "/records") {
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          recordRequests++;
+        }
+        response->body = "{\"id\": 1}\n\n{\"id\": 2}\r\n{\"id\": 3}";
+        return;
+      }
+      if (request.path == "/slow") {
+        response->headers.push_back(std::make_pair("Content-Type",
+                                                   "text/event-stream"));
+        response->body = "retry: 60000\ndata: x\n\n";
+        return;
+      }
+      std::map<std::string, std::string>::const_iterator it =
+        request.headers.find("last-event-id");
+      std::string last = it == request.headers.end() ? "" : it->second;
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        lastEventIds.push_back(last);
+        accept = request.headers.at("accept");
+      }
+      int next = std::atoi(last.c_str()) + 1;
+      if (next > 4) {
+        response->status = 204;
+        return;
+      }
+      response->headers.push_back(std::make_pair("Content-Type",
+                                                 "text/event-stream"));
+      response->body = "retry: 10\n\n";
+      for (int id = next; id < next + 2; id++) {
+        response->body += "id: " + std::to_string(id) + "\ndata: event " +
+                          std::to_string(id) + "\n\n";
+      }
+      // cut off in the middle of an event
+      response->body += "data: unfinished";
+    }
+
+    // feed a stream in pieces of the given size
+    static bool feed(RestClient::StreamConsumer* consumer,
+                     const std::string& stream, size_t piece)
+    {
+      for (size_t i = 0; i < stream.size(); i += piece) {
+        if (!consumer->Consume(stream.data() + i,
+                               std::min(piece, stream.size() - i))) {
+          return false;
+        }
+      }
+      return consumer->Finish();
+    }
+};
+
+TEST_F(StreamConsumerTest, TestNdjsonRecords)
+{
+  const std::string stream = "{\"a\": 1}\n\n  \n{\"b\": 2}\r\n[3]\n{\"c\": 4}";
+  for (size_t piece = 1; piece <= stream.size(); piece++) {
+    std::vector<std::string> records;
+    RestClient::NdjsonConsumer consumer(
+        [&records](const char* record, size_t length) {
+          records.push_back(std::string(record, length));
+          return true;
+        });
+    ASSERT_TRUE(feed(&consumer, stream, piece)) << piece;
+    ASSERT_EQ(4u, records.size()) << piece;
+    EXPECT_EQ("{\"a\": 1}", records[0]);
+    EXPECT_EQ("{\"b\": 2}", records[1]);
+    EXPECT_EQ("[3]", records[2]);
+    EXPECT_EQ("{\"c\": 4}", records[3]);
+    EXPECT_EQ(4u, consumer.Records());
+  }
+}
+
+TEST_F(StreamConsumerTest, TestRecordTooLong)
+{
+  for (size_t piece : {1, 4, 100}) {
+    int records = 0;
+    RestClient::NdjsonConsumer consumer(
+        [&records](const char*, size_t) { return ++records < 10; }, 8);
+    EXPECT_FALSE(feed(&consumer, "12345678\n123456789\n", piece)) << piece;
+    EXPECT_EQ("Line too long", consumer.Error());
+    EXPECT_EQ(1, records);
+    // stays stopped until Reset()
+    EXPECT_FALSE(consumer.Consume("1\n", 2));
+    consumer.Reset();
+    EXPECT_TRUE(consumer.Consume("1\n", 2));
+  }
+
+  RestClient::NdjsonConsumer stopping(
+      [](const char*, size_t) { return false; });
+  EXPECT_FALSE(feed(&stopping, "1\n2\n", 100));
+  EXPECT_EQ("Stopped by the callback", stopping.Error());
+}
+
+TEST_F(StreamConsumerTest, TestServerSentEvents)
+{
+  const std::string stream =
+    "\xEF\xBB\xBF: comment\n"
+    "data: first\n\n"
+    "event: update\r\ndata:no space\r\ndata:  two spaces\r\nid: 7\r\n\r\n"
+    "data\rretry: 1500\rretry: x\r\r"
+    "id: 8\nevent: empty\n\n"
+    "data: last\nid: 9\n";
+  for (size_t piece = 1; piece <= stream.size(); piece++) {
+    std::vector<RestClient::ServerSentEvent> events;
+    RestClient::SseConsumer consumer(
+        [&events](const RestClient::ServerSentEvent& event) {
+          events.push_back(event);
+          return true;
+        });
+    ASSERT_TRUE(feed(&consumer, stream, piece)) << piece;
+    ASSERT_EQ(3u, events.size()) << piece;
+    EXPECT_EQ("message", events[0].event);
+    EXPECT_EQ("first", events[0].data);
+    EXPECT_EQ("", events[0].id);
+    EXPECT_EQ("update", events[1].event);
+    EXPECT_EQ("no space\n two spaces", events[1].data);
+    EXPECT_EQ("7", events[1].id);
+    // a data field without value is an empty line of data
+    EXPECT_EQ("message", events[2].event);
+    EXPECT_EQ("", events[2].data);
+    EXPECT_EQ(1500, consumer.Retry());
+    // the event without data isn't dispatched but its id counts, the
+    // unfinished one at the end is dropped
+    EXPECT_EQ("9", consumer.LastEventId());
+    EXPECT_EQ(3u, consumer.Events());
+  }
+}
+
+TEST_F(StreamConsumerTest, TestEventLimits)
+{
+  RestClient::SseConsumer consumer(
+      [](const RestClient::ServerSentEvent&) { return true; }, 16);
+  EXPECT_FALSE(feed(&consumer, "data: 0123456789\ndata: 0123456789\n\n", 5));
+  EXPECT_EQ("Event too large", consumer.Error());
+
+  int events = 0;
+  RestClient::SseConsumer stopping(
+      [&events](const RestClient::ServerSentEvent&) { return ++events < 2; });
+  EXPECT_FALSE(feed(&stopping, "data: 1\n\ndata: 2\n\ndata: 3\n\n", 100));
+  EXPECT_EQ(2, events);
+}
+
+TEST_F(StreamConsumerTest, TestNdjsonResponse)
+{
+  RestClient::Connection conn(server.Url());
+  int ids = 0;
+  RestClient::JsonValue record;
+  RestClient::JsonDomBuilder builder(&record);
+  RestClient::JsonParser parser(&builder);
+  RestClient::NdjsonConsumer consumer(
+      [&](const char* data, size_t length) {
+        parser.Reset();
+        if (!parser.Consume(data, length) || !parser.Finish()) {
+          return false;
+        }
+        ids += static_cast<int>(record.Find("id")->number);
+        return true;
+      });
+  RestClient::StreamResponse response = {};
+  response.consumer = &consumer;
+  conn.get("/records", &response);
+  EXPECT_EQ(200, response.code);
+  EXPECT_EQ(3u, consumer.Records());
+  EXPECT_EQ(6, ids);
+}
+
+TEST_F(StreamConsumerTest, TestSubscribeReconnects)
+{
+  RestClient::Connection conn(server.Url());
+  conn.AppendHeader("X-Kept", "1");
+  std::vector<std::string> data;
+  RestClient::SseConsumer consumer(
+      [&data](const RestClient::ServerSentEvent& event) {
+        data.push_back(event.data);
+        return true;
+      });
+  RestClient::StreamResponse response = {};
+  conn.subscribe("/events", &consumer, &response);
+  EXPECT_EQ(204, response.code);
+  ASSERT_EQ(4u, data.size());
+  EXPECT_EQ("event 1", data[0]);
+  EXPECT_EQ("event 4", data[3]);
+  EXPECT_EQ(10, consumer.Retry());
+  ASSERT_EQ(3u, lastEventIds.size());
+  EXPECT_EQ("", lastEventIds[0]);
+  EXPECT_EQ("2", lastEventIds[1]);
+  EXPECT_EQ("4", lastEventIds[2]);
+  EXPECT_EQ("text/event-stream", accept);
+  // the connection's headers are as they were
+  EXPECT_EQ(1u, conn.GetHeaders().size());
+
+  // pick up where another subscription left off
+  lastEventIds.clear();
+  data.clear();
+  consumer.SetLastEventId("3");
+  conn.subscribe("/events", &consumer, &response, 0);
+  EXPECT_EQ(200, response.code);
+  ASSERT_EQ(1u, lastEventIds.size());
+  EXPECT_EQ("3", lastEventIds[0]);
+  ASSERT_EQ(2u, data.size());
+  EXPECT_EQ("event 4", data[0]);
+}
+
+TEST_F(StreamConsumerTest, TestSubscribeStops)
+{
+  RestClient::Connection conn(server.Url());
+  RestClient::SseConsumer consumer(
+      [](const RestClient::ServerSentEvent&) { return false; });
+  RestClient::StreamResponse response = {};
+  conn.subscribe("/events", &consumer, &response);
+  EXPECT_EQ(RestClient::kStreamAborted, response.code);
+  EXPECT_EQ(1u, lastEventIds.size());
+
+  // cancelled while waiting to reconnect
+  RestClient::CancellationToken token;
+  conn.SetCancellationToken(&token);
+  RestClient::SseConsumer waiting(
+      [](const RestClient::ServerSentEvent&) { return true; });
+  std::thread canceller([&token]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    token.Cancel();
+  });
+  std::chrono::steady_clock::time_point start =
+    std::chrono::steady_clock::now();
+  conn.subscribe("/slow", &waiting, &response);
+  canceller.join();
+  EXPECT_EQ(RestClient::kCancelled, response.code);
+  EXPECT_LT(std::chrono::steady_clock::now() - start,
+            std::chrono::seconds(2));
+}
+
+TEST_F(StreamConsumerTest, TestSubscribeNeedsEventStream)
+{
+  RestClient::Connection conn(server.Url());
+  // no headers are captured, the Content-Type is checked anyway
+  conn.SetHeaderCapture(RestClient::Connection::HeaderCapture::None);
+  RestClient::SseConsumer consumer(
+      [](const RestClient::ServerSentEvent&) { return true; });
+  RestClient::StreamResponse response = {};
+  conn.subscribe("/records", &consumer, &response);
+  EXPECT_EQ(200, response.code);
+  EXPECT_EQ(1, recordRequests);
+}
+
+TEST_F(StreamConsumerTest, TestSubscribeRestoresHeaders)
+{
+  RestClient::Connection conn(server.Url());
+  conn.AppendHeader("X-Kept", "1");
+  conn.Terminate();
+  RestClient::SseConsumer consumer(
+      [](const RestClient::ServerSentEvent&) { return true; });
+  RestClient::StreamResponse response = {};
+  EXPECT_THROW(conn.subscribe("/events", &consumer, &response),
+               std::runtime_error);
+  ASSERT_EQ(1u, conn.GetHeaders().size());
+  EXPECT_EQ("1", conn.GetHeaders().at("X-Kept"));
+}
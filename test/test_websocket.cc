@@ -0,0 +1,454 @@
+#include "restclient-cpp/websocket.h"
+#include "restclient-cpp/connection.h"
+#include "loopback_server.h"
+#include "wire.h"
+#include <gtest/gtest.h>
+#include <poll.h>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace {
+
+uint32_t rotate(uint32_t value, int bits) {
+  return (value << bits) | (value >> (32 - bits));
+}
+
+// SHA-1 (RFC 3174), only needed for the Sec-WebSocket-Accept header
+std::string sha1(const std::string& message) {
+  uint32_t h[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476,
+                   0xC3D2E1F0};
+  std::string data = message;
+  data.push_back('\x80');
+  while (data.size() % 64 != 56) {
+    data.push_back('\0');
+  }
+  uint64_t bits = static_cast<uint64_t>(message.size()) * 8;
+  for (int i = 7; i >= 0; i--) {
+    data.push_back(static_cast<char>((bits >> (i * 8)) & 0xff));
+  }
+  for (size_t block = 0; block < data.size(); block += 64) {
+    uint32_t w[80];
+    for (int i = 0; i < 16; i++) {
+      const unsigned char* p =
+        reinterpret_cast<const unsigned char*>(data.data() + block + i * 4);
+      w[i] = (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+    }
+    for (int i = 16; i < 80; i++) {
+      w[i] = rotate(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+    }
+    uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+    for (int i = 0; i < 80; i++) {
+      uint32_t f, k;
+      if (i < 20) {
+        f = (b & c) | (~b & d);
+        k = 0x5A827999;
+      } else if (i < 40) {
+        f = b ^ c ^ d;
+        k = 0x6ED9EBA1;
+      } else if (i < 60) {
+        f = (b & c) | (b & d) | (c & d);
+        k = 0x8F1BBCDC;
+      } else {
+        f = b ^ c ^ d;
+        k = 0xCA62C1D6;
+      }
+      uint32_t t = rotate(a, 5) + f + e + k + w[i];
+      e = d;
+      d = c;
+      c = rotate(b, 30);
+      b = a;
+      a = t;
+    }
+    h[0] += a;
+    h[1] += b;
+    h[2] += c;
+    h[3] += d;
+    h[4] += e;
+  }
+  std::string digest;
+  for (int i = 0; i < 5; i++) {
+    for (int j = 3; j >= 0; j--) {
+      digest.push_back(static_cast<char>((h[i] >> (j * 8)) & 0xff));
+    }
+  }
+  return digest;
+}
+
+std::string base64(const std::string& data) {
+  const char alphabet[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  std::string out;
+  for (size_t i = 0; i < data.size(); i += 3) {
+    uint32_t n = static_cast<unsigned char>(data[i]) << 16;
+    if (i + 1 < data.size()) {
+      n |= static_cast<unsigned char>(data[i + 1]) << 8;
+    }
+    if (i + 2 < data.size()) {
+      n |= static_cast<unsigned char>(data[i + 2]);
+    }
+    out.push_back(alphabet[(n >> 18) & 63]);
+    out.push_back(alphabet[(n >> 12) & 63]);
+    out.push_back(i + 1 < data.size() ? alphabet[(n >> 6) & 63] : '=');
+    out.push_back(i + 2 < data.size() ? alphabet[n & 63] : '=');
+  }
+  return out;
+}
+
+}  // namespace
+
+class WebSocketTest : public ::testing::Test
+{
+ protected:
+
+    RestClient::Testing::LoopbackServer server;
+    std::mutex mutex;
+    // what the echo server saw
+    std::map<std::string, std::string> handshake;
+    std::string target;
+    int pings;
+    bool pongSeen;
+    int closeCode;
+
+    WebSocketTest()
+    {
+    }
+
+    virtual ~WebSocketTest()
+    {
+    }
+
+    virtual void SetUp()
+    {
+      pings = 0;
+      pongSeen = false;
+      closeCode = 0;
+      server.SetConnectionHandler([this](int fd) { serve(fd); });
+      ASSERT_TRUE(server.Start());
+    }
+
+    virtual void TearDown()
+    {
+      server.Stop();
+    }
+
+    static bool sendFrame(int fd, int opcode, const std::string& payload,
+                          bool fin = true)
+    {
+      std::string frame;
+      frame.push_back(static_cast<char>((fin ? 0x80 : 0) | opcode));
+      if (payload.size() < 126) {
+        frame.push_back(static_cast<char>(payload.size()));
+      } else if (payload.size() < 65536) {
+        frame.push_back(126);
+        frame.push_back(static_cast<char>(payload.size() >> 8));
+        frame.push_back(static_cast<char>(payload.size() & 0xff));
+      } else {
+        frame.push_back(127);
+        for (int i = 7; i >= 0; i--) {
+          frame.push_back(static_cast<char>(
+              (static_cast<uint64_t>(payload.size()) >> (i * 8)) & 0xff));
+        }
+      }
+      return RestClient::Testing::Wire::SendAll(fd, frame + payload);
+    }
+
+    // read a masked client frame
+    static bool readFrame(int fd, std::string* buffer, int* opcode,
+                          std::string* payload)
+    {
+      using RestClient::Testing::Wire::RecvMore;
+      while (buffer->size() < 2) {
+        if (!RecvMore(fd, buffer)) {
+          return false;
+        }
+      }
+      *opcode = (*buffer)[0] & 0x0f;
+      uint64_t length = (*buffer)[1] & 0x7f;
+      size_t head = 2;
+      size_t extra = length == 126 ? 2 : (length == 127 ? 8 : 0);
+      while (buffer->size() < head + extra + 4) {
+        if (!RecvMore(fd, buffer)) {
+          return false;
+        }
+      }
+      if (extra > 0) {
+        length = 0;
+        for (size_t i = 0; i < extra; i++) {
+          length = (length << 8) |
+                   static_cast<unsigned char>((*buffer)[2 + i]);
+        }
+        head += extra;
+      }
+      std::string mask = buffer->substr(head, 4);
+      head += 4;
+      buffer->erase(0, head);
+      if (!RestClient::Testing::Wire::ReadBody(fd, buffer, length, payload)) {
+        return false;
+      }
+      for (size_t i = 0; i < payload->size(); i++) {
+        (*payload)[i] ^= mask[i % 4];
+      }
+      return true;
+    }
+
+    // WebSocket echo server. Text starting with "fragment:" comes back in
+    // three fragments, "ping me" makes the server ping and report the
+    // pong, "close me" makes it close and "silence" stops all answers.
+    // Requests without an upgrade get a plain 200.
+    void serve(int fd)
+    {
+      std::string buffer;
+      size_t headLength = RestClient::Testing::Wire::ReadHead(fd, &buffer);
+      if (headLength == 0) {
+        return;
+      }
+      std::map<std::string, std::string> headers;
+      std::string requestLine = RestClient::Testing::Wire::ParseHead(
+          buffer.substr(0, headLength), &headers);
+      buffer.erase(0, headLength);
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        handshake = headers;
+        target = requestLine;
+      }
+      if (requestLine.find("/refuse") != std::string::npos) {
+        RestClient::Testing::Wire::SendAll(fd, "HTTP/1.1 403 Forbidden\r\n"
+            "Content-Length: 2\r\nConnection: close\r\n\r\nno");
+        return;
+      }
+      if (headers.count("sec-websocket-key") == 0) {
+        RestClient::Testing::Wire::SendAll(fd, "HTTP/1.1 200 OK\r\n"
+            "Content-Length: 5\r\nConnection: close\r\n\r\nplain");
+        return;
+      }
+      std::string accept = base64(sha1(headers["sec-websocket-key"] +
+          "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"));
+      RestClient::Testing::Wire::SendAll(fd,
+          "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\n"
+          "Connection: Upgrade\r\nSec-WebSocket-Accept: " + accept +
+          "\r\n\r\n");
+      int opcode;
+      std::string payload;
+      bool silent = false;
+      while (readFrame(fd, &buffer, &opcode, &payload)) {
+        if (silent) {
+          continue;
+        }
+        if (opcode == 0x8) {
+          std::lock_guard<std::mutex> lock(mutex);
+          closeCode = payload.size() >= 2 ?
+            (static_cast<unsigned char>(payload[0]) << 8) |
+            static_cast<unsigned char>(payload[1]) : 1005;
+          sendFrame(fd, 0x8, payload);
+          return;
+        } else if (opcode == 0x9) {
+          {
+            std::lock_guard<std::mutex> lock(mutex);
+            pings++;
+          }
+          sendFrame(fd, 0xA, payload);
+        } else if (opcode == 0xA) {
+          {
+            std::lock_guard<std::mutex> lock(mutex);
+            pongSeen = payload == "hello";
+          }
+          sendFrame(fd, 0x1, "got pong");
+        } else if (payload == "ping me") {
+          sendFrame(fd, 0x9, "hello");
+        } else if (payload == "close me") {
+          sendFrame(fd, 0x8, std::string("\x0f\xa0", 2) + "bye");
+        } else if (payload == "silence") {
+          silent = true;
+        } else if (payload.compare(0, 9, "fragment:") == 0) {
+          size_t third = payload.size() / 3;
+          sendFrame(fd, opcode, payload.substr(0, third), false);
+          // a control frame between the fragments
+          sendFrame(fd, 0xA, "unsolicited");
+          sendFrame(fd, 0x0, payload.substr(third, third), false);
+          sendFrame(fd, 0x0, payload.substr(2 * third), true);
+        } else {
+          sendFrame(fd, opcode, payload);
+        }
+      }
+    }
+};
+
+TEST_F(WebSocketTest, TestEcho)
+{
+  RestClient::Connection conn(server.Url());
+  conn.AppendHeader("X-Token", "secret");
+  conn.SetBasicAuth("user", "password");
+  RestClient::WebSocket socket(&conn);
+  RestClient::Response response = socket.Open("/echo");
+  EXPECT_EQ(101, response.code);
+  ASSERT_TRUE(socket.IsOpen());
+  EXPECT_EQ(0u, target.find("GET /echo HTTP/1.1"));
+  // the connection's configuration reaches the handshake
+  EXPECT_EQ("secret", handshake["x-token"]);
+  EXPECT_EQ("Basic dXNlcjpwYXNzd29yZA==", handshake["authorization"]);
+  EXPECT_EQ("websocket", RestClient::Testing::Wire::ToLower(
+      handshake["upgrade"]));
+
+  RestClient::WebSocketMessage message;
+  EXPECT_EQ(CURLE_OK, socket.SendText("hello"));
+  ASSERT_EQ(RestClient::WebSocket::Status::Message,
+            socket.Receive(&message, 5000));
+  EXPECT_EQ(RestClient::WebSocketMessageType::Text, message.type);
+  EXPECT_EQ("hello", message.data);
+
+  const std::string binary("\x00\x01\xff\x00", 4);
+  EXPECT_EQ(CURLE_OK, socket.SendBinary(binary.data(), binary.size()));
+  ASSERT_EQ(RestClient::WebSocket::Status::Message,
+            socket.Receive(&message, 5000));
+  EXPECT_EQ(RestClient::WebSocketMessageType::Binary, message.type);
+  EXPECT_EQ(binary, message.data);
+
+  // larger than the socket buffers and libcurl's receive buffer
+  std::string large(1 << 20, 'x');
+  for (size_t i = 0; i < large.size(); i += 997) {
+    large[i] = static_cast<char>(i);
+  }
+  EXPECT_EQ(CURLE_OK, socket.SendBinary(large.data(), large.size()));
+  ASSERT_EQ(RestClient::WebSocket::Status::Message,
+            socket.Receive(&message, 5000));
+  EXPECT_EQ(large, message.data);
+
+  // fragments are reassembled into one message
+  const std::string fragmented = "fragment: " + std::string(50000, 'f') + "!";
+  EXPECT_EQ(CURLE_OK, socket.SendText(fragmented));
+  ASSERT_EQ(RestClient::WebSocket::Status::Message,
+            socket.Receive(&message, 5000));
+  EXPECT_EQ(RestClient::WebSocketMessageType::Text, message.type);
+  EXPECT_EQ(fragmented, message.data);
+
+  EXPECT_EQ(CURLE_OK, socket.Close(1000, "done"));
+  ASSERT_EQ(RestClient::WebSocket::Status::Closed,
+            socket.Receive(&message, 5000));
+  EXPECT_EQ(RestClient::WebSocketMessageType::Close, message.type);
+  EXPECT_EQ(1000, message.closeCode);
+  EXPECT_EQ("done", message.data);
+  EXPECT_FALSE(socket.IsOpen());
+  EXPECT_EQ(1000, closeCode);
+  EXPECT_TRUE(socket.Error().empty());
+
+  // the connection makes plain requests again
+  RestClient::Response plain = conn.get("/plain");
+  EXPECT_EQ(200, plain.code);
+  EXPECT_EQ("plain", plain.body);
+}
+
+TEST_F(WebSocketTest, TestNonBlockingReceive)
+{
+  RestClient::Connection conn(server.Url());
+  RestClient::WebSocket socket(&conn);
+  ASSERT_EQ(101, socket.Open("/echo").code);
+  RestClient::WebSocketMessage message;
+  EXPECT_EQ(RestClient::WebSocket::Status::WouldBlock,
+            socket.Receive(&message, 0));
+
+  // wait for the socket like an event loop would
+  socket.SendText("event");
+  RestClient::WebSocket::Status status =
+    RestClient::WebSocket::Status::WouldBlock;
+  std::chrono::steady_clock::time_point start =
+    std::chrono::steady_clock::now();
+  while (status == RestClient::WebSocket::Status::WouldBlock &&
+         std::chrono::steady_clock::now() - start < std::chrono::seconds(5)) {
+    pollfd pfd;
+    pfd.fd = socket.Socket();
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    ASSERT_GE(poll(&pfd, 1, 1000), 0);
+    status = socket.Receive(&message, 0);
+  }
+  ASSERT_EQ(RestClient::WebSocket::Status::Message, status);
+  EXPECT_EQ("event", message.data);
+
+  // pings are answered on both sides
+  EXPECT_EQ(CURLE_OK, socket.Ping("p"));
+  EXPECT_EQ(RestClient::WebSocket::Status::WouldBlock,
+            socket.Receive(&message, 200));
+  EXPECT_EQ(1u, socket.Pongs());
+  socket.SendText("ping me");
+  ASSERT_EQ(RestClient::WebSocket::Status::Message,
+            socket.Receive(&message, 5000));
+  EXPECT_EQ("got pong", message.data);
+  EXPECT_TRUE(pongSeen);
+}
+
+TEST_F(WebSocketTest, TestKeepalive)
+{
+  RestClient::Connection conn(server.Url());
+  RestClient::WebSocket socket(&conn);
+  ASSERT_EQ(101, socket.Open("/echo").code);
+  socket.SetKeepalive(50);
+  RestClient::WebSocketMessage message;
+  EXPECT_EQ(RestClient::WebSocket::Status::WouldBlock,
+            socket.Receive(&message, 300));
+  EXPECT_GE(socket.Pongs(), 2u);
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    EXPECT_GE(pings, 2);
+  }
+
+  // a peer that stops answering is given up on
+  socket.SendText("silence");
+  std::chrono::steady_clock::time_point start =
+    std::chrono::steady_clock::now();
+  EXPECT_EQ(RestClient::WebSocket::Status::Error,
+            socket.Receive(&message, 5000));
+  EXPECT_LT(std::chrono::steady_clock::now() - start,
+            std::chrono::seconds(2));
+  EXPECT_EQ("No answer to the keepalive ping", socket.Error());
+  EXPECT_FALSE(socket.IsOpen());
+}
+
+TEST_F(WebSocketTest, TestClosedByServer)
+{
+  RestClient::Connection conn(server.Url());
+  RestClient::WebSocket socket(&conn);
+  ASSERT_EQ(101, socket.Open("/echo").code);
+  socket.SendText("close me");
+  RestClient::WebSocketMessage message;
+  ASSERT_EQ(RestClient::WebSocket::Status::Closed,
+            socket.Receive(&message, 5000));
+  EXPECT_EQ(4000, message.closeCode);
+  EXPECT_EQ("bye", message.data);
+  EXPECT_FALSE(socket.IsOpen());
+  EXPECT_NE(CURLE_OK, socket.SendText("too late"));
+  // the close was answered
+  std::chrono::steady_clock::time_point start =
+    std::chrono::steady_clock::now();
+  while (std::chrono::steady_clock::now() - start < std::chrono::seconds(5)) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (closeCode != 0) {
+        break;
+      }
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  EXPECT_EQ(4000, closeCode);
+
+  // a refused upgrade leaves the socket closed
+  RestClient::Response response = socket.Open("/refuse");
+  EXPECT_EQ(403, response.code);
+  // libcurl doesn't read the body of a refused upgrade
+  EXPECT_EQ(socket.LibcurlFrames() ? "" : "no", response.body);
+  EXPECT_FALSE(socket.IsOpen());
+  EXPECT_EQ(RestClient::WebSocket::Status::Closed,
+            socket.Receive(&message, 0));
+
+  // messages are bounded
+  RestClient::WebSocket small(&conn, 16);
+  ASSERT_EQ(101, small.Open("/echo").code);
+  small.SendText(std::string(32, 'x'));
+  EXPECT_EQ(RestClient::WebSocket::Status::Error,
+            small.Receive(&message, 5000));
+  EXPECT_EQ("Message too large", small.Error());
+}
@@ -0,0 +1,460 @@
+/**
+ * @file fault_proxy.cc
+ * @brief implementation of the fault injecting HTTP/1.1 proxy
+ * @author Daniel Schauenberg <d@unwiredcouch.com>
+ */
+
+#include "fault_proxy.h"
+#include "wire.h"
+
+#if !defined(_WIN32)
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <map>
+#include <string>
+#include <thread>
+
+namespace {
+
+void splitHostPort(const std::string& authority, std::string* host,
+                   int* port, int defaultPort) {
+  size_t colon = authority.rfind(':');
+  if (colon == std::string::npos || authority.find(']', colon) !=
+      std::string::npos) {
+    *host = authority;
+    *port = defaultPort;
+  } else {
+    *host = authority.substr(0, colon);
+    *port = std::atoi(authority.c_str() + colon + 1);
+  }
+  if (host->size() > 1 && (*host)[0] == '[') {
+    *host = host->substr(1, host->size() - 2);
+  }
+}
+
+#if !defined(_WIN32)
+/**
+ * @brief move a complete chunked body, including the terminating chunk and
+ * trailers, from buffer/fd to out without decoding it
+ */
+bool readChunked(int fd, std::string* buffer, std::string* out) {
+  for (;;) {
+    size_t lineEnd;
+    while ((lineEnd = buffer->find("\r\n")) == std::string::npos) {
+      if (!RestClient::Testing::Wire::RecvMore(fd, buffer)) {
+        return false;
+      }
+    }
+    size_t chunk = std::strtoul(buffer->c_str(), NULL, 16);
+    size_t total;
+    if (chunk == 0) {
+      size_t end;
+      while ((end = buffer->find("\r\n\r\n")) == std::string::npos) {
+        if (!RestClient::Testing::Wire::RecvMore(fd, buffer)) {
+          return false;
+        }
+      }
+      total = end + 4;
+    } else {
+      total = lineEnd + 2 + chunk + 2;
+    }
+    while (buffer->size() < total) {
+      if (!RestClient::Testing::Wire::RecvMore(fd, buffer)) {
+        return false;
+      }
+    }
+    out->append(*buffer, 0, total);
+    buffer->erase(0, total);
+    if (chunk == 0) {
+      return true;
+    }
+  }
+}
+#endif
+
+}  // namespace
+
+RestClient::Testing::LatencyDistribution::LatencyDistribution()
+  : kind(kNone), a(0), b(0) {
+}
+
+RestClient::Testing::LatencyDistribution::LatencyDistribution(Kind kind,
+                                                              double a,
+                                                              double b)
+  : kind(kind), a(a), b(b) {
+}
+
+RestClient::Testing::LatencyDistribution
+RestClient::Testing::LatencyDistribution::Fixed(int64_t micros) {
+  return LatencyDistribution(kFixed, static_cast<double>(micros), 0);
+}
+
+RestClient::Testing::LatencyDistribution
+RestClient::Testing::LatencyDistribution::Uniform(int64_t minMicros,
+                                                  int64_t maxMicros) {
+  return LatencyDistribution(kUniform, static_cast<double>(minMicros),
+                             static_cast<double>(maxMicros));
+}
+
+RestClient::Testing::LatencyDistribution
+RestClient::Testing::LatencyDistribution::Exponential(int64_t meanMicros) {
+  return LatencyDistribution(kExponential, static_cast<double>(meanMicros),
+                             0);
+}
+
+RestClient::Testing::LatencyDistribution
+RestClient::Testing::LatencyDistribution::LogNormal(int64_t medianMicros,
+                                                    double sigma) {
+  return LatencyDistribution(kLogNormal, static_cast<double>(medianMicros),
+                             sigma);
+}
+
+/**
+ * @brief draw a delay
+ *
+ * @param rng generator to draw from
+ *
+ * @return delay in microseconds, >= 0
+ */
+int64_t
+RestClient::Testing::LatencyDistribution::Sample(std::mt19937_64* rng) const {
+  double value = 0;
+  switch (this->kind) {
+    case kNone:
+      return 0;
+    case kFixed:
+      value = this->a;
+      break;
+    case kUniform:
+      value = std::uniform_real_distribution<double>(this->a, this->b)(*rng);
+      break;
+    case kExponential:
+      value = this->a > 0
+        ? std::exponential_distribution<double>(1.0 / this->a)(*rng) : 0;
+      break;
+    case kLogNormal:
+      value = this->a > 0
+        ? std::lognormal_distribution<double>(std::log(this->a),
+                                              this->b)(*rng) : 0;
+      break;
+  }
+  return value > 0 ? static_cast<int64_t>(value) : 0;
+}
+
+RestClient::Testing::FaultConfig::FaultConfig()
+  : errorRate(0), errorStatus(503), resetRate(0), stallRate(0),
+    stallMicros(0), dripBytes(0), dripMicros(0), seed(1) {
+}
+
+RestClient::Testing::FaultProxy::FaultProxy()
+  : upstreamHost("127.0.0.1"), upstreamPort(80), rng(1), stopping(false),
+    requests(0), faulted(0) {
+  this->server.SetConnectionHandler([this](int fd) { this->serve(fd); });
+}
+
+RestClient::Testing::FaultProxy::~FaultProxy() {
+  this->Stop();
+}
+
+void
+RestClient::Testing::FaultProxy::SetUpstream(const std::string& host,
+                                             int port) {
+  this->upstreamHost = host;
+  this->upstreamPort = port;
+}
+
+void
+RestClient::Testing::FaultProxy::SetFaults(
+    const RestClient::Testing::FaultConfig& faults) {
+  std::lock_guard<std::mutex> lock(this->faultsMutex);
+  this->faults = faults;
+  this->rng.seed(faults.seed);
+}
+
+bool
+RestClient::Testing::FaultProxy::Start(int port) {
+  this->stopping = false;
+  return this->server.Start(port);
+}
+
+void
+RestClient::Testing::FaultProxy::Stop() {
+  this->stopping = true;
+  this->server.Stop();
+}
+
+int
+RestClient::Testing::FaultProxy::Port() const {
+  return this->server.Port();
+}
+
+std::string
+RestClient::Testing::FaultProxy::Url() const {
+  return this->server.Url();
+}
+
+uint64_t
+RestClient::Testing::FaultProxy::Requests() const {
+  return this->requests.load();
+}
+
+uint64_t
+RestClient::Testing::FaultProxy::Faults() const {
+  return this->faulted.load();
+}
+
+/**
+ * @brief decide which faults the next request gets. All random numbers are
+ * drawn for every request so the sequence of decisions only depends on the
+ * seed and the number of requests.
+ *
+ * @return faults to inject
+ */
+bool
+RestClient::Testing::FaultProxy::pause(int64_t micros) {
+  // sleep in slices so Stop() doesn't wait for long injected delays
+  std::chrono::steady_clock::time_point until =
+    std::chrono::steady_clock::now() + std::chrono::microseconds(micros);
+  while (!this->stopping) {
+    std::chrono::steady_clock::duration left =
+      until - std::chrono::steady_clock::now();
+    if (left <= std::chrono::steady_clock::duration::zero()) {
+      return true;
+    }
+    std::this_thread::sleep_for(std::min<std::chrono::steady_clock::duration>(
+        left, std::chrono::milliseconds(10)));
+  }
+  return false;
+}
+
+RestClient::Testing::FaultProxy::Decision
+RestClient::Testing::FaultProxy::decide() {
+  std::lock_guard<std::mutex> lock(this->faultsMutex);
+  std::uniform_real_distribution<double> coin(0.0, 1.0);
+  Decision d;
+  d.delay = this->faults.latency.Sample(&this->rng);
+  d.reset = coin(this->rng) < this->faults.resetRate;
+  d.error = coin(this->rng) < this->faults.errorRate;
+  d.stall = coin(this->rng) < this->faults.stallRate;
+  d.errorStatus = this->faults.errorStatus;
+  d.stallMicros = this->faults.stallMicros;
+  d.dripBytes = this->faults.dripBytes;
+  d.dripMicros = this->faults.dripMicros;
+  if (d.delay > 0 || d.reset || d.error || d.stall) {
+    this->faulted.fetch_add(1);
+  }
+  return d;
+}
+
+#if defined(_WIN32)
+
+void
+RestClient::Testing::FaultProxy::serve(int) {
+}
+
+#else
+
+/**
+ * @brief proxy requests from one client connection until either side
+ * closes it
+ *
+ * @param fd client socket
+ */
+void
+RestClient::Testing::FaultProxy::serve(int fd) {
+  namespace Wire = RestClient::Testing::Wire;
+  std::string buffer;
+  std::string tunnelHost;
+  int tunnelPort = 0;
+  int upstream = -1;
+  std::string upstreamKey;
+  std::string upstreamBuffer;
+
+  for (;;) {
+    size_t headLength = Wire::ReadHead(fd, &buffer);
+    if (headLength == 0) {
+      break;
+    }
+    std::map<std::string, std::string> headers;
+    std::string line = Wire::ParseHead(buffer.substr(0, headLength),
+                                       &headers);
+    buffer.erase(0, headLength);
+    size_t first = line.find(' ');
+    size_t second = line.find(' ', first + 1);
+    if (first == std::string::npos || second == std::string::npos) {
+      break;
+    }
+    std::string method = line.substr(0, first);
+    std::string target = line.substr(first + 1, second - first - 1);
+    std::string version = line.substr(second + 1);
+
+    if (method == "CONNECT") {
+      splitHostPort(target, &tunnelHost, &tunnelPort, 443);
+      if (!Wire::SendAll(fd, "HTTP/1.1 200 Connection established\r\n\r\n")) {
+        break;
+      }
+      continue;
+    }
+
+    std::string host = tunnelPort ? tunnelHost : this->upstreamHost;
+    int port = tunnelPort ? tunnelPort : this->upstreamPort;
+    if (target.compare(0, 7, "http://") == 0) {
+      size_t slash = target.find('/', 7);
+      splitHostPort(target.substr(7, slash == std::string::npos
+                                     ? std::string::npos : slash - 7),
+                    &host, &port, 80);
+      target = slash == std::string::npos ? "/" : target.substr(slash);
+    }
+
+    if (Wire::ToLower(headers["expect"]) == "100-continue" &&
+        !Wire::SendAll(fd, "HTTP/1.1 100 Continue\r\n\r\n")) {
+      break;
+    }
+    std::string body;
+    if (!Wire::ReadBody(fd, &buffer, std::strtoul(
+            headers["content-length"].c_str(), NULL, 10), &body)) {
+      break;
+    }
+    this->requests.fetch_add(1);
+    bool clientClose = Wire::ToLower(headers["connection"]) == "close";
+
+    Decision d = this->decide();
+    if (d.reset) {
+      // abortive close, the client sees a connection reset
+      struct linger abort = {1, 0};
+      setsockopt(fd, SOL_SOCKET, SO_LINGER, &abort, sizeof(abort));
+      break;
+    }
+
+    std::string responseHead;
+    std::string responseBody;
+    bool upstreamClose = false;
+    int errorStatus = d.errorStatus;
+    if (!d.error) {
+      std::string request = method + " " + target + " " + version + "\r\n";
+      for (std::map<std::string, std::string>::const_iterator it =
+          headers.begin(); it != headers.end(); ++it) {
+        if (it->first != "expect" && it->first != "proxy-connection" &&
+            it->first != "proxy-authorization") {
+          request += it->first + ": " + it->second + "\r\n";
+        }
+      }
+      request += "\r\n" + body;
+
+      std::string key = host + ":" + std::to_string(port);
+      size_t upstreamHeadLength = 0;
+      // retry once on a fresh connection in case the upstream closed an
+      // idle one
+      for (int attempt = 0; attempt < 2 && upstreamHeadLength == 0;
+           attempt++) {
+        if (upstream >= 0 && (attempt > 0 || key != upstreamKey)) {
+          close(upstream);
+          upstream = -1;
+        }
+        if (upstream < 0) {
+          upstream = Wire::Connect(host, port);
+          upstreamKey = key;
+          upstreamBuffer.clear();
+        }
+        if (upstream >= 0 && Wire::SendAll(upstream, request)) {
+          upstreamHeadLength = Wire::ReadHead(upstream, &upstreamBuffer);
+        }
+      }
+
+      std::map<std::string, std::string> responseHeaders;
+      int status = 0;
+      if (upstreamHeadLength > 0) {
+        responseHead = upstreamBuffer.substr(0, upstreamHeadLength);
+        upstreamBuffer.erase(0, upstreamHeadLength);
+        std::string statusLine = Wire::ParseHead(responseHead,
+                                                 &responseHeaders);
+        status = std::atoi(statusLine.c_str() + statusLine.find(' ') + 1);
+      }
+      bool ok = upstreamHeadLength > 0;
+      if (ok && method != "HEAD" && status >= 200 && status != 204 &&
+          status != 304) {
+        if (Wire::ToLower(responseHeaders["transfer-encoding"]) ==
+            "chunked") {
+          ok = readChunked(upstream, &upstreamBuffer, &responseBody);
+        } else if (responseHeaders.count("content-length")) {
+          ok = Wire::ReadBody(upstream, &upstreamBuffer, std::strtoul(
+              responseHeaders["content-length"].c_str(), NULL, 10),
+              &responseBody);
+        } else {
+          // delimited by the end of the connection
+          while (Wire::RecvMore(upstream, &upstreamBuffer)) {
+          }
+          responseBody.swap(upstreamBuffer);
+          upstreamClose = true;
+        }
+      }
+      if (!ok) {
+        d.error = true;
+        errorStatus = 502;
+        upstreamClose = true;
+      } else if (Wire::ToLower(responseHeaders["connection"]) == "close") {
+        upstreamClose = true;
+      }
+      if (upstreamClose && upstream >= 0) {
+        close(upstream);
+        upstream = -1;
+      }
+    }
+    if (d.error) {
+      responseBody = "fault injected\n";
+      responseHead = "HTTP/1.1 " + std::to_string(errorStatus) + " " +
+                     Wire::ReasonPhrase(errorStatus) + "\r\n"
+                     "Content-Type: text/plain\r\n"
+                     "Content-Length: " +
+                     std::to_string(responseBody.size()) + "\r\n";
+      if (upstreamClose) {
+        responseHead += "Connection: close\r\n";
+      }
+      responseHead += "\r\n";
+    }
+
+    if (!this->pause(d.delay)) {
+      break;
+    }
+    if (d.stall) {
+      size_t half = responseHead.size() / 2;
+      if (!Wire::SendAll(fd, responseHead.data(), half)) {
+        break;
+      }
+      if (!this->pause(d.stallMicros) ||
+          !Wire::SendAll(fd, responseHead.data() + half,
+                         responseHead.size() - half)) {
+        break;
+      }
+    } else if (!Wire::SendAll(fd, responseHead)) {
+      break;
+    }
+    if (d.dripBytes > 0) {
+      bool sent = true;
+      for (size_t offset = 0; sent && offset < responseBody.size();
+           offset += d.dripBytes) {
+        sent = (offset == 0 || this->pause(d.dripMicros)) &&
+               Wire::SendAll(fd, responseBody.substr(offset, d.dripBytes));
+      }
+      if (!sent) {
+        break;
+      }
+    } else if (!Wire::SendAll(fd, responseBody)) {
+      break;
+    }
+    if (clientClose || upstreamClose) {
+      break;
+    }
+  }
+  if (upstream >= 0) {
+    close(upstream);
+  }
+}
+
+#endif
@@ -0,0 +1,149 @@
+/**
+ * @file fault_proxy.h
+ * @brief HTTP/1.1 proxy on the loopback interface that injects latency,
+ * errors, connection resets, stalls and slow bodies into the responses it
+ * forwards, for deterministic resilience tests and benchmarks
+ * @author Daniel Schauenberg <d@unwiredcouch.com>
+ */
+
+#ifndef TOOLS_FAULT_PROXY_H_
+#define TOOLS_FAULT_PROXY_H_
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <random>
+#include <string>
+
+#include "loopback_server.h"
+
+namespace RestClient {
+namespace Testing {
+
+/**
+  * @brief distribution of injected delays in microseconds
+  */
+class LatencyDistribution {
+ public:
+    // no delay
+    LatencyDistribution();
+
+    static LatencyDistribution Fixed(int64_t micros);
+    static LatencyDistribution Uniform(int64_t minMicros, int64_t maxMicros);
+    static LatencyDistribution Exponential(int64_t meanMicros);
+    // heavy tailed, sigma is the one of the underlying normal distribution
+    static LatencyDistribution LogNormal(int64_t medianMicros, double sigma);
+
+    int64_t Sample(std::mt19937_64* rng) const;
+
+ private:
+    enum Kind {
+      kNone,
+      kFixed,
+      kUniform,
+      kExponential,
+      kLogNormal
+    };
+
+    LatencyDistribution(Kind kind, double a, double b);
+
+    Kind kind;
+    double a;
+    double b;
+};
+
+/**
+  * @brief what to inject into forwarded requests. Every fault is decided
+  * per request with its own probability, from a generator seeded with seed
+  * so a sequence of requests sees the same faults on every run.
+  */
+struct FaultConfig {
+  // delay before the response head is sent
+  LatencyDistribution latency;
+  // answer with errorStatus instead of forwarding the request
+  double errorRate;
+  int errorStatus;
+  // reset the client connection instead of answering
+  double resetRate;
+  // send half of the response head, then stall for stallMicros
+  double stallRate;
+  int64_t stallMicros;
+  // send the response body in pieces of dripBytes every dripMicros,
+  // 0 disables
+  size_t dripBytes;
+  int64_t dripMicros;
+  uint64_t seed;
+
+  FaultConfig();
+};
+
+/**
+  * @brief fault injecting HTTP/1.1 proxy.
+  *
+  * Plain requests are forwarded to the upstream set with SetUpstream().
+  * The proxy also understands absolute request targets and CONNECT, so it
+  * can be used with Connection::SetProxy(); faults are then injected into
+  * the tunneled (cleartext) requests. Request bodies need a Content-Length.
+  * Not available on Windows.
+  */
+class FaultProxy {
+ public:
+    FaultProxy();
+    ~FaultProxy();
+
+    FaultProxy(const FaultProxy&) = delete;
+    FaultProxy& operator=(const FaultProxy&) = delete;
+
+    // where to forward requests with a relative target. Has to be called
+    // before Start()
+    void SetUpstream(const std::string& host, int port);
+
+    // replace the faults to inject, may be called while running
+    void SetFaults(const FaultConfig& faults);
+
+    bool Start(int port = 0);
+    void Stop();
+
+    int Port() const;
+
+    // "http://127.0.0.1:<port>"
+    std::string Url() const;
+
+    // number of requests received
+    uint64_t Requests() const;
+
+    // number of requests that got at least one fault
+    uint64_t Faults() const;
+
+ private:
+    struct Decision {
+      int64_t delay;
+      bool error;
+      bool reset;
+      bool stall;
+      int errorStatus;
+      int64_t stallMicros;
+      size_t dripBytes;
+      int64_t dripMicros;
+    };
+
+    void serve(int fd);
+    Decision decide();
+    // false if the proxy was stopped while sleeping
+    bool pause(int64_t micros);
+
+    LoopbackServer server;
+    std::string upstreamHost;
+    int upstreamPort;
+    std::mutex faultsMutex;
+    FaultConfig faults;
+    std::mt19937_64 rng;
+    std::atomic<bool> stopping;
+    std::atomic<uint64_t> requests;
+    std::atomic<uint64_t> faulted;
+};
+
+}  // namespace Testing
+}  // namespace RestClient
+
+#endif  // TOOLS_FAULT_PROXY_H_
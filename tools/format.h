@@ -0,0 +1,43 @@
+/**
+ * @file format.h
+ * @brief human readable durations and sizes for the command line tools
+ * @author Daniel Schauenberg <d@unwiredcouch.com>
+ */
+
+#ifndef TOOLS_FORMAT_H_
+#define TOOLS_FORMAT_H_
+
+#include <cstdio>
+#include <string>
+
+namespace RestClient {
+namespace Tools {
+
+inline std::string formatMicros(double us) {
+  char out[32];
+  if (us < 1000) {
+    std::snprintf(out, sizeof(out), "%.0fus", us);
+  } else if (us < 1000000) {
+    std::snprintf(out, sizeof(out), "%.2fms", us / 1000);
+  } else {
+    std::snprintf(out, sizeof(out), "%.2fs", us / 1000000);
+  }
+  return out;
+}
+
+inline std::string formatBytes(double bytes) {
+  const char* units[] = {"B", "KB", "MB", "GB", "TB"};
+  size_t unit = 0;
+  while (bytes >= 1024 && unit < 4) {
+    bytes /= 1024;
+    unit++;
+  }
+  char out[32];
+  std::snprintf(out, sizeof(out), "%.2f%s", bytes, units[unit]);
+  return out;
+}
+
+}  // namespace Tools
+}  // namespace RestClient
+
+#endif  // TOOLS_FORMAT_H_
@@ -0,0 +1,590 @@
+/**
+ * @file loopback_server.cc
+ * @brief implementation of the in-process loopback HTTP server
+ * @author Daniel Schauenberg <d@unwiredcouch.com>
+ */
+
+#include "loopback_server.h"
+#include "wire.h"
+
+#if !defined(_WIN32)
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+
+namespace {
+
+using RestClient::Testing::Wire::ReasonPhrase;
+using RestClient::Testing::Wire::ToLower;
+#if !defined(_WIN32)
+using RestClient::Testing::Wire::RecvMore;
+using RestClient::Testing::Wire::SendAll;
+#endif
+
+const char kHttp2Preface[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+const size_t kHttp2PrefaceLength = sizeof(kHttp2Preface) - 1;
+const size_t kHttp2MaxFrameSize = 16384;
+
+enum Http2FrameType {
+  kData = 0x0,
+  kHeaders = 0x1,
+  kSettings = 0x4,
+  kPing = 0x6,
+  kGoAway = 0x7,
+  kWindowUpdate = 0x8,
+  kContinuation = 0x9
+};
+
+const uint8_t kEndStream = 0x1;
+const uint8_t kAck = 0x1;
+const uint8_t kEndHeaders = 0x4;
+const uint8_t kPadded = 0x8;
+
+/**
+ * @brief HPACK integer with the given prefix size, see RFC 7541 5.1
+ */
+void hpackInteger(std::string* out, uint64_t value, int prefixBits,
+                  uint8_t flags) {
+  const uint64_t max = (1u << prefixBits) - 1;
+  if (value < max) {
+    out->push_back(static_cast<char>(flags | value));
+    return;
+  }
+  out->push_back(static_cast<char>(flags | max));
+  value -= max;
+  while (value >= 128) {
+    out->push_back(static_cast<char>((value & 0x7f) | 0x80));
+    value >>= 7;
+  }
+  out->push_back(static_cast<char>(value));
+}
+
+void hpackString(std::string* out, const std::string& s) {
+  hpackInteger(out, s.size(), 7, 0);
+  out->append(s);
+}
+
+#if !defined(_WIN32)
+bool sendFrame(int fd, uint8_t type, uint8_t flags, uint32_t stream,
+               const std::string& payload) {
+  char header[9];
+  header[0] = static_cast<char>((payload.size() >> 16) & 0xff);
+  header[1] = static_cast<char>((payload.size() >> 8) & 0xff);
+  header[2] = static_cast<char>(payload.size() & 0xff);
+  header[3] = static_cast<char>(type);
+  header[4] = static_cast<char>(flags);
+  header[5] = static_cast<char>((stream >> 24) & 0x7f);
+  header[6] = static_cast<char>((stream >> 16) & 0xff);
+  header[7] = static_cast<char>((stream >> 8) & 0xff);
+  header[8] = static_cast<char>(stream & 0xff);
+  std::string frame(header, sizeof(header));
+  frame.append(payload);
+  return SendAll(fd, frame.data(), frame.size());
+}
+
+/**
+ * @brief send a response as HEADERS and DATA frames. Header fields are sent
+ * as literals without indexing, names from the static table where possible
+ * (:status is index 8, content-length index 28)
+ */
+bool sendHttp2Response(int fd, uint32_t id,
+                       const RestClient::Testing::LoopbackResponse& response) {
+  std::string block;
+  hpackInteger(&block, 8, 4, 0);
+  hpackString(&block, std::to_string(response.status));
+  hpackInteger(&block, 28, 4, 0);
+  hpackString(&block, std::to_string(response.body.size()));
+  for (size_t i = 0; i < response.headers.size(); i++) {
+    block.push_back('\0');
+    hpackString(&block, ToLower(response.headers[i].first));
+    hpackString(&block, response.headers[i].second);
+  }
+  if (!sendFrame(fd, kHeaders,
+                 kEndHeaders | (response.body.empty() ? kEndStream : 0),
+                 id, block)) {
+    return false;
+  }
+  for (size_t offset = 0; offset < response.body.size();
+       offset += kHttp2MaxFrameSize) {
+    bool last = offset + kHttp2MaxFrameSize >= response.body.size();
+    if (!sendFrame(fd, kData, last ? kEndStream : 0, id,
+                   response.body.substr(offset, kHttp2MaxFrameSize))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+std::string windowIncrement(uint32_t increment) {
+  std::string payload(4, '\0');
+  payload[0] = static_cast<char>((increment >> 24) & 0x7f);
+  payload[1] = static_cast<char>((increment >> 16) & 0xff);
+  payload[2] = static_cast<char>((increment >> 8) & 0xff);
+  payload[3] = static_cast<char>(increment & 0xff);
+  return payload;
+}
+#endif
+
+}  // namespace
+
+RestClient::Testing::LoopbackServer::LoopbackServer()
+  : handler(DefaultHandler), http2Path("/"), listenFd(-1), port(0),
+    running(false), activeThreads(0), connections(0), requests(0) {
+}
+
+RestClient::Testing::LoopbackServer::~LoopbackServer() {
+  this->Stop();
+}
+
+void
+RestClient::Testing::LoopbackServer::SetHandler(
+    const RestClient::Testing::LoopbackHandler& handler) {
+  this->handler = handler;
+}
+
+void
+RestClient::Testing::LoopbackServer::SetConnectionHandler(
+    const RestClient::Testing::LoopbackConnectionHandler& handler) {
+  this->connectionHandler = handler;
+}
+
+void
+RestClient::Testing::LoopbackServer::SetHttp2Path(const std::string& path) {
+  this->http2Path = path;
+}
+
+int
+RestClient::Testing::LoopbackServer::Port() const {
+  return this->port;
+}
+
+std::string
+RestClient::Testing::LoopbackServer::Url() const {
+  return "http://127.0.0.1:" + std::to_string(this->port);
+}
+
+uint64_t
+RestClient::Testing::LoopbackServer::Connections() const {
+  return this->connections.load();
+}
+
+uint64_t
+RestClient::Testing::LoopbackServer::Requests() const {
+  return this->requests.load();
+}
+
+/**
+ * @brief the built-in routes, see LoopbackServer
+ *
+ * @param request to answer
+ * @param response to fill
+ */
+void
+RestClient::Testing::LoopbackServer::DefaultHandler(
+    const RestClient::Testing::LoopbackRequest& request,
+    RestClient::Testing::LoopbackResponse* response) {
+  std::string path = request.path.substr(0, request.path.find('?'));
+  response->status = 200;
+  response->headers.push_back(std::make_pair("Content-Type", "text/plain"));
+  if (path.compare(0, 7, "/bytes/") == 0) {
+    response->body.assign(std::strtoul(path.c_str() + 7, NULL, 10), 'x');
+  } else if (path.compare(0, 9, "/headers/") == 0) {
+    unsigned long n = std::strtoul(path.c_str() + 9, NULL, 10);  // NOLINT
+    for (unsigned long i = 0; i < n; i++) {  // NOLINT
+      response->headers.push_back(std::make_pair(
+          "X-Loopback-Header-" + std::to_string(i),
+          "value-" + std::to_string(i) + "-abcdefghijklmnopqrstuvwxyz"));
+    }
+    response->body = "ok";
+  } else if (path.compare(0, 8, "/status/") == 0) {
+    response->status = std::atoi(path.c_str() + 8);
+  } else if (path == "/echo") {
+    response->body = request.body;
+  } else {
+    response->body = "ok";
+  }
+}
+
+void
+RestClient::Testing::LoopbackServer::dispatch(
+    const RestClient::Testing::LoopbackRequest& request,
+    RestClient::Testing::LoopbackResponse* response) {
+  response->status = 200;
+  this->handler(request, response);
+  this->requests.fetch_add(1);
+}
+
+#if defined(_WIN32)
+
+bool
+RestClient::Testing::LoopbackServer::Start(int) {
+  return false;
+}
+
+void
+RestClient::Testing::LoopbackServer::Stop() {
+}
+
+#else
+
+/**
+ * @brief bind to 127.0.0.1 and start accepting connections
+ *
+ * @param port to listen on, 0 to pick a free one
+ *
+ * @return true if the server is running
+ */
+bool
+RestClient::Testing::LoopbackServer::Start(int port) {
+  if (this->running.load()) {
+    return true;
+  }
+  this->listenFd = socket(AF_INET, SOCK_STREAM, 0);
+  if (this->listenFd < 0) {
+    return false;
+  }
+  int one = 1;
+  setsockopt(this->listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  struct sockaddr_in addr;
+  std::memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(static_cast<uint16_t>(port));
+  socklen_t length = sizeof(addr);
+  if (bind(this->listenFd, reinterpret_cast<struct sockaddr*>(&addr),
+           sizeof(addr)) != 0 ||
+      listen(this->listenFd, 1024) != 0 ||
+      getsockname(this->listenFd, reinterpret_cast<struct sockaddr*>(&addr),
+                  &length) != 0) {
+    close(this->listenFd);
+    this->listenFd = -1;
+    return false;
+  }
+  this->port = ntohs(addr.sin_port);
+  this->running.store(true);
+  this->activeThreads.fetch_add(1);
+  std::thread(&LoopbackServer::acceptLoop, this).detach();
+  return true;
+}
+
+/**
+ * @brief stop accepting, shut down all open connections and wait until all
+ * server threads are gone
+ */
+void
+RestClient::Testing::LoopbackServer::Stop() {
+  if (!this->running.exchange(false)) {
+    return;
+  }
+  shutdown(this->listenFd, SHUT_RDWR);
+  {
+    std::lock_guard<std::mutex> lock(this->clientsMutex);
+    for (std::set<int>::const_iterator it = this->clients.begin();
+         it != this->clients.end(); ++it) {
+      shutdown(*it, SHUT_RDWR);
+    }
+  }
+  while (this->activeThreads.load() > 0) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  close(this->listenFd);
+  this->listenFd = -1;
+}
+
+void
+RestClient::Testing::LoopbackServer::acceptLoop() {
+  while (this->running.load()) {
+    int fd = accept(this->listenFd, NULL, NULL);
+    if (fd < 0) {
+      if (!this->running.load()) {
+        break;
+      }
+      // out of file descriptors or an aborted handshake, try again
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      continue;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    {
+      std::lock_guard<std::mutex> lock(this->clientsMutex);
+      if (!this->running.load()) {
+        close(fd);
+        break;
+      }
+      this->clients.insert(fd);
+    }
+    this->connections.fetch_add(1);
+    this->activeThreads.fetch_add(1);
+    std::thread(&LoopbackServer::serve, this, fd).detach();
+  }
+  this->activeThreads.fetch_sub(1);
+}
+
+/**
+ * @brief serve one connection as HTTP/1.1 or, if it starts with the client
+ * preface, as h2c until the peer closes it
+ *
+ * @param fd connected socket
+ */
+void
+RestClient::Testing::LoopbackServer::serve(int fd) {
+  std::string buffer;
+  bool open = !this->connectionHandler;
+  if (this->connectionHandler) {
+    this->connectionHandler(fd);
+  }
+  while (open && buffer.size() < kHttp2PrefaceLength &&
+         buffer.compare(0, buffer.size(), kHttp2Preface,
+                        buffer.size()) == 0) {
+    open = RecvMore(fd, &buffer);
+  }
+  if (open) {
+    if (buffer.compare(0, kHttp2PrefaceLength, kHttp2Preface) == 0) {
+      buffer.erase(0, kHttp2PrefaceLength);
+      this->serveHttp2(fd, &buffer, NULL);
+    } else {
+      this->serveHttp1(fd, &buffer);
+    }
+  }
+  {
+    std::lock_guard<std::mutex> lock(this->clientsMutex);
+    this->clients.erase(fd);
+    close(fd);
+  }
+  this->activeThreads.fetch_sub(1);
+}
+
+void
+RestClient::Testing::LoopbackServer::serveHttp1(int fd,
+                                                std::string* buffer) {
+  for (;;) {
+    size_t headLength = RestClient::Testing::Wire::ReadHead(fd, buffer);
+    if (headLength == 0) {
+      return;
+    }
+    LoopbackRequest request;
+    request.http2 = false;
+    std::string line = RestClient::Testing::Wire::ParseHead(
+        buffer->substr(0, headLength), &request.headers);
+    buffer->erase(0, headLength);
+    size_t first = line.find(' ');
+    size_t second = line.find(' ', first + 1);
+    if (first == std::string::npos || second == std::string::npos) {
+      return;
+    }
+    request.method = line.substr(0, first);
+    request.path = line.substr(first + 1, second - first - 1);
+    std::string version = line.substr(second + 1);
+
+    std::string connection = ToLower(request.headers["connection"]);
+    bool keepAlive = version == "HTTP/1.1" ? connection != "close"
+                                           : connection == "keep-alive";
+    if (ToLower(request.headers["expect"]) == "100-continue") {
+      const char kContinue[] = "HTTP/1.1 100 Continue\r\n\r\n";
+      if (!SendAll(fd, kContinue, sizeof(kContinue) - 1)) {
+        return;
+      }
+    }
+
+    if (ToLower(request.headers["transfer-encoding"]) == "chunked") {
+      for (;;) {
+        size_t sizeEnd;
+        while ((sizeEnd = buffer->find("\r\n")) == std::string::npos) {
+          if (!RecvMore(fd, buffer)) {
+            return;
+          }
+        }
+        size_t chunk = std::strtoul(buffer->c_str(), NULL, 16);
+        if (chunk == 0) {
+          // skip trailers up to the final empty line
+          size_t end;
+          while ((end = buffer->find("\r\n\r\n")) == std::string::npos) {
+            if (!RecvMore(fd, buffer)) {
+              return;
+            }
+          }
+          buffer->erase(0, end + 4);
+          break;
+        }
+        while (buffer->size() < sizeEnd + 2 + chunk + 2) {
+          if (!RecvMore(fd, buffer)) {
+            return;
+          }
+        }
+        request.body.append(*buffer, sizeEnd + 2, chunk);
+        buffer->erase(0, sizeEnd + 2 + chunk + 2);
+      }
+    } else {
+      size_t length = std::strtoul(
+          request.headers["content-length"].c_str(), NULL, 10);
+      if (!RestClient::Testing::Wire::ReadBody(fd, buffer, length,
+                                               &request.body)) {
+        return;
+      }
+    }
+
+    if (ToLower(request.headers["upgrade"]) == "h2c") {
+      const char kSwitching[] = "HTTP/1.1 101 Switching Protocols\r\n"
+                                "Connection: Upgrade\r\n"
+                                "Upgrade: h2c\r\n\r\n";
+      if (SendAll(fd, kSwitching, sizeof(kSwitching) - 1)) {
+        request.http2 = true;
+        this->serveHttp2(fd, buffer, &request);
+      }
+      return;
+    }
+
+    LoopbackResponse response;
+    this->dispatch(request, &response);
+
+    std::string out = "HTTP/1.1 " + std::to_string(response.status) + " " +
+                      ReasonPhrase(response.status) + "\r\n";
+    for (size_t i = 0; i < response.headers.size(); i++) {
+      out += response.headers[i].first + ": " + response.headers[i].second +
+             "\r\n";
+    }
+    out += "Content-Length: " + std::to_string(response.body.size()) +
+           "\r\n";
+    if (!keepAlive) {
+      out += "Connection: close\r\n";
+    }
+    out += "\r\n";
+    if (request.method != "HEAD") {
+      out += response.body;
+    }
+    if (!SendAll(fd, out.data(), out.size()) || !keepAlive) {
+      return;
+    }
+  }
+}
+
+void
+RestClient::Testing::LoopbackServer::serveHttp2(
+    int fd, std::string* buffer,
+    const RestClient::Testing::LoopbackRequest* upgraded) {
+  struct Stream {
+    bool headersDone;
+    bool ended;
+    std::string body;
+  };
+  std::map<uint32_t, Stream> streams;
+
+  if (!sendFrame(fd, kSettings, 0, 0, std::string())) {
+    return;
+  }
+  if (upgraded) {
+    // the request that asked for the upgrade becomes stream 1, then the
+    // client sends its preface
+    LoopbackResponse response;
+    this->dispatch(*upgraded, &response);
+    if (!sendHttp2Response(fd, 1, response)) {
+      return;
+    }
+    while (buffer->size() < kHttp2PrefaceLength) {
+      if (!RecvMore(fd, buffer)) {
+        return;
+      }
+    }
+    if (buffer->compare(0, kHttp2PrefaceLength, kHttp2Preface) != 0) {
+      return;
+    }
+    buffer->erase(0, kHttp2PrefaceLength);
+  }
+  for (;;) {
+    while (buffer->size() < 9) {
+      if (!RecvMore(fd, buffer)) {
+        return;
+      }
+    }
+    const unsigned char* h =
+      reinterpret_cast<const unsigned char*>(buffer->data());
+    size_t length = (static_cast<size_t>(h[0]) << 16) |
+                    (static_cast<size_t>(h[1]) << 8) | h[2];
+    uint8_t type = h[3];
+    uint8_t flags = h[4];
+    uint32_t id = ((static_cast<uint32_t>(h[5]) & 0x7f) << 24) |
+                  (static_cast<uint32_t>(h[6]) << 16) |
+                  (static_cast<uint32_t>(h[7]) << 8) | h[8];
+    while (buffer->size() < 9 + length) {
+      if (!RecvMore(fd, buffer)) {
+        return;
+      }
+    }
+    std::string payload = buffer->substr(9, length);
+    buffer->erase(0, 9 + length);
+
+    switch (type) {
+      case kHeaders:
+        streams[id].headersDone = (flags & kEndHeaders) != 0;
+        streams[id].ended = (flags & kEndStream) != 0;
+        break;
+      case kContinuation:
+        if (flags & kEndHeaders) {
+          streams[id].headersDone = true;
+        }
+        break;
+      case kData:
+        if ((flags & kPadded) && !payload.empty()) {
+          size_t pad = static_cast<unsigned char>(payload[0]);
+          payload = payload.substr(1, payload.size() - 1 - pad);
+        }
+        streams[id].body.append(payload);
+        if (flags & kEndStream) {
+          streams[id].ended = true;
+        }
+        if (length > 0 &&
+            (!sendFrame(fd, kWindowUpdate, 0, 0,
+                        windowIncrement(static_cast<uint32_t>(length))) ||
+             !sendFrame(fd, kWindowUpdate, 0, id,
+                        windowIncrement(static_cast<uint32_t>(length))))) {
+          return;
+        }
+        break;
+      case kSettings:
+        if (!(flags & kAck) && !sendFrame(fd, kSettings, kAck, 0,
+                                          std::string())) {
+          return;
+        }
+        break;
+      case kPing:
+        if (!(flags & kAck) && !sendFrame(fd, kPing, kAck, 0, payload)) {
+          return;
+        }
+        break;
+      case kGoAway:
+        return;
+      default:
+        break;
+    }
+
+    std::map<uint32_t, Stream>::iterator stream = streams.find(id);
+    if (id == 0 || stream == streams.end() || !stream->second.headersDone ||
+        !stream->second.ended) {
+      continue;
+    }
+    LoopbackRequest request;
+    request.http2 = true;
+    request.method = stream->second.body.empty() ? "GET" : "POST";
+    request.path = this->http2Path;
+    request.body = stream->second.body;
+    streams.erase(stream);
+
+    LoopbackResponse response;
+    this->dispatch(request, &response);
+
+    if (!sendHttp2Response(fd, id, response)) {
+      return;
+    }
+  }
+}
+
+#endif
@@ -0,0 +1,154 @@
+/**
+ * @file loopback_server.h
+ * @brief minimal in-process HTTP/1.1 and h2c server on 127.0.0.1 for tests,
+ * benchmarks and tools that must not depend on the network
+ * @author Daniel Schauenberg <d@unwiredcouch.com>
+ */
+
+#ifndef TOOLS_LOOPBACK_SERVER_H_
+#define TOOLS_LOOPBACK_SERVER_H_
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace RestClient {
+namespace Testing {
+
+/** @struct LoopbackRequest
+  *  @brief request as seen by a LoopbackServer handler
+  *  @var LoopbackRequest::method
+  *  Member 'method' contains the HTTP method
+  *  @var LoopbackRequest::path
+  *  Member 'path' contains the request target including the query string
+  *  @var LoopbackRequest::headers
+  *  Member 'headers' contains the request headers with lower case names
+  *  @var LoopbackRequest::body
+  *  Member 'body' contains the request body
+  *  @var LoopbackRequest::http2
+  *  Member 'http2' is true for requests received over h2c
+  */
+typedef struct {
+  std::string method;
+  std::string path;
+  std::map<std::string, std::string> headers;
+  std::string body;
+  bool http2;
+} LoopbackRequest;
+
+/** @struct LoopbackResponse
+  *  @brief response a LoopbackServer handler fills in. Content-Length is
+  *  added by the server
+  *  @var LoopbackResponse::status
+  *  Member 'status' contains the HTTP status code
+  *  @var LoopbackResponse::headers
+  *  Member 'headers' contains additional response headers
+  *  @var LoopbackResponse::body
+  *  Member 'body' contains the response body
+  */
+typedef struct {
+  int status;
+  std::vector<std::pair<std::string, std::string> > headers;
+  std::string body;
+} LoopbackResponse;
+
+typedef std::function<void(const LoopbackRequest&, LoopbackResponse*)>
+  LoopbackHandler;
+
+typedef std::function<void(int fd)> LoopbackConnectionHandler;
+
+/**
+  * @brief HTTP server on an ephemeral loopback port, serving every
+  * connection from its own thread.
+  *
+  * HTTP/1.1 supports keep-alive, Content-Length and chunked request bodies
+  * and "Expect: 100-continue". Connections starting with the HTTP/2 client
+  * preface (prior knowledge) or asking for "Upgrade: h2c" are served as
+  * h2c. The h2c side does not decode HPACK, so apart from the upgrade
+  * request every stream is dispatched as a GET (POST if it carries a body)
+  * of http2Path, and response bodies have to fit into the client's flow
+  * control window.
+  *
+  * Without a custom handler the following routes are served:
+  *
+  *   /bytes/N     N bytes of body
+  *   /headers/N   N additional response headers and a short body
+  *   /status/N    empty response with status N
+  *   /echo        the request body
+  *   anything else  "ok"
+  *
+  * Not available on Windows.
+  */
+class LoopbackServer {
+ public:
+    LoopbackServer();
+    ~LoopbackServer();
+
+    LoopbackServer(const LoopbackServer&) = delete;
+    LoopbackServer& operator=(const LoopbackServer&) = delete;
+
+    // replace the built-in routes. Has to be called before Start()
+    void SetHandler(const LoopbackHandler& handler);
+
+    // take over accepted connections entirely instead of serving HTTP on
+    // them. The handler runs on the connection's thread, the server closes
+    // the socket when it returns. Has to be called before Start()
+    void SetConnectionHandler(const LoopbackConnectionHandler& handler);
+
+    // path h2c streams are dispatched as, "/" by default
+    void SetHttp2Path(const std::string& path);
+
+    // bind to 127.0.0.1 on the given port (0 picks a free one) and start
+    // accepting connections. Returns false if the socket can't be set up
+    bool Start(int port = 0);
+
+    // close the listening socket and all connections and wait for their
+    // threads to finish
+    void Stop();
+
+    int Port() const;
+
+    // "http://127.0.0.1:<port>"
+    std::string Url() const;
+
+    // number of accepted connections
+    uint64_t Connections() const;
+
+    // number of requests served
+    uint64_t Requests() const;
+
+    // the built-in routes
+    static void DefaultHandler(const LoopbackRequest& request,
+                               LoopbackResponse* response);
+
+ private:
+    void acceptLoop();
+    void serve(int fd);
+    void serveHttp1(int fd, std::string* buffer);
+    void serveHttp2(int fd, std::string* buffer,
+                    const LoopbackRequest* upgraded);
+    void dispatch(const LoopbackRequest& request, LoopbackResponse* response);
+
+    LoopbackHandler handler;
+    LoopbackConnectionHandler connectionHandler;
+    std::string http2Path;
+    int listenFd;
+    int port;
+    std::atomic<bool> running;
+    std::atomic<int> activeThreads;
+    std::atomic<uint64_t> connections;
+    std::atomic<uint64_t> requests;
+    std::mutex clientsMutex;
+    std::set<int> clients;
+};
+
+}  // namespace Testing
+}  // namespace RestClient
+
+#endif  // TOOLS_LOOPBACK_SERVER_H_
@@ -0,0 +1,425 @@
+/**
+ * @file restclient_bench.cc
+ * @brief wrk style HTTP load generator built on RestClient::Connection
+ * @author Daniel Schauenberg <d@unwiredcouch.com>
+ *
+ * Every worker thread owns one Connection and issues requests back to back
+ * (closed loop) or, with --rate, on a fixed schedule (open loop). With a
+ * schedule, latency is measured from the time a request was supposed to be
+ * sent rather than when it actually went out, so a stalled server shows up
+ * in the percentiles instead of silently lowering the request rate
+ * (coordinated omission).
+ */
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "restclient-cpp/connection.h"
+#include "restclient-cpp/metrics.h"
+#include "restclient-cpp/restclient.h"
+#include "loopback_server.h"
+#include "fault_proxy.h"
+#include "format.h"
+
+namespace {
+
+using RestClient::Tools::formatBytes;
+using RestClient::Tools::formatMicros;
+
+typedef std::chrono::steady_clock Clock;
+
+struct Options {
+  std::string url;
+  std::string method;
+  std::string body;
+  std::vector<std::pair<std::string, std::string> > headers;
+  int connections;
+  double rate;
+  double duration;
+  int timeout;
+  bool keepAlive;
+  bool http2;
+  bool serve;
+  RestClient::Testing::FaultConfig faults;
+  bool injectFaults;
+
+  Options() : method("GET"), connections(1), rate(0), duration(10),
+              timeout(0), keepAlive(true), http2(false), serve(false),
+              injectFaults(false) {}
+};
+
+/**
+ * @brief everything a worker measures. Only the owning worker writes to it
+ * while the test runs.
+ */
+struct WorkerStats {
+  RestClient::Metrics::Histogram latency;
+  RestClient::Metrics::Histogram serviceTime;
+  double latencySum;
+  double latencySquares;
+  uint64_t requests;
+  uint64_t bytesRead;
+  uint64_t bytesWritten;
+  uint64_t newConnections;
+  uint64_t reused;
+  uint64_t statusClasses[6];
+  std::map<int, uint64_t> curlErrors;
+  std::map<int, std::string> curlErrorMessages;
+
+  WorkerStats() : latencySum(0), latencySquares(0), requests(0),
+                  bytesRead(0), bytesWritten(0), newConnections(0),
+                  reused(0) {
+    std::memset(statusClasses, 0, sizeof(statusClasses));
+  }
+};
+
+void usage() {
+  std::fprintf(stderr,
+    "usage: restclient-bench [options] <url>\n"
+    "\n"
+    "  -c, --connections N   concurrent connections, one thread each (1)\n"
+    "  -R, --rate N          total requests per second, 0 sends requests\n"
+    "                        back to back without correcting latencies (0)\n"
+    "  -d, --duration S      test duration in seconds (10)\n"
+    "  -m, --method M        GET, POST, PUT, PATCH, DELETE, HEAD, OPTIONS\n"
+    "  -b, --body DATA       request body\n"
+    "      --body-file PATH  read the request body from a file\n"
+    "  -H, --header 'K: V'   add a request header, may be repeated\n"
+    "      --timeout S       request timeout in seconds (none)\n"
+    "      --no-keepalive    send 'Connection: close' with every request\n"
+    "      --http2           use h2c (upgrade from HTTP/1.1)\n"
+    "      --serve           run against an in-process loopback server,\n"
+    "                        <url> is a path on it, e.g. /bytes/1024\n"
+    "\n"
+    "  fault injection in front of the loopback server, needs --serve:\n"
+    "      --fault-latency MS  log-normal response delay with median MS\n"
+    "      --fault-error P     answer with 503 with probability P\n"
+    "      --fault-reset P     reset the connection with probability P\n");
+}
+
+bool parseOptions(int argc, char** argv, Options* options) {
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    bool hasValue = i + 1 < argc;
+    if ((arg == "-c" || arg == "--connections") && hasValue) {
+      options->connections = std::atoi(argv[++i]);
+    } else if ((arg == "-R" || arg == "--rate") && hasValue) {
+      options->rate = std::atof(argv[++i]);
+    } else if ((arg == "-d" || arg == "--duration") && hasValue) {
+      options->duration = std::atof(argv[++i]);
+    } else if ((arg == "-m" || arg == "--method") && hasValue) {
+      options->method = argv[++i];
+    } else if ((arg == "-b" || arg == "--body") && hasValue) {
+      options->body = argv[++i];
+    } else if (arg == "--body-file" && hasValue) {
+      std::ifstream in(argv[++i], std::ios::binary);
+      if (!in) {
+        std::fprintf(stderr, "can't read %s\n", argv[i]);
+        return false;
+      }
+      std::stringstream data;
+      data << in.rdbuf();
+      options->body = data.str();
+    } else if ((arg == "-H" || arg == "--header") && hasValue) {
+      std::string header = argv[++i];
+      size_t colon = header.find(':');
+      if (colon == std::string::npos) {
+        std::fprintf(stderr, "invalid header: %s\n", header.c_str());
+        return false;
+      }
+      size_t value = header.find_first_not_of(' ', colon + 1);
+      options->headers.push_back(std::make_pair(header.substr(0, colon),
+          value == std::string::npos ? "" : header.substr(value)));
+    } else if (arg == "--timeout" && hasValue) {
+      options->timeout = std::atoi(argv[++i]);
+    } else if (arg == "--no-keepalive") {
+      options->keepAlive = false;
+    } else if (arg == "--http2") {
+      options->http2 = true;
+    } else if (arg == "--serve") {
+      options->serve = true;
+    } else if (arg == "--fault-latency" && hasValue) {
+      options->faults.latency =
+        RestClient::Testing::LatencyDistribution::LogNormal(
+            static_cast<int64_t>(std::atof(argv[++i]) * 1000), 1.0);
+      options->injectFaults = true;
+    } else if (arg == "--fault-error" && hasValue) {
+      options->faults.errorRate = std::atof(argv[++i]);
+      options->injectFaults = true;
+    } else if (arg == "--fault-reset" && hasValue) {
+      options->faults.resetRate = std::atof(argv[++i]);
+      options->injectFaults = true;
+    } else if (arg[0] != '-' && options->url.empty()) {
+      options->url = arg;
+    } else {
+      return false;
+    }
+  }
+  const char* methods[] = {"GET", "POST", "PUT", "PATCH", "DELETE", "HEAD",
+                           "OPTIONS"};
+  bool knownMethod = false;
+  for (size_t i = 0; i < sizeof(methods) / sizeof(methods[0]); i++) {
+    knownMethod = knownMethod || options->method == methods[i];
+  }
+  if (!knownMethod) {
+    std::fprintf(stderr, "unsupported method: %s\n",
+                 options->method.c_str());
+    return false;
+  }
+  if (options->injectFaults && (!options->serve || options->http2)) {
+    std::fprintf(stderr, "fault injection needs --serve and HTTP/1.1\n");
+    return false;
+  }
+  return !options->url.empty() && options->connections > 0 &&
+         options->duration > 0 && options->rate >= 0;
+}
+
+RestClient::Response perform(RestClient::Connection* conn,
+                             const Options& options) {
+  const std::string& m = options.method;
+  if (m == "POST") {
+    return conn->post(options.url, options.body);
+  } else if (m == "PUT") {
+    return conn->put(options.url, options.body);
+  } else if (m == "PATCH") {
+    return conn->patch(options.url, options.body);
+  } else if (m == "DELETE") {
+    return conn->del(options.url);
+  } else if (m == "HEAD") {
+    return conn->head(options.url);
+  } else if (m == "OPTIONS") {
+    return conn->options(options.url);
+  }
+  return conn->get(options.url);
+}
+
+/**
+ * @brief issue requests until the deadline. With a rate every worker sends
+ * one request every `interval`, offset by `phase` so the workers don't all
+ * fire at once.
+ */
+void runWorker(const Options& options, Clock::time_point start,
+               Clock::time_point deadline, Clock::duration interval,
+               Clock::duration phase, WorkerStats* stats) {
+  RestClient::Connection conn("");
+  conn.SetFlightRecorder(NULL);
+  for (size_t i = 0; i < options.headers.size(); i++) {
+    conn.AppendHeader(options.headers[i].first, options.headers[i].second);
+  }
+  if (!options.keepAlive) {
+    conn.AppendHeader("Connection", "close");
+  }
+  if (options.timeout > 0) {
+    conn.SetTimeout(options.timeout);
+  }
+  if (options.http2) {
+    conn.SetHttpVersion(CURL_HTTP_VERSION_2_0);
+  }
+  conn.SetNoSignal(true);
+
+  const bool scheduled = interval.count() > 0;
+  Clock::time_point intended = start + phase;
+  for (;;) {
+    Clock::time_point now = Clock::now();
+    if (scheduled) {
+      if (intended >= deadline) {
+        break;
+      }
+      if (intended > now) {
+        std::this_thread::sleep_until(intended);
+      }
+    } else if (now >= deadline) {
+      break;
+    }
+    Clock::time_point sent = Clock::now();
+    if (!scheduled) {
+      intended = sent;
+    }
+    RestClient::Response res = perform(&conn, options);
+    Clock::time_point done = Clock::now();
+
+    uint64_t latency = std::chrono::duration_cast<std::chrono::microseconds>(
+        done - intended).count();
+    uint64_t service = std::chrono::duration_cast<std::chrono::microseconds>(
+        done - sent).count();
+    stats->latency.Record(latency);
+    stats->serviceTime.Record(service);
+    stats->latencySum += static_cast<double>(latency);
+    stats->latencySquares += static_cast<double>(latency) * latency;
+    stats->requests++;
+
+    RestClient::Connection::ExtendedRequestInfo info = conn.GetRequestInfo();
+    stats->bytesRead += info.downloadedBytes + info.responseHeaderBytes;
+    stats->bytesWritten += info.uploadedBytes + info.requestHeaderBytes;
+    stats->newConnections += info.newConnections;
+    stats->reused += info.connectionReused ? 1 : 0;
+    if (info.curlCode != CURLE_OK) {
+      if (stats->curlErrors[info.curlCode]++ == 0) {
+        stats->curlErrorMessages[info.curlCode] =
+          conn.GetInfo().lastRequest.curlError;
+      }
+    } else {
+      int statusClass = res.code / 100;
+      stats->statusClasses[statusClass >= 1 && statusClass <= 5
+                           ? statusClass : 0]++;
+    }
+
+    if (scheduled) {
+      intended += interval;
+    }
+  }
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  Options options;
+  if (!parseOptions(argc, argv, &options)) {
+    usage();
+    return 1;
+  }
+
+  RestClient::init();
+  RestClient::Testing::LoopbackServer server;
+  RestClient::Testing::FaultProxy proxy;
+  if (options.serve) {
+    if (!server.Start()) {
+      std::fprintf(stderr, "can't start loopback server\n");
+      return 1;
+    }
+    if (options.injectFaults) {
+      proxy.SetUpstream("127.0.0.1", server.Port());
+      proxy.SetFaults(options.faults);
+      if (!proxy.Start()) {
+        std::fprintf(stderr, "can't start fault proxy\n");
+        return 1;
+      }
+      options.url = proxy.Url() + options.url;
+    } else {
+      options.url = server.Url() + options.url;
+    }
+  }
+
+  std::printf("Running %.0fs test @ %s\n", options.duration,
+              options.url.c_str());
+  std::printf("  %d connections, %s, keep-alive %s%s\n", options.connections,
+              options.rate > 0
+                ? (std::to_string(static_cast<int64_t>(options.rate)) +
+                   " requests/sec").c_str()
+                : "closed loop",
+              options.keepAlive ? "on" : "off",
+              options.http2 ? ", h2c" : "");
+
+  std::vector<std::unique_ptr<WorkerStats> > stats;
+  std::vector<std::thread> workers;
+  Clock::duration interval(0);
+  if (options.rate > 0) {
+    interval = std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(options.connections / options.rate));
+  }
+  Clock::time_point start = Clock::now();
+  Clock::time_point deadline = start +
+    std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(options.duration));
+  for (int i = 0; i < options.connections; i++) {
+    stats.push_back(std::unique_ptr<WorkerStats>(new WorkerStats()));
+    workers.push_back(std::thread(runWorker, std::cref(options), start,
+                                  deadline, interval,
+                                  interval * i / options.connections,
+                                  stats.back().get()));
+  }
+  for (size_t i = 0; i < workers.size(); i++) {
+    workers[i].join();
+  }
+  double elapsed = std::chrono::duration<double>(Clock::now() - start)
+                     .count();
+
+  WorkerStats total;
+  RestClient::Metrics::HistogramSnapshot latency, serviceTime;
+  for (size_t i = 0; i < stats.size(); i++) {
+    const WorkerStats& s = *stats[i];
+    latency.Merge(s.latency.Snapshot());
+    serviceTime.Merge(s.serviceTime.Snapshot());
+    total.latencySum += s.latencySum;
+    total.latencySquares += s.latencySquares;
+    total.requests += s.requests;
+    total.bytesRead += s.bytesRead;
+    total.bytesWritten += s.bytesWritten;
+    total.newConnections += s.newConnections;
+    total.reused += s.reused;
+    for (int c = 0; c < 6; c++) {
+      total.statusClasses[c] += s.statusClasses[c];
+    }
+    for (std::map<int, uint64_t>::const_iterator it = s.curlErrors.begin();
+         it != s.curlErrors.end(); ++it) {
+      total.curlErrors[it->first] += it->second;
+      total.curlErrorMessages[it->first] =
+        s.curlErrorMessages.find(it->first)->second;
+    }
+  }
+
+  double mean = total.requests ? total.latencySum / total.requests : 0;
+  double variance = total.requests
+    ? total.latencySquares / total.requests - mean * mean : 0;
+  std::printf("  Latency   mean %s, stdev %s, max %s\n",
+              formatMicros(mean).c_str(),
+              formatMicros(std::sqrt(variance > 0 ? variance : 0)).c_str(),
+              formatMicros(static_cast<double>(latency.max)).c_str());
+  std::printf("  Latency distribution (%s, +-12.5%%)\n",
+              options.rate > 0 ? "corrected for coordinated omission"
+                               : "closed loop, use --rate to correct for "
+                                 "coordinated omission");
+  std::printf("    %9s %12s %12s\n", "", "latency", "service");
+  const double quantiles[] = {0.5, 0.75, 0.9, 0.99, 0.999, 0.9999, 1.0};
+  for (size_t i = 0; i < sizeof(quantiles) / sizeof(quantiles[0]); i++) {
+    std::printf("    %8.3f%% %12s %12s\n", quantiles[i] * 100,
+      formatMicros(static_cast<double>(
+          latency.Percentile(quantiles[i]))).c_str(),
+      formatMicros(static_cast<double>(
+          serviceTime.Percentile(quantiles[i]))).c_str());
+  }
+
+  std::printf("  %llu requests in %.2fs, %s read, %s written\n",
+              static_cast<unsigned long long>(total.requests),  // NOLINT
+              elapsed, formatBytes(total.bytesRead).c_str(),
+              formatBytes(total.bytesWritten).c_str());
+  std::printf("  %llu new connections (%.1f%% of requests reused one)\n",
+              static_cast<unsigned long long>(total.newConnections),  // NOLINT
+              total.requests ? 100.0 * total.reused / total.requests : 0.0);
+  std::printf("  Status codes: 1xx=%llu 2xx=%llu 3xx=%llu 4xx=%llu "
+              "5xx=%llu other=%llu\n",
+              static_cast<unsigned long long>(total.statusClasses[1]),  // NOLINT
+              static_cast<unsigned long long>(total.statusClasses[2]),  // NOLINT
+              static_cast<unsigned long long>(total.statusClasses[3]),  // NOLINT
+              static_cast<unsigned long long>(total.statusClasses[4]),  // NOLINT
+              static_cast<unsigned long long>(total.statusClasses[5]),  // NOLINT
+              static_cast<unsigned long long>(total.statusClasses[0]));  // NOLINT
+  for (std::map<int, uint64_t>::const_iterator it = total.curlErrors.begin();
+       it != total.curlErrors.end(); ++it) {
+    std::printf("  Errors: curl %d (%s): %llu\n", it->first,
+                total.curlErrorMessages[it->first].empty()
+                  ? curl_easy_strerror(static_cast<CURLcode>(it->first))
+                  : total.curlErrorMessages[it->first].c_str(),
+                static_cast<unsigned long long>(it->second));  // NOLINT
+  }
+  std::printf("Requests/sec: %10.2f\n", total.requests / elapsed);
+  std::printf("Transfer/sec: %10s\n",
+              formatBytes(total.bytesRead / elapsed).c_str());
+
+  proxy.Stop();
+  server.Stop();
+  RestClient::disable();
+  return total.requests > 0 && total.curlErrors.empty() ? 0 : 2;
+}
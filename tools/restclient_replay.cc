@@ -0,0 +1,392 @@
+/**
+ * @file restclient_replay.cc
+ * @brief replays a traffic capture (see traffic.h) through
+ * RestClient::Connection and reports latency and throughput
+ * @author Daniel Schauenberg <d@unwiredcouch.com>
+ *
+ * Requests are sent on the schedule of the capture, optionally sped up or
+ * slowed down, by a pool of worker threads that each own one Connection.
+ * Latency is measured from the scheduled send time, so a slow build shows
+ * up in the percentiles instead of stretching the replay (coordinated
+ * omission). Results can be saved and compared with the run of another
+ * library build against the same capture.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "restclient-cpp/connection.h"
+#include "restclient-cpp/metrics.h"
+#include "restclient-cpp/restclient.h"
+#include "restclient-cpp/traffic.h"
+#include "loopback_server.h"
+#include "format.h"
+
+namespace {
+
+using RestClient::Tools::formatBytes;
+using RestClient::Tools::formatMicros;
+
+typedef std::chrono::steady_clock Clock;
+
+struct Options {
+  std::string capture;
+  std::string target;
+  int connections;
+  double speed;
+  size_t limit;
+  int timeout;
+  std::string save;
+  std::string compare;
+
+  Options() : connections(16), speed(1), limit(0), timeout(0) {}
+};
+
+/**
+ * @brief what a worker measures, only written by the owning worker
+ */
+struct WorkerStats {
+  RestClient::Metrics::Histogram latency;
+  RestClient::Metrics::Histogram serviceTime;
+  double latencySum;
+  uint64_t requests;
+  uint64_t errors;
+  uint64_t bytesRead;
+  uint64_t lateStarts;
+
+  WorkerStats() : latencySum(0), requests(0), errors(0), bytesRead(0),
+                  lateStarts(0) {}
+};
+
+typedef std::map<std::string, double> Summary;
+
+void usage() {
+  std::fprintf(stderr,
+    "usage: restclient-replay [options] <capture file>\n"
+    "\n"
+    "  -c, --connections N   worker connections (16)\n"
+    "  -s, --speed X         replay X times as fast as captured, 0 sends\n"
+    "                        requests back to back (1)\n"
+    "  -n, --limit N         replay only the first N requests\n"
+    "      --target URL      send requests to URL instead of an in-process\n"
+    "                        loopback server, paths and queries are kept\n"
+    "      --timeout S       request timeout in seconds (none)\n"
+    "      --save FILE       write the results to FILE\n"
+    "      --compare FILE    compare the results with a saved run\n");
+}
+
+bool parseOptions(int argc, char** argv, Options* options) {
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    bool hasValue = i + 1 < argc;
+    if ((arg == "-c" || arg == "--connections") && hasValue) {
+      options->connections = std::atoi(argv[++i]);
+    } else if ((arg == "-s" || arg == "--speed") && hasValue) {
+      options->speed = std::atof(argv[++i]);
+    } else if ((arg == "-n" || arg == "--limit") && hasValue) {
+      options->limit = static_cast<size_t>(std::atol(argv[++i]));
+    } else if (arg == "--target" && hasValue) {
+      options->target = argv[++i];
+    } else if (arg == "--timeout" && hasValue) {
+      options->timeout = std::atoi(argv[++i]);
+    } else if (arg == "--save" && hasValue) {
+      options->save = argv[++i];
+    } else if (arg == "--compare" && hasValue) {
+      options->compare = argv[++i];
+    } else if (arg[0] != '-' && options->capture.empty()) {
+      options->capture = arg;
+    } else {
+      return false;
+    }
+  }
+  return !options->capture.empty() && options->connections > 0 &&
+         options->speed >= 0;
+}
+
+// path and query of an absolute URL
+std::string pathOf(const std::string& url) {
+  size_t scheme = url.find("://");
+  if (scheme == std::string::npos) {
+    return url;
+  }
+  size_t path = url.find_first_of("/?", scheme + 3);
+  if (path == std::string::npos) {
+    return "/";
+  }
+  return url[path] == '/' ? url.substr(path) : "/" + url.substr(path);
+}
+
+RestClient::Response perform(RestClient::Connection* conn,
+                             const RestClient::TrafficRecord& record,
+                             const std::string& url,
+                             const std::string& body) {
+  const std::string& m = record.method;
+  if (m == "POST") {
+    return conn->post(url, body);
+  } else if (m == "PUT") {
+    return conn->put(url, body);
+  } else if (m == "PATCH") {
+    return conn->patch(url, body);
+  } else if (m == "DELETE") {
+    return conn->del(url);
+  } else if (m == "HEAD") {
+    return conn->head(url);
+  } else if (m == "OPTIONS") {
+    return conn->options(url);
+  }
+  return conn->get(url);
+}
+
+/**
+ * @brief take the next record from the shared schedule until it is
+ * exhausted, wait for its send time and replay it
+ */
+void runWorker(const Options& options,
+               const std::vector<RestClient::TrafficRecord>& records,
+               const std::string& target, Clock::time_point start,
+               std::atomic<size_t>* next, WorkerStats* stats) {
+  RestClient::Connection conn(target);
+  conn.SetFlightRecorder(NULL);
+  conn.SetNoSignal(true);
+  if (options.timeout > 0) {
+    conn.SetTimeout(options.timeout);
+  }
+  std::string body;
+  for (;;) {
+    size_t index = next->fetch_add(1);
+    if (index >= records.size()) {
+      break;
+    }
+    const RestClient::TrafficRecord& record = records[index];
+    body.assign(record.bodySize, 'x');
+    std::string url = pathOf(record.url);
+    conn.SetHeaders(record.headers);
+
+    Clock::time_point intended = Clock::now();
+    if (options.speed > 0) {
+      intended = start + std::chrono::duration_cast<Clock::duration>(
+          std::chrono::duration<double, std::micro>(
+              static_cast<double>(record.offset) / options.speed));
+      Clock::time_point now = Clock::now();
+      if (intended > now) {
+        std::this_thread::sleep_until(intended);
+      } else if (now - intended > std::chrono::milliseconds(1)) {
+        stats->lateStarts++;
+      }
+    }
+    Clock::time_point sent = Clock::now();
+    perform(&conn, record, url, body);
+    Clock::time_point done = Clock::now();
+
+    uint64_t latency = std::chrono::duration_cast<std::chrono::microseconds>(
+        done - intended).count();
+    stats->latency.Record(latency);
+    stats->serviceTime.Record(
+        std::chrono::duration_cast<std::chrono::microseconds>(
+            done - sent).count());
+    stats->latencySum += static_cast<double>(latency);
+    stats->requests++;
+    RestClient::Connection::ExtendedRequestInfo info = conn.GetRequestInfo();
+    stats->bytesRead += info.downloadedBytes + info.responseHeaderBytes;
+    if (info.curlCode != CURLE_OK) {
+      stats->errors++;
+    }
+  }
+}
+
+bool saveSummary(const std::string& path, const Summary& summary) {
+  std::ofstream out(path.c_str());
+  for (Summary::const_iterator it = summary.begin(); it != summary.end();
+       ++it) {
+    out << it->first << " " << it->second << "\n";
+  }
+  return static_cast<bool>(out);
+}
+
+bool loadSummary(const std::string& path, Summary* summary) {
+  std::ifstream in(path.c_str());
+  std::string key;
+  double value;
+  while (in >> key >> value) {
+    (*summary)[key] = value;
+  }
+  return !summary->empty();
+}
+
+std::string formatValue(const std::string& key, double value) {
+  if (key.compare(0, 8, "latency_") == 0) {
+    return formatMicros(value);
+  }
+  char out[32];
+  std::snprintf(out, sizeof(out), "%.2f", value);
+  return out;
+}
+
+void printComparison(const Summary& baseline, const Summary& current) {
+  const char* keys[] = {"throughput", "latency_mean", "latency_p50",
+                        "latency_p90", "latency_p99", "latency_p999",
+                        "latency_max", "errors"};
+  std::printf("Comparison with saved run\n");
+  std::printf("  %-14s %12s %12s %9s\n", "", "saved", "this run", "change");
+  for (size_t i = 0; i < sizeof(keys) / sizeof(keys[0]); i++) {
+    Summary::const_iterator before = baseline.find(keys[i]);
+    Summary::const_iterator after = current.find(keys[i]);
+    if (before == baseline.end() || after == current.end()) {
+      continue;
+    }
+    std::printf("  %-14s %12s %12s", keys[i],
+                formatValue(keys[i], before->second).c_str(),
+                formatValue(keys[i], after->second).c_str());
+    if (before->second != 0) {
+      std::printf(" %+8.1f%%\n",
+                  100.0 * (after->second - before->second) / before->second);
+    } else {
+      std::printf("\n");
+    }
+  }
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  Options options;
+  if (!parseOptions(argc, argv, &options)) {
+    usage();
+    return 1;
+  }
+
+  std::vector<RestClient::TrafficRecord> records;
+  if (!RestClient::TrafficRecorder::Load(options.capture, &records)) {
+    std::fprintf(stderr, "can't read capture %s\n", options.capture.c_str());
+    return 1;
+  }
+  if (options.limit > 0 && options.limit < records.size()) {
+    records.resize(options.limit);
+  }
+  if (records.empty()) {
+    std::fprintf(stderr, "capture %s has no requests\n",
+                 options.capture.c_str());
+    return 1;
+  }
+  // rebase so the replay starts with the first request
+  int64_t first = records.front().offset;
+  for (size_t i = 0; i < records.size(); i++) {
+    records[i].offset -= first;
+  }
+  double captured = static_cast<double>(records.back().offset) / 1e6;
+
+  RestClient::init();
+  RestClient::Testing::LoopbackServer server;
+  std::string target = options.target;
+  if (target.empty()) {
+    if (!server.Start()) {
+      std::fprintf(stderr, "can't start loopback server\n");
+      return 1;
+    }
+    target = server.Url();
+  }
+  while (!target.empty() && target[target.size() - 1] == '/') {
+    target.erase(target.size() - 1);
+  }
+
+  std::printf("Replaying %llu requests captured over %.2fs @ %s\n",
+              static_cast<unsigned long long>(records.size()),  // NOLINT
+              captured, target.c_str());
+  if (options.speed > 0) {
+    std::printf("  %d connections, %gx speed\n", options.connections,
+                options.speed);
+  } else {
+    std::printf("  %d connections, back to back\n", options.connections);
+  }
+
+  std::vector<std::unique_ptr<WorkerStats> > stats;
+  std::vector<std::thread> workers;
+  std::atomic<size_t> next(0);
+  Clock::time_point start = Clock::now();
+  for (int i = 0; i < options.connections; i++) {
+    stats.push_back(std::unique_ptr<WorkerStats>(new WorkerStats()));
+    workers.push_back(std::thread(runWorker, std::cref(options),
+                                  std::cref(records), std::cref(target),
+                                  start, &next, stats.back().get()));
+  }
+  for (size_t i = 0; i < workers.size(); i++) {
+    workers[i].join();
+  }
+  double elapsed = std::chrono::duration<double>(Clock::now() - start)
+                     .count();
+
+  WorkerStats total;
+  RestClient::Metrics::HistogramSnapshot latency, serviceTime;
+  for (size_t i = 0; i < stats.size(); i++) {
+    latency.Merge(stats[i]->latency.Snapshot());
+    serviceTime.Merge(stats[i]->serviceTime.Snapshot());
+    total.latencySum += stats[i]->latencySum;
+    total.requests += stats[i]->requests;
+    total.errors += stats[i]->errors;
+    total.bytesRead += stats[i]->bytesRead;
+    total.lateStarts += stats[i]->lateStarts;
+  }
+
+  Summary summary;
+  summary["requests"] = static_cast<double>(total.requests);
+  summary["errors"] = static_cast<double>(total.errors);
+  summary["elapsed"] = elapsed;
+  summary["throughput"] = total.requests / elapsed;
+  summary["latency_mean"] = total.requests
+    ? total.latencySum / total.requests : 0;
+  summary["latency_p50"] = static_cast<double>(latency.Percentile(0.5));
+  summary["latency_p90"] = static_cast<double>(latency.Percentile(0.9));
+  summary["latency_p99"] = static_cast<double>(latency.Percentile(0.99));
+  summary["latency_p999"] = static_cast<double>(latency.Percentile(0.999));
+  summary["latency_max"] = static_cast<double>(latency.max);
+
+  std::printf("  Latency distribution (from scheduled send time, "
+              "+-12.5%%)\n");
+  std::printf("    %9s %12s %12s\n", "", "latency", "service");
+  const double quantiles[] = {0.5, 0.75, 0.9, 0.99, 0.999, 1.0};
+  for (size_t i = 0; i < sizeof(quantiles) / sizeof(quantiles[0]); i++) {
+    std::printf("    %8.3f%% %12s %12s\n", quantiles[i] * 100,
+      formatMicros(static_cast<double>(
+          latency.Percentile(quantiles[i]))).c_str(),
+      formatMicros(static_cast<double>(
+          serviceTime.Percentile(quantiles[i]))).c_str());
+  }
+  std::printf("  %llu requests in %.2fs (captured in %.2fs), %s read\n",
+              static_cast<unsigned long long>(total.requests),  // NOLINT
+              elapsed, captured, formatBytes(total.bytesRead).c_str());
+  if (options.speed > 0 && total.lateStarts > 0) {
+    std::printf("  %llu requests started more than 1ms after their "
+                "scheduled time\n",
+                static_cast<unsigned long long>(total.lateStarts));  // NOLINT
+  }
+  std::printf("  Errors: %llu\n",
+              static_cast<unsigned long long>(total.errors));  // NOLINT
+  std::printf("Requests/sec: %10.2f\n", summary["throughput"]);
+
+  if (!options.compare.empty()) {
+    Summary baseline;
+    if (loadSummary(options.compare, &baseline)) {
+      printComparison(baseline, summary);
+    } else {
+      std::fprintf(stderr, "can't read results %s\n",
+                   options.compare.c_str());
+    }
+  }
+  if (!options.save.empty() && !saveSummary(options.save, summary)) {
+    std::fprintf(stderr, "can't write results %s\n", options.save.c_str());
+  }
+
+  server.Stop();
+  RestClient::disable();
+  return total.errors == 0 ? 0 : 2;
+}
@@ -0,0 +1,171 @@
+/**
+ * @file wire.cc
+ * @brief implementation of the socket and HTTP/1.1 parsing helpers
+ * @author Daniel Schauenberg <d@unwiredcouch.com>
+ */
+
+#include "wire.h"
+
+#if !defined(_WIN32)
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <string>
+
+const char*
+RestClient::Testing::Wire::ReasonPhrase(int status) {
+  switch (status) {
+    case 200: return "OK";
+    case 201: return "Created";
+    case 204: return "No Content";
+    case 206: return "Partial Content";
+    case 301: return "Moved Permanently";
+    case 302: return "Found";
+    case 304: return "Not Modified";
+    case 400: return "Bad Request";
+    case 404: return "Not Found";
+    case 429: return "Too Many Requests";
+    case 500: return "Internal Server Error";
+    case 502: return "Bad Gateway";
+    case 503: return "Service Unavailable";
+    case 504: return "Gateway Timeout";
+    default: return "Unknown";
+  }
+}
+
+std::string
+RestClient::Testing::Wire::ToLower(std::string s) {
+  std::transform(s.begin(), s.end(), s.begin(), ::tolower);
+  return s;
+}
+
+std::string
+RestClient::Testing::Wire::Trim(const std::string& s) {
+  size_t begin = s.find_first_not_of(" \t\r");
+  if (begin == std::string::npos) {
+    return std::string();
+  }
+  size_t end = s.find_last_not_of(" \t\r");
+  return s.substr(begin, end - begin + 1);
+}
+
+/**
+ * @brief split a message head into start line and headers
+ *
+ * @param head message head, with or without the final empty line
+ * @param headers map to add the headers to, names are lower cased
+ *
+ * @return the start line
+ */
+std::string
+RestClient::Testing::Wire::ParseHead(
+    const std::string& head, std::map<std::string, std::string>* headers) {
+  size_t lineEnd = head.find("\r\n");
+  std::string startLine = head.substr(0, lineEnd);
+  while (lineEnd != std::string::npos && lineEnd + 2 < head.size()) {
+    size_t next = head.find("\r\n", lineEnd + 2);
+    std::string line = head.substr(lineEnd + 2, next == std::string::npos
+                                   ? std::string::npos
+                                   : next - lineEnd - 2);
+    size_t colon = line.find(':');
+    if (colon != std::string::npos) {
+      (*headers)[ToLower(line.substr(0, colon))] =
+        Trim(line.substr(colon + 1));
+    }
+    lineEnd = next;
+  }
+  return startLine;
+}
+
+#if !defined(_WIN32)
+
+bool
+RestClient::Testing::Wire::RecvMore(int fd, std::string* buffer) {
+  char data[16384];
+  ssize_t n = recv(fd, data, sizeof(data), 0);
+  if (n <= 0) {
+    return false;
+  }
+  buffer->append(data, static_cast<size_t>(n));
+  return true;
+}
+
+bool
+RestClient::Testing::Wire::SendAll(int fd, const char* data, size_t length) {
+  while (length > 0) {
+    ssize_t n = send(fd, data, length, MSG_NOSIGNAL);
+    if (n <= 0) {
+      return false;
+    }
+    data += n;
+    length -= static_cast<size_t>(n);
+  }
+  return true;
+}
+
+bool
+RestClient::Testing::Wire::SendAll(int fd, const std::string& data) {
+  return SendAll(fd, data.data(), data.size());
+}
+
+size_t
+RestClient::Testing::Wire::ReadHead(int fd, std::string* buffer) {
+  size_t end;
+  while ((end = buffer->find("\r\n\r\n")) == std::string::npos) {
+    if (!RecvMore(fd, buffer)) {
+      return 0;
+    }
+  }
+  return end + 4;
+}
+
+bool
+RestClient::Testing::Wire::ReadBody(int fd, std::string* buffer,
+                                    size_t length, std::string* out) {
+  while (buffer->size() < length) {
+    if (!RecvMore(fd, buffer)) {
+      return false;
+    }
+  }
+  out->assign(*buffer, 0, length);
+  buffer->erase(0, length);
+  return true;
+}
+
+int
+RestClient::Testing::Wire::Connect(const std::string& host, int port) {
+  struct addrinfo hints;
+  std::memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  struct addrinfo* result = NULL;
+  if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints,
+                  &result) != 0) {
+    return -1;
+  }
+  int fd = -1;
+  for (struct addrinfo* ai = result; ai != NULL; ai = ai->ai_next) {
+    fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (fd < 0) {
+      continue;
+    }
+    if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+      int one = 1;
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+      break;
+    }
+    close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(result);
+  return fd;
+}
+
+#endif
@@ -0,0 +1,53 @@
+/**
+ * @file wire.h
+ * @brief small blocking socket and HTTP/1.1 parsing helpers shared by the
+ * loopback server and the fault proxy
+ * @author Daniel Schauenberg <d@unwiredcouch.com>
+ */
+
+#ifndef TOOLS_WIRE_H_
+#define TOOLS_WIRE_H_
+
+#include <cstddef>
+#include <map>
+#include <string>
+
+namespace RestClient {
+namespace Testing {
+namespace Wire {
+
+const char* ReasonPhrase(int status);
+
+std::string ToLower(std::string s);
+
+// strip leading and trailing spaces, tabs and carriage returns
+std::string Trim(const std::string& s);
+
+// split a message head into its start line and headers (lower case names)
+std::string ParseHead(const std::string& head,
+                      std::map<std::string, std::string>* headers);
+
+#if !defined(_WIN32)
+// append whatever is available on fd to buffer, false if the peer is gone
+bool RecvMore(int fd, std::string* buffer);
+
+bool SendAll(int fd, const char* data, size_t length);
+bool SendAll(int fd, const std::string& data);
+
+// receive until buffer holds a complete message head. Returns the length of
+// the head including the empty line, 0 if the peer went away before
+size_t ReadHead(int fd, std::string* buffer);
+
+// move length bytes from the front of buffer (receiving more as needed)
+// into out
+bool ReadBody(int fd, std::string* buffer, size_t length, std::string* out);
+
+// connect to host:port, -1 on failure
+int Connect(const std::string& host, int port);
+#endif
+
+}  // namespace Wire
+}  // namespace Testing
+}  // namespace RestClient
+
+#endif  // TOOLS_WIRE_H_